@@ -627,6 +627,8 @@ enum iscsi_param {
 
 	ISCSI_PARAM_DISCOVERY_PARENT_IDX,
 	ISCSI_PARAM_DISCOVERY_PARENT_TYPE,
+	/* next CmdSN of a session, for MC/S logins */
+	ISCSI_PARAM_CMDSN,
 	/* must always be last */
 	ISCSI_PARAM_MAX,
 };
@@ -783,6 +785,11 @@ enum iscsi_ping_status_code {
 #define STOP_CONN_SUSPEND	0x2
 #define STOP_CONN_RECOVER	0x3
 
+/*
+ * Max number of connections in a session (MaxConnections)
+ */
+#define ISCSI_MAX_CONNS		8
+
 #define ISCSI_STATS_CUSTOM_MAX		32
 #define ISCSI_STATS_CUSTOM_DESC_MAX	64
 struct iscsi_stats_custom {
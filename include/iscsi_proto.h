@@ -636,6 +636,7 @@ struct iscsi_reject {
 #define ISCSI_MAX_MAX_BURST_LEN			16777215
 
 #define ISCSI_DEF_TIME2WAIT			2
+#define ISCSI_DEF_TIME2RETAIN			20
 
 /************************* RFC 3720 End *****************************/
 
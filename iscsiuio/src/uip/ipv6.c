@@ -42,6 +42,7 @@
 #include <arpa/inet.h>
 #include "logger.h"
 #include "uip.h"
+#include "uip-neighbor.h"
 #include "ipv6.h"
 #include "ipv6_pkt.h"
 #include "icmpv6.h"
@@ -140,7 +141,6 @@ void ipv6_init(struct ndpc_state *ndp, int cfg)
 	int i;
 	struct ipv6_context *context = (struct ipv6_context *)ndp->ipv6_context;
 	struct mac_address *mac_addr = (struct mac_address *)ndp->mac_addr;
-	struct ipv6_arp_entry *ipv6_arp_table;
 	struct ipv6_prefix_entry *ipv6_prefix_table;
 	struct mac_address mc_addr;
 
@@ -154,10 +154,9 @@ void ipv6_init(struct ndpc_state *ndp, int cfg)
 	/* Associate the nic_iface's ustack to this ipv6_context */
 	context->ustack = ndp->ustack;
 
-	ipv6_arp_table = &context->ipv6_arp_table[0];
 	ipv6_prefix_table = &context->ipv6_prefix_table[0];
 
-	memset((char *)ipv6_arp_table, 0, sizeof(*ipv6_arp_table));
+	uip_ncache_init(&context->ipv6_arp_table);
 	memset((char *)ipv6_prefix_table, 0, sizeof(*ipv6_prefix_table));
 	memcpy((char *)&context->mac_addr,
 	       (char *)mac_addr, sizeof(struct mac_address));
@@ -605,19 +604,16 @@ int ipv6_ip_in_arp_table(struct ipv6_context *context,
 			 struct ipv6_addr *ip_addr,
 			 struct mac_address *mac_addr)
 {
-	struct ipv6_arp_entry *arp_entry;
-	int i;
+	struct uip_ncache_entry *arp_entry;
 
-	for (i = 0; i < UIP_ARPTAB_SIZE; i++) {
-		arp_entry = &context->ipv6_arp_table[i];
+	arp_entry = uip_ncache_lookup(&context->ipv6_arp_table, ip_addr,
+				      sizeof(struct ipv6_addr));
+	if (arp_entry == NULL)
+		return 0;
 
-		if (IPV6_ARE_ADDR_EQUAL(&arp_entry->ip_addr, ip_addr)) {
-			memcpy((char *)mac_addr, &arp_entry->mac_addr,
-			       sizeof(struct mac_address));
-			return 1;
-		}
-	}
-	return 0;
+	memcpy((char *)mac_addr, &arp_entry->ethaddr,
+	       sizeof(struct mac_address));
+	return 1;
 }
 
 struct ipv6_addr *ipv6_find_longest_match(struct ipv6_context *context,
@@ -657,61 +653,15 @@ static void ipv6_update_arp_table(struct ipv6_context *context,
 				  struct ipv6_addr *ip_addr,
 				  struct mac_address *mac_addr)
 {
-	struct ipv6_arp_entry *arp_entry;
-	int i;
-	struct ipv6_arp_entry *ipv6_arp_table = context->ipv6_arp_table;
-
 	LOG_DEBUG("IPv6: Neighbor update");
 	/*
-	 * Walk through the ARP mapping table and try to find an entry to
-	 * update. If none is found, the IP -> MAC address mapping is
-	 * inserted in the ARP table.
-	 */
-	for (i = 0; i < UIP_ARPTAB_SIZE; i++) {
-		arp_entry = &ipv6_arp_table[i];
-
-		/* Only check those entries that are actually in use. */
-		if (arp_entry->ip_addr.addr[0] != 0) {
-			/*
-			 * Check if the source IP address of the incoming
-			 * packet matches the IP address in this ARP table
-			 * entry.
-			 */
-			if (IPV6_ARE_ADDR_EQUAL(&arp_entry->ip_addr, ip_addr)) {
-				/* An old entry found, update this and return */
-				memcpy((char *)&arp_entry->mac_addr,
-				       (char *)mac_addr,
-				       sizeof(struct mac_address));
-				arp_entry->time = context->arptime;
-				return;
-			}
-		}
-	}
-
-	/*
-	 * If we get here, no existing ARP table entry was found, so we
-	 * create one.
-	 *
-	 * First, we try to find an unused entry in the ARP table.
+	 * Refresh the existing IP -> MAC address mapping, or insert a new
+	 * one; when the table is full the least recently used entry is
+	 * recycled.
 	 */
-	for (i = 0; i < UIP_ARPTAB_SIZE; i++) {
-		arp_entry = &ipv6_arp_table[i];
-
-		if (arp_entry->ip_addr.addr[0] == 0)
-			break;
-	}
-
-	if (i == UIP_ARPTAB_SIZE)
-		return;
-
-	/* Index j is the entry that is least used */
-	arp_entry = &ipv6_arp_table[i];
-	memcpy((char *)&arp_entry->ip_addr, (char *)ip_addr,
-	       sizeof(struct ipv6_addr));
-	memcpy((char *)&arp_entry->mac_addr,
-	       (char *)mac_addr, sizeof(struct mac_address));
-
-	arp_entry->time = context->arptime;
+	uip_ncache_update(&context->ipv6_arp_table, ip_addr,
+			  sizeof(struct ipv6_addr),
+			  (struct uip_eth_addr *)mac_addr);
 }
 
 /* DestIP is intact */
@@ -236,12 +236,6 @@ struct packet_ipv6_vlan {
 	} layer4_prot;
 };
 
-struct ipv6_arp_entry {
-	struct ipv6_addr ip_addr;
-	struct mac_address mac_addr;
-	u8_t time;
-};
-
 #define IPV6_NUM_OF_ADDRESS_ENTRY  4
 
 struct ipv6_prefix_entry {
@@ -270,13 +264,11 @@ struct ipv6_context {
 	struct ipv6_addr default_router;
 	struct ipv6_prefix_entry *addr_list;
 	u8_t hop_limit;
-#define UIP_ARPTAB_SIZE 16
 
 	struct uip_stack *ustack;
 #define MAX_MCADDR_TABLE 5
 	struct mac_address mc_addr[MAX_MCADDR_TABLE];
-	u8_t arptime;
-	struct ipv6_arp_entry ipv6_arp_table[UIP_ARPTAB_SIZE];
+	struct uip_ncache ipv6_arp_table;
 	struct ipv6_prefix_entry ipv6_prefix_table[IPV6_NUM_OF_ADDRESS_ENTRY];
 
 	/* VLAN support */
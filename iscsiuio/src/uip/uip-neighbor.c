@@ -51,97 +51,197 @@
  ******************************************************************************/
 #define PFX "uip-neigh "
 
-#define MAX_TIME 128
+#define UIP_ARPTAB_HASH_MASK	(UIP_ARPTAB_HASH_SIZE - 1)
 
 /*---------------------------------------------------------------------------*/
-void uip_neighbor_init(struct uip_stack *ustack)
+/*  Generic hashed neighbor cache, shared by the IPv4 ARP table and the
+ *  IPv6 neighbor tables.  Locking is left to the caller.               */
+/*---------------------------------------------------------------------------*/
+static u32_t uip_ncache_hash(const u8_t *addr, u8_t addr_len)
 {
+	u32_t hash = 2166136261U;	/* FNV-1a */
 	int i;
 
-	pthread_mutex_lock(&ustack->lock);
-	for (i = 0; i < UIP_NEIGHBOR_ENTRIES; ++i) {
-		memset(&(ustack->neighbor_entries[i].ipaddr), 0,
-		       sizeof(ustack->neighbor_entries[i].ipaddr));
-		memset(&(ustack->neighbor_entries[i].mac_addr), 0,
-		       sizeof(ustack->neighbor_entries[i].mac_addr));
-		ustack->neighbor_entries[i].time = MAX_TIME;
+	for (i = 0; i < addr_len; i++) {
+		hash ^= addr[i];
+		hash *= 16777619U;
 	}
-	pthread_mutex_unlock(&ustack->lock);
+
+	return (hash ^ (hash >> 16)) & UIP_ARPTAB_HASH_MASK;
 }
 
-void uip_neighbor_add(struct uip_stack *ustack,
-		      struct in6_addr *addr6, struct uip_eth_addr *addr)
+static void uip_ncache_lru_del(struct uip_ncache_entry *e)
 {
-	int i, oldest;
-	u8_t oldest_time;
-	char buf[INET6_ADDRSTRLEN];
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+}
 
-	inet_ntop(AF_INET6, addr6, buf, sizeof(buf));
+static void uip_ncache_lru_add(struct uip_ncache *nc,
+			       struct uip_ncache_entry *e)
+{
+	e->lru_next = nc->lru.lru_next;
+	e->lru_prev = &nc->lru;
+	nc->lru.lru_next->lru_prev = e;
+	nc->lru.lru_next = e;
+}
 
-	pthread_mutex_lock(&ustack->lock);
+static void uip_ncache_remove(struct uip_ncache *nc,
+			      struct uip_ncache_entry *e)
+{
+	struct uip_ncache_entry **pp;
 
-	/* Find the first unused entry or the oldest used entry. */
-	oldest_time = 0;
-	oldest = 0;
-	for (i = 0; i < UIP_NEIGHBOR_ENTRIES; ++i) {
-		if (ustack->neighbor_entries[i].time == MAX_TIME) {
-			oldest = i;
-			break;
+	pp = &nc->hash[uip_ncache_hash(e->ipaddr, e->addr_len)];
+	while (*pp != NULL && *pp != e)
+		pp = &(*pp)->hash_next;
+	if (*pp != NULL)
+		*pp = e->hash_next;
+
+	uip_ncache_lru_del(e);
+
+	e->addr_len = 0;
+	e->hash_next = nc->free_list;
+	nc->free_list = e;
+}
+
+void uip_ncache_init(struct uip_ncache *nc)
+{
+	int i;
+
+	memset(nc, 0, sizeof(*nc));
+	nc->lru.lru_next = &nc->lru;
+	nc->lru.lru_prev = &nc->lru;
+
+	for (i = UIP_ARPTAB_SIZE - 1; i >= 0; i--) {
+		nc->entries[i].hash_next = nc->free_list;
+		nc->free_list = &nc->entries[i];
+	}
+}
+
+/**
+ * Find the entry for the given address and mark it as most recently
+ * used.  Lookups do not refresh the entry age, only confirmations
+ * through uip_ncache_update() do.
+ */
+struct uip_ncache_entry *uip_ncache_lookup(struct uip_ncache *nc,
+					   const void *addr, u8_t addr_len)
+{
+	struct uip_ncache_entry *e;
+
+	for (e = nc->hash[uip_ncache_hash(addr, addr_len)]; e != NULL;
+	     e = e->hash_next) {
+		if (e->addr_len == addr_len &&
+		    memcmp(e->ipaddr, addr, addr_len) == 0) {
+			if (nc->lru.lru_next != e) {
+				uip_ncache_lru_del(e);
+				uip_ncache_lru_add(nc, e);
+			}
+			nc->hits++;
+			return e;
 		}
-		if (uip_ip6addr_cmp
-		    (ustack->neighbor_entries[i].ipaddr.s6_addr, addr6)) {
-			oldest = i;
+	}
+
+	nc->misses++;
+	return NULL;
+}
+
+/**
+ * Insert or refresh the mapping addr -> ethaddr.  When the cache is
+ * full the least recently used entry is recycled.
+ */
+struct uip_ncache_entry *uip_ncache_update(struct uip_ncache *nc,
+					   const void *addr, u8_t addr_len,
+					   const struct uip_eth_addr *ethaddr)
+{
+	struct uip_ncache_entry *e;
+	u32_t hash = uip_ncache_hash(addr, addr_len);
+
+	for (e = nc->hash[hash]; e != NULL; e = e->hash_next) {
+		if (e->addr_len == addr_len &&
+		    memcmp(e->ipaddr, addr, addr_len) == 0)
 			break;
+	}
+
+	if (e == NULL) {
+		if (nc->free_list == NULL) {
+			uip_ncache_remove(nc, nc->lru.lru_prev);
+			nc->evictions++;
 		}
-		if (ustack->neighbor_entries[i].time > oldest_time) {
-			oldest = i;
-			oldest_time = ustack->neighbor_entries[i].time;
-		}
+
+		e = nc->free_list;
+		nc->free_list = e->hash_next;
+
+		memset(e->ipaddr, 0, sizeof(e->ipaddr));
+		memcpy(e->ipaddr, addr, addr_len);
+		e->addr_len = addr_len;
+		e->hash_next = nc->hash[hash];
+		nc->hash[hash] = e;
+	} else {
+		uip_ncache_lru_del(e);
 	}
 
-	/* Use the oldest or first free entry (either pointed to by the
-	   "oldest" variable). */
-	ustack->neighbor_entries[oldest].time = 0;
-	uip_ip6addr_copy(ustack->neighbor_entries[oldest].ipaddr.s6_addr,
-			 addr6);
-	memcpy(&ustack->neighbor_entries[oldest].mac_addr, addr,
-	       sizeof(struct uip_eth_addr));
+	uip_ncache_lru_add(nc, e);
+	memcpy(&e->ethaddr, ethaddr, sizeof(e->ethaddr));
+	e->time = nc->time;
 
-	LOG_DEBUG("Adding neighbor %s with "
-		  "mac address %02x:%02x:%02x:%02x:%02x:%02x at %d",
-		  buf, addr->addr[0], addr->addr[1], addr->addr[2],
-		  addr->addr[3], addr->addr[4], addr->addr[5], oldest);
+	return e;
+}
 
-	pthread_mutex_unlock(&ustack->lock);
+/**
+ * Advance the cache clock by one tick and flush all the entries which
+ * have not been confirmed for maxage ticks.
+ */
+void uip_ncache_age(struct uip_ncache *nc, u8_t maxage)
+{
+	struct uip_ncache_entry *e, *prev;
+
+	++nc->time;
+	for (e = nc->lru.lru_prev; e != &nc->lru; e = prev) {
+		prev = e->lru_prev;
+		if ((u8_t)(nc->time - e->time) >= maxage)
+			uip_ncache_remove(nc, e);
+	}
 }
 
 /*---------------------------------------------------------------------------*/
-static struct neighbor_entry *find_entry(struct uip_stack *ustack,
-					 struct in6_addr *addr6)
+void uip_neighbor_init(struct uip_stack *ustack)
 {
-	int i;
+	pthread_mutex_lock(&ustack->lock);
+	uip_ncache_init(&ustack->neighbor_cache);
+	pthread_mutex_unlock(&ustack->lock);
+}
 
-	for (i = 0; i < UIP_NEIGHBOR_ENTRIES; ++i) {
-		if (uip_ip6addr_cmp
-		    (ustack->neighbor_entries[i].ipaddr.s6_addr,
-		     addr6->s6_addr)) {
-			return &ustack->neighbor_entries[i];
-		}
-	}
+void uip_neighbor_add(struct uip_stack *ustack,
+		      struct in6_addr *addr6, struct uip_eth_addr *addr)
+{
+	struct uip_ncache_entry *e;
+	char buf[INET6_ADDRSTRLEN];
 
-	return NULL;
+	inet_ntop(AF_INET6, addr6, buf, sizeof(buf));
+
+	pthread_mutex_lock(&ustack->lock);
+
+	e = uip_ncache_update(&ustack->neighbor_cache, addr6,
+			      sizeof(*addr6), addr);
+
+	LOG_DEBUG("Adding neighbor %s with "
+		  "mac address %02x:%02x:%02x:%02x:%02x:%02x at %d",
+		  buf, addr->addr[0], addr->addr[1], addr->addr[2],
+		  addr->addr[3], addr->addr[4], addr->addr[5],
+		  (int)(e - ustack->neighbor_cache.entries));
+
+	pthread_mutex_unlock(&ustack->lock);
 }
 
 /*---------------------------------------------------------------------------*/
 void uip_neighbor_update(struct uip_stack *ustack, struct in6_addr *addr6)
 {
-	struct neighbor_entry *e;
+	struct uip_ncache_entry *e;
 
 	pthread_mutex_lock(&ustack->lock);
 
-	e = find_entry(ustack, addr6);
+	e = uip_ncache_lookup(&ustack->neighbor_cache, addr6, sizeof(*addr6));
 	if (e != NULL)
-		e->time = 0;
+		e->time = ustack->neighbor_cache.time;
 
 	pthread_mutex_unlock(&ustack->lock);
 }
@@ -150,10 +250,10 @@ void uip_neighbor_update(struct uip_stack *ustack, struct in6_addr *addr6)
 int uip_neighbor_lookup(struct uip_stack *ustack,
 			struct in6_addr *addr6, uint8_t *mac_addr)
 {
-	struct neighbor_entry *e;
+	struct uip_ncache_entry *e;
 
 	pthread_mutex_lock(&ustack->lock);
-	e = find_entry(ustack, addr6);
+	e = uip_ncache_lookup(&ustack->neighbor_cache, addr6, sizeof(*addr6));
 	if (e != NULL) {
 		char addr6_str[INET6_ADDRSTRLEN];
 		uint8_t *entry_mac_addr;
@@ -161,7 +261,7 @@ int uip_neighbor_lookup(struct uip_stack *ustack,
 		addr6_str[0] = '\0';
 		inet_ntop(AF_INET6, addr6->s6_addr, addr6_str,
 			  sizeof(addr6_str));
-		entry_mac_addr = (uint8_t *)&e->mac_addr.addr;
+		entry_mac_addr = (uint8_t *)&e->ethaddr.addr;
 
 		LOG_DEBUG(PFX
 			  "Found %s at %02x:%02x:%02x:%02x:%02x:%02x",
@@ -170,7 +270,7 @@ int uip_neighbor_lookup(struct uip_stack *ustack,
 			  entry_mac_addr[2], entry_mac_addr[3],
 			  entry_mac_addr[4], entry_mac_addr[5]);
 
-		memcpy(mac_addr, entry_mac_addr, sizeof(e->mac_addr));
+		memcpy(mac_addr, entry_mac_addr, sizeof(e->ethaddr));
 		pthread_mutex_unlock(&ustack->lock);
 		return 0;
 	}
@@ -181,7 +281,7 @@ int uip_neighbor_lookup(struct uip_stack *ustack,
 
 void uip_neighbor_out(struct uip_stack *ustack)
 {
-	struct neighbor_entry *e;
+	struct uip_ncache_entry *e;
 	struct uip_eth_hdr *eth_hdr =
 	    (struct uip_eth_hdr *)ustack->data_link_layer;
 	struct uip_ipv6_hdr *ipv6_hdr =
@@ -195,7 +295,8 @@ void uip_neighbor_out(struct uip_stack *ustack)
 
 	   If not ARP table entry is found, we overwrite the original IP
 	   packet with an ARP request for the IP address. */
-	e = find_entry(ustack, (struct in6_addr *)ipv6_hdr->destipaddr);
+	e = uip_ncache_lookup(&ustack->neighbor_cache, ipv6_hdr->destipaddr,
+			      sizeof(struct in6_addr));
 	if (e == NULL) {
 		struct uip_eth_addr eth_addr_tmp;
 
@@ -209,7 +310,7 @@ void uip_neighbor_out(struct uip_stack *ustack)
 		return;
 	}
 
-	memcpy(eth_hdr->dest.addr, &e->mac_addr, sizeof(eth_hdr->dest.addr));
+	memcpy(eth_hdr->dest.addr, &e->ethaddr, sizeof(eth_hdr->dest.addr));
 	memcpy(eth_hdr->src.addr, ustack->uip_ethaddr.addr,
 	       sizeof(eth_hdr->src.addr));
 
@@ -93,6 +93,14 @@ struct __attribute__ ((__packed__)) icmpv6_hdr {
 };
 #endif
 
+void uip_ncache_init(struct uip_ncache *nc);
+struct uip_ncache_entry *uip_ncache_lookup(struct uip_ncache *nc,
+					   const void *addr, u8_t addr_len);
+struct uip_ncache_entry *uip_ncache_update(struct uip_ncache *nc,
+					   const void *addr, u8_t addr_len,
+					   const struct uip_eth_addr *ethaddr);
+void uip_ncache_age(struct uip_ncache *nc, u8_t maxage);
+
 void uip_neighbor_init(struct uip_stack *ustack);
 void uip_neighbor_add(struct uip_stack *ustack,
 		      struct in6_addr *addr6, struct uip_eth_addr *addr);
@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <stdlib.h>
 #include <netinet/in.h>
 #include <netinet/ip6.h>
 #include <netinet/icmp6.h>
@@ -407,6 +409,162 @@ u16_t uip_udpchksum(struct uip_stack *ustack)
 }
 #endif /* UIP_UDP_CHECKSUMS */
 #endif /* UIP_ARCH_CHKSUM */
+/*---------------------------------------------------------------------------*/
+/*  TCP connection table
+ *
+ *  Connections are allocated UIP_CONNS at a time and never move, so
+ *  pointers handed out by uip_connect() stay valid until uip_reset().
+ *  Every connection which has been given a remote endpoint is kept in
+ *  a hash bucket keyed by {lport, rport, ripaddr}; it stays there once
+ *  closed and is only rehashed when the slot is reused.
+ */
+static u16_t uip_conn_hashfn(u16_t lport, u16_t rport,
+			     const void *ripaddr, int addr_len)
+{
+	const u8_t *addr = ripaddr;
+	u32_t hash = 2166136261U;	/* FNV-1a */
+	int i;
+
+	hash = (hash ^ lport) * 16777619U;
+	hash = (hash ^ rport) * 16777619U;
+	for (i = 0; i < addr_len; i++)
+		hash = (hash ^ addr[i]) * 16777619U;
+
+	return (hash ^ (hash >> 16)) & (UIP_CONN_HASH_SIZE - 1);
+}
+
+static void uip_conn_unhash(struct uip_stack *ustack, struct uip_conn *conn)
+{
+	struct uip_conn *prev = NULL, *cconn;
+
+	if (conn->hash == UIP_CONN_UNHASHED)
+		return;
+
+	/*  struct uip_conn is packed, so walk with the previous entry
+	 *  rather than a pointer to its hash_next member */
+	for (cconn = ustack->uip_conn_hash[conn->hash]; cconn != NULL;
+	     prev = cconn, cconn = cconn->hash_next) {
+		if (cconn != conn)
+			continue;
+		if (prev != NULL)
+			prev->hash_next = conn->hash_next;
+		else
+			ustack->uip_conn_hash[conn->hash] = conn->hash_next;
+		break;
+	}
+
+	conn->hash_next = NULL;
+	conn->hash = UIP_CONN_UNHASHED;
+}
+
+static void uip_conn_rehash(struct uip_stack *ustack, struct uip_conn *conn,
+			    const void *ripaddr, int addr_len)
+{
+	uip_conn_unhash(ustack, conn);
+
+	conn->hash = uip_conn_hashfn(conn->lport, conn->rport,
+				     ripaddr, addr_len);
+	conn->hash_next = ustack->uip_conn_hash[conn->hash];
+	ustack->uip_conn_hash[conn->hash] = conn;
+}
+
+static struct uip_conn *uip_conn_lookup(struct uip_stack *ustack,
+					u16_t lport, u16_t rport,
+					const void *ripaddr, int addr_len)
+{
+	struct uip_conn *conn;
+
+	conn = ustack->uip_conn_hash[uip_conn_hashfn(lport, rport,
+						     ripaddr, addr_len)];
+	for (; conn != NULL; conn = conn->hash_next) {
+		if (conn->tcpstateflags != UIP_CLOSED &&
+		    lport == conn->lport && rport == conn->rport &&
+		    memcmp(ripaddr, conn->ripaddr, addr_len) == 0)
+			return conn;
+	}
+
+	return NULL;
+}
+
+static int uip_conns_grow(struct uip_stack *ustack)
+{
+	struct uip_conn **conns;
+	struct uip_conn *chunk;
+	u16_t size;
+	int i;
+
+	if (ustack->uip_conns_num + UIP_CONNS > UIP_CONNS_MAX)
+		return -ENOSPC;
+
+	if (ustack->uip_conns_num + UIP_CONNS > ustack->uip_conns_size) {
+		size = ustack->uip_conns_size ? ustack->uip_conns_size * 2 :
+						UIP_CONNS;
+		if (size > UIP_CONNS_MAX)
+			size = UIP_CONNS_MAX;
+
+		conns = realloc(ustack->uip_conns, size * sizeof(*conns));
+		if (conns == NULL)
+			return -ENOMEM;
+
+		ustack->uip_conns = conns;
+		ustack->uip_conns_size = size;
+	}
+
+	chunk = calloc(UIP_CONNS, sizeof(*chunk));
+	if (chunk == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < UIP_CONNS; i++) {
+		chunk[i].tcpstateflags = UIP_CLOSED;
+		chunk[i].hash = UIP_CONN_UNHASHED;
+		ustack->uip_conns[ustack->uip_conns_num++] = &chunk[i];
+	}
+
+	return 0;
+}
+
+static void uip_conns_free(struct uip_stack *ustack)
+{
+	u16_t c;
+
+	/*  Each chunk starts on a multiple of UIP_CONNS */
+	for (c = 0; c < ustack->uip_conns_num; c += UIP_CONNS)
+		free(ustack->uip_conns[c]);
+	free(ustack->uip_conns);
+
+	/*  uip_conn may still point into one of the freed chunks */
+	ustack->uip_conn = NULL;
+	ustack->uip_conns = NULL;
+	ustack->uip_conns_num = 0;
+	ustack->uip_conns_size = 0;
+	memset(ustack->uip_conn_hash, 0, sizeof(ustack->uip_conn_hash));
+}
+
+/*  Find a slot for a new connection: an unused one if possible, then a
+ *  freshly allocated one, and as a last resort the oldest connection
+ *  in TIME_WAIT.  Thanks to Eddie C. Dost for a very nice algorithm
+ *  for the TIME_WAIT search. */
+static struct uip_conn *uip_conn_alloc(struct uip_stack *ustack)
+{
+	struct uip_conn *conn = NULL, *cconn;
+	u16_t c;
+
+	for (c = 0; c < ustack->uip_conns_num; ++c) {
+		cconn = ustack->uip_conns[c];
+		if (cconn->tcpstateflags == UIP_CLOSED)
+			return cconn;
+		if (cconn->tcpstateflags == UIP_TIME_WAIT) {
+			if (conn == NULL || cconn->timer > conn->timer)
+				conn = cconn;
+		}
+	}
+
+	if (uip_conns_grow(ustack) == 0)
+		conn = ustack->uip_conns[ustack->uip_conns_num - UIP_CONNS];
+
+	return conn;
+}
+
 /*---------------------------------------------------------------------------*/
 void uip_init(struct uip_stack *ustack, uint8_t ipv6_enabled)
 {
@@ -414,8 +572,7 @@ void uip_init(struct uip_stack *ustack, uint8_t ipv6_enabled)
 
 	for (c = 0; c < UIP_LISTENPORTS; ++c)
 		ustack->uip_listenports[c] = 0;
-	for (c = 0; c < UIP_CONNS; ++c)
-		ustack->uip_conns[c].tcpstateflags = UIP_CLOSED;
+	uip_conns_free(ustack);
 #if UIP_ACTIVE_OPEN
 	ustack->lastport = 1024;
 #endif /* UIP_ACTIVE_OPEN */
@@ -454,6 +611,8 @@ void uip_reset(struct uip_stack *ustack)
 
 	ndpc_exit(ustack->ndpc);
 
+	uip_conns_free(ustack);
+
 	memset(ustack, 0, sizeof(*ustack));
 }
 
@@ -462,8 +621,8 @@ void uip_reset(struct uip_stack *ustack)
 struct uip_conn *uip_connect(struct uip_stack *ustack, uip_ip4addr_t *ripaddr,
 			     u16_t rport)
 {
-	u8_t c;
-	register struct uip_conn *conn, *cconn;
+	u16_t c;
+	register struct uip_conn *conn;
 
 	/* Find an unused local port. */
 again:
@@ -474,27 +633,15 @@ again:
 
 	/* Check if this port is already in use, and if so try to find
 	   another one. */
-	for (c = 0; c < UIP_CONNS; ++c) {
-		conn = &ustack->uip_conns[c];
+	for (c = 0; c < ustack->uip_conns_num; ++c) {
+		conn = ustack->uip_conns[c];
 		if (conn->tcpstateflags != UIP_CLOSED &&
 		    conn->lport == htons(ustack->lastport)) {
 			goto again;
 		}
 	}
 
-	conn = 0;
-	for (c = 0; c < UIP_CONNS; ++c) {
-		cconn = &ustack->uip_conns[c];
-		if (cconn->tcpstateflags == UIP_CLOSED) {
-			conn = cconn;
-			break;
-		}
-		if (cconn->tcpstateflags == UIP_TIME_WAIT) {
-			if (conn == 0 || cconn->timer > conn->timer)
-				conn = cconn;
-		}
-	}
-
+	conn = uip_conn_alloc(ustack);
 	if (conn == 0)
 		return 0;
 
@@ -516,6 +663,7 @@ again:
 	conn->lport = htons(ustack->lastport);
 	conn->rport = rport;
 	uip_ip4addr_copy(&conn->ripaddr, ripaddr);
+	uip_conn_rehash(ustack, conn, ripaddr, sizeof(uip_ip4addr_t));
 
 	return conn;
 }
@@ -937,7 +1085,7 @@ void uip_input(struct uip_stack *ustack)
  * The ususal way of calling the function is through a for() loop like
  * this:
  \code
-	for(i = 0; i < UIP_CONNS; ++i) {
+	for(i = 0; i < ustack->uip_conns_num; ++i) {
 		uip_periodic(i);
 		if(uip_len > 0) {
 			devicedriver_send();
@@ -950,7 +1098,7 @@ void uip_input(struct uip_stack *ustack)
  * Ethernet, you will need to call the uip_arp_out() function before
  * calling the device driver:
  \code
-	for(i = 0; i < UIP_CONNS; ++i) {
+	for(i = 0; i < ustack->uip_conns_num; ++i) {
 		uip_periodic(i);
 		if(uip_len > 0) {
 			uip_arp_out();
@@ -965,7 +1113,7 @@ void uip_input(struct uip_stack *ustack)
  */
 void uip_periodic(struct uip_stack *ustack, int conn)
 {
-	ustack->uip_conn = &ustack->uip_conns[conn];
+	ustack->uip_conn = ustack->uip_conns[conn];
 	uip_process(ustack, UIP_TIMER);
 }
 
@@ -1592,35 +1740,20 @@ tcp_input:
 		goto drop;
 	}
 
-	if (is_ipv6(ustack)) {
-		/* Demultiplex this segment. */
-		/* First check any active connections. */
-		for (uip_connr = &ustack->uip_conns[0];
-		     uip_connr <= &ustack->uip_conns[UIP_CONNS - 1];
-		     ++uip_connr) {
-			if (uip_connr->tcpstateflags != UIP_CLOSED &&
-			    tcp_hdr->destport == uip_connr->lport &&
-			    tcp_hdr->srcport == uip_connr->rport &&
-			    uip_ip6addr_cmp(IPv6_BUF(ustack)->srcipaddr,
-					    uip_connr->ripaddr)) {
-				goto found;
-			}
-		}
-	} else {
-		/* Demultiplex this segment. */
-		/* First check any active connections. */
-		for (uip_connr = &ustack->uip_conns[0];
-		     uip_connr <= &ustack->uip_conns[UIP_CONNS - 1];
-		     ++uip_connr) {
-			if (uip_connr->tcpstateflags != UIP_CLOSED &&
-			    tcp_hdr->destport == uip_connr->lport &&
-			    tcp_hdr->srcport == uip_connr->rport &&
-			    uip_ip4addr_cmp(tcp_ipv4_hdr->srcipaddr,
-					    uip_connr->ripaddr)) {
-				goto found;
-			}
-		}
-	}
+	/* Demultiplex this segment. */
+	/* First check any active connections. */
+	if (is_ipv6(ustack))
+		uip_connr = uip_conn_lookup(ustack, tcp_hdr->destport,
+					    tcp_hdr->srcport,
+					    IPv6_BUF(ustack)->srcipaddr,
+					    sizeof(uip_ip6addr_t));
+	else
+		uip_connr = uip_conn_lookup(ustack, tcp_hdr->destport,
+					    tcp_hdr->srcport,
+					    tcp_ipv4_hdr->srcipaddr,
+					    sizeof(uip_ip4addr_t));
+	if (uip_connr != NULL)
+		goto found;
 
 	/* If we didn't find and active connection that expected the packet,
 	   either this packet is an old duplicate, or this is a SYN packet
@@ -1703,24 +1836,10 @@ reset:
 found_listen:
 	/* First we check if there are any connections avaliable. Unused
 	   connections are kept in the same table as used connections, but
-	   unused ones have the tcpstate set to CLOSED. Also, connections in
-	   TIME_WAIT are kept track of and we'll use the oldest one if no
-	   CLOSED connections are found. Thanks to Eddie C. Dost for a very
-	   nice algorithm for the TIME_WAIT search. */
-	uip_connr = 0;
-	for (c = 0; c < UIP_CONNS; ++c) {
-		if (ustack->uip_conns[c].tcpstateflags == UIP_CLOSED) {
-			uip_connr = &ustack->uip_conns[c];
-			break;
-		}
-		if (ustack->uip_conns[c].tcpstateflags == UIP_TIME_WAIT) {
-			if (uip_connr == 0 ||
-			    ustack->uip_conns[c].timer > uip_connr->timer) {
-				uip_connr = &ustack->uip_conns[c];
-			}
-		}
-	}
-
+	   unused ones have the tcpstate set to CLOSED. The table is grown
+	   when there are none, and connections in TIME_WAIT are recycled
+	   once it has reached UIP_CONNS_MAX. */
+	uip_connr = uip_conn_alloc(ustack);
 	if (uip_connr == 0) {
 		/* All connections are used already, we drop packet and hope
 		   that the remote end will retransmit the packet at a time when
@@ -1741,8 +1860,12 @@ found_listen:
 	if (is_ipv6(ustack)) {
 		uip_ip6addr_copy(uip_connr->ripaddr,
 				 IPv6_BUF(ustack)->srcipaddr);
+		uip_conn_rehash(ustack, uip_connr, IPv6_BUF(ustack)->srcipaddr,
+				sizeof(uip_ip6addr_t));
 	} else {
 		uip_ip4addr_copy(uip_connr->ripaddr, tcp_ipv4_hdr->srcipaddr);
+		uip_conn_rehash(ustack, uip_connr, tcp_ipv4_hdr->srcipaddr,
+				sizeof(uip_ip4addr_t));
 	}
 	uip_connr->tcpstateflags = UIP_SYN_RCVD;
 
@@ -204,7 +204,8 @@ void uip_setipid(u16_t id);
  *
  *
  */
-#define uip_conn_active(conn) (uip_conns[conn].tcpstateflags != UIP_CLOSED)
+#define uip_conn_active(ustack, conn) \
+	((ustack)->uip_conns[conn]->tcpstateflags != UIP_CLOSED)
 
 #if UIP_UDP
 void uip_udp_periodic(struct uip_stack *ustack, int conn);
@@ -1006,8 +1007,15 @@ struct __attribute__ ((__packed__)) uip_conn {
 	u8_t timer;   /**< The retransmission timer. */
 	u8_t nrtx;    /**< The number of retransmissions for the last
 			 segment sent. */
+
+	struct uip_conn *hash_next;
+		      /**< Next connection in the same hash bucket. */
+	u16_t hash;   /**< Hash bucket of this connection, or
+			 UIP_CONN_UNHASHED. */
 };
 
+#define UIP_CONN_UNHASHED	0xffff
+
 /**
  * \addtogroup uiparch
  * @{
@@ -1451,10 +1459,40 @@ u16_t uip_udpchksum(struct uip_stack *ustack);
 /*  IPv6 checksum */
 uint16_t icmpv6_checksum(uint8_t *data);
 
-struct neighbor_entry {
-	struct in6_addr ipaddr;
-	struct uip_eth_addr mac_addr;
+/**
+ * An entry in a neighbor cache.
+ *
+ * The same entry type is used for IPv4 ARP (4 byte keys) and IPv6
+ * neighbor discovery (16 byte keys).  Entries are chained into a hash
+ * bucket for lookups and into an LRU list for eviction.
+ */
+struct uip_ncache_entry {
+	struct uip_ncache_entry *hash_next;
+	struct uip_ncache_entry *lru_prev;
+	struct uip_ncache_entry *lru_next;
+	u8_t ipaddr[16];
+	u8_t addr_len;		/* 0 if the entry is unused */
+	u8_t time;		/* cache time of the last confirmation */
+	struct uip_eth_addr ethaddr;
+};
+
+/**
+ * A hashed neighbor cache with LRU eviction.
+ *
+ * lru.lru_next is the most recently used entry and lru.lru_prev is the
+ * least recently used one, which is recycled when the cache is full.
+ */
+struct uip_ncache {
+	struct uip_ncache_entry *hash[UIP_ARPTAB_HASH_SIZE];
+	struct uip_ncache_entry lru;
+	struct uip_ncache_entry *free_list;
 	u8_t time;
+
+	u32_t hits;
+	u32_t misses;
+	u32_t evictions;
+
+	struct uip_ncache_entry entries[UIP_ARPTAB_SIZE];
 };
 
 struct uip_stack {
@@ -1485,9 +1523,15 @@ struct uip_stack {
 	struct uip_conn *uip_conn;	/* uip_conn always points to the current
 					   connection. */
 
-	struct uip_conn uip_conns[UIP_CONNS];
-	/* The uip_conns array holds all TCP
-	   connections. */
+	struct uip_conn **uip_conns;
+	/* The uip_conns table holds all TCP
+	   connections.  It is grown UIP_CONNS
+	   slots at a time, up to UIP_CONNS_MAX. */
+	u16_t uip_conns_num;
+	u16_t uip_conns_size;
+	struct uip_conn *uip_conn_hash[UIP_CONN_HASH_SIZE];
+	/* Connections hashed by local port,
+	   remote port and remote address. */
 	u16_t uip_listenports[UIP_LISTENPORTS];
 	/* The uip_listenports list all currently
 	   listning ports. */
@@ -1537,8 +1581,7 @@ struct uip_stack {
 #define IPV6_RTR_AUTOCFG_NOTSPEC	(1<<6)
 #define IPV6_RTR_AUTOCFG_NOTUSED	(1<<7)
 
-#define UIP_NEIGHBOR_ENTRIES 8
-	struct neighbor_entry neighbor_entries[UIP_NEIGHBOR_ENTRIES];
+	struct uip_ncache neighbor_cache;
 
 	struct uip_stats stats;
 
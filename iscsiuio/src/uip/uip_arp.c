@@ -66,6 +66,7 @@
 
 #include "uip_arp.h"
 #include "uip_eth.h"
+#include "uip-neighbor.h"
 
 #include <pthread.h>
 #include <string.h>
@@ -75,9 +76,7 @@ static const struct uip_eth_addr broadcast_ethaddr = {
 static const u16_t broadcast_ipaddr[2] = { 0xffff, 0xffff };
 
 pthread_mutex_t arp_table_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct arp_entry arp_table[UIP_ARPTAB_SIZE];
-
-static u8_t arptime;
+static struct uip_ncache arp_table;
 
 /**
  * Initialize the ARP module.
@@ -86,9 +85,7 @@ static u8_t arptime;
 /*----------------------------------------------------------------------------*/
 void uip_arp_init(void)
 {
-	u8_t i;
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i)
-		memset(&arp_table[i], 0, sizeof(arp_table[i]));
+	uip_ncache_init(&arp_table);
 
 	pthread_mutex_init(&arp_table_mutex, NULL);
 }
@@ -105,81 +102,23 @@ void uip_arp_init(void)
 /*----------------------------------------------------------------------------*/
 void uip_arp_timer(void)
 {
-	u8_t i;
-	struct arp_entry *tabptr;
-
-	++arptime;
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-		tabptr = &arp_table[i];
-		if ((tabptr->ipaddr[0] | tabptr->ipaddr[1]) != 0 &&
-		    (u8_t)(arptime - tabptr->time) >= UIP_ARP_MAXAGE)
-			memset(tabptr->ipaddr, 0, 4);
-	}
-
+	pthread_mutex_lock(&arp_table_mutex);
+	uip_ncache_age(&arp_table, UIP_ARP_MAXAGE);
+	pthread_mutex_unlock(&arp_table_mutex);
 }
 
 /*----------------------------------------------------------------------------*/
 static void uip_arp_update(u16_t *ipaddr, struct uip_eth_addr *ethaddr)
 {
-	u8_t i;
-	struct arp_entry *tabptr;
+	/* Never cache the unspecified address. */
+	if (ipaddr[0] == 0 && ipaddr[1] == 0)
+		return;
 
+	/* Refresh the existing IP -> MAC address mapping, or insert a new
+	   one; when the table is full the least recently used entry is
+	   thrown away. */
 	pthread_mutex_lock(&arp_table_mutex);
-	/* Walk through the ARP mapping table and try to find an entry to
-	   update. If none is found, the IP -> MAC address mapping is
-	   inserted in the ARP table. */
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-
-		tabptr = &arp_table[i];
-		/* Only check those entries that are actually in use. */
-		if (tabptr->ipaddr[0] != 0 && tabptr->ipaddr[1] != 0) {
-
-			/* Check if the source IP address of the incoming packet
-			   matches the IP address in this ARP table entry. */
-			if (ipaddr[0] == tabptr->ipaddr[0] &&
-			    ipaddr[1] == tabptr->ipaddr[1]) {
-
-				tabptr->time = arptime;
-
-				pthread_mutex_unlock(&arp_table_mutex);
-				return;
-			}
-		}
-	}
-
-	/* If we get here, no existing ARP table entry was found, so we
-	   create one. */
-
-	/* First, we try to find an unused entry in the ARP table. */
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-		tabptr = &arp_table[i];
-		if (tabptr->ipaddr[0] == 0 && tabptr->ipaddr[1] == 0)
-			break;
-	}
-
-	/* If no unused entry is found, we try to find the oldest entry and
-	   throw it away. */
-	if (i == UIP_ARPTAB_SIZE) {
-		u8_t c;
-		u8_t tmpage = 0;
-		c = 0;
-		for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-			tabptr = &arp_table[i];
-			if ((u8_t)(arptime - tabptr->time) > tmpage) {
-				tmpage = (u8_t)(arptime - tabptr->time);
-				c = i;
-			}
-		}
-		i = c;
-		tabptr = &arp_table[i];
-	}
-
-	/* Now, i is the ARP table entry which we will fill with the new
-	   information. */
-	memcpy(tabptr->ipaddr, ipaddr, 4);
-	memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
-	tabptr->time = arptime;
-
+	uip_ncache_update(&arp_table, ipaddr, 4, ethaddr);
 	pthread_mutex_unlock(&arp_table_mutex);
 }
 
@@ -346,25 +285,19 @@ uip_determine_dest_ipv4_addr(struct uip_stack *ustack, u16_t *ipaddr)
 	}
 }
 
-arp_out_t is_in_arp_table(u16_t *ipaddr, struct arp_entry **tabptr)
+arp_out_t is_in_arp_table(u16_t *ipaddr, struct uip_ncache_entry **tabptr)
 {
-	u8_t i;
+	struct uip_ncache_entry *e;
 
 	pthread_mutex_lock(&arp_table_mutex);
-
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-		if (uip_ip4addr_cmp(ipaddr, arp_table[i].ipaddr)) {
-			*tabptr = &arp_table[i];
-			break;
-		}
-	}
-
+	e = uip_ncache_lookup(&arp_table, ipaddr, 4);
 	pthread_mutex_unlock(&arp_table_mutex);
 
-	if (i == UIP_ARPTAB_SIZE)
+	if (e == NULL)
 		return NOT_IN_ARP_TABLE;
-	else
-		return IS_IN_ARP_TABLE;
+
+	*tabptr = e;
+	return IS_IN_ARP_TABLE;
 }
 
 void uip_build_arp_request(struct uip_stack *ustack, u16_t *ipaddr)
@@ -400,7 +333,7 @@ void uip_build_arp_request(struct uip_stack *ustack, u16_t *ipaddr)
 void
 uip_build_eth_header(struct uip_stack *ustack,
 		     u16_t *ipaddr,
-		     struct arp_entry *tabptr,
+		     struct uip_ncache_entry *tabptr,
 		     struct packet *pkt, u16_t vlan_id)
 {
 	struct uip_ipv4_hdr *ip_buf;
@@ -435,38 +368,28 @@ uip_build_eth_header(struct uip_stack *ustack,
 	}
 }
 
-static struct arp_entry *uip_get_arp_entry(int index)
-{
-	return &arp_table[index];
-}
-
 int uip_lookup_arp_entry(uint32_t ip_addr, uint8_t *mac_addr)
 {
-	int i;
+	struct uip_ncache_entry *entry;
 	int rc = -EINVAL;
 
 	pthread_mutex_lock(&arp_table_mutex);
 
-	for (i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-		struct arp_entry *entry = uip_get_arp_entry(i);
+	entry = uip_ncache_lookup(&arp_table, &ip_addr, 4);
+	if (entry != NULL) {
+		struct in_addr addr;
+		char *addr_str;
 
-		if (((entry->ipaddr[1] << 16) == (ip_addr & 0xffff0000)) &&
-		    ((entry->ipaddr[0]) == (ip_addr & 0x0000ffff))) {
-			struct in_addr addr;
-			char *addr_str;
+		addr.s_addr = ip_addr;
+		addr_str = inet_ntoa(addr);
 
-			addr.s_addr = ip_addr;
-			addr_str = inet_ntoa(addr);
+		memcpy(mac_addr, entry->ethaddr.addr, 6);
 
-			memcpy(mac_addr, entry->ethaddr.addr, 6);
-
-			LOG_INFO("Found %s at %02x:%02x:%02x:%02x:%02x:%02x",
-				 addr_str,
-				 mac_addr[0], mac_addr[1], mac_addr[2],
-				 mac_addr[3], mac_addr[4], mac_addr[5]);
-			rc = 0;
-			break;
-		}
+		LOG_INFO("Found %s at %02x:%02x:%02x:%02x:%02x:%02x",
+			 addr_str,
+			 mac_addr[0], mac_addr[1], mac_addr[2],
+			 mac_addr[3], mac_addr[4], mac_addr[5]);
+		rc = 0;
 	}
 
 	pthread_mutex_unlock(&arp_table_mutex);
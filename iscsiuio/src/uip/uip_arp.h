@@ -86,12 +86,6 @@ struct __attribute__ ((__packed__)) ethip_hdr {
 	u16_t srcipaddr[2], destipaddr[2];
 };
 
-struct arp_entry {
-	u16_t ipaddr[2];
-	struct uip_eth_addr ethaddr;
-	u8_t time;
-};
-
 /* The uip_arp_init() function must be called before any of the other
    ARP functions. */
 void uip_arp_init(void);
@@ -131,14 +125,14 @@ typedef enum {
 
 dest_ipv4_addr_t
 uip_determine_dest_ipv4_addr(struct uip_stack *ustack, u16_t *ipaddr);
-arp_out_t is_in_arp_table(u16_t *ipaddr, struct arp_entry **tabptr);
+arp_out_t is_in_arp_table(u16_t *ipaddr, struct uip_ncache_entry **tabptr);
 
 void uip_build_arp_request(struct uip_stack *ustack, u16_t *ipaddr);
 
 void
 uip_build_eth_header(struct uip_stack *ustack,
 		     u16_t *ipaddr,
-		     struct arp_entry *tabptr,
+		     struct uip_ncache_entry *tabptr,
 		     struct packet *pkt, u16_t vlan_id);
 
 /* The uip_arp_out() function should be called when an IP packet
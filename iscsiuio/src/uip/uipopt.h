@@ -230,20 +230,45 @@
 #define UIP_ACTIVE_OPEN 1
 
 /**
- * The maximum number of simultaneously open TCP connections.
+ * The number of TCP connection slots allocated at a time.
  *
- * Since the TCP connections are statically allocated, turning this
- * configuration knob down results in less RAM used. Each TCP
- * connection requires approximatly 30 bytes of memory.
+ * TCP connections are allocated on demand, this many at a time, until
+ * UIP_CONNS_MAX slots are in use.  Each TCP connection requires
+ * approximatly 60 bytes of memory.
+ *
+ * \hideinitializer
+ */
+#ifndef UIP_CONF_CONNS_CHUNK
+#define UIP_CONNS	10
+#else /* UIP_CONF_CONNS_CHUNK */
+#define UIP_CONNS UIP_CONF_CONNS_CHUNK
+#endif /* UIP_CONF_CONNS_CHUNK */
+
+/**
+ * The maximum number of simultaneously open TCP connections.
  *
  * \hideinitializer
  */
 #ifndef UIP_CONF_MAX_CONNECTIONS
-#define UIP_CONNS       10
+#define UIP_CONNS_MAX	1024
 #else /* UIP_CONF_MAX_CONNECTIONS */
-#define UIP_CONNS UIP_CONF_MAX_CONNECTIONS
+#define UIP_CONNS_MAX UIP_CONF_MAX_CONNECTIONS
 #endif /* UIP_CONF_MAX_CONNECTIONS */
 
+/**
+ * The number of hash buckets used to demultiplex incoming TCP segments
+ * to their connection by {local port, remote port, remote address}.
+ *
+ * Must be a power of two.
+ *
+ * \hideinitializer
+ */
+#ifndef UIP_CONF_CONN_HASH_SIZE
+#define UIP_CONN_HASH_SIZE	256
+#else /* UIP_CONF_CONN_HASH_SIZE */
+#define UIP_CONN_HASH_SIZE UIP_CONF_CONN_HASH_SIZE
+#endif /* UIP_CONF_CONN_HASH_SIZE */
+
 /**
  * The maximum number of simultaneously listening TCP ports.
  *
@@ -341,7 +366,22 @@
 #ifdef UIP_CONF_ARPTAB_SIZE
 #define UIP_ARPTAB_SIZE UIP_CONF_ARPTAB_SIZE
 #else
-#define UIP_ARPTAB_SIZE 16
+#define UIP_ARPTAB_SIZE 256
+#endif
+
+/**
+ * The number of hash buckets used to index the ARP and IPv6 neighbor
+ * tables.
+ *
+ * Must be a power of two.  Lookups stay O(1) as long as this is in
+ * the same order as UIP_ARPTAB_SIZE.
+ *
+ * \hideinitializer
+ */
+#ifdef UIP_CONF_ARPTAB_HASH_SIZE
+#define UIP_ARPTAB_HASH_SIZE UIP_CONF_ARPTAB_HASH_SIZE
+#else
+#define UIP_ARPTAB_HASH_SIZE 128
 #endif
 
 /**
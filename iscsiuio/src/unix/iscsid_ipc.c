@@ -44,6 +44,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
@@ -65,6 +66,8 @@
 #include "logger.h"
 #include "uip.h"
 #include "ping.h"
+#include "ipv6.h"
+#include "ipv6_ndpc.h"
 
 /*  private iscsid options stucture */
 struct iscsid_options {
@@ -659,7 +662,17 @@ static int parse_iface(void *arg, int do_ping)
 	}
 
 	nic_iface->flags |= NIC_IFACE_PATHREQ_WAIT1;
-	if (nic->nl_process_thread == INVALID_THREAD) {
+	if (nic->nl_process_efd == INVALID_FD) {
+		nic->nl_process_efd = eventfd(0, EFD_CLOEXEC);
+		if (nic->nl_process_efd < 0) {
+			LOG_ERR(PFX "%s: Could not create NIC NL "
+				"eventfd [%s]", nic->log_name,
+				strerror(errno));
+			nic->nl_process_efd = INVALID_FD;
+		}
+	}
+	if (nic->nl_process_thread == INVALID_THREAD &&
+	    nic->nl_process_efd != INVALID_FD) {
 		pthread_attr_init(&attr);
 		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 		rc = pthread_create(&nic->nl_process_thread, &attr,
@@ -899,6 +912,128 @@ early_exit:
 	return rc;
 }
 
+static void fill_iface_stats(nic_interface_t *nic_iface,
+			     struct iscsid_uip_iface_stats *ifs)
+{
+	struct uip_stack *ustack = &nic_iface->ustack;
+	struct ndpc_state *n = ustack->ndpc;
+
+	ifs->iface_num = nic_iface->iface_num;
+	ifs->vlan_id = nic_iface->vlan_id;
+	ifs->protocol = nic_iface->protocol;
+
+	ifs->tx_packets = nic_iface->stats.tx.packets;
+	ifs->tx_bytes = nic_iface->stats.tx.bytes;
+	ifs->rx_packets = nic_iface->stats.rx.packets;
+	ifs->rx_bytes = nic_iface->stats.rx.bytes;
+
+	if (nic_iface->protocol == AF_INET6 && n && n->ipv6_context) {
+		struct ipv6_context *ipv6c = n->ipv6_context;
+
+		/* The IPv6 neighbor cache is private to the ustack */
+		ifs->arp_hits = ipv6c->ipv6_arp_table.hits;
+		ifs->arp_misses = ipv6c->ipv6_arp_table.misses;
+	} else {
+		ifs->arp_hits = nic_iface->stats.arp_hits;
+		ifs->arp_misses = nic_iface->stats.arp_misses;
+	}
+
+	ifs->ip_recv = ustack->stats.ip.recv;
+	ifs->ip_sent = ustack->stats.ip.sent;
+	ifs->ip_drop = ustack->stats.ip.drop;
+	ifs->ip_chkerr = ustack->stats.ip.chkerr;
+	ifs->icmp_recv = ustack->stats.icmp.recv;
+	ifs->icmp_sent = ustack->stats.icmp.sent;
+	ifs->icmp_drop = ustack->stats.icmp.drop;
+	ifs->tcp_recv = ustack->stats.tcp.recv;
+	ifs->tcp_sent = ustack->stats.tcp.sent;
+	ifs->tcp_drop = ustack->stats.tcp.drop;
+	ifs->tcp_chkerr = ustack->stats.tcp.chkerr;
+	ifs->tcp_rexmit = ustack->stats.tcp.rexmit;
+	ifs->tcp_rst = ustack->stats.tcp.rst;
+	ifs->udp_recv = ustack->stats.udp.recv;
+	ifs->udp_sent = ustack->stats.udp.sent;
+	ifs->udp_drop = ustack->stats.udp.drop;
+	ifs->udp_chkerr = ustack->stats.udp.chkerr;
+}
+
+/**
+ *  get_nic_stats() - Snapshot the counters of the NIC named by the iface
+ *                    record and of all of its nic_ifaces
+ *  @param iface_stats - allocated here, one entry per nic_iface; the
+ *                       caller must free it
+ *  @return 0 on success, -ENODEV if the NIC isn't managed by iscsiuio,
+ *          -ENOMEM
+ */
+static int get_nic_stats(struct iface_rec *rec,
+			 struct iscsid_uip_nic_stats *stats,
+			 struct iscsid_uip_iface_stats **iface_stats)
+{
+	nic_t *nic;
+	nic_interface_t *nic_iface, *vlan_iface;
+	struct iscsid_uip_iface_stats *ifs;
+	uint32_t num_ifaces = 0;
+	int rc;
+
+	pthread_mutex_lock(&nic_list_mutex);
+
+	rc = from_netdev_name_find_nic(rec->netdev, &nic);
+	if (rc != 0) {
+		LOG_WARN(PFX "Couldn't find NIC: %s for stats", rec->netdev);
+		rc = -ENODEV;
+		goto done;
+	}
+
+	pthread_mutex_lock(&nic->nic_mutex);
+
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next)
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next)
+			num_ifaces++;
+
+	ifs = calloc(num_ifaces ? num_ifaces : 1, sizeof(*ifs));
+	if (ifs == NULL) {
+		pthread_mutex_unlock(&nic->nic_mutex);
+		rc = -ENOMEM;
+		goto done;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->interrupts = nic->stats.interrupts;
+	stats->missed_interrupts = nic->stats.missed_interrupts;
+	stats->tx_packets = nic->stats.tx.packets;
+	stats->tx_bytes = nic->stats.tx.bytes;
+	stats->rx_packets = nic->stats.rx.packets;
+	stats->rx_bytes = nic->stats.rx.bytes;
+	stats->rx_no_iface = nic->stats.rx_no_iface;
+	stats->rx_ignored = nic->stats.rx_ignored;
+	stats->pkt_alloc_failures = nic->stats.pkt_alloc_failures;
+	stats->tx_queue_failures = nic->stats.tx_queue_failures;
+	stats->nl_enqueued = nic->nl_stats.enqueued;
+	stats->nl_processed = nic->nl_stats.processed;
+	stats->nl_dropped = nic->nl_stats.dropped;
+	stats->nl_flushed = nic->nl_stats.flushed;
+	stats->nl_depth_max = nic->nl_stats.depth_max;
+	stats->num_ifaces = num_ifaces;
+
+	num_ifaces = 0;
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next)
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next)
+			fill_iface_stats(vlan_iface, &ifs[num_ifaces++]);
+
+	pthread_mutex_unlock(&nic->nic_mutex);
+
+	*iface_stats = ifs;
+
+done:
+	pthread_mutex_unlock(&nic_list_mutex);
+
+	return rc;
+}
+
 /**
  *  process_iscsid_broadcast() - This function is used to process the
  *                               broadcast messages from iscsid
@@ -912,6 +1047,8 @@ int process_iscsid_broadcast(int s2)
 	size_t size;
 	iscsid_uip_cmd_e cmd;
 	uint32_t payload_len;
+	struct iscsid_uip_nic_stats nic_stats;
+	struct iscsid_uip_iface_stats *iface_stats = NULL;
 
 	fd = fdopen(s2, "r+");
 	if (fd == NULL) {
@@ -991,6 +1128,33 @@ int process_iscsid_broadcast(int s2)
 			rsp.err = ISCSID_UIP_MGMT_IPC_ERR;
 		}
 
+		break;
+	case ISCSID_UIP_IPC_GET_STATS:
+		size = fread(&data->u.stats_rec, payload_len, 1, fd);
+		if (!size) {
+			LOG_ERR(PFX "Could not read data: %d(%s)",
+				errno, strerror(errno));
+			goto error;
+		}
+
+		rc = get_nic_stats(&data->u.stats_rec.rec, &nic_stats,
+				   &iface_stats);
+		rsp.command = cmd;
+
+		switch (rc) {
+		case 0:
+			rsp.err = ISCSID_UIP_MGMT_IPC_OK;
+			break;
+		case -ENODEV:
+			rsp.err = ISCSID_UIP_MGMT_IPC_ERR_NOT_FOUND;
+			break;
+		case -ENOMEM:
+			rsp.err = ISCSID_UIP_MGMT_IPC_ERR_NOMEM;
+			break;
+		default:
+			rsp.err = ISCSID_UIP_MGMT_IPC_ERR;
+		}
+
 		break;
 	default:
 		LOG_WARN(PFX "Unknown iscsid broadcast command: %x",
@@ -1010,7 +1174,19 @@ int process_iscsid_broadcast(int s2)
 		rc = ferror(fd);
 	}
 
+	/*  The stats follow the response header */
+	if (iface_stats != NULL) {
+		if (fwrite(&nic_stats, sizeof(nic_stats), 1, fd) != 1 ||
+		    fwrite(iface_stats, sizeof(*iface_stats),
+			   nic_stats.num_ifaces, fd) != nic_stats.num_ifaces) {
+			LOG_ERR(PFX "Could not send stats: %d(%s)",
+				errno, strerror(errno));
+			rc = ferror(fd);
+		}
+	}
+
 error:
+	free(iface_stats);
 	free(data);
 	fclose(fd);
 
@@ -960,6 +960,8 @@ int bnx2_write(nic_t *nic, nic_interface_t *nic_iface, packet_t *pkt)
 	/*  bump the bnx2 dev send statistics */
 	nic->stats.tx.packets++;
 	nic->stats.tx.bytes += uip->uip_len;
+	nic_iface->stats.tx.packets++;
+	nic_iface->stats.tx.bytes += uip->uip_len;
 
 	LOG_PACKET(PFX "%s: transmitted %d bytes "
 		   "dev->tx_cons: %d, dev->tx_prod: %d, dev->tx_bseq:%d",
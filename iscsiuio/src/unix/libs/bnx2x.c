@@ -1403,6 +1403,8 @@ int bnx2x_write(nic_t *nic, nic_interface_t *nic_iface, packet_t *pkt)
 	/*  bump the cnic dev send statistics */
 	nic->stats.tx.packets++;
 	nic->stats.tx.bytes += uip->uip_len;
+	nic_iface->stats.tx.packets++;
+	nic_iface->stats.tx.bytes += uip->uip_len;
 
 	LOG_PACKET(PFX "%s: transmitted %d bytes "
 		   "dev->tx_cons: %d, dev->tx_prod: %d, dev->tx_bd_prod:%d",
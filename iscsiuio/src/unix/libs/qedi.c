@@ -945,6 +945,8 @@ int qedi_write(nic_t *nic, nic_interface_t *nic_iface, packet_t *pkt)
 	/* bump up the tx stats */
 	nic->stats.tx.packets++;
 	nic->stats.tx.bytes += uip->uip_len;
+	nic_iface->stats.tx.packets++;
+	nic_iface->stats.tx.bytes += uip->uip_len;
 
 	LOG_PACKET(PFX "%s: transmitted %d bytes dev->tx_cons: %d, dev->tx_prod: %d, dev->tx_bd_prod:%d",
 		   nic->log_name, pkt->buf_size,
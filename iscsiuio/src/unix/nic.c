@@ -431,12 +431,9 @@ nic_t *nic_init()
 
 	pthread_mutex_init(&nic->nl_process_mutex, NULL);
 	pthread_cond_init(&nic->nl_process_if_down_cond, NULL);
-	pthread_cond_init(&nic->nl_process_cond, NULL);
 	nic->nl_process_thread = INVALID_THREAD;
 	nic->nl_process_if_down = 0;
-	nic->nl_process_head = 0;
-	nic->nl_process_tail = 0;
-	memset(&nic->nl_process_ring, 0, sizeof(nic->nl_process_ring));
+	nic->nl_process_efd = INVALID_FD;
 
 	nic->ping_thread = INVALID_THREAD;
 
@@ -525,6 +522,19 @@ int nic_remove(nic_t *nic)
 			  nic->log_name);
 	}
 
+	if (nic->nl_process_efd != INVALID_FD) {
+		close(nic->nl_process_efd);
+		nic->nl_process_efd = INVALID_FD;
+	}
+
+	LOG_INFO(PFX "%s: nl ring: enqueued %llu processed %llu dropped %llu "
+		 "flushed %llu max depth %u", nic->log_name,
+		 (unsigned long long)nic->nl_stats.enqueued,
+		 (unsigned long long)nic->nl_stats.processed,
+		 (unsigned long long)nic->nl_stats.dropped,
+		 (unsigned long long)nic->nl_stats.flushed,
+		 nic->nl_stats.depth_max);
+
 	current = prev = nic_list;
 	while (current != NULL) {
 		if (current == nic)
@@ -814,7 +824,7 @@ void prepare_ipv4_packet(nic_t *nic,
 	u16_t ipaddr[2];
 	arp_table_query_t arp_query;
 	dest_ipv4_addr_t dest_ipv4_addr;
-	struct arp_entry *tabptr;
+	struct uip_ncache_entry *tabptr;
 	int queue_rc;
 	int vlan_id = 0;
 
@@ -836,10 +846,12 @@ void prepare_ipv4_packet(nic_t *nic,
 
 	switch (arp_query) {
 	case IS_IN_ARP_TABLE:
+		nic_iface->stats.arp_hits++;
 		uip_build_eth_header(ustack,
 				     ipaddr, tabptr, pkt, vlan_id);
 		break;
 	case NOT_IN_ARP_TABLE:
+		nic_iface->stats.arp_misses++;
 		queue_rc = nic_queue_tx_packet(nic, nic_iface, pkt);
 		if (queue_rc) {
 			LOG_ERR("could not queue TX packet: %d", queue_rc);
@@ -989,6 +1001,141 @@ static int check_timers(nic_t *nic,
 	return 0;
 }
 
+/*  Hand a received packet to one nic_iface's uIP stack and send whatever
+ *  it generates in response.  Called with nic_mutex locked */
+static void nic_iface_input(nic_t *nic, nic_interface_t *nic_iface,
+			    packet_t *pkt, uint16_t type, uint16_t vlan_id)
+{
+	struct uip_stack *ustack;
+
+	pkt->nic_iface = nic_iface;
+	nic_iface->stats.rx.packets++;
+	nic_iface->stats.rx.bytes += pkt->buf_size;
+	LOG_DEBUG(PFX "%s: found nic iface, type=0x%x, bufsize=%d",
+		  nic->log_name, type, pkt->buf_size);
+
+	ustack = &nic_iface->ustack;
+
+	ustack->uip_buf = pkt->buf;
+	ustack->uip_len = pkt->buf_size;
+	ustack->data_link_layer = pkt->buf;
+
+	/*  Adjust the network layer pointer depending if there is a
+	 *  VLAN tag or not, or if the hardware has stripped out the
+	 *  VLAN tag */
+	if ((vlan_id == 0) ||
+	    (NIC_VLAN_STRIP_ENABLED & nic->flags))
+		ustack->network_layer = ustack->data_link_layer +
+		    sizeof(struct uip_eth_hdr);
+	else
+		ustack->network_layer = ustack->data_link_layer +
+		    sizeof(struct uip_vlan_eth_hdr);
+
+	/*  determine how we should process this packet based on the
+	 *  ethernet type */
+	switch (type) {
+	case UIP_ETHTYPE_IPv6:
+		uip_input(ustack);
+		if (ustack->uip_len > 0) {
+			/* The pkt generated has already consulted
+			   the IPv6 ARP table */
+			pkt->buf_size = ustack->uip_len;
+			prepare_ipv6_packet(nic, nic_iface,
+					    ustack, pkt);
+
+			(*nic->ops->write) (nic, nic_iface, pkt);
+		}
+		break;
+	case UIP_ETHTYPE_IPv4:
+		uip_arp_ipin(ustack, pkt);
+		uip_input(ustack);
+		/* If the above function invocation resulted
+		 * in data that should be sent out on the
+		 * network, the global variable uip_len is
+		 * set to a value > 0. */
+		if (ustack->uip_len > 0) {
+			prepare_ipv4_packet(nic, nic_iface,
+					    ustack, pkt);
+
+			(*nic->ops->write) (nic, nic_iface, pkt);
+		}
+
+		break;
+	case UIP_ETHTYPE_ARP:
+		uip_arp_arpin(nic_iface, ustack, pkt);
+
+		/* If the above function invocation resulted
+		 * in data that should be sent out on the
+		 * network, the global variable uip_len
+		 * is set to a value > 0. */
+		if (pkt->buf_size > 0)
+			(*nic->ops->write) (nic, nic_iface, pkt);
+		break;
+	}
+	ustack->uip_len = 0;
+}
+
+/*  While addresses are being acquired, every nic_iface on the same VLAN
+ *  and protocol shares the NIC's MAC address, so a DHCP or NDP reply
+ *  cannot be told apart by destination.  Give a copy of the packet to
+ *  each of them which is still acquiring, as well as to the nic_iface
+ *  the packet would normally go to, and let their clients keep the
+ *  replies that match their own state.  Returns the number of
+ *  nic_ifaces the packet went to, 0 if none is acquiring.
+ *  Called with nic_mutex locked */
+static int nic_acquiring_input(nic_t *nic, nic_interface_t *def_iface,
+			       packet_t *pkt, int af_type, uint16_t type,
+			       uint16_t vlan_id)
+{
+	nic_interface_t *nic_iface, *vlan_iface;
+	uint8_t *orig = NULL;
+	size_t orig_size = pkt->buf_size;
+	int acquiring = 0;
+	int count = 0;
+
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next) {
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next) {
+			if ((vlan_iface->flags & NIC_IFACE_ACQUIRING) &&
+			    vlan_iface->protocol == af_type &&
+			    vlan_iface->vlan_id == vlan_id)
+				acquiring++;
+		}
+	}
+	if (acquiring == 0)
+		return 0;
+
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next) {
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next) {
+			if (vlan_iface != def_iface &&
+			    (!(vlan_iface->flags & NIC_IFACE_ACQUIRING) ||
+			     vlan_iface->protocol != af_type ||
+			     vlan_iface->vlan_id != vlan_id))
+				continue;
+
+			/*  The stack may build its response in place */
+			if (count == 0) {
+				orig = malloc(orig_size);
+				if (orig == NULL)
+					return 0;
+				memcpy(orig, pkt->buf, orig_size);
+			} else {
+				memcpy(pkt->buf, orig, orig_size);
+				pkt->buf_size = orig_size;
+			}
+
+			nic_iface_input(nic, vlan_iface, pkt, type, vlan_id);
+			count++;
+		}
+	}
+
+	free(orig);
+	return count;
+}
+
 int process_packets(nic_t *nic,
 		    struct timer *periodic_timer,
 		    struct timer *arp_timer, nic_interface_t *nic_iface)
@@ -1010,7 +1157,6 @@ int process_packets(nic_t *nic,
 	if ((rc != 0) && (pkt->buf_size > 0)) {
 		uint16_t type = 0;
 		int af_type = 0;
-		struct uip_stack *ustack;
 		uint16_t vlan_id;
 
 		pkt->data_link_layer = pkt->buf;
@@ -1038,6 +1184,7 @@ int process_packets(nic_t *nic,
 			af_type = AF_INET;
 			break;
 		default:
+			nic->stats.rx_ignored++;
 			LOG_PACKET(PFX "%s: Ignoring vlan:0x%x ethertype:0x%x",
 				   nic->log_name, vlan_id, type);
 			goto done;
@@ -1061,8 +1208,16 @@ int process_packets(nic_t *nic,
 		nic_iface = nic_find_nic_iface(nic, af_type, vlan_id,
 					       IFACE_NUM_INVALID,
 					       IP_CONFIG_OFF);
+
+		if (nic_acquiring_input(nic, nic_iface, pkt, af_type, type,
+					vlan_id)) {
+			pthread_mutex_unlock(&nic->nic_mutex);
+			goto done;
+		}
+
 		if (nic_iface == NULL) {
 			/* Matching nic_iface not found */
+			nic->stats.rx_no_iface++;
 			pthread_mutex_unlock(&nic->nic_mutex);
 			LOG_PACKET(PFX "%s: Couldn't find interface for "
 				   "VLAN: %d af_type %d",
@@ -1071,69 +1226,7 @@ int process_packets(nic_t *nic,
 			goto done;
 		}
 nic_iface_present:
-		pkt->nic_iface = nic_iface;
-		LOG_DEBUG(PFX "%s: found nic iface, type=0x%x, bufsize=%d",
-			  nic->log_name, type, pkt->buf_size);
-
-		ustack = &nic_iface->ustack;
-
-		ustack->uip_buf = pkt->buf;
-		ustack->uip_len = pkt->buf_size;
-		ustack->data_link_layer = pkt->buf;
-
-		/*  Adjust the network layer pointer depending if there is a
-		 *  VLAN tag or not, or if the hardware has stripped out the
-		 *  VLAN tag */
-		if ((vlan_id == 0) ||
-		    (NIC_VLAN_STRIP_ENABLED & nic->flags))
-			ustack->network_layer = ustack->data_link_layer +
-			    sizeof(struct uip_eth_hdr);
-		else
-			ustack->network_layer = ustack->data_link_layer +
-			    sizeof(struct uip_vlan_eth_hdr);
-
-		/*  determine how we should process this packet based on the
-		 *  ethernet type */
-		switch (type) {
-		case UIP_ETHTYPE_IPv6:
-			uip_input(ustack);
-			if (ustack->uip_len > 0) {
-				/* The pkt generated has already consulted
-				   the IPv6 ARP table */
-				pkt->buf_size = ustack->uip_len;
-				prepare_ipv6_packet(nic, nic_iface,
-						    ustack, pkt);
-
-				(*nic->ops->write) (nic, nic_iface, pkt);
-			}
-			break;
-		case UIP_ETHTYPE_IPv4:
-			uip_arp_ipin(ustack, pkt);
-			uip_input(ustack);
-			/* If the above function invocation resulted
-			 * in data that should be sent out on the
-			 * network, the global variable uip_len is
-			 * set to a value > 0. */
-			if (ustack->uip_len > 0) {
-				prepare_ipv4_packet(nic, nic_iface,
-						    ustack, pkt);
-
-				(*nic->ops->write) (nic, nic_iface, pkt);
-			}
-
-			break;
-		case UIP_ETHTYPE_ARP:
-			uip_arp_arpin(nic_iface, ustack, pkt);
-
-			/* If the above function invocation resulted
-			 * in data that should be sent out on the
-			 * network, the global variable uip_len
-			 * is set to a value > 0. */
-			if (pkt->buf_size > 0)
-				(*nic->ops->write) (nic, nic_iface, pkt);
-			break;
-		}
-		ustack->uip_len = 0;
+		nic_iface_input(nic, nic_iface, pkt, type, vlan_id);
 		pthread_mutex_unlock(&nic->nic_mutex);
 	}
 
@@ -1143,105 +1236,107 @@ done:
 	return rc;
 }
 
-static int process_dhcp_loop(nic_t *nic,
-			     nic_interface_t *nic_iface,
-			     struct timer *periodic_timer,
-			     struct timer *arp_timer)
+/*
+ * Address acquisition
+ *
+ * The DHCPv4, DHCPv6 and NDP clients are protothreads driven by the
+ * periodic timer and by incoming packets, so every nic_iface which needs
+ * an address is started first and all of them are then run from a
+ * single loop.  Bring-up is bounded by the slowest nic_iface instead of
+ * the sum of all of their timeouts.
+ */
+static time_t acquisition_timeout(nic_interface_t *nic_iface)
 {
-	struct dhcpc_state *s;
-	struct ndpc_state *n;
-	int rc;
-	struct timeval start_time;
-	struct timeval current_time;
-	struct timeval wait_time;
-	struct timeval total_time;
-
-	/* 10s loop time to wait for DHCP */
 	switch (nic_iface->ustack.ip_config) {
 	case IPV4_CONFIG_DHCP:
-		wait_time.tv_sec = 10;
-		break;
+		return 10;
 	case IPV6_CONFIG_DHCP:
-		wait_time.tv_sec = 15;
-		break;
+		return 15;
 	case IPV6_CONFIG_STATIC:
-		wait_time.tv_sec = 4;
-		break;
+		return 4;
 	default:
-		wait_time.tv_sec = 2;
+		return 2;
 	}
-	wait_time.tv_usec = 0;
+}
 
-	s = nic_iface->ustack.dhcpc;
-	n = nic_iface->ustack.ndpc;
+static int acquisition_done(nic_interface_t *nic_iface)
+{
+	struct dhcpc_state *s = nic_iface->ustack.dhcpc;
+	struct ndpc_state *n = nic_iface->ustack.ndpc;
 
-	if (gettimeofday(&start_time, NULL)) {
-		LOG_ERR(PFX "%s: Couldn't get time of day to start DHCP timer",
-			nic->log_name);
-		return -EIO;
+	switch (nic_iface->ustack.ip_config) {
+	case IPV4_CONFIG_DHCP:
+		return s->state == STATE_CONFIG_RECEIVED;
+	case IPV6_CONFIG_DHCP:
+	case IPV6_CONFIG_STATIC:
+		return n->state == NDPC_STATE_BACKGROUND_LOOP;
+	default:
+		return 1;
 	}
+}
 
-	timeradd(&start_time, &wait_time, &total_time);
-
-	periodic_timer->start = periodic_timer->start -
-	    periodic_timer->interval;
+/* Called with nic_mutex locked */
+static void finish_acquisition(nic_t *nic, nic_interface_t *nic_iface, int rc,
+			       int *cancel_enable)
+{
+	struct in6_addr addr6;
+	char buf[INET6_ADDRSTRLEN];
 
-	while ((event_loop_stop == 0) &&
-	       (nic->flags & NIC_ENABLED) && !(nic->flags & NIC_GOING_DOWN)) {
+	nic_iface->flags &= ~NIC_IFACE_ACQUIRING;
 
-		if (nic_iface->ustack.ip_config == IPV4_CONFIG_DHCP) {
-			if (s->state == STATE_CONFIG_RECEIVED)
-				break;
-		}
-		if (nic_iface->ustack.ip_config == IPV6_CONFIG_DHCP ||
-		    nic_iface->ustack.ip_config == IPV6_CONFIG_STATIC) {
-			if (n->state == NDPC_STATE_BACKGROUND_LOOP)
-				break;
+	switch (nic_iface->ustack.ip_config) {
+	case IPV4_CONFIG_DHCP:
+		if (rc) {
+			LOG_ERR(PFX "%s: DHCP failed", nic->log_name);
+			/* For DHCPv4 failure, the ustack must be cleaned so
+			   it can re-acquire on the next iscsid request */
+			uip_reset(&nic_iface->ustack);
+			*cancel_enable = 1;
+			return;
 		}
 
-		/*  Check the periodic and ARP timer */
-		check_timers(nic, periodic_timer, arp_timer);
-
-		rc = nic_process_intr(nic, 1);
-
-		while ((rc > 0) && (!(nic->flags & NIC_GOING_DOWN))) {
-			rc = process_packets(nic,
-					     periodic_timer,
-					     arp_timer, nic_iface);
-		}
+		LOG_INFO(PFX "%s: Initialized dhcp client", nic->log_name);
+		break;
 
-		if (gettimeofday(&current_time, NULL)) {
-			LOG_ERR(PFX "%s: Couldn't get current time for "
-				"DHCP start", nic->log_name);
-			return -EIO;
+	case IPV6_CONFIG_DHCP:
+	case IPV6_CONFIG_STATIC:
+		if (rc) {
+			/* Don't reset and allow to use RA and LL */
+			LOG_ERR(PFX "%s: IPv6 DHCP/NDP failed", nic->log_name);
 		}
-
-		if (timercmp(&total_time, &current_time, <)) {
-			LOG_ERR(PFX "%s: timeout waiting for DHCP/NDP",
-				nic->log_name);
-			if (nic_iface->ustack.ip_config == IPV6_CONFIG_DHCP ||
-			    nic_iface->ustack.ip_config == IPV6_CONFIG_STATIC)
-				n->retry_count = IPV6_MAX_ROUTER_SOL_RETRY;
-			return -EIO;
+		if (nic_iface->ustack.ip_config == IPV6_CONFIG_STATIC) {
+			memcpy(&addr6.s6_addr, nic_iface->ustack.hostaddr6,
+			       sizeof(addr6.s6_addr));
+			inet_ntop(AF_INET6, addr6.s6_addr, buf, sizeof(buf));
+			LOG_INFO(PFX "%s: hostaddr IP: %s", nic->log_name, buf);
+			memcpy(&addr6.s6_addr, nic_iface->ustack.netmask6,
+			       sizeof(addr6.s6_addr));
+			inet_ntop(AF_INET6, addr6.s6_addr, buf, sizeof(buf));
+			LOG_INFO(PFX "%s: netmask IP: %s", nic->log_name, buf);
 		}
+		break;
 	}
 
-	if (nic->flags & NIC_GOING_DOWN)
-		return -EIO;
-	else if (nic->flags & NIC_DISABLED)
-		return -EINVAL;
-	else
-		return 0;
+	/* Mark acquisition done for this nic iface */
+	nic_iface->flags &= ~NIC_IFACE_ACQUIRE;
+
+	LOG_INFO(PFX "%s: enabled vlan %d protocol: %d", nic->log_name,
+		 nic_iface->vlan_id, nic_iface->protocol);
 }
 
-/* Called with nic_mutex locked */
-static int do_acquisition(nic_t *nic, nic_interface_t *nic_iface,
-			  struct timer *periodic_timer, struct timer *arp_timer)
+/**
+ *  start_acquisition() - Initialize the IP stack of a nic_iface and start
+ *                        its DHCP/NDP engine
+ *  Called with nic_mutex locked
+ *  @return 1 if the engine was started and the nic_iface is now
+ *          NIC_IFACE_ACQUIRING, 0 if the nic_iface is done, <0 on failure
+ */
+static int start_acquisition(nic_t *nic, nic_interface_t *nic_iface,
+			     struct timeval *now)
 {
 	struct in_addr addr;
-	struct in6_addr addr6;
-	char buf[INET6_ADDRSTRLEN];
-	int rc = -1;
+	struct timeval wait_time;
+	int cancel_enable = 0;
 
 	/* New acquisition */
 	uip_init(&nic_iface->ustack, nic->flags & NIC_IPv6_ENABLED);
@@ -1276,7 +1371,7 @@ static int do_acquisition(nic_t *nic, nic_interface_t *nic_iface,
 		set_uip_stack(&nic_iface->ustack,
 			      NULL, NULL, NULL,
 			      nic_iface->mac_addr);
-		break;
+		goto skip;
 
 	case IPV4_CONFIG_DHCP:
 		set_uip_stack(&nic_iface->ustack,
@@ -1291,43 +1386,9 @@ static int do_acquisition(nic_t *nic, nic_interface_t *nic_iface,
 			} else {
 				LOG_DEBUG(PFX "%s: DHCPv4 engine failed "
 					  "initialization!", nic->log_name);
-				goto error;
+				return -EIO;
 			}
 		}
-		pthread_mutex_unlock(&nic->nic_mutex);
-		rc = process_dhcp_loop(nic, nic_iface, periodic_timer,
-				       arp_timer);
-		pthread_mutex_lock(&nic->nic_mutex);
-
-		if (rc) {
-			LOG_ERR(PFX "%s: DHCP failed", nic->log_name);
-			/* For DHCPv4 failure, the ustack must be cleaned so
-			   it can re-acquire on the next iscsid request */
-			uip_reset(&nic_iface->ustack);
-
-			/*  Signal that the device enable is
-			    done */
-			pthread_cond_broadcast(&nic->enable_done_cond);
-			pthread_mutex_unlock(&nic->nic_mutex);
-
-			if (nic->enable_thread == INVALID_THREAD)
-				goto dhcp_err;
-
-			rc = pthread_cancel(nic->enable_thread);
-			if (rc != 0)
-				LOG_ERR(PFX "%s: Couldn't cancel "
-					"enable nic thread", nic->log_name);
-dhcp_err:
-			pthread_mutex_lock(&nic->nic_mutex);
-			goto error;
-		}
-
-		if (nic->flags & NIC_DISABLED) {
-			/* Break out of this loop */
-			break;
-		}
-
-		LOG_INFO(PFX "%s: Initialized dhcp client", nic->log_name);
 		break;
 
 	case IPV6_CONFIG_DHCP:
@@ -1338,42 +1399,169 @@ dhcp_err:
 				  nic->log_name);
 			goto skip;
 		}
-		pthread_mutex_unlock(&nic->nic_mutex);
-		rc = process_dhcp_loop(nic, nic_iface, periodic_timer,
-				       arp_timer);
-		pthread_mutex_lock(&nic->nic_mutex);
-		if (rc) {
-			/* Don't reset and allow to use RA and LL */
-			LOG_ERR(PFX "%s: IPv6 DHCP/NDP failed", nic->log_name);
-		}
-		if (nic_iface->ustack.ip_config == IPV6_CONFIG_STATIC) {
-			memcpy(&addr6.s6_addr, nic_iface->ustack.hostaddr6,
-			       sizeof(addr6.s6_addr));
-			inet_ntop(AF_INET6, addr6.s6_addr, buf, sizeof(buf));
-			LOG_INFO(PFX "%s: hostaddr IP: %s", nic->log_name, buf);
-			memcpy(&addr6.s6_addr, nic_iface->ustack.netmask6,
-			       sizeof(addr6.s6_addr));
-			inet_ntop(AF_INET6, addr6.s6_addr, buf, sizeof(buf));
-			LOG_INFO(PFX "%s: netmask IP: %s", nic->log_name, buf);
-		}
 		break;
 
 	default:
 		LOG_INFO(PFX "%s: ipconfig = %d?", nic->log_name,
 			 nic_iface->ustack.ip_config);
+		goto skip;
 	}
-skip:
-	/* Mark acquisition done for this nic iface */
-	nic_iface->flags &= ~NIC_IFACE_ACQUIRE;
 
-	LOG_INFO(PFX "%s: enabled vlan %d protocol: %d", nic->log_name,
-		 nic_iface->vlan_id, nic_iface->protocol);
+	wait_time.tv_sec = acquisition_timeout(nic_iface);
+	wait_time.tv_usec = 0;
+	timeradd(now, &wait_time, &nic_iface->acquire_deadline);
+	nic_iface->flags |= NIC_IFACE_ACQUIRING;
+
+	return 1;
+
+skip:
+	finish_acquisition(nic, nic_iface, 0, &cancel_enable);
 	return 0;
+}
 
-error:
-	return -EIO;
+/**
+ *  check_acquisitions() - Complete the nic_ifaces whose engine is done or
+ *                         has timed out
+ *  Called with nic_mutex locked
+ *  @return the number of nic_ifaces still acquiring
+ */
+static int check_acquisitions(nic_t *nic, struct timeval *now,
+			      int *cancel_enable)
+{
+	nic_interface_t *nic_iface, *vlan_iface;
+	int pending = 0;
+
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next) {
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next) {
+			struct ndpc_state *n = vlan_iface->ustack.ndpc;
+
+			if (!(vlan_iface->flags & NIC_IFACE_ACQUIRING))
+				continue;
+
+			if (acquisition_done(vlan_iface)) {
+				finish_acquisition(nic, vlan_iface, 0,
+						   cancel_enable);
+				continue;
+			}
+
+			if (timercmp(&vlan_iface->acquire_deadline, now, <)) {
+				LOG_ERR(PFX "%s: timeout waiting for DHCP/NDP "
+					"on VLAN: %d", nic->log_name,
+					vlan_iface->vlan_id);
+				if (vlan_iface->ustack.ip_config ==
+				    IPV6_CONFIG_DHCP ||
+				    vlan_iface->ustack.ip_config ==
+				    IPV6_CONFIG_STATIC)
+					n->retry_count =
+						IPV6_MAX_ROUTER_SOL_RETRY;
+				finish_acquisition(nic, vlan_iface, -EIO,
+						   cancel_enable);
+				continue;
+			}
+
+			pending++;
+		}
+	}
+
+	return pending;
 }
 
+/**
+ *  do_acquisitions() - Acquire addresses on all the nic_ifaces of a NIC
+ *                      which are flagged NIC_IFACE_ACQUIRE, concurrently
+ *  Called with nic_mutex locked, the lock is dropped while packets are
+ *  processed
+ */
+static void do_acquisitions(nic_t *nic, struct timer *periodic_timer,
+			    struct timer *arp_timer)
+{
+	nic_interface_t *nic_iface, *vlan_iface;
+	struct timeval now;
+	int cancel_enable = 0;
+	int pending = 0;
+	int rc;
+
+	if (gettimeofday(&now, NULL)) {
+		LOG_ERR(PFX "%s: Couldn't get time of day to start DHCP timer",
+			nic->log_name);
+		return;
+	}
+
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next) {
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next) {
+			if (!(vlan_iface->flags & NIC_IFACE_ACQUIRE))
+				continue;
+
+			if (start_acquisition(nic, vlan_iface, &now) > 0)
+				pending++;
+		}
+	}
+
+	if (pending == 0)
+		return;
+
+	/*  Kick the engines off right away */
+	periodic_timer->start = periodic_timer->start -
+	    periodic_timer->interval;
+
+	while ((event_loop_stop == 0) &&
+	       (nic->flags & NIC_ENABLED) && !(nic->flags & NIC_GOING_DOWN)) {
+		if (gettimeofday(&now, NULL)) {
+			LOG_ERR(PFX "%s: Couldn't get current time for "
+				"DHCP start", nic->log_name);
+			break;
+		}
+
+		if (check_acquisitions(nic, &now, &cancel_enable) == 0)
+			break;
+
+		pthread_mutex_unlock(&nic->nic_mutex);
+
+		/*  Check the periodic and ARP timer */
+		check_timers(nic, periodic_timer, arp_timer);
+
+		rc = nic_process_intr(nic, 1);
+
+		while ((rc > 0) && (!(nic->flags & NIC_GOING_DOWN))) {
+			rc = process_packets(nic,
+					     periodic_timer,
+					     arp_timer, NULL);
+		}
+
+		pthread_mutex_lock(&nic->nic_mutex);
+	}
+
+	/*  Whatever is left was interrupted by the NIC going away */
+	rc = (nic->flags & NIC_GOING_DOWN) ? -EIO : -EINVAL;
+	for (nic_iface = nic->nic_iface; nic_iface != NULL;
+	     nic_iface = nic_iface->next) {
+		for (vlan_iface = nic_iface; vlan_iface != NULL;
+		     vlan_iface = vlan_iface->vlan_next) {
+			if (vlan_iface->flags & NIC_IFACE_ACQUIRING)
+				finish_acquisition(nic, vlan_iface, rc,
+						   &cancel_enable);
+		}
+	}
+
+	if (cancel_enable) {
+		/*  Signal that the device enable is done */
+		pthread_cond_broadcast(&nic->enable_done_cond);
+		pthread_mutex_unlock(&nic->nic_mutex);
+
+		if (nic->enable_thread != INVALID_THREAD) {
+			rc = pthread_cancel(nic->enable_thread);
+			if (rc != 0)
+				LOG_ERR(PFX "%s: Couldn't cancel "
+					"enable nic thread", nic->log_name);
+		}
+
+		pthread_mutex_lock(&nic->nic_mutex);
+	}
+}
 
 void *nic_loop(void *arg)
 {
@@ -1398,8 +1586,6 @@ void *nic_loop(void *arg)
 	while ((event_loop_stop == 0) &&
 	       !(nic->flags & NIC_EXIT_MAIN_LOOP) &&
 	       !(nic->flags & NIC_GOING_DOWN)) {
-		nic_interface_t *nic_iface, *vlan_iface;
-
 		if (nic->flags & NIC_DISABLED) {
 			LOG_DEBUG(PFX "%s: Waiting to be enabled",
 				  nic->log_name);
@@ -1459,24 +1645,7 @@ void *nic_loop(void *arg)
 		pthread_mutex_lock(&nic->nic_mutex);
 
 		/* If DHCP fails, exit loop and restart the engine */
-		nic_iface = nic->nic_iface;
-		while (nic_iface != NULL) {
-			if (nic_iface->flags & NIC_IFACE_ACQUIRE) {
-				do_acquisition(nic, nic_iface,
-					       &periodic_timer,
-					       &arp_timer);
-			}
-			vlan_iface = nic_iface->vlan_next;
-			while (vlan_iface != NULL) {
-				if (vlan_iface->flags & NIC_IFACE_ACQUIRE) {
-					do_acquisition(nic, vlan_iface,
-						       &periodic_timer,
-						       &arp_timer);
-				}
-				vlan_iface = vlan_iface->next;
-			}
-			nic_iface = nic_iface->next;
-		}
+		do_acquisitions(nic, &periodic_timer, &arp_timer);
 		if (nic->flags & NIC_DISABLED) {
 			LOG_WARN(PFX "%s: nic was disabled during nic loop, "
 				 "closing flag 0x%x",
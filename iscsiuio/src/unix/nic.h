@@ -48,6 +48,8 @@
 #include <linux/limits.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
 
 #include "nic_nl.h"
 #include "packet.h"
@@ -105,6 +107,10 @@ struct pci_device_id {
 struct nic_stats {
 	uint64_t interrupts;
 	uint64_t missed_interrupts;
+	uint64_t rx_no_iface;		/* no nic_iface for the VLAN/protocol */
+	uint64_t rx_ignored;		/* unhandled ethertype */
+	uint64_t pkt_alloc_failures;	/* free packet queue was empty */
+	uint64_t tx_queue_failures;	/* couldn't queue a TX awaiting ARP */
 
 	struct {
 		uint64_t packets;
@@ -117,6 +123,41 @@ struct nic_stats {
 	} rx;
 };
 
+/*  Per nic_iface (VLAN/protocol) counters, the uIP layer counters are kept
+ *  in the nic_iface's ustack */
+struct nic_iface_stats {
+	uint64_t arp_hits;
+	uint64_t arp_misses;
+
+	struct {
+		uint64_t packets;
+		uint64_t bytes;
+	} tx;
+
+	struct {
+		uint64_t packets;
+		uint64_t bytes;
+	} rx;
+};
+
+/*  Netlink messages queued for the NIC specific NL processing thread */
+#define NIC_NL_PROCESS_MAX_RING_SIZE	512	/* must be a power of 2 */
+#define NIC_NL_PROCESS_RING_MASK	(NIC_NL_PROCESS_MAX_RING_SIZE - 1)
+#define NIC_NL_PROCESS_MSG_SIZE		NLMSG_SPACE(sizeof(struct iscsi_uevent) \
+						    + sizeof(struct iscsi_path))
+
+struct nic_nl_msg {
+	char data[NIC_NL_PROCESS_MSG_SIZE];
+} __attribute__ ((aligned(NLMSG_ALIGNTO)));
+
+struct nic_nl_stats {
+	uint64_t enqueued;
+	uint64_t processed;
+	uint64_t dropped;	/* ring was full */
+	uint64_t flushed;	/* discarded by an if_down */
+	uint32_t depth_max;
+};
+
 /******************************************************************************
  * NIC interface structure
  ******************************************************************************/
@@ -133,6 +174,7 @@ typedef struct nic_interface {
 #define NIC_IFACE_PATHREQ_WAIT2 (1<<3)
 #define NIC_IFACE_PATHREQ_WAIT	(NIC_IFACE_PATHREQ_WAIT1 | \
 				 NIC_IFACE_PATHREQ_WAIT2)
+#define NIC_IFACE_ACQUIRING	(1<<4)
 	uint8_t mac_addr[ETH_ALEN];
 	uint8_t vlan_priority;
 	uint16_t vlan_id;
@@ -140,6 +182,9 @@ typedef struct nic_interface {
 
 	uint16_t mtu;
 	time_t start_time;
+	struct timeval acquire_deadline;
+
+	struct nic_iface_stats stats;
 
 	struct uip_stack ustack;
 
@@ -319,18 +364,23 @@ typedef struct nic {
 
 	struct nic_ops *ops;
 
-	/* NL processing parameters */
+	/* NL processing parameters
+	 *
+	 * nl_process_ring is a lockless single producer (the netlink
+	 * listener) single consumer (nl_process_thread) ring.  The head
+	 * is only written by the producer and the tail only by the
+	 * consumer; both are free running and masked on access.  The
+	 * consumer is woken up through the nl_process_efd eventfd. */
 	pthread_t nl_process_thread;
-	pthread_cond_t nl_process_cond;
 	pthread_cond_t nl_process_if_down_cond;
 	pthread_mutex_t nl_process_mutex;
 	int nl_process_if_down;
-	int nl_process_head;
-	int nl_process_tail;
-#define NIC_NL_PROCESS_MAX_RING_SIZE        128
-#define NIC_NL_PROCESS_LAST_ENTRY           (NIC_NL_PROCESS_MAX_RING_SIZE - 1)
-#define NIC_NL_PROCESS_NEXT_ENTRY(x) ((x + 1) & NIC_NL_PROCESS_MAX_RING_SIZE)
-	void *nl_process_ring[NIC_NL_PROCESS_MAX_RING_SIZE];
+	int nl_process_efd;
+	uint32_t nl_process_head;
+	uint32_t nl_process_tail;
+	uint32_t nl_process_flush;	/* entries before this are stale */
+	struct nic_nl_stats nl_stats;
+	struct nic_nl_msg nl_process_ring[NIC_NL_PROCESS_MAX_RING_SIZE];
 
 	/* The thread used to perform ping */
 	pthread_t ping_thread;
@@ -69,6 +69,8 @@
 #define PFX "NIC_NL "
 
 static u8_t nlm_sendbuf[NLM_BUF_DEFAULT_MAX];
+static char nlm_recvbuf[NLM_BUF_DEFAULT_MAX]
+			__attribute__ ((aligned(NLMSG_ALIGNTO)));
 
 static struct sockaddr_nl src_addr;
 
@@ -200,14 +202,15 @@ int __kipc_call(int fd, void *iov_base, int iov_len)
 	return rc;
 }
 
+/*
+ * Read the next netlink message into nlm_recvbuf.  Only the listener
+ * thread reads from the netlink socket, so the buffer is never shared.
+ */
 static int pull_from_nl(char **buf)
 {
 	int rc;
-	size_t ev_size, payload_size, alloc_size;
 	char nlm_ev[NLMSG_SPACE(sizeof(struct iscsi_uevent))];
 	struct nlmsghdr *nlh;
-	char *data = NULL;
-	struct iscsi_uevent *ev;
 
 	/*  Take a quick peek at what how much uIP will need to read */
 	rc = nl_read(nl_sock, nlm_ev,
@@ -231,44 +234,28 @@ static int pull_from_nl(char **buf)
 		return -EINVAL;
 	}
 
-	ev = (struct iscsi_uevent *)NLMSG_DATA(nlh);
-	if (ev->type == ISCSI_KEVENT_PATH_REQ) {
-		ev_size = nlh->nlmsg_len - NLMSG_ALIGN(sizeof(struct nlmsghdr));
-		payload_size = ev_size - sizeof(struct iscsi_uevent);
-		if (payload_size < sizeof(struct iscsi_path))
-			alloc_size = nlh->nlmsg_len + (payload_size -
-				     sizeof(struct iscsi_path));
-		else
-			alloc_size = nlh->nlmsg_len;
-	} else {
-		alloc_size = nlh->nlmsg_len;
-	}
-	data = (char *)malloc(alloc_size);
-	if (unlikely(data == NULL)) {
-		LOG_ERR(PFX "Couldn't allocate %d bytes for Netlink "
-			"iSCSI message", alloc_size);
-		return -ENOMEM;
+	if (unlikely(nlh->nlmsg_len > sizeof(nlm_recvbuf))) {
+		LOG_ERR(PFX "Dropping %d byte Netlink iSCSI message",
+			nlh->nlmsg_len);
+		/*  Consume the datagram, the tail is discarded */
+		nl_read(nl_sock, nlm_recvbuf, sizeof(nlm_recvbuf), 0);
+		return -EMSGSIZE;
 	}
 
-	memset(data, 0, alloc_size);
-	rc = nl_read(nl_sock, data, (int)nlh->nlmsg_len, MSG_WAITALL);
+	/*  A path request may carry a shorter iscsi_path than ours, make
+	 *  sure the missing fields read back as zero */
+	memset(nlm_recvbuf, 0, NIC_NL_PROCESS_MSG_SIZE);
+	rc = nl_read(nl_sock, nlm_recvbuf, (int)nlh->nlmsg_len, MSG_WAITALL);
 	if (rc <= 0) {
 		LOG_ERR("can not read nlm_ev, error %s[%d]",
 			strerror(errno), rc);
 		if (rc == 0)
-			rc = -EIO;
+			return -EIO;
 		else
-			rc = errno;
-
-		goto error;
+			return errno;
 	}
-	*buf = data;
+	*buf = nlm_recvbuf;
 	return 0;
-error:
-	if (data != NULL)
-		free(data);
-
-	return rc;
 }
 
 static const struct timespec ctldev_sleep_req = {
@@ -476,52 +463,96 @@ void *nl_process_handle_thread(void *arg)
 {
 	int rc;
 	nic_t *nic = (nic_t *)arg;
+	uint32_t head, tail, flush;
+	uint64_t events;
 
 	if (nic == NULL)
 		goto error;
 
 	while (!event_loop_stop) {
-		char *data = NULL;
-
-		pthread_mutex_lock(&nic->nl_process_mutex);
-		rc = pthread_cond_wait(&nic->nl_process_cond,
-				       &nic->nl_process_mutex);
-		if (rc != 0) {
-			pthread_mutex_unlock(&nic->nl_process_mutex);
+		rc = read(nic->nl_process_efd, &events, sizeof(events));
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
 			LOG_ERR("Fatal error in NL processing thread "
-				"during wait[%s]", strerror(rc));
+				"during wait[%s]", strerror(errno));
 			break;
 		}
 
-		data = nic->nl_process_ring[nic->nl_process_head];
-		nic->nl_process_ring[nic->nl_process_head] = NULL;
-		nic->nl_process_tail =
-				NIC_NL_PROCESS_NEXT_ENTRY(nic->nl_process_tail);
-
-		pthread_mutex_unlock(&nic->nl_process_mutex);
+		tail = nic->nl_process_tail;
+		head = __atomic_load_n(&nic->nl_process_head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			struct nic_nl_msg *msg;
+
+			msg = &nic->nl_process_ring[tail &
+						    NIC_NL_PROCESS_RING_MASK];
+			flush = __atomic_load_n(&nic->nl_process_flush,
+						__ATOMIC_ACQUIRE);
+			if ((int32_t)(flush - tail) > 0) {
+				nic->nl_stats.flushed++;
+			} else {
+				ctldev_handle(msg->data, nic);
+				nic->nl_stats.processed++;
+			}
 
-		if (data) {
-			ctldev_handle(data, nic);
-			free(data);
+			/*  Hand the slot back to the producer */
+			tail++;
+			__atomic_store_n(&nic->nl_process_tail, tail,
+					 __ATOMIC_RELEASE);
+			head = __atomic_load_n(&nic->nl_process_head,
+					       __ATOMIC_ACQUIRE);
 		}
 	}
 error:
 	return NULL;
 }
 
-static void flush_nic_nl_process_ring(nic_t *nic)
+/*
+ * Copy a message into the NIC specific ring; only ever called from the
+ * netlink listener thread, which is the single producer.
+ */
+static int nic_nl_process_enqueue(nic_t *nic, char *buf)
 {
-	int i;
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	uint32_t head, tail, depth;
+	uint64_t event = 1;
 
-	for (i = 0; i < NIC_NL_PROCESS_MAX_RING_SIZE; i++) {
-		if (nic->nl_process_ring[i] != NULL) {
-			free(nic->nl_process_ring[i]);
-			nic->nl_process_ring[i] = NULL;
-		}
+	if (nlh->nlmsg_len > NIC_NL_PROCESS_MSG_SIZE) {
+		nic->nl_stats.dropped++;
+		return -EMSGSIZE;
+	}
+
+	head = nic->nl_process_head;
+	tail = __atomic_load_n(&nic->nl_process_tail, __ATOMIC_ACQUIRE);
+	depth = head - tail;
+	if (depth >= NIC_NL_PROCESS_MAX_RING_SIZE) {
+		nic->nl_stats.dropped++;
+		return -ENOSPC;
 	}
 
-	nic->nl_process_head = 0;
-	nic->nl_process_tail = 0;
+	memcpy(nic->nl_process_ring[head & NIC_NL_PROCESS_RING_MASK].data,
+	       buf, NIC_NL_PROCESS_MSG_SIZE);
+	__atomic_store_n(&nic->nl_process_head, head + 1, __ATOMIC_RELEASE);
+
+	nic->nl_stats.enqueued++;
+	if (depth + 1 > nic->nl_stats.depth_max)
+		nic->nl_stats.depth_max = depth + 1;
+
+	if (write(nic->nl_process_efd, &event, sizeof(event)) < 0)
+		LOG_ERR(PFX "%s: Couldn't wake NL processing thread [%s]",
+			nic->log_name, strerror(errno));
+
+	return 0;
+}
+
+/*
+ *  Discard everything queued so far; the consumer skips the stale
+ *  entries, so the producer never has to touch the tail.
+ */
+static void flush_nic_nl_process_ring(nic_t *nic)
+{
+	__atomic_store_n(&nic->nl_process_flush, nic->nl_process_head,
+			 __ATOMIC_RELEASE);
 
 	LOG_DEBUG(PFX "%s: Flushed NIC NL ring", nic->log_name);
 }
@@ -649,24 +680,23 @@ int nic_nl_open()
 		}
 
 		/* Place msg into the nic specific queue */
-		pthread_mutex_lock(&nic->nl_process_mutex);
-		if ((nic->nl_process_head + 1 == nic->nl_process_tail) ||
-		    (nic->nl_process_tail == 0 &&
-		     nic->nl_process_head == NIC_NL_PROCESS_LAST_ENTRY)) {
-			pthread_mutex_unlock(&nic->nl_process_mutex);
+		rc = nic_nl_process_enqueue(nic, buf);
+		if (rc == -EMSGSIZE) {
 			pthread_mutex_unlock(&nic_list_mutex);
-			LOG_WARN(PFX "%s: No space on Netlink ring",
-				 nic->log_name);
+			LOG_WARN(PFX "%s: Netlink message of %u bytes is larger "
+				 "than the %zu byte ring slot, dropped",
+				 nic->log_name,
+				 ((struct nlmsghdr *)buf)->nlmsg_len,
+				 (size_t)NIC_NL_PROCESS_MSG_SIZE);
+			continue;
+		} else if (rc != 0) {
+			pthread_mutex_unlock(&nic_list_mutex);
+			LOG_WARN(PFX "%s: No space on Netlink ring, dropped "
+				 "%llu path requests so far", nic->log_name,
+				 (unsigned long long)nic->nl_stats.dropped);
 			continue;
 		}
 
-		nic->nl_process_ring[nic->nl_process_head] = buf;
-		nic->nl_process_head =
-				NIC_NL_PROCESS_NEXT_ENTRY(nic->nl_process_head);
-		pthread_cond_signal(&nic->nl_process_cond);
-
-		pthread_mutex_unlock(&nic->nl_process_mutex);
-
 		pthread_mutex_unlock(&nic_list_mutex);
 
 		LOG_DEBUG(PFX "Pulled nl event");
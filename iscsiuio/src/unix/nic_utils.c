@@ -1343,6 +1343,7 @@ int nic_queue_tx_packet(nic_t *nic,
 	queued_pkt = nic_alloc_packet_buffer(nic, nic_iface,
 					     pkt->buf, pkt->buf_size);
 	if (queued_pkt == NULL) {
+		nic->stats.tx_queue_failures++;
 		LOG_ERR(PFX "%s: Couldn't allocate tx packet to queue",
 			nic->log_name);
 		return -ENOMEM;
@@ -1595,6 +1596,8 @@ packet_t *get_next_free_packet(nic_t *nic)
 	packet_t *pkt;
 	pthread_mutex_lock(&nic->free_packet_queue_mutex);
 	pkt = get_next_packet_in_queue(&nic->free_packet_queue);
+	if (pkt == NULL)
+		nic->stats.pkt_alloc_failures++;
 	pthread_mutex_unlock(&nic->free_packet_queue_mutex);
 
 	if (pkt != NULL)
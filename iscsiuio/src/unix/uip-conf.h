@@ -98,7 +98,7 @@ typedef uint64_t uip_stats_t;
  *
  * \hideinitializer
  */
-#define UIP_CONF_MAX_CONNECTIONS 40
+#define UIP_CONF_MAX_CONNECTIONS 1024
 
 /**
  * Maximum number of listening TCP ports.
@@ -149,6 +149,44 @@ static void iscsi_sw_tcp_data_ready(struct sock *sk, int flag)
 	iscsi_tcp_segment_unmap(&tcp_conn->in.segment);
 }
 
+/*
+ * The recv side suspend bit is checked under sk_callback_lock, so
+ * once we have had it for writing no data_ready is still past it.
+ */
+static void iscsi_sw_tcp_suspend_rx(struct iscsi_conn *conn)
+{
+	struct iscsi_tcp_conn *tcp_conn = conn->dd_data;
+	struct iscsi_sw_tcp_conn *tcp_sw_conn = tcp_conn->dd_data;
+	struct socket *sock = tcp_sw_conn->sock;
+
+	if (!sock)
+		return;
+
+	write_lock_bh(&sock->sk->sk_callback_lock);
+	write_unlock_bh(&sock->sk->sk_callback_lock);
+}
+
+/*
+ * Data that arrived while suspended is still queued on the socket and
+ * the target may send nothing more, so read it now.
+ */
+static void iscsi_sw_tcp_resume_rx(struct iscsi_conn *conn)
+{
+	struct iscsi_tcp_conn *tcp_conn = conn->dd_data;
+	struct iscsi_sw_tcp_conn *tcp_sw_conn = tcp_conn->dd_data;
+	struct socket *sock = tcp_sw_conn->sock;
+
+	if (!sock)
+		return;
+
+	local_bh_disable();
+	bh_lock_sock(sock->sk);
+	if (!sock_owned_by_user(sock->sk))
+		iscsi_sw_tcp_data_ready(sock->sk, 0);
+	bh_unlock_sock(sock->sk);
+	local_bh_enable();
+}
+
 static void iscsi_sw_tcp_state_change(struct sock *sk)
 {
 	struct iscsi_tcp_conn *tcp_conn;
@@ -223,6 +261,9 @@ iscsi_sw_tcp_conn_restore_callbacks(struct iscsi_conn *conn)
 	write_unlock_bh(&sk->sk_callback_lock);
 }
 
+static int iscsi_sw_tcp_send_hdr_done(struct iscsi_tcp_conn *tcp_conn,
+				      struct iscsi_segment *segment);
+
 /**
  * iscsi_sw_tcp_xmit_segment - transmit segment
  * @tcp_conn: the iSCSI TCP connection
@@ -253,7 +294,14 @@ static int iscsi_sw_tcp_xmit_segment(struct iscsi_tcp_conn *tcp_conn,
 		offset = segment->copied;
 		copy = segment->size - offset;
 
-		if (segment->total_copied + segment->size < segment->total_size)
+		/*
+		 * Do not push a header that has data behind it, or the
+		 * tail of a Data-Out that is followed by more of its burst.
+		 */
+		if (segment->total_copied + segment->size < segment->total_size ||
+		    (segment->done == iscsi_sw_tcp_send_hdr_done &&
+		     tcp_sw_conn->out.data_segment.total_size) ||
+		    tcp_sw_conn->out.more)
 			flags |= MSG_MORE;
 
 		/* Use sendpage if we can; else fall back to sendmsg */
@@ -273,6 +321,8 @@ static int iscsi_sw_tcp_xmit_segment(struct iscsi_tcp_conn *tcp_conn,
 		}
 
 		if (r < 0) {
+			if (r == -EAGAIN)
+				tcp_sw_conn->sndbuf_full_cnt++;
 			iscsi_tcp_segment_unmap(segment);
 			return r;
 		}
@@ -346,8 +396,17 @@ static inline int iscsi_sw_tcp_xmit_qlen(struct iscsi_conn *conn)
 static int iscsi_sw_tcp_pdu_xmit(struct iscsi_task *task)
 {
 	struct iscsi_conn *conn = task->conn;
+	struct iscsi_tcp_conn *tcp_conn = conn->dd_data;
+	struct iscsi_sw_tcp_conn *tcp_sw_conn = tcp_conn->dd_data;
 	int rc;
 
+	if (task->sc) {
+		struct iscsi_tcp_task *tcp_task = task->dd_data;
+
+		tcp_sw_conn->out.more = tcp_task->dout_more;
+	} else
+		tcp_sw_conn->out.more = 0;
+
 	while (iscsi_sw_tcp_xmit_qlen(conn)) {
 		rc = iscsi_sw_tcp_xmit(conn);
 		if (rc == 0)
@@ -789,13 +848,16 @@ iscsi_sw_tcp_conn_get_stats(struct iscsi_cls_conn *cls_conn,
 	struct iscsi_tcp_conn *tcp_conn = conn->dd_data;
 	struct iscsi_sw_tcp_conn *tcp_sw_conn = tcp_conn->dd_data;
 
-	stats->custom_length = 3;
+	stats->custom_length = 4;
 	strcpy(stats->custom[0].desc, "tx_sendpage_failures");
 	stats->custom[0].value = tcp_sw_conn->sendpage_failures_cnt;
 	strcpy(stats->custom[1].desc, "rx_discontiguous_hdr");
 	stats->custom[1].value = tcp_sw_conn->discontiguous_hdr_cnt;
 	strcpy(stats->custom[2].desc, "eh_abort_cnt");
 	stats->custom[2].value = conn->eh_abort_cnt;
+	strcpy(stats->custom[3].desc, "tx_sndbuf_full");
+	stats->custom[3].value = tcp_sw_conn->sndbuf_full_cnt;
+	iscsi_add_custom_stats(conn, stats);
 
 	iscsi_tcp_conn_get_stats(cls_conn, stats);
 }
@@ -921,7 +983,8 @@ static struct iscsi_transport iscsi_sw_tcp_transport = {
 				  ISCSI_FAST_ABORT | ISCSI_ABORT_TMO |
 				  ISCSI_LU_RESET_TMO | ISCSI_TGT_RESET_TMO |
 				  ISCSI_PING_TMO | ISCSI_RECV_TMO |
-				  ISCSI_IFACE_NAME | ISCSI_INITIATOR_NAME,
+				  ISCSI_IFACE_NAME | ISCSI_INITIATOR_NAME |
+				  ISCSI_CMDSN,
 	.host_param_mask	= ISCSI_HOST_HWADDRESS | ISCSI_HOST_IPADDRESS |
 				  ISCSI_HOST_INITIATOR_NAME |
 				  ISCSI_HOST_NETDEV_NAME,
@@ -951,6 +1014,8 @@ static struct iscsi_transport iscsi_sw_tcp_transport = {
 	.xmit_pdu		= iscsi_sw_tcp_pdu_xmit,
 	.init_pdu		= iscsi_sw_tcp_pdu_init,
 	.alloc_pdu		= iscsi_sw_tcp_pdu_alloc,
+	.suspend_rx		= iscsi_sw_tcp_suspend_rx,
+	.resume_rx		= iscsi_sw_tcp_resume_rx,
 	/* recovery */
 	.session_recovery_timedout = iscsi_session_recovery_timedout,
 };
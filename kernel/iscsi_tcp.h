@@ -33,6 +33,7 @@ struct iscsi_sw_tcp_send {
 	struct iscsi_hdr	*hdr;
 	struct iscsi_segment	segment;
 	struct iscsi_segment	data_segment;
+	int			more;		/* another pdu follows */
 };
 
 struct iscsi_sw_tcp_conn {
@@ -51,6 +52,7 @@ struct iscsi_sw_tcp_conn {
 	/* MIB custom statistics */
 	uint32_t		sendpage_failures_cnt;
 	uint32_t		discontiguous_hdr_cnt;
+	uint32_t		sndbuf_full_cnt;
 
 	ssize_t (*sendpage)(struct socket *, struct page *, int, size_t, int);
 };
@@ -60,6 +60,16 @@ MODULE_PARM_DESC(debug_libiscsi_eh,
 		 "Turn on debugging for error handling in libiscsi module. "
 		 "Set to 1 to turn on, and zero to turn off. Default is off.");
 
+static int iscsi_qdepth_ctl;
+module_param_named(qdepth_ctl, iscsi_qdepth_ctl, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(qdepth_ctl,
+		 "Adapt LUN queue depths to the target's CmdSN window and "
+		 "command latency. Set to 1 to turn on, and zero to turn off. "
+		 "Default is off.");
+
+/* how often the queue depth controller may adjust a session's LUNs */
+#define ISCSI_QDEPTH_CTL_INTERVAL	(HZ / 10)
+
 #define ISCSI_DBG_CONN(_conn, dbg_fmt, arg...)			\
 	do {							\
 		if (iscsi_dbg_lib_conn)				\
@@ -105,11 +115,68 @@ inline void iscsi_conn_queue_work(struct iscsi_conn *conn)
 	struct Scsi_Host *shost = conn->session->host;
 	struct iscsi_host *ihost = shost_priv(shost);
 
-	if (ihost->workq)
+	if (conn->workq)
+		queue_work(conn->workq, &conn->xmitwork);
+	else if (ihost->workq)
 		queue_work(ihost->workq, &conn->xmitwork);
 }
 EXPORT_SYMBOL_GPL(iscsi_conn_queue_work);
 
+/*
+ * Started connections are kept in session->conns. A command submitted
+ * on cpu N is sent on conns[N % nr_conns]. The leading connection's
+ * xmit work runs from the host's single threaded workqueue and each of
+ * the others has one of its own, so a connection's xmit work never runs
+ * on two cpus at once and the connections of a session are sent on in
+ * parallel. Session lock must be held.
+ */
+static void iscsi_session_add_conn(struct iscsi_session *session,
+				   struct iscsi_conn *conn)
+{
+	int i;
+
+	for (i = 0; i < session->nr_conns; i++)
+		if (session->conns[i] == conn)
+			return;
+
+	if (session->nr_conns == ISCSI_MAX_CONNS) {
+		iscsi_conn_printk(KERN_ERR, conn, "session already has %d "
+				  "connections. Not using for commands.\n",
+				  ISCSI_MAX_CONNS);
+		return;
+	}
+	session->conns[session->nr_conns++] = conn;
+}
+
+static void iscsi_session_del_conn(struct iscsi_session *session,
+				   struct iscsi_conn *conn)
+{
+	int i;
+
+	for (i = 0; i < session->nr_conns; i++) {
+		if (session->conns[i] != conn)
+			continue;
+
+		session->nr_conns--;
+		memmove(&session->conns[i], &session->conns[i + 1],
+			(session->nr_conns - i) * sizeof(conn));
+		return;
+	}
+}
+
+static struct iscsi_conn *iscsi_select_conn(struct iscsi_session *session)
+{
+	struct iscsi_conn *conn;
+
+	if (session->nr_conns <= 1)
+		return session->leadconn;
+
+	conn = session->conns[smp_processor_id() % session->nr_conns];
+	if (test_bit(ISCSI_SUSPEND_BIT, &conn->suspend_tx))
+		return session->leadconn;
+	return conn;
+}
+
 static void __iscsi_update_cmdsn(struct iscsi_session *session,
 				 uint32_t exp_cmdsn, uint32_t max_cmdsn)
 {
@@ -126,14 +193,27 @@ static void __iscsi_update_cmdsn(struct iscsi_session *session,
 
 	if (max_cmdsn != session->max_cmdsn &&
 	    !iscsi_sna_lt(max_cmdsn, session->max_cmdsn)) {
+		struct iscsi_conn *conn;
+		int i;
+
 		session->max_cmdsn = max_cmdsn;
 		/*
 		 * if the window closed with IO queued, then kick the
-		 * xmit thread
+		 * xmit threads
 		 */
 		if (!list_empty(&session->leadconn->cmdqueue) ||
 		    !list_empty(&session->leadconn->mgmtqueue))
 			iscsi_conn_queue_work(session->leadconn);
+
+		for (i = 0; i < session->nr_conns; i++) {
+			conn = session->conns[i];
+			if (conn == session->leadconn)
+				continue;
+
+			if (!list_empty(&conn->cmdqueue) ||
+			    !list_empty(&conn->mgmtqueue))
+				iscsi_conn_queue_work(conn);
+		}
 	}
 }
 
@@ -477,6 +557,9 @@ static int iscsi_prep_scsi_cmd_pdu(struct iscsi_task *task)
 		return -EIO;
 
 	task->state = ISCSI_TASK_RUNNING;
+	list_add_tail(&task->inflight, &session->inflight);
+	if (iscsi_qdepth_ctl)
+		task->sent = ktime_get();
 	session->cmdsn++;
 
 	conn->scsicmd_pdus_cnt++;
@@ -555,6 +638,174 @@ void iscsi_put_task(struct iscsi_task *task)
 }
 EXPORT_SYMBOL_GPL(iscsi_put_task);
 
+/*
+ * Must be called with session lock. Runs the controller at most every
+ * ISCSI_QDEPTH_CTL_INTERVAL; it cannot adjust queue depths from here
+ * because the block layer takes its queue lock before the host lock.
+ */
+static void iscsi_qdepth_ctl_kick(struct iscsi_session *session)
+{
+	if (time_before(jiffies, session->qd_last + ISCSI_QDEPTH_CTL_INTERVAL))
+		return;
+	session->qd_last = jiffies;
+	schedule_work(&session->qd_work);
+}
+
+/*
+ * Must be called with session lock.
+ */
+static void iscsi_qdepth_ctl_sample(struct iscsi_task *task)
+{
+	struct iscsi_session *session = task->conn->session;
+	unsigned lat;
+
+	lat = ktime_us_delta(ktime_get(), task->sent);
+	/* same 1/8 gain TCP uses for its srtt */
+	if (!session->qd_lat)
+		session->qd_lat = lat;
+	else
+		session->qd_lat = session->qd_lat - (session->qd_lat >> 3) +
+				  (lat >> 3);
+	if (!session->qd_lat_min || lat < session->qd_lat_min)
+		session->qd_lat_min = lat;
+	iscsi_qdepth_ctl_kick(session);
+}
+
+/*
+ * AIMD over the session's LUNs: halve the depth when the target closed
+ * the CmdSN window on us or latency went over twice its baseline, else
+ * give a LUN that is using all of its depth one more, up to the depth
+ * the session was created with.
+ */
+static void iscsi_qdepth_ctl_work(struct work_struct *work)
+{
+	struct iscsi_session *session =
+		container_of(work, struct iscsi_session, qd_work);
+	struct iscsi_cls_session *cls_session = session->cls_session;
+	struct Scsi_Host *shost = session->host;
+	struct scsi_device *sdev;
+	int congested, depth;
+
+	spin_lock_bh(&session->lock);
+	if (session->state != ISCSI_STATE_LOGGED_IN) {
+		spin_unlock_bh(&session->lock);
+		return;
+	}
+	congested = session->qd_closed ||
+		    session->qd_lat > 2 * session->qd_lat_min;
+	session->qd_closed = 0;
+	/* let the baseline follow the target as its load changes */
+	session->qd_lat_min += (session->qd_lat_min >> 6) + 1;
+	spin_unlock_bh(&session->lock);
+
+	shost_for_each_device(sdev, shost) {
+		if (starget_to_session(scsi_target(sdev)) != cls_session)
+			continue;
+
+		depth = sdev->queue_depth;
+		if (congested)
+			depth = max(depth >> 1, 1);
+		else if (sdev->device_busy >= sdev->queue_depth &&
+			 depth < shost->cmd_per_lun)
+			depth++;
+
+		if (depth != sdev->queue_depth) {
+			ISCSI_DBG_SESSION(session, "lun %d queue depth %d -> "
+					  "%d lat %uus min %uus\n", sdev->lun,
+					  sdev->queue_depth, depth,
+					  session->qd_lat, session->qd_lat_min);
+			scsi_adjust_queue_depth(sdev, scsi_get_tag_type(sdev),
+						depth);
+		}
+	}
+}
+
+/*
+ * Make room in a full xfer_marks. Only the last step below the oldest
+ * inflight task can still be looked up, so older ones are dropped. If
+ * that is not enough the two oldest steps are merged, which can only
+ * make a task think the ones ahead of it moved, never the reverse.
+ */
+static int iscsi_xfer_marks_compact(struct iscsi_session *session, int cnt)
+{
+	struct iscsi_xfer_mark *marks = session->xfer_marks;
+	struct iscsi_task *oldest;
+	uint32_t oldest_sn;
+	int drop = 0;
+
+	oldest = list_first_entry(&session->inflight, struct iscsi_task,
+				  inflight);
+	oldest_sn = be32_to_cpu(oldest->cmdsn);
+	while (drop + 1 < cnt && iscsi_sna_lt(marks[drop + 1].cmdsn,
+					      oldest_sn))
+		drop++;
+
+	if (!drop) {
+		marks[1].cmdsn = marks[0].cmdsn;
+		drop = 1;
+	}
+	cnt -= drop;
+	memmove(marks, marks + drop, cnt * sizeof(*marks));
+	return cnt;
+}
+
+/**
+ * iscsi_task_xfer - note that a task transferred data
+ * @task: iscsi cmd task
+ *
+ * Every task sent after this one has now seen progress on a task ahead
+ * of it, so the steps for them are replaced by one for this task.
+ *
+ * Must be called with session lock.
+ */
+void iscsi_task_xfer(struct iscsi_task *task)
+{
+	struct iscsi_session *session = task->conn->session;
+	struct iscsi_xfer_mark *marks = session->xfer_marks;
+	int cnt = session->xfer_marks_cnt;
+	uint32_t cmdsn;
+
+	task->last_xfer = jiffies;
+	if (list_empty(&task->inflight))
+		return;
+
+	cmdsn = be32_to_cpu(task->cmdsn);
+	while (cnt && iscsi_sna_lte(cmdsn, marks[cnt - 1].cmdsn))
+		cnt--;
+	if (cnt == session->cmds_max)
+		cnt = iscsi_xfer_marks_compact(session, cnt);
+
+	marks[cnt].cmdsn = cmdsn;
+	marks[cnt].jiffies = task->last_xfer;
+	session->xfer_marks_cnt = cnt + 1;
+}
+EXPORT_SYMBOL_GPL(iscsi_task_xfer);
+
+/*
+ * Find when a task sent before @task last transferred data. Returns 0
+ * if none has since the inflight list last drained.
+ */
+static int iscsi_older_xfer(struct iscsi_session *session,
+			    struct iscsi_task *task, unsigned long *when)
+{
+	struct iscsi_xfer_mark *marks = session->xfer_marks;
+	uint32_t cmdsn = be32_to_cpu(task->cmdsn);
+	int lo = 0, hi = session->xfer_marks_cnt, mid;
+
+	/* the last step below cmdsn */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (iscsi_sna_lt(marks[mid].cmdsn, cmdsn))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return 0;
+	*when = marks[lo - 1].jiffies;
+	return 1;
+}
+
 /**
  * iscsi_complete_task - finish a task
  * @task: iscsi cmd task
@@ -574,11 +825,22 @@ static void iscsi_complete_task(struct iscsi_task *task, int state)
 	    task->state == ISCSI_TASK_ABRT_SESS_RECOV)
 		return;
 	WARN_ON_ONCE(task->state == ISCSI_TASK_FREE);
+	/* sent is not set if the controller was turned on since queueing */
+	if (iscsi_qdepth_ctl && task->sc && state == ISCSI_TASK_COMPLETED &&
+	    ktime_to_ns(task->sent))
+		iscsi_qdepth_ctl_sample(task);
 	task->state = state;
 
 	if (!list_empty(&task->running))
 		list_del_init(&task->running);
 
+	if (!list_empty(&task->inflight)) {
+		list_del_init(&task->inflight);
+		/* nothing left for the marks to be looked up for */
+		if (list_empty(&conn->session->inflight))
+			conn->session->xfer_marks_cnt = 0;
+	}
+
 	if (conn->task == task)
 		conn->task = NULL;
 
@@ -952,6 +1214,32 @@ static void iscsi_tmf_rsp(struct iscsi_conn *conn, struct iscsi_hdr *hdr)
 	wake_up(&conn->ehwait);
 }
 
+/*
+ * The transport timeouts are in seconds, so the timers of the conns on
+ * the box are batched into ISCSI_TRANSPORT_TIMER_SLOTS wakeups a second
+ * instead of waking the cpu up for each of them. Conns are spread over
+ * the slots by session and conn id, so their pings do not all go out
+ * at once either.
+ */
+#define ISCSI_TRANSPORT_TIMER_SLOTS	8
+
+static void iscsi_mod_transport_timer(struct iscsi_conn *conn,
+				      unsigned long expires)
+{
+	struct iscsi_cls_session *cls_session = conn->session->cls_session;
+	unsigned int slot;
+
+	/*
+	 * sids are handed out in order, so single conn sessions (cid 0)
+	 * take the slots in turn and a session's conns sit side by side.
+	 */
+	slot = (cls_session->sid + conn->cls_conn->cid) %
+		ISCSI_TRANSPORT_TIMER_SLOTS;
+	expires = round_jiffies_up(expires) +
+		  slot * (HZ / ISCSI_TRANSPORT_TIMER_SLOTS);
+	mod_timer(&conn->transport_timer, expires);
+}
+
 static void iscsi_send_nopout(struct iscsi_conn *conn, struct iscsi_nopin *rhdr)
 {
         struct iscsi_nopout hdr;
@@ -972,9 +1260,13 @@ static void iscsi_send_nopout(struct iscsi_conn *conn, struct iscsi_nopin *rhdr)
 		hdr.ttt = RESERVED_ITT;
 
 	task = __iscsi_conn_send_pdu(conn, (struct iscsi_hdr *)&hdr, NULL, 0);
-	if (!task)
+	if (!task) {
 		iscsi_conn_printk(KERN_ERR, conn, "Could not send nopout\n");
-	else if (!rhdr) {
+		return;
+	}
+
+	conn->noptx_pdus_cnt++;
+	if (!rhdr) {
 		/* only track our nops */
 		conn->ping_task = task;
 		conn->last_ping = jiffies;
@@ -996,7 +1288,8 @@ static int iscsi_nop_out_rsp(struct iscsi_task *task,
 				   data, datalen))
 			rc = ISCSI_ERR_CONN_FAILED;
 	} else
-		mod_timer(&conn->transport_timer, jiffies + conn->recv_timeout);
+		iscsi_mod_transport_timer(conn, jiffies +
+					  (conn->recv_timeout * HZ));
 	iscsi_complete_task(task, ISCSI_TASK_COMPLETED);
 	return rc;
 }
@@ -1145,6 +1438,7 @@ int __iscsi_complete_pdu(struct iscsi_conn *conn, struct iscsi_hdr *hdr,
 
 		switch(opcode) {
 		case ISCSI_OP_NOOP_IN:
+			conn->noprx_pdus_cnt++;
 			if (datalen) {
 				rc = ISCSI_ERR_PROTO;
 				break;
@@ -1176,7 +1470,7 @@ int __iscsi_complete_pdu(struct iscsi_conn *conn, struct iscsi_hdr *hdr,
 		task = iscsi_itt_to_ctask(conn, hdr->itt);
 		if (!task)
 			return ISCSI_ERR_BAD_ITT;
-		task->last_xfer = jiffies;
+		iscsi_task_xfer(task);
 		break;
 	case ISCSI_OP_R2T:
 		/*
@@ -1230,6 +1524,7 @@ int __iscsi_complete_pdu(struct iscsi_conn *conn, struct iscsi_hdr *hdr,
 		iscsi_complete_task(task, ISCSI_TASK_COMPLETED);
 		break;
 	case ISCSI_OP_NOOP_IN:
+		conn->noprx_pdus_cnt++;
 		iscsi_update_cmdsn(session, (struct iscsi_nopin*)hdr);
 		if (hdr->ttt != cpu_to_be32(ISCSI_RESERVED_TAG) || datalen) {
 			rc = ISCSI_ERR_PROTO;
@@ -1372,7 +1667,12 @@ void iscsi_conn_failure(struct iscsi_conn *conn, enum iscsi_err err)
 		return;
 	}
 
-	if (conn->stop_stage == 0)
+	/*
+	 * a non-leading conn failing before it was started is just
+	 * dropped by userspace, the session is fine.
+	 */
+	if (conn->stop_stage == 0 &&
+	    (conn == session->leadconn || conn->c_stage == ISCSI_CONN_STARTED))
 		session->state = ISCSI_STATE_FAILED;
 	spin_unlock_irqrestore(&session->lock, flags);
 
@@ -1413,7 +1713,7 @@ static int iscsi_xmit_task(struct iscsi_conn *conn)
 	spin_lock_bh(&conn->session->lock);
 	if (!rc) {
 		/* done with this task */
-		task->last_xfer = jiffies;
+		iscsi_task_xfer(task);
 		conn->task = NULL;
 	}
 	__iscsi_put_task(task);
@@ -1582,7 +1882,9 @@ static inline struct iscsi_task *iscsi_alloc_task(struct iscsi_conn *conn,
 	task->have_checked_conn = 0;
 	task->last_timeout = jiffies;
 	task->last_xfer = jiffies;
+	task->sent = ktime_set(0, 0);
 	INIT_LIST_HEAD(&task->running);
+	INIT_LIST_HEAD(&task->inflight);
 	return task;
 }
 
@@ -1659,13 +1961,13 @@ int iscsi_queuecommand(struct scsi_cmnd *sc, void (*done)(struct scsi_cmnd *))
 		goto fault;
 	}
 
-	conn = session->leadconn;
-	if (!conn) {
+	if (!session->leadconn) {
 		reason = FAILURE_SESSION_FREED;
 		sc->result = DID_NO_CONNECT << 16;
 		goto fault;
 	}
 
+	conn = iscsi_select_conn(session);
 	if (test_bit(ISCSI_SUSPEND_BIT, &conn->suspend_tx)) {
 		reason = FAILURE_SESSION_IN_RECOVERY;
 		sc->result = DID_REQUEUE;
@@ -1673,12 +1975,18 @@ int iscsi_queuecommand(struct scsi_cmnd *sc, void (*done)(struct scsi_cmnd *))
 	}
 
 	if (iscsi_check_cmdsn_window_closed(conn)) {
+		conn->cmdsn_closed_cnt++;
+		if (iscsi_qdepth_ctl) {
+			session->qd_closed++;
+			iscsi_qdepth_ctl_kick(session);
+		}
 		reason = FAILURE_WINDOW_CLOSED;
 		goto reject;
 	}
 
 	task = iscsi_alloc_task(conn, sc);
 	if (!task) {
+		conn->cmdpool_empty_cnt++;
 		reason = FAILURE_OOM;
 		goto reject;
 	}
@@ -1836,7 +2144,8 @@ static int iscsi_exec_task_mgmt_fn(struct iscsi_conn *conn,
 
 /*
  * Fail commands. session lock held and recv side suspended and xmit
- * thread flushed
+ * thread flushed. For the leading connection this is every command in
+ * the session, for the others only the commands sent on that connection.
  */
 static void fail_scsi_tasks(struct iscsi_conn *conn, unsigned lun,
 			    int error)
@@ -1849,6 +2158,9 @@ static void fail_scsi_tasks(struct iscsi_conn *conn, unsigned lun,
 		if (!task->sc || task->state == ISCSI_TASK_FREE)
 			continue;
 
+		if (conn != conn->session->leadconn && task->conn != conn)
+			continue;
+
 		if (lun != -1 && lun != task->sc->device->lun)
 			continue;
 
@@ -1892,7 +2204,9 @@ void iscsi_suspend_tx(struct iscsi_conn *conn)
 	struct iscsi_host *ihost = shost_priv(shost);
 
 	set_bit(ISCSI_SUSPEND_BIT, &conn->suspend_tx);
-	if (ihost->workq)
+	if (conn->workq)
+		flush_workqueue(conn->workq);
+	else if (ihost->workq)
 		flush_workqueue(ihost->workq);
 }
 EXPORT_SYMBOL_GPL(iscsi_suspend_tx);
@@ -1903,6 +2217,58 @@ static void iscsi_start_tx(struct iscsi_conn *conn)
 	iscsi_conn_queue_work(conn);
 }
 
+/*
+ * The transport's suspend_rx waits for a recv already past the
+ * suspend check, and its resume_rx picks up what arrived meanwhile.
+ */
+static void iscsi_suspend_rx(struct iscsi_conn *conn)
+{
+	set_bit(ISCSI_EH_SUSPEND_BIT, &conn->suspend_rx);
+	if (conn->session->tt->suspend_rx)
+		conn->session->tt->suspend_rx(conn);
+}
+
+static void iscsi_start_rx(struct iscsi_conn *conn)
+{
+	clear_bit(ISCSI_EH_SUSPEND_BIT, &conn->suspend_rx);
+	if (conn->session->tt->resume_rx)
+		conn->session->tt->resume_rx(conn);
+}
+
+/*
+ * A LU or target reset fails tasks sent on any of the session's
+ * connections, so all of them stop sending and receiving first. The
+ * caller holds the eh_mutex, so none of them can be stopped and
+ * removed before iscsi_start_session_conns.
+ */
+static int iscsi_suspend_session_conns(struct iscsi_session *session,
+				       struct iscsi_conn **conns)
+{
+	int i, nr_conns;
+
+	spin_lock_bh(&session->lock);
+	nr_conns = session->nr_conns;
+	memcpy(conns, session->conns, nr_conns * sizeof(*conns));
+	spin_unlock_bh(&session->lock);
+
+	for (i = 0; i < nr_conns; i++) {
+		iscsi_suspend_rx(conns[i]);
+		iscsi_suspend_tx(conns[i]);
+	}
+	return nr_conns;
+}
+
+static void iscsi_start_session_conns(struct iscsi_conn **conns,
+				      int nr_conns)
+{
+	int i;
+
+	for (i = 0; i < nr_conns; i++) {
+		iscsi_start_rx(conns[i]);
+		iscsi_start_tx(conns[i]);
+	}
+}
+
 /*
  * We want to make sure a ping is in flight. It has timed out.
  * And we are not busy processing a pdu that is making
@@ -1922,11 +2288,11 @@ static int iscsi_has_ping_timed_out(struct iscsi_conn *conn)
 static enum blk_eh_timer_return iscsi_eh_cmd_timed_out(struct scsi_cmnd *sc)
 {
 	enum blk_eh_timer_return rc = BLK_EH_NOT_HANDLED;
-	struct iscsi_task *task = NULL, *running_task;
+	struct iscsi_task *task = NULL;
 	struct iscsi_cls_session *cls_session;
 	struct iscsi_session *session;
 	struct iscsi_conn *conn;
-	int i;
+	unsigned long last_xfer;
 
 	cls_session = starget_to_session(scsi_target(sc->device));
 	session = cls_session->dd_data;
@@ -1959,6 +2325,8 @@ static enum blk_eh_timer_return iscsi_eh_cmd_timed_out(struct scsi_cmnd *sc)
 		rc = BLK_EH_RESET_TIMER;
 		goto done;
 	}
+	/* check the connection the command was sent on */
+	conn = task->conn;
 
 	/*
 	 * If we have sent (at least queued to the network layer) a pdu or
@@ -1988,41 +2356,30 @@ static enum blk_eh_timer_return iscsi_eh_cmd_timed_out(struct scsi_cmnd *sc)
 		goto done;
 	}
 
-	for (i = 0; i < conn->session->cmds_max; i++) {
-		running_task = conn->session->cmds[i];
-		if (!running_task->sc || running_task == task ||
-		     running_task->state != ISCSI_TASK_RUNNING)
-			continue;
-
+	/*
+	 * Only check if cmds started before this one have made
+	 * progress, or this could never fail
+	 */
+	if (iscsi_older_xfer(session, task, &last_xfer) &&
+	    time_after(last_xfer, task->last_timeout)) {
 		/*
-		 * Only check if cmds started before this one have made
-		 * progress, or this could never fail
+		 * This task has not made progress, but a task
+		 * started before us has transferred data since
+		 * we started/last-checked. We could be queueing
+		 * too many tasks or the LU is bad.
+		 *
+		 * If the device is bad the cmds ahead of us on
+		 * other devs will complete, and this check will
+		 * eventually fail starting the scsi eh.
 		 */
-		if (time_after(running_task->sc->jiffies_at_alloc,
-			       task->sc->jiffies_at_alloc))
-			continue;
-
-		if (time_after(running_task->last_xfer, task->last_timeout)) {
-			/*
-			 * This task has not made progress, but a task
-			 * started before us has transferred data since
-			 * we started/last-checked. We could be queueing
-			 * too many tasks or the LU is bad.
-			 *
-			 * If the device is bad the cmds ahead of us on
-			 * other devs will complete, and this loop will
-			 * eventually fail starting the scsi eh.
-			 */
-			ISCSI_DBG_EH(session, "Command has not made progress "
-				     "but commands ahead of it have. "
-				     "Asking scsi-ml for more time to "
-				     "complete. Our last xfer vs running task "
-				     "last xfer %lu/%lu. Last check %lu.\n",
-				     task->last_xfer, running_task->last_xfer,
-				     task->last_timeout);
-			rc = BLK_EH_RESET_TIMER;
-			goto done;
-		}
+		ISCSI_DBG_EH(session, "Command has not made progress "
+			     "but commands ahead of it have. "
+			     "Asking scsi-ml for more time to "
+			     "complete. Our last xfer vs older tasks "
+			     "last xfer %lu/%lu. Last check %lu.\n",
+			     task->last_xfer, last_xfer, task->last_timeout);
+		rc = BLK_EH_RESET_TIMER;
+		goto done;
 	}
 
 	/* Assumes nop timeout is shorter than scsi cmd timeout */
@@ -2076,6 +2433,7 @@ static void iscsi_check_transport_timeouts(unsigned long data)
 				  "last ping %lu, now %lu\n",
 				  conn->ping_timeout, conn->recv_timeout,
 				  last_recv, conn->last_ping, jiffies);
+		conn->timeout_err_cnt++;
 		spin_unlock(&session->lock);
 		iscsi_conn_failure(conn, ISCSI_ERR_CONN_FAILED);
 		return;
@@ -2090,7 +2448,7 @@ static void iscsi_check_transport_timeouts(unsigned long data)
 		next_timeout = last_recv + recv_timeout;
 
 	ISCSI_DBG_CONN(conn, "Setting next tmo %lu\n", next_timeout);
-	mod_timer(&conn->transport_timer, next_timeout);
+	iscsi_mod_transport_timer(conn, next_timeout);
 done:
 	spin_unlock(&session->lock);
 }
@@ -2111,7 +2469,7 @@ int iscsi_eh_abort(struct scsi_cmnd *sc)
 {
 	struct iscsi_cls_session *cls_session;
 	struct iscsi_session *session;
-	struct iscsi_conn *conn;
+	struct iscsi_conn *conn = NULL;
 	struct iscsi_task *task;
 	struct iscsi_tm *hdr;
 	int rc, age;
@@ -2148,8 +2506,6 @@ int iscsi_eh_abort(struct scsi_cmnd *sc)
 		return FAILED;
 	}
 
-	conn = session->leadconn;
-	conn->eh_abort_cnt++;
 	age = session->age;
 
 	task = (struct iscsi_task *)sc->SCp.ptr;
@@ -2162,6 +2518,18 @@ int iscsi_eh_abort(struct scsi_cmnd *sc)
 		goto success;
 	}
 
+	/*
+	 * the abort has to go out on the connection the task was
+	 * sent on
+	 */
+	conn = task->conn;
+	conn->eh_abort_cnt++;
+	/*
+	 * a non-leading conn can be torn down while we wait for the
+	 * tmf response, so hold a ref to it until we are done
+	 */
+	get_device(&conn->cls_conn->dev);
+
 	if (task->state == ISCSI_TASK_PENDING) {
 		fail_scsi_task(task, DID_ABORT);
 		goto success;
@@ -2225,6 +2593,8 @@ success_unlocked:
 	ISCSI_DBG_EH(session, "abort success [sc %p itt 0x%x]\n",
 		     sc, task->itt);
 	mutex_unlock(&session->eh_mutex);
+	if (conn)
+		put_device(&conn->cls_conn->dev);
 	return SUCCESS;
 
 failed:
@@ -2233,6 +2603,8 @@ failed_unlocked:
 	ISCSI_DBG_EH(session, "abort failed [sc %p itt 0x%x]\n", sc,
 		     task ? task->itt : 0);
 	mutex_unlock(&session->eh_mutex);
+	if (conn)
+		put_device(&conn->cls_conn->dev);
 	return FAILED;
 }
 EXPORT_SYMBOL_GPL(iscsi_eh_abort);
@@ -2251,9 +2623,9 @@ int iscsi_eh_device_reset(struct scsi_cmnd *sc)
 {
 	struct iscsi_cls_session *cls_session;
 	struct iscsi_session *session;
-	struct iscsi_conn *conn;
+	struct iscsi_conn *conn, *conns[ISCSI_MAX_CONNS];
 	struct iscsi_tm *hdr;
-	int rc = FAILED;
+	int nr_conns, rc = FAILED;
 
 	cls_session = starget_to_session(scsi_target(sc->device));
 	session = cls_session->dd_data;
@@ -2299,7 +2671,7 @@ int iscsi_eh_device_reset(struct scsi_cmnd *sc)
 	rc = SUCCESS;
 	spin_unlock_bh(&session->lock);
 
-	iscsi_suspend_tx(conn);
+	nr_conns = iscsi_suspend_session_conns(session, conns);
 
 	spin_lock_bh(&session->lock);
 	memset(hdr, 0, sizeof(*hdr));
@@ -2307,7 +2679,7 @@ int iscsi_eh_device_reset(struct scsi_cmnd *sc)
 	conn->tmf_state = TMF_INITIAL;
 	spin_unlock_bh(&session->lock);
 
-	iscsi_start_tx(conn);
+	iscsi_start_session_conns(conns, nr_conns);
 	goto done;
 
 unlock:
@@ -2413,9 +2785,9 @@ int iscsi_eh_target_reset(struct scsi_cmnd *sc)
 {
 	struct iscsi_cls_session *cls_session;
 	struct iscsi_session *session;
-	struct iscsi_conn *conn;
+	struct iscsi_conn *conn, *conns[ISCSI_MAX_CONNS];
 	struct iscsi_tm *hdr;
-	int rc = FAILED;
+	int nr_conns, rc = FAILED;
 
 	cls_session = starget_to_session(scsi_target(sc->device));
 	session = cls_session->dd_data;
@@ -2462,7 +2834,7 @@ int iscsi_eh_target_reset(struct scsi_cmnd *sc)
 	rc = SUCCESS;
 	spin_unlock_bh(&session->lock);
 
-	iscsi_suspend_tx(conn);
+	nr_conns = iscsi_suspend_session_conns(session, conns);
 
 	spin_lock_bh(&session->lock);
 	memset(hdr, 0, sizeof(*hdr));
@@ -2470,7 +2842,7 @@ int iscsi_eh_target_reset(struct scsi_cmnd *sc)
 	conn->tmf_state = TMF_INITIAL;
 	spin_unlock_bh(&session->lock);
 
-	iscsi_start_tx(conn);
+	iscsi_start_session_conns(conns, nr_conns);
 	goto done;
 
 unlock:
@@ -2774,6 +3146,9 @@ iscsi_session_setup(struct iscsi_transport *iscsit, struct Scsi_Host *shost,
 	session->dd_data = cls_session->dd_data + sizeof(*session);
 	mutex_init(&session->eh_mutex);
 	spin_lock_init(&session->lock);
+	INIT_LIST_HEAD(&session->inflight);
+	INIT_WORK(&session->qd_work, iscsi_qdepth_ctl_work);
+	session->qd_last = jiffies;
 
 	/* initialize SCSI PDU commands pool */
 	if (iscsi_pool_init(&session->cmdpool, session->cmds_max,
@@ -2781,6 +3156,11 @@ iscsi_session_setup(struct iscsi_transport *iscsit, struct Scsi_Host *shost,
 			    cmd_task_size + sizeof(struct iscsi_task)))
 		goto cmdpool_alloc_fail;
 
+	session->xfer_marks = kcalloc(session->cmds_max,
+				      sizeof(*session->xfer_marks), GFP_KERNEL);
+	if (!session->xfer_marks)
+		goto xfer_marks_alloc_fail;
+
 	/* pre-format cmds pool with ITT */
 	for (cmd_i = 0; cmd_i < session->cmds_max; cmd_i++) {
 		struct iscsi_task *task = session->cmds[cmd_i];
@@ -2790,6 +3170,7 @@ iscsi_session_setup(struct iscsi_transport *iscsit, struct Scsi_Host *shost,
 		task->itt = cmd_i;
 		task->state = ISCSI_TASK_FREE;
 		INIT_LIST_HEAD(&task->running);
+		INIT_LIST_HEAD(&task->inflight);
 	}
 
 	if (!try_module_get(iscsit->owner))
@@ -2803,6 +3184,8 @@ iscsi_session_setup(struct iscsi_transport *iscsit, struct Scsi_Host *shost,
 cls_session_fail:
 	module_put(iscsit->owner);
 module_get_fail:
+	kfree(session->xfer_marks);
+xfer_marks_alloc_fail:
 	iscsi_pool_free(&session->cmdpool);
 cmdpool_alloc_fail:
 	iscsi_free_session(cls_session);
@@ -2825,6 +3208,8 @@ void iscsi_session_teardown(struct iscsi_cls_session *cls_session)
 	struct module *owner = cls_session->transport->owner;
 	struct Scsi_Host *shost = session->host;
 
+	cancel_work_sync(&session->qd_work);
+	kfree(session->xfer_marks);
 	iscsi_pool_free(&session->cmdpool);
 
 	kfree(session->password);
@@ -2852,6 +3237,7 @@ iscsi_conn_setup(struct iscsi_cls_session *cls_session, int dd_size,
 		 uint32_t conn_idx)
 {
 	struct iscsi_session *session = cls_session->dd_data;
+	struct iscsi_host *ihost = shost_priv(session->host);
 	struct iscsi_conn *conn;
 	struct iscsi_cls_conn *cls_conn;
 	char *data;
@@ -2896,11 +3282,26 @@ iscsi_conn_setup(struct iscsi_cls_session *cls_session, int dd_size,
 		goto login_task_data_alloc_fail;
 	conn->login_task->data = conn->data = data;
 
+	/*
+	 * The leading conn shares the host's queue. An MC/S conn gets its
+	 * own so the session's conns can be sent on in parallel.
+	 */
+	if (conn_idx && ihost->workq) {
+		snprintf(conn->workq_name, sizeof(conn->workq_name),
+			 "iscsi_q_%d_%u", session->host->host_no, conn_idx);
+		conn->workq = create_singlethread_workqueue(conn->workq_name);
+		if (!conn->workq)
+			goto workq_alloc_fail;
+	}
+
 	init_timer(&conn->tmf_timer);
 	init_waitqueue_head(&conn->ehwait);
 
 	return cls_conn;
 
+workq_alloc_fail:
+	free_pages((unsigned long) data,
+		   get_order(ISCSI_DEF_MAX_RECV_SEG_LEN));
 login_task_data_alloc_fail:
 	kfifo_in(&session->cmdpool.queue, (void*)&conn->login_task,
 		    sizeof(void*));
@@ -2927,6 +3328,7 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 
 	spin_lock_bh(&session->lock);
 	conn->c_stage = ISCSI_CONN_CLEANUP_WAIT;
+	iscsi_session_del_conn(session, conn);
 	if (session->leadconn == conn) {
 		/*
 		 * leading connection? then give up on recovery.
@@ -2938,9 +3340,11 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 
 	/*
 	 * Block until all in-progress commands for this connection
-	 * time out or fail.
+	 * time out or fail. The commands of a non-leading connection
+	 * were failed when it was stopped and the host can be busy
+	 * with the other connections.
 	 */
-	for (;;) {
+	while (session->leadconn == conn) {
 		spin_lock_irqsave(session->host->host_lock, flags);
 		if (!session->host->host_busy) { /* OK for ERL == 0 */
 			spin_unlock_irqrestore(session->host->host_lock, flags);
@@ -2960,6 +3364,8 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 
 	/* flush queued up work because we free the connection below */
 	iscsi_suspend_tx(conn);
+	if (conn->workq)
+		destroy_workqueue(conn->workq);
 
 	spin_lock_bh(&session->lock);
 	free_pages((unsigned long) conn->data,
@@ -3010,12 +3416,13 @@ int iscsi_conn_start(struct iscsi_cls_conn *cls_conn)
 	conn->c_stage = ISCSI_CONN_STARTED;
 	session->state = ISCSI_STATE_LOGGED_IN;
 	session->queued_cmdsn = session->cmdsn;
+	iscsi_session_add_conn(session, conn);
 
 	conn->last_recv = jiffies;
 	conn->last_ping = jiffies;
 	if (conn->recv_timeout && conn->ping_timeout)
-		mod_timer(&conn->transport_timer,
-			  jiffies + (conn->recv_timeout * HZ));
+		iscsi_mod_transport_timer(conn, jiffies +
+					  (conn->recv_timeout * HZ));
 
 	switch(conn->stop_stage) {
 	case STOP_CONN_RECOVER:
@@ -3057,6 +3464,9 @@ fail_mgmt_tasks(struct iscsi_session *session, struct iscsi_conn *conn)
 		if (task->state == ISCSI_TASK_FREE)
 			continue;
 
+		if (conn != session->leadconn && task->conn != conn)
+			continue;
+
 		ISCSI_DBG_SESSION(conn->session,
 				  "failing mgmt itt 0x%x state %d\n",
 				  task->itt, task->state);
@@ -3081,6 +3491,32 @@ static void iscsi_start_session_recovery(struct iscsi_session *session,
 		return;
 	}
 
+	iscsi_session_del_conn(session, conn);
+	/*
+	 * A non-leading connection only takes its own tasks down with it.
+	 * The session keeps running on the others, or is being recovered
+	 * through the leading connection.
+	 */
+	if (conn != session->leadconn) {
+		conn->stop_stage = flag;
+		spin_unlock_bh(&session->lock);
+
+		del_timer_sync(&conn->transport_timer);
+		iscsi_suspend_tx(conn);
+
+		spin_lock_bh(&session->lock);
+		conn->c_stage = ISCSI_CONN_STOPPED;
+		conn->hdrdgst_en = 0;
+		conn->datadgst_en = 0;
+		fail_scsi_tasks(conn, -1, DID_TRANSPORT_DISRUPTED);
+		fail_mgmt_tasks(session, conn);
+		memset(&conn->tmhdr, 0, sizeof(conn->tmhdr));
+		spin_unlock_bh(&session->lock);
+		mutex_unlock(&session->eh_mutex);
+		wake_up(&conn->ehwait);
+		return;
+	}
+
 	/*
 	 * When this is called for the in_login state, we only want to clean
 	 * up the login task and connection. We do not need to block and set
@@ -3306,6 +3742,11 @@ int iscsi_session_get_param(struct iscsi_cls_session *cls_session,
 	case ISCSI_PARAM_TGT_RESET_TMO:
 		len = sprintf(buf, "%d\n", session->tgt_reset_timeout);
 		break;
+	case ISCSI_PARAM_CMDSN:
+		spin_lock_bh(&session->lock);
+		len = sprintf(buf, "%u\n", session->cmdsn);
+		spin_unlock_bh(&session->lock);
+		break;
 	case ISCSI_PARAM_INITIAL_R2T_EN:
 		len = sprintf(buf, "%d\n", session->initial_r2t_en);
 		break;
@@ -3410,6 +3851,45 @@ int iscsi_conn_get_param(struct iscsi_cls_conn *cls_conn,
 }
 EXPORT_SYMBOL_GPL(iscsi_conn_get_param);
 
+static void iscsi_add_custom_stat(struct iscsi_stats *stats, char *desc,
+				  uint64_t value)
+{
+	if (stats->custom_length >= ISCSI_STATS_CUSTOM_MAX)
+		return;
+
+	strlcpy(stats->custom[stats->custom_length].desc, desc,
+		ISCSI_STATS_CUSTOM_DESC_MAX);
+	stats->custom[stats->custom_length].value = value;
+	stats->custom_length++;
+}
+
+/**
+ * iscsi_add_custom_stats - append libiscsi's queueing stats
+ * @conn: iscsi conn
+ * @stats: stats being built for userspace
+ *
+ * LLDs call this after filling in their own custom stats. It adds why
+ * queuecommand pushed back and a sample of the CmdSN window and the
+ * commands queued against it.
+ */
+void iscsi_add_custom_stats(struct iscsi_conn *conn, struct iscsi_stats *stats)
+{
+	struct iscsi_session *session = conn->session;
+	uint32_t window, queued;
+
+	spin_lock_bh(&session->lock);
+	window = session->max_cmdsn - session->exp_cmdsn + 1;
+	queued = session->queued_cmdsn - session->exp_cmdsn;
+	spin_unlock_bh(&session->lock);
+
+	iscsi_add_custom_stat(stats, "cmdsn_window_closed",
+			      conn->cmdsn_closed_cnt);
+	iscsi_add_custom_stat(stats, "cmdpool_empty", conn->cmdpool_empty_cnt);
+	iscsi_add_custom_stat(stats, "cmdsn_window", window);
+	iscsi_add_custom_stat(stats, "cmds_queued", queued);
+}
+EXPORT_SYMBOL_GPL(iscsi_add_custom_stats);
+
 int iscsi_host_get_param(struct Scsi_Host *shost, enum iscsi_host_param param,
 			 char *buf)
 {
@@ -28,6 +28,8 @@
 #include <linux/mutex.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
+#include <linux/mempool.h>
+#include <linux/ktime.h>
 #include "iscsi_proto.h"
 #include "iscsi_if.h"
 #include "scsi_transport_iscsi.h"
@@ -63,6 +65,8 @@ enum {
 
 /* Connection suspend "bit" */
 #define ISCSI_SUSPEND_BIT		1
+/* recv side held while a reset fails the session's tasks */
+#define ISCSI_EH_SUSPEND_BIT		2
 
 #define ISCSI_ITT_MASK			0x1fff
 #define ISCSI_TOTAL_CMDS_MAX		4096
@@ -101,6 +105,12 @@ struct iscsi_r2t_info {
 	int			sent;		/* R2T sequence progress */
 };
 
+/* an inflight task transferred data at jiffies */
+struct iscsi_xfer_mark {
+	uint32_t		cmdsn;
+	unsigned long		jiffies;
+};
+
 struct iscsi_task {
 	/*
 	 * Because LLDs allocate their hdr differently, this is a pointer
@@ -128,11 +138,13 @@ struct iscsi_task {
 	/* data processing tracking */
 	unsigned long		last_xfer;
 	unsigned long		last_timeout;
+	ktime_t			sent;		/* for the qdepth controller */
 	int			have_checked_conn;
 	/* state set/tested under session->lock */
 	int			state;
 	atomic_t		refcount;
 	struct list_head	running;	/* running cmd list */
+	struct list_head	inflight;	/* item in session inflight */
 	void			*dd_data;	/* driver/transport data */
 };
 
@@ -191,6 +203,9 @@ struct iscsi_conn {
 	struct list_head	cmdqueue;	/* data-path cmd queue */
 	struct list_head	requeue;	/* tasks needing another run */
 	struct work_struct	xmitwork;	/* per-conn. xmit workqueue */
+	/* ordered xmit queue of a non-leading conn, else the host's */
+	struct workqueue_struct	*workq;
+	char			workq_name[20];
 	unsigned long		suspend_tx;	/* suspend Tx */
 	unsigned long		suspend_rx;	/* suspend Rx */
 
@@ -224,10 +239,17 @@ struct iscsi_conn {
 	uint32_t		r2t_pdus_cnt;
 	uint32_t		tmfcmd_pdus_cnt;
 	int32_t			tmfrsp_pdus_cnt;
+	uint32_t		noptx_pdus_cnt;
+	uint32_t		noprx_pdus_cnt;
+	uint32_t		digest_err_cnt;
+	uint32_t		timeout_err_cnt;
 
 	/* custom statistics */
 	uint32_t		eh_abort_cnt;
 	uint32_t		fmr_unalign_cnt;
+	/* queuecommand rejects, see iscsi_add_custom_stats() */
+	uint32_t		cmdsn_closed_cnt;
+	uint32_t		cmdpool_empty_cnt;
 };
 
 struct iscsi_pool {
@@ -291,6 +313,9 @@ struct iscsi_session {
 	struct iscsi_transport	*tt;
 	struct Scsi_Host	*host;
 	struct iscsi_conn	*leadconn;	/* leading connection */
+	/* started connections commands are spread over */
+	struct iscsi_conn	*conns[ISCSI_MAX_CONNS];
+	int			nr_conns;
 	spinlock_t		lock;		/* protects session state, *
 						 * sequence numbers,       *
 						 * session resources:      *
@@ -304,6 +329,21 @@ struct iscsi_session {
 	int			cmds_max;	/* size of cmds array */
 	struct iscsi_task	**cmds;		/* Original Cmds arr */
 	struct iscsi_pool	cmdpool;	/* PDU's pool */
+	mempool_t		*r2t_pool;	/* R2T reserve, libiscsi_tcp */
+	/* scsi tasks sent to the target, oldest (lowest cmdsn) first */
+	struct list_head	inflight;
+	/*
+	 * When the inflight tasks before a cmdsn last transferred data,
+	 * see iscsi_task_xfer(). Steps of increasing cmdsn and jiffies.
+	 */
+	struct iscsi_xfer_mark	*xfer_marks;
+	int			xfer_marks_cnt;
+	/* queue depth controller, see iscsi_qdepth_ctl_work() */
+	struct work_struct	qd_work;
+	unsigned long		qd_last;	/* last run, in jiffies */
+	int			qd_closed;	/* cmdsn window closed hits */
+	unsigned		qd_lat;		/* cmd latency ewma, usecs */
+	unsigned		qd_lat_min;	/* latency baseline, usecs */
 	void			*dd_data;	/* LLD private data */
 };
 
@@ -393,6 +433,8 @@ extern void iscsi_session_failure(struct iscsi_session *session,
 				  enum iscsi_err err);
 extern int iscsi_conn_get_param(struct iscsi_cls_conn *cls_conn,
 				enum iscsi_param param, char *buf);
+extern void iscsi_add_custom_stats(struct iscsi_conn *conn,
+				   struct iscsi_stats *stats);
 extern void iscsi_suspend_tx(struct iscsi_conn *conn);
 extern void iscsi_suspend_queue(struct iscsi_conn *conn);
 extern void iscsi_conn_queue_work(struct iscsi_conn *conn);
@@ -418,6 +460,7 @@ extern int iscsi_verify_itt(struct iscsi_conn *, itt_t);
 extern struct iscsi_task *iscsi_itt_to_ctask(struct iscsi_conn *, itt_t);
 extern struct iscsi_task *iscsi_itt_to_task(struct iscsi_conn *, itt_t);
 extern void iscsi_requeue_task(struct iscsi_task *task);
+extern void iscsi_task_xfer(struct iscsi_task *task);
 extern void iscsi_put_task(struct iscsi_task *task);
 extern void __iscsi_get_task(struct iscsi_task *task);
 extern void iscsi_complete_scsi_task(struct iscsi_task *task,
@@ -34,7 +34,7 @@
 #include <linux/blkdev.h>
 #include <linux/crypto.h>
 #include <linux/delay.h>
-#include <linux/kfifo.h>
+#include <linux/mempool.h>
 #include <linux/scatterlist.h>
 #include <net/tcp.h>
 #include <scsi/scsi_cmnd.h>
@@ -69,6 +69,56 @@ MODULE_PARM_DESC(debug_libiscsi_tcp, "Turn on debugging for libiscsi_tcp "
 static int iscsi_tcp_hdr_recv_done(struct iscsi_tcp_conn *tcp_conn,
 				   struct iscsi_segment *segment);
 
+/*
+ * R2T infos are only allocated while a write has R2Ts outstanding, so
+ * they come from one cache for all sessions. Each session keeps a
+ * reserve of them in its r2t_pool, see iscsi_tcp_r2tpool_alloc().
+ */
+static struct kmem_cache *iscsi_r2t_cache;
+
+static inline unsigned iscsi_tcp_r2tq_len(struct iscsi_tcp_task *tcp_task)
+{
+	return tcp_task->r2tq_head - tcp_task->r2tq_tail;
+}
+
+/*
+ * must be called with session lock, there is only one producer
+ */
+static int iscsi_tcp_r2tq_put(struct iscsi_tcp_task *tcp_task,
+			      struct iscsi_r2t_info *r2t)
+{
+	unsigned head = tcp_task->r2tq_head;
+
+	if (head - ACCESS_ONCE(tcp_task->r2tq_tail) > tcp_task->r2tq_mask)
+		return -ENOSPC;
+
+	tcp_task->r2tq[head & tcp_task->r2tq_mask] = r2t;
+	/* the consumer must see the slot before the new head */
+	smp_wmb();
+	tcp_task->r2tq_head = head + 1;
+	return 0;
+}
+
+/*
+ * called from the xmit path, or with the session lock when the task
+ * is being freed and cannot be sent anymore
+ */
+static struct iscsi_r2t_info *iscsi_tcp_r2tq_get(struct iscsi_tcp_task *tcp_task)
+{
+	unsigned tail = tcp_task->r2tq_tail;
+	struct iscsi_r2t_info *r2t;
+
+	if (tail == ACCESS_ONCE(tcp_task->r2tq_head))
+		return NULL;
+	/* pairs with the smp_wmb in iscsi_tcp_r2tq_put */
+	smp_rmb();
+	r2t = tcp_task->r2tq[tail & tcp_task->r2tq_mask];
+	/* read the slot before handing it back to the producer */
+	smp_mb();
+	tcp_task->r2tq_tail = tail + 1;
+	return r2t;
+}
+
 /*
  * Scatterlist handling: inside the iscsi_segment, we
  * remember an index into the scatterlist, and set data/size
@@ -403,8 +453,10 @@ iscsi_tcp_data_recv_done(struct iscsi_tcp_conn *tcp_conn,
 	struct iscsi_conn *conn = tcp_conn->iscsi_conn;
 	int rc = 0;
 
-	if (!iscsi_tcp_dgst_verify(tcp_conn, segment))
+	if (!iscsi_tcp_dgst_verify(tcp_conn, segment)) {
+		conn->digest_err_cnt++;
 		return ISCSI_ERR_DATA_DGST;
+	}
 
 	rc = iscsi_complete_pdu(conn, tcp_conn->in.hdr,
 			conn->data, tcp_conn->in.datalen);
@@ -445,17 +497,15 @@ void iscsi_tcp_cleanup_task(struct iscsi_task *task)
 	if (!task->sc)
 		return;
 
-	/* flush task's r2t queues */
-	while (kfifo_out(&tcp_task->r2tqueue, (void*)&r2t, sizeof(void*))) {
-		kfifo_in(&tcp_task->r2tpool.queue, (void*)&r2t,
-			    sizeof(void*));
+	/* flush task's r2t queue */
+	while ((r2t = iscsi_tcp_r2tq_get(tcp_task))) {
+		mempool_free(r2t, task->conn->session->r2t_pool);
 		ISCSI_DBG_TCP(task->conn, "pending r2t dropped\n");
 	}
 
 	r2t = tcp_task->r2t;
 	if (r2t != NULL) {
-		kfifo_in(&tcp_task->r2tpool.queue, (void*)&r2t,
-			    sizeof(void*));
+		mempool_free(r2t, task->conn->session->r2t_pool);
 		tcp_task->r2t = NULL;
 	}
 }
@@ -517,7 +567,6 @@ static int iscsi_tcp_r2t_rsp(struct iscsi_conn *conn, struct iscsi_task *task)
 	struct iscsi_r2t_rsp *rhdr = (struct iscsi_r2t_rsp *)tcp_conn->in.hdr;
 	struct iscsi_r2t_info *r2t;
 	int r2tsn = be32_to_cpu(rhdr->r2tsn);
-	int rc;
 
 	if (tcp_conn->in.datalen) {
 		iscsi_conn_printk(KERN_ERR, conn,
@@ -542,21 +591,25 @@ static int iscsi_tcp_r2t_rsp(struct iscsi_conn *conn, struct iscsi_task *task)
 		return 0;
 	}
 
-	rc = kfifo_out(&tcp_task->r2tpool.queue, (void*)&r2t, sizeof(void*));
-	if (!rc) {
-		iscsi_conn_printk(KERN_ERR, conn, "Could not allocate R2T. "
+	if (iscsi_tcp_r2tq_len(tcp_task) > tcp_task->r2tq_mask) {
+		iscsi_conn_printk(KERN_ERR, conn, "Could not queue R2T. "
 				  "Target has sent more R2Ts than it "
 				  "negotiated for or driver has has leaked.\n");
 		return ISCSI_ERR_PROTO;
 	}
 
+	r2t = mempool_alloc(session->r2t_pool, GFP_ATOMIC);
+	if (!r2t) {
+		iscsi_conn_printk(KERN_ERR, conn, "Could not allocate R2T.\n");
+		return ISCSI_ERR_CONN_FAILED;
+	}
+
 	r2t->exp_statsn = rhdr->statsn;
 	r2t->data_length = be32_to_cpu(rhdr->data_length);
 	if (r2t->data_length == 0) {
 		iscsi_conn_printk(KERN_ERR, conn,
 				  "invalid R2T with zero data len\n");
-		kfifo_in(&tcp_task->r2tpool.queue, (void*)&r2t,
-			    sizeof(void*));
+		mempool_free(r2t, session->r2t_pool);
 		return ISCSI_ERR_DATALEN;
 	}
 
@@ -571,8 +624,7 @@ static int iscsi_tcp_r2t_rsp(struct iscsi_conn *conn, struct iscsi_task *task)
 				  "invalid R2T with data len %u at offset %u "
 				  "and total length %d\n", r2t->data_length,
 				  r2t->data_offset, scsi_out(task->sc)->length);
-		kfifo_in(&tcp_task->r2tpool.queue, (void*)&r2t,
-			    sizeof(void*));
+		mempool_free(r2t, session->r2t_pool);
 		return ISCSI_ERR_DATALEN;
 	}
 
@@ -581,7 +633,8 @@ static int iscsi_tcp_r2t_rsp(struct iscsi_conn *conn, struct iscsi_task *task)
 	r2t->sent = 0;
 
 	tcp_task->exp_datasn = r2tsn + 1;
-	kfifo_in(&tcp_task->r2tqueue, (void*)&r2t, sizeof(void*));
+	/* we checked there was room above */
+	iscsi_tcp_r2tq_put(tcp_task, r2t);
 	conn->r2t_pdus_cnt++;
 
 	iscsi_requeue_task(task);
@@ -599,8 +652,10 @@ iscsi_tcp_process_data_in(struct iscsi_tcp_conn *tcp_conn,
 	struct iscsi_hdr *hdr = tcp_conn->in.hdr;
 	int rc;
 
-	if (!iscsi_tcp_dgst_verify(tcp_conn, segment))
+	if (!iscsi_tcp_dgst_verify(tcp_conn, segment)) {
+		conn->digest_err_cnt++;
 		return ISCSI_ERR_DATA_DGST;
+	}
 
 	/* check for non-exceptional status */
 	if (hdr->flags & ISCSI_FLAG_DATA_STATUS) {
@@ -687,7 +742,7 @@ iscsi_tcp_hdr_dissect(struct iscsi_conn *conn, struct iscsi_hdr *hdr)
 				     "offset=%d, datalen=%d)\n",
 				      tcp_task->data_offset,
 				      tcp_conn->in.datalen);
-			task->last_xfer = jiffies;
+			iscsi_task_xfer(task);
 			rc = iscsi_segment_seek_sg(&tcp_conn->in.segment,
 						   sdb->table.sgl,
 						   sdb->table.nents,
@@ -716,7 +771,7 @@ iscsi_tcp_hdr_dissect(struct iscsi_conn *conn, struct iscsi_hdr *hdr)
 		else if (ahslen)
 			rc = ISCSI_ERR_AHSLEN;
 		else if (task->sc->sc_data_direction == DMA_TO_DEVICE) {
-			task->last_xfer = jiffies;
+			iscsi_task_xfer(task);
 			rc = iscsi_tcp_r2t_rsp(conn, task);
 		} else
 			rc = ISCSI_ERR_PROTO;
@@ -825,8 +880,10 @@ iscsi_tcp_hdr_recv_done(struct iscsi_tcp_conn *tcp_conn,
 				      segment->total_copied - ISCSI_DIGEST_SIZE,
 				      segment->digest);
 
-		if (!iscsi_tcp_dgst_verify(tcp_conn, segment))
+		if (!iscsi_tcp_dgst_verify(tcp_conn, segment)) {
+			tcp_conn->iscsi_conn->digest_err_cnt++;
 			return ISCSI_ERR_HDR_DGST;
+		}
 	}
 
 	tcp_conn->in.hdr = hdr;
@@ -952,8 +1009,9 @@ int iscsi_tcp_task_init(struct iscsi_task *task)
 		return conn->session->tt->init_pdu(task, 0, task->data_count);
 	}
 
-	BUG_ON(kfifo_len(&tcp_task->r2tqueue));
+	BUG_ON(iscsi_tcp_r2tq_len(tcp_task));
 	tcp_task->exp_datasn = 0;
+	tcp_task->dout_more = 0;
 
 	/* Prepare PDU, optionally w/ immediate data */
 	ISCSI_DBG_TCP(conn, "task deq [itt 0x%x imm %d unsol %d]\n",
@@ -967,6 +1025,10 @@ int iscsi_tcp_task_init(struct iscsi_task *task)
 }
 EXPORT_SYMBOL_GPL(iscsi_tcp_task_init);
 
+/*
+ * tcp_task->r2t is only touched by the xmit path while the task can
+ * be sent, so this does not need the session lock.
+ */
 static struct iscsi_r2t_info *iscsi_tcp_get_curr_r2t(struct iscsi_task *task)
 {
 	struct iscsi_session *session = task->conn->session;
@@ -976,29 +1038,19 @@ static struct iscsi_r2t_info *iscsi_tcp_get_curr_r2t(struct iscsi_task *task)
 	if (iscsi_task_has_unsol_data(task))
 		r2t = &task->unsol_r2t;
 	else {
-		spin_lock_bh(&session->lock);
 		if (tcp_task->r2t) {
 			r2t = tcp_task->r2t;
 			/* Continue with this R2T? */
 			if (r2t->data_length <= r2t->sent) {
 				ISCSI_DBG_TCP(task->conn,
 					      "  done with r2t %p\n", r2t);
-				kfifo_in(&tcp_task->r2tpool.queue,
-					    (void *)&tcp_task->r2t,
-					    sizeof(void *));
+				mempool_free(r2t, session->r2t_pool);
 				tcp_task->r2t = r2t = NULL;
 			}
 		}
 
-		if (r2t == NULL) {
-			if (kfifo_out(&tcp_task->r2tqueue,
-			    (void *)&tcp_task->r2t, sizeof(void *)) !=
-			    sizeof(void *))
-				r2t = NULL;
-			else
-				r2t = tcp_task->r2t;
-		}
-		spin_unlock_bh(&session->lock);
+		if (r2t == NULL)
+			r2t = tcp_task->r2t = iscsi_tcp_r2tq_get(tcp_task);
 	}
 
 	return r2t;
@@ -1016,6 +1068,7 @@ int iscsi_tcp_task_xmit(struct iscsi_task *task)
 {
 	struct iscsi_conn *conn = task->conn;
 	struct iscsi_session *session = conn->session;
+	struct iscsi_tcp_task *tcp_task = task->dd_data;
 	struct iscsi_r2t_info *r2t;
 	int rc = 0;
 
@@ -1040,6 +1093,7 @@ flush:
 	if (r2t == NULL) {
 		/* Waiting for more R2Ts to arrive. */
 		ISCSI_DBG_TCP(conn, "no R2Ts yet\n");
+		tcp_task->dout_more = 0;
 		return 0;
 	}
 
@@ -1060,6 +1114,12 @@ flush:
 	}
 
 	r2t->sent += r2t->data_count;
+	/*
+	 * When a R2T is bigger than MaxRecvDataSegmentLength it is sent
+	 * as a run of Data-Outs. Let the LLD know so it can hand the
+	 * whole burst to the network layer before it is pushed out.
+	 */
+	tcp_task->dout_more = r2t->sent < r2t->data_length;
 	goto flush;
 }
 EXPORT_SYMBOL_GPL(iscsi_tcp_task_xmit);
@@ -1111,31 +1171,34 @@ int iscsi_tcp_r2tpool_alloc(struct iscsi_session *session)
 	int cmd_i;
 
 	/*
-	 * initialize per-task: R2T pool and xmit queue
+	 * The R2Ts come from the slab when they are received. A reserve
+	 * of one r2tq worth keeps this session's writes going when an
+	 * atomic allocation fails, whatever the other sessions hold.
+	 */
+	session->r2t_pool = mempool_create_slab_pool(session->max_r2t * 2,
+						     iscsi_r2t_cache);
+	if (!session->r2t_pool)
+		return -ENOMEM;
+
+	/*
+	 * initialize per-task R2T xmit queue
 	 */
 	for (cmd_i = 0; cmd_i < session->cmds_max; cmd_i++) {
 	        struct iscsi_task *task = session->cmds[cmd_i];
 		struct iscsi_tcp_task *tcp_task = task->dd_data;
 
 		/*
-		 * pre-allocated x2 as much r2ts to handle race when
+		 * room for x2 as much r2ts to handle race when
 		 * target acks DataOut faster than we data_xmit() queues
-		 * could replenish r2tqueue.
+		 * could drain r2tq. max_r2t is a power of 2.
 		 */
-
-		/* R2T pool */
-		if (iscsi_pool_init(&tcp_task->r2tpool,
-				    session->max_r2t * 2, NULL,
-				    sizeof(struct iscsi_r2t_info))) {
+		tcp_task->r2tq = kcalloc(session->max_r2t * 2,
+					 sizeof(struct iscsi_r2t_info *),
+					 GFP_KERNEL);
+		if (!tcp_task->r2tq)
 			goto r2t_alloc_fail;
-		}
-
-		/* R2T xmit queue */
-		if (kfifo_alloc(&tcp_task->r2tqueue,
-		      session->max_r2t * 4 * sizeof(void*), GFP_KERNEL)) {
-			iscsi_pool_free(&tcp_task->r2tpool);
-			goto r2t_alloc_fail;
-		}
+		tcp_task->r2tq_mask = session->max_r2t * 2 - 1;
+		tcp_task->r2tq_head = tcp_task->r2tq_tail = 0;
 	}
 
 	return 0;
@@ -1145,9 +1208,11 @@ r2t_alloc_fail:
 		struct iscsi_task *task = session->cmds[i];
 		struct iscsi_tcp_task *tcp_task = task->dd_data;
 
-		kfifo_free(&tcp_task->r2tqueue);
-		iscsi_pool_free(&tcp_task->r2tpool);
+		kfree(tcp_task->r2tq);
+		tcp_task->r2tq = NULL;
 	}
+	mempool_destroy(session->r2t_pool);
+	session->r2t_pool = NULL;
 	return -ENOMEM;
 }
 EXPORT_SYMBOL_GPL(iscsi_tcp_r2tpool_alloc);
@@ -1160,9 +1225,11 @@ void iscsi_tcp_r2tpool_free(struct iscsi_session *session)
 		struct iscsi_task *task = session->cmds[i];
 		struct iscsi_tcp_task *tcp_task = task->dd_data;
 
-		kfifo_free(&tcp_task->r2tqueue);
-		iscsi_pool_free(&tcp_task->r2tpool);
+		kfree(tcp_task->r2tq);
+		tcp_task->r2tq = NULL;
 	}
+	mempool_destroy(session->r2t_pool);
+	session->r2t_pool = NULL;
 }
 EXPORT_SYMBOL_GPL(iscsi_tcp_r2tpool_free);
 
@@ -1180,5 +1247,27 @@ void iscsi_tcp_conn_get_stats(struct iscsi_cls_conn *cls_conn,
 	stats->r2t_pdus = conn->r2t_pdus_cnt;
 	stats->tmfcmd_pdus = conn->tmfcmd_pdus_cnt;
 	stats->tmfrsp_pdus = conn->tmfrsp_pdus_cnt;
+	stats->noptx_pdus = conn->noptx_pdus_cnt;
+	stats->noprx_pdus = conn->noprx_pdus_cnt;
+	stats->digest_err = conn->digest_err_cnt;
+	stats->timeout_err = conn->timeout_err_cnt;
 }
 EXPORT_SYMBOL_GPL(iscsi_tcp_conn_get_stats);
+
+static int __init iscsi_tcp_lib_init(void)
+{
+	iscsi_r2t_cache = kmem_cache_create("iscsi_r2t_cache",
+					    sizeof(struct iscsi_r2t_info),
+					    0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!iscsi_r2t_cache)
+		return -ENOMEM;
+	return 0;
+}
+
+static void __exit iscsi_tcp_lib_exit(void)
+{
+	kmem_cache_destroy(iscsi_r2t_cache);
+}
+
+module_init(iscsi_tcp_lib_init);
+module_exit(iscsi_tcp_lib_exit);
@@ -79,8 +79,16 @@ struct iscsi_tcp_task {
 	uint32_t		exp_datasn;	/* expected target's R2TSN/DataSN */
 	int			data_offset;
 	struct iscsi_r2t_info	*r2t;		/* in progress solict R2T */
-	struct iscsi_pool	r2tpool;
-	struct kfifo		r2tqueue;
+	/*
+	 * R2Ts waiting to be sent. The recv path adds them under the
+	 * session lock and the xmit path takes them off without it.
+	 */
+	struct iscsi_r2t_info	**r2tq;
+	unsigned		r2tq_mask;	/* ring size - 1 */
+	unsigned		r2tq_head;	/* next free slot, recv */
+	unsigned		r2tq_tail;	/* next r2t to send, xmit */
+	/* more Data-Out of the same burst follow the PDU being sent */
+	int			dout_more;
 	void			*dd_data;
 };
 
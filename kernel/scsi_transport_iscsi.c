@@ -23,6 +23,9 @@
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/hash.h>
+#include <linux/rculist.h>
 #include <net/tcp.h>
 #include <scsi/scsi.h>
 #include <scsi/scsi_host.h>
@@ -31,7 +34,7 @@
 #include "scsi_transport_iscsi.h"
 #include "iscsi_if.h"
 
-#define ISCSI_SESSION_ATTRS 22
+#define ISCSI_SESSION_ATTRS 23
 #define ISCSI_CONN_ATTRS 13
 #define ISCSI_HOST_ATTRS 4
 
@@ -302,9 +305,18 @@ static DECLARE_TRANSPORT_CLASS(iscsi_connection_class,
 static struct sock *nls;
 static DEFINE_MUTEX(rx_queue_mutex);
 
-static LIST_HEAD(sesslist);
+/*
+ * Sessions are hashed by sid and connections by sid/cid. The tables
+ * are modified under the sesslock/connlock and walked under rcu, so
+ * looking up an id for a netlink request does not take a lock that
+ * is shared by every session on the box.
+ */
+#define ISCSI_ID_HASH_BITS	10
+#define ISCSI_ID_HASH_SIZE	(1 << ISCSI_ID_HASH_BITS)
+
+static struct hlist_head sesshash[ISCSI_ID_HASH_SIZE];
 static DEFINE_SPINLOCK(sesslock);
-static LIST_HEAD(connlist);
+static struct hlist_head connhash[ISCSI_ID_HASH_SIZE];
 static DEFINE_SPINLOCK(connlock);
 
 static uint32_t iscsi_conn_get_sid(struct iscsi_cls_conn *conn)
@@ -313,22 +325,37 @@ static uint32_t iscsi_conn_get_sid(struct iscsi_cls_conn *conn)
 	return sess->sid;
 }
 
+static struct hlist_head *iscsi_sess_bucket(uint32_t sid)
+{
+	return &sesshash[hash_32(sid, ISCSI_ID_HASH_BITS)];
+}
+
+static struct hlist_head *iscsi_conn_bucket(uint32_t sid, uint32_t cid)
+{
+	return &connhash[jhash_2words(sid, cid, 0) &
+			 (ISCSI_ID_HASH_SIZE - 1)];
+}
+
 /*
  * Returns the matching session to a given sid
+ *
+ * The session is not refcounted. Like before, the caller relies on the
+ * rx_queue_mutex to keep it from being destroyed under it.
  */
 static struct iscsi_cls_session *iscsi_session_lookup(uint32_t sid)
 {
-	unsigned long flags;
 	struct iscsi_cls_session *sess;
+	struct hlist_node *pos;
 
-	spin_lock_irqsave(&sesslock, flags);
-	list_for_each_entry(sess, &sesslist, sess_list) {
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(sess, pos, iscsi_sess_bucket(sid),
+				 sess_list) {
 		if (sess->sid == sid) {
-			spin_unlock_irqrestore(&sesslock, flags);
+			rcu_read_unlock();
 			return sess;
 		}
 	}
-	spin_unlock_irqrestore(&sesslock, flags);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -337,17 +364,18 @@ static struct iscsi_cls_session *iscsi_session_lookup(uint32_t sid)
  */
 static struct iscsi_cls_conn *iscsi_conn_lookup(uint32_t sid, uint32_t cid)
 {
-	unsigned long flags;
 	struct iscsi_cls_conn *conn;
+	struct hlist_node *pos;
 
-	spin_lock_irqsave(&connlock, flags);
-	list_for_each_entry(conn, &connlist, conn_list) {
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(conn, pos, iscsi_conn_bucket(sid, cid),
+				 conn_list) {
 		if ((conn->cid == cid) && (iscsi_conn_get_sid(conn) == sid)) {
-			spin_unlock_irqrestore(&connlock, flags);
+			rcu_read_unlock();
 			return conn;
 		}
 	}
-	spin_unlock_irqrestore(&connlock, flags);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -403,6 +431,11 @@ int iscsi_session_chkready(struct iscsi_cls_session *session)
 }
 EXPORT_SYMBOL_GPL(iscsi_session_chkready);
 
+static void iscsi_session_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct iscsi_cls_session, rcu));
+}
+
 static void iscsi_session_release(struct device *dev)
 {
 	struct iscsi_cls_session *session = iscsi_dev_to_session(dev);
@@ -411,7 +444,8 @@ static void iscsi_session_release(struct device *dev)
 	shost = iscsi_session_to_shost(session);
 	scsi_host_put(shost);
 	ISCSI_DBG_TRANS_SESSION(session, "Completing session release\n");
-	kfree(session);
+	/* a lookup could still be walking over it */
+	call_rcu(&session->rcu, iscsi_session_free_rcu);
 }
 
 static int iscsi_is_session_dev(const struct device *dev)
@@ -683,7 +717,7 @@ iscsi_alloc_session(struct Scsi_Host *shost, struct iscsi_transport *transport,
 	session->recovery_tmo = 120;
 	session->state = ISCSI_SESSION_FREE;
 	INIT_DELAYED_WORK(&session->recovery_work, session_recovery_timedout);
-	INIT_LIST_HEAD(&session->sess_list);
+	INIT_HLIST_NODE(&session->sess_list);
 	INIT_WORK(&session->unblock_work, __iscsi_unblock_session);
 	INIT_WORK(&session->block_work, __iscsi_block_session);
 	INIT_WORK(&session->unbind_work, __iscsi_unbind_session);
@@ -760,7 +794,8 @@ int iscsi_add_session(struct iscsi_cls_session *session, unsigned int target_id)
 	transport_register_device(&session->dev);
 
 	spin_lock_irqsave(&sesslock, flags);
-	list_add(&session->sess_list, &sesslist);
+	hlist_add_head_rcu(&session->sess_list,
+			   iscsi_sess_bucket(session->sid));
 	spin_unlock_irqrestore(&sesslock, flags);
 
 	iscsi_session_event(session, ISCSI_KEVENT_CREATE_SESSION);
@@ -800,13 +835,22 @@ iscsi_create_session(struct Scsi_Host *shost, struct iscsi_transport *transport,
 }
 EXPORT_SYMBOL_GPL(iscsi_create_session);
 
+static void iscsi_conn_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct iscsi_cls_conn, rcu));
+}
+
 static void iscsi_conn_release(struct device *dev)
 {
 	struct iscsi_cls_conn *conn = iscsi_dev_to_conn(dev);
 	struct device *parent = conn->dev.parent;
 
 	ISCSI_DBG_TRANS_CONN(conn, "Releasing conn\n");
-	kfree(conn);
+	/*
+	 * a lookup could still be walking over it. The session it gets
+	 * the sid from is freed after a grace period too.
+	 */
+	call_rcu(&conn->rcu, iscsi_conn_free_rcu);
 	put_device(parent);
 }
 
@@ -831,7 +875,7 @@ void iscsi_remove_session(struct iscsi_cls_session *session)
 	ISCSI_DBG_TRANS_SESSION(session, "Removing session\n");
 
 	spin_lock_irqsave(&sesslock, flags);
-	list_del(&session->sess_list);
+	hlist_del_init_rcu(&session->sess_list);
 	spin_unlock_irqrestore(&sesslock, flags);
 
 	/* make sure there are no blocks/unblocks queued */
@@ -922,7 +966,7 @@ iscsi_create_conn(struct iscsi_cls_session *session, int dd_size, uint32_t cid)
 	if (dd_size)
 		conn->dd_data = &conn[1];
 
-	INIT_LIST_HEAD(&conn->conn_list);
+	INIT_HLIST_NODE(&conn->conn_list);
 	conn->transport = transport;
 	conn->cid = cid;
 
@@ -942,7 +986,8 @@ iscsi_create_conn(struct iscsi_cls_session *session, int dd_size, uint32_t cid)
 	transport_register_device(&conn->dev);
 
 	spin_lock_irqsave(&connlock, flags);
-	list_add(&conn->conn_list, &connlist);
+	hlist_add_head_rcu(&conn->conn_list,
+			   iscsi_conn_bucket(session->sid, cid));
 	conn->active = 1;
 	spin_unlock_irqrestore(&connlock, flags);
 
@@ -970,7 +1015,7 @@ int iscsi_destroy_conn(struct iscsi_cls_conn *conn)
 
 	spin_lock_irqsave(&connlock, flags);
 	conn->active = 0;
-	list_del(&conn->conn_list);
+	hlist_del_init_rcu(&conn->conn_list);
 	spin_unlock_irqrestore(&connlock, flags);
 
 	transport_unregister_device(&conn->dev);
@@ -1762,6 +1807,7 @@ iscsi_session_attr(fast_abort, ISCSI_PARAM_FAST_ABORT, 0);
 iscsi_session_attr(abort_tmo, ISCSI_PARAM_ABORT_TMO, 0);
 iscsi_session_attr(lu_reset_tmo, ISCSI_PARAM_LU_RESET_TMO, 0);
 iscsi_session_attr(tgt_reset_tmo, ISCSI_PARAM_TGT_RESET_TMO, 0);
+iscsi_session_attr(cmdsn, ISCSI_PARAM_CMDSN, 0);
 iscsi_session_attr(ifacename, ISCSI_PARAM_IFACE_NAME, 0);
 iscsi_session_attr(initiatorname, ISCSI_PARAM_INITIATOR_NAME, 0)
 
@@ -2004,6 +2050,7 @@ iscsi_register_transport(struct iscsi_transport *tt)
 	SETUP_SESSION_RD_ATTR(abort_tmo, ISCSI_ABORT_TMO);
 	SETUP_SESSION_RD_ATTR(lu_reset_tmo,ISCSI_LU_RESET_TMO);
 	SETUP_SESSION_RD_ATTR(tgt_reset_tmo,ISCSI_TGT_RESET_TMO);
+	SETUP_SESSION_RD_ATTR(cmdsn, ISCSI_CMDSN);
 	SETUP_SESSION_RD_ATTR(ifacename, ISCSI_IFACE_NAME);
 	SETUP_SESSION_RD_ATTR(initiatorname, ISCSI_INITIATOR_NAME);
 	SETUP_PRIV_SESSION_RD_ATTR(recovery_tmo);
@@ -2122,6 +2169,8 @@ static void __exit iscsi_transport_exit(void)
 	transport_class_unregister(&iscsi_host_class);
 	class_unregister(&iscsi_endpoint_class);
 	class_unregister(&iscsi_transport_class);
+	/* wait for the session/conn frees queued by their release fns */
+	rcu_barrier();
 }
 
 module_init(iscsi_transport_init);
@@ -25,6 +25,7 @@
 
 #include <linux/device.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
 #include <linux/mutex.h>
 #include "iscsi_if.h"
 
@@ -124,6 +125,8 @@ struct iscsi_transport {
 			 unsigned int count);
 	void (*parse_pdu_itt) (struct iscsi_conn *conn, itt_t itt,
 			       int *index, int *age);
+	void (*suspend_rx) (struct iscsi_conn *conn);
+	void (*resume_rx) (struct iscsi_conn *conn);
 
 	void (*session_recovery_timedout) (struct iscsi_cls_session *session);
 	struct iscsi_endpoint *(*ep_connect) (struct Scsi_Host *shost,
@@ -155,13 +158,14 @@ extern int iscsi_offload_mesg(struct Scsi_Host *shost,
 			      char *data, uint16_t data_size);
 
 struct iscsi_cls_conn {
-	struct list_head conn_list;	/* item in connlist */
+	struct hlist_node conn_list;	/* item in connhash */
 	void *dd_data;			/* LLD private data */
 	struct iscsi_transport *transport;
 	uint32_t cid;			/* connection id */
 
 	int active;			/* must be accessed with the connlock */
 	struct device dev;		/* sysfs transport/container device */
+	struct rcu_head rcu;		/* deferred free for connhash walkers */
 };
 
 #define iscsi_dev_to_conn(_dev) \
@@ -180,7 +184,7 @@ enum {
 #define ISCSI_MAX_TARGET -1
 
 struct iscsi_cls_session {
-	struct list_head sess_list;		/* item in session_list */
+	struct hlist_node sess_list;		/* item in sesshash */
 	struct iscsi_transport *transport;
 	spinlock_t lock;
 	struct work_struct block_work;
@@ -198,6 +202,7 @@ struct iscsi_cls_session {
 	int sid;				/* session id */
 	void *dd_data;				/* LLD private data */
 	struct device dev;	/* sysfs transport/container device */
+	struct rcu_head rcu;	/* deferred free for sesshash walkers */
 };
 
 #define iscsi_dev_to_session(_dev) \
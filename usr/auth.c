@@ -27,14 +27,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
 
 #include "sysdeps.h"
 #include "auth.h"
 #include "initiator.h"
 #include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
 #include "log.h"
 
 static const char acl_hexstring[] = "0123456789abcdefABCDEF";
@@ -43,33 +49,266 @@ static const char acl_base64_string[] =
 static const char acl_authmethod_set_chap_alg_list[] = "CHAP";
 static const char acl_reject_option_name[] = "Reject";
 
-void auth_md5_init(struct MD5Context *);
-void auth_md5_update(struct MD5Context *, unsigned char *, unsigned int);
-void auth_md5_final(unsigned char *, struct MD5Context *);
 void get_random_bytes(unsigned char *data, unsigned int length);
 size_t strlcpy(char *, const char *, size_t);
 size_t strlcat(char *, const char *, size_t);
 
+static void
+auth_md5_init(void *ctx)
+{
+	MD5Init(ctx);
+}
+
+static void
+auth_md5_update(void *ctx, const unsigned char *data, unsigned int length)
+{
+	MD5Update(ctx, data, length);
+}
+
+static void
+auth_md5_final(void *ctx, unsigned char *hash)
+{
+	MD5Final(hash, ctx);
+}
+
+/*
+ * CHAP hash backends.
+ *
+ * A CHAP response is computed by the kernel crypto API through an AF_ALG
+ * socket when the kernel offers the hash, so any CPU-accelerated driver it
+ * has registered is used.  If the socket cannot be set up, or fails later
+ * on, the builtin implementation is used from then on.
+ */
+enum {
+	AUTH_HASH_ALG_UNTRIED = -1,
+	AUTH_HASH_ALG_NONE = -2,
+};
+
+union auth_hash_ctx {
+	struct MD5Context md5;
+	struct sha1_ctx sha1;
+	struct sha256_ctx sha256;
+};
+
+struct auth_hash {
+	int chap_alg;
+	const char *name;
+	const char *alg_name;
+	unsigned int digest_len;
+	void (*init)(void *ctx);
+	void (*update)(void *ctx, const unsigned char *data,
+		       unsigned int length);
+	void (*final)(void *ctx, unsigned char *hash);
+	int alg_fd;
+	pid_t alg_pid;
+};
+
+static struct auth_hash auth_hashes[] = {
+	{
+		.chap_alg = AUTH_CHAP_ALG_MD5,
+		.name = "MD5",
+		.alg_name = "md5",
+		.digest_len = AUTH_CHAP_RSP_LEN,
+		.init = auth_md5_init,
+		.update = auth_md5_update,
+		.final = auth_md5_final,
+		.alg_fd = AUTH_HASH_ALG_UNTRIED,
+	},
+	{
+		.chap_alg = AUTH_CHAP_ALG_SHA1,
+		.name = "SHA1",
+		.alg_name = "sha1",
+		.digest_len = SHA1_DIGEST_SIZE,
+		.init = sha1_init,
+		.update = sha1_update,
+		.final = sha1_final,
+		.alg_fd = AUTH_HASH_ALG_UNTRIED,
+	},
+	{
+		.chap_alg = AUTH_CHAP_ALG_SHA256,
+		.name = "SHA256",
+		.alg_name = "sha256",
+		.digest_len = SHA256_DIGEST_SIZE,
+		.init = sha256_init,
+		.update = sha256_update,
+		.final = sha256_final,
+		.alg_fd = AUTH_HASH_ALG_UNTRIED,
+	},
+};
+
+static struct auth_hash *
+acl_get_hash(int chap_alg)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(auth_hashes) / sizeof(auth_hashes[0]); i++)
+		if (auth_hashes[i].chap_alg == chap_alg)
+			return &auth_hashes[i];
+	return NULL;
+}
+
+static unsigned int
+acl_chap_rsp_len(struct iscsi_acl *client)
+{
+	struct auth_hash *hash = acl_get_hash(client->negotiated_chap_alg);
+
+	return hash ? hash->digest_len : AUTH_CHAP_RSP_LEN;
+}
+
+static int
+acl_hash_alg_open(struct auth_hash *hash)
+{
+	struct sockaddr_alg sa;
+	int tfm_fd, op_fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strcpy((char *)sa.salg_type, "hash");
+	strlcpy((char *)sa.salg_name, hash->alg_name, sizeof(sa.salg_name));
+
+	tfm_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (tfm_fd < 0)
+		return -1;
+
+	if (bind(tfm_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(tfm_fd);
+		return -1;
+	}
+
+	/* the op socket holds its own reference on the transform */
+	op_fd = accept4(tfm_fd, NULL, NULL, SOCK_CLOEXEC);
+	close(tfm_fd);
+	return op_fd;
+}
+
+static int
+acl_hash_alg(struct auth_hash *hash, struct iovec *iov, int iov_count,
+	     unsigned char *out_data)
+{
+	struct msghdr msg;
+	pid_t pid = getpid();
+
+	if (hash->alg_fd == AUTH_HASH_ALG_NONE)
+		return -1;
+
+	/* do not share an op socket inherited across fork() */
+	if (hash->alg_fd >= 0 && hash->alg_pid != pid) {
+		close(hash->alg_fd);
+		hash->alg_fd = AUTH_HASH_ALG_UNTRIED;
+	}
+
+	if (hash->alg_fd == AUTH_HASH_ALG_UNTRIED) {
+		hash->alg_fd = acl_hash_alg_open(hash);
+		if (hash->alg_fd < 0) {
+			log_debug(3, "kernel %s hash not available (%d), "
+				  "using builtin", hash->alg_name, errno);
+			hash->alg_fd = AUTH_HASH_ALG_NONE;
+			return -1;
+		}
+		hash->alg_pid = pid;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov_count;
+
+	if (sendmsg(hash->alg_fd, &msg, 0) < 0 ||
+	    read(hash->alg_fd, out_data, hash->digest_len) !=
+	    hash->digest_len) {
+		log_debug(1, "kernel %s hash failed (%d), using builtin",
+			  hash->alg_name, errno);
+		close(hash->alg_fd);
+		hash->alg_fd = AUTH_HASH_ALG_NONE;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Compute hash(id | secret | challenge) with the hash for chap_alg.
+ * Returns the digest length, or 0 if chap_alg is not supported.
+ */
+static unsigned int
+acl_chap_hash(int chap_alg, unsigned int id, unsigned char *secret,
+	      unsigned int secret_length, unsigned char *challenge_data,
+	      unsigned int challenge_length, unsigned char *out_data)
+{
+	struct auth_hash *hash = acl_get_hash(chap_alg);
+	union auth_hash_ctx context;
+	unsigned char id_data[1];
+	struct iovec iov[3];
+
+	if (!hash)
+		return 0;
+
+	id_data[0] = id;
+	iov[0].iov_base = id_data;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = secret;
+	iov[1].iov_len = secret_length;
+	iov[2].iov_base = challenge_data;
+	iov[2].iov_len = challenge_length;
+
+	if (!acl_hash_alg(hash, iov, 3, out_data))
+		return hash->digest_len;
+
+	hash->init(&context);
+	hash->update(&context, id_data, 1);
+	hash->update(&context, secret, secret_length);
+	hash->update(&context, challenge_data, challenge_length);
+	hash->final(&context, out_data);
+	memset(&context, 0, sizeof(context));
+
+	return hash->digest_len;
+}
+
+/*
+ * Parse a comma separated list of CHAP algorithm names, e.g.
+ * "SHA256,SHA1,MD5", in order of preference.  An empty list selects MD5.
+ * Returns the number of algorithms, or -1 if a name is not known.
+ */
+int
+acl_parse_chap_algs(const char *algs, int *chap_alg_list,
+		    unsigned int max_count)
+{
+	char buf[AUTH_CHAP_ALGS_MAXLEN];
+	char *name, *next;
+	unsigned int count = 0, i;
+
+	strlcpy(buf, algs, sizeof(buf));
+	for (next = buf; (name = strsep(&next, ", ")); ) {
+		if (!*name)
+			continue;
+
+		for (i = 0; i < sizeof(auth_hashes) / sizeof(auth_hashes[0]);
+		     i++)
+			if (!strcasecmp(name, auth_hashes[i].name))
+				break;
+		if (i == sizeof(auth_hashes) / sizeof(auth_hashes[0]))
+			return -1;
+
+		if (count < max_count)
+			chap_alg_list[count++] = auth_hashes[i].chap_alg;
+	}
+
+	if (!count && max_count)
+		chap_alg_list[count++] = AUTH_CHAP_ALG_MD5;
+	return count;
+}
+
 enum auth_dbg_status
 acl_chap_compute_rsp(struct iscsi_acl *client, int rmt_auth, unsigned int id,
 		     unsigned char *challenge_data,
 		     unsigned int challenge_length,
 		     unsigned char *response_data)
 {
-	unsigned char id_data[1];
-	struct MD5Context context;
 	unsigned char out_data[AUTH_STR_MAX_LEN];
 	unsigned int out_length = AUTH_STR_MAX_LEN;
+	unsigned int rsp_length;
 
 	if (!client->passwd_present)
 		return AUTH_DBG_STATUS_LOCAL_PASSWD_NOT_SET;
 
-	auth_md5_init(&context);
-
-	/* id byte */
-	id_data[0] = id;
-	auth_md5_update(&context, id_data, 1);
-
 	/* decrypt password */
 	if (acl_data(out_data, &out_length, client->passwd_data,
 		     client->passwd_length))
@@ -78,16 +317,15 @@ acl_chap_compute_rsp(struct iscsi_acl *client, int rmt_auth, unsigned int id,
 	if (!rmt_auth && !client->ip_sec && out_length < 12)
 		return AUTH_DBG_STATUS_PASSWD_TOO_SHORT_WITH_NO_IPSEC;
 
-	/* shared secret */
-	auth_md5_update(&context, out_data, out_length);
+	rsp_length = acl_chap_hash(client->negotiated_chap_alg, id,
+				   out_data, out_length, challenge_data,
+				   challenge_length, response_data);
 
 	/* clear decrypted password */
 	memset(out_data, 0, AUTH_STR_MAX_LEN);
 
-	/* challenge value */
-	auth_md5_update(&context, challenge_data, challenge_length);
-
-	auth_md5_final(response_data, &context);
+	if (!rsp_length)
+		return AUTH_DBG_STATUS_CHAP_ALG_BAD;
 
 	return AUTH_DBG_STATUS_NOT_SET;	/* no error */
 }
@@ -103,8 +341,8 @@ acl_chap_auth_request(struct iscsi_acl *client, char *username, unsigned int id,
 		      unsigned int rsp_length)
 {
 	iscsi_session_t *session = client->session_handle;
-	struct MD5Context context;
-	unsigned char verify_data[16];
+	unsigned char verify_data[AUTH_CHAP_RSP_MAX_LEN];
+	unsigned int verify_length;
 
 	/* the expected credentials are in the session */
 	if (session->username_in == NULL) {
@@ -130,30 +368,21 @@ acl_chap_auth_request(struct iscsi_acl *client, char *username, unsigned int id,
 
 	/* challenge length is I->T, and shouldn't need to be checked */
 
-	if (rsp_length != sizeof(verify_data)) {
+	if (rsp_length != acl_chap_rsp_len(client)) {
 		log_error("failing authentication, received incorrect "
 			  "CHAP response length %u from target %s",
 			  rsp_length, session->target_name);
 		return AUTH_STATUS_FAIL;
 	}
 
-	auth_md5_init(&context);
+	verify_length = acl_chap_hash(client->negotiated_chap_alg, id,
+				      (unsigned char *)session->password_in,
+				      session->password_in_length,
+				      challenge_data, challenge_length,
+				      verify_data);
 
-	/* id byte */
-	verify_data[0] = id;
-	auth_md5_update(&context, verify_data, 1);
-
-	/* shared secret */
-	auth_md5_update(&context, (unsigned char *)session->password_in,
-			session->password_in_length);
-
-	/* challenge value */
-	auth_md5_update(&context, (unsigned char *)challenge_data,
-			challenge_length);
-
-	auth_md5_final(verify_data, &context);
-
-	if (memcmp(response_data, verify_data, sizeof(verify_data)) == 0) {
+	if (verify_length &&
+	    memcmp(response_data, verify_data, verify_length) == 0) {
 		log_debug(1, "initiator authenticated target %s",
 			  session->target_name);
 		return AUTH_STATUS_PASS;
@@ -164,25 +393,6 @@ acl_chap_auth_request(struct iscsi_acl *client, char *username, unsigned int id,
 	return AUTH_STATUS_FAIL;
 }
 
-void
-auth_md5_init(struct MD5Context *context)
-{
-	MD5Init(context);
-}
-
-void
-auth_md5_update(struct MD5Context *context, unsigned char *data,
-		unsigned int length)
-{
-	MD5Update(context, data, length);
-}
-
-void
-auth_md5_final(unsigned char *hash, struct MD5Context *context)
-{
-	MD5Final(hash, context);
-}
-
 void
 get_random_bytes(unsigned char *data, unsigned int length)
 {
@@ -301,7 +511,7 @@ static int
 acl_chk_chap_alg_optn(int chap_algorithm)
 {
 	if (chap_algorithm == AUTH_OPTION_NONE ||
-	    chap_algorithm == AUTH_CHAP_ALG_MD5)
+	    acl_get_hash(chap_algorithm))
 		return 0;
 
 	return 1;
@@ -816,7 +1026,7 @@ static void
 acl_local_auth(struct iscsi_acl *client)
 {
 	unsigned int chap_identifier;
-	unsigned char response_data[AUTH_CHAP_RSP_LEN];
+	unsigned char response_data[AUTH_CHAP_RSP_MAX_LEN];
 	unsigned long number;
 	int status;
 	enum auth_dbg_status dbg_status;
@@ -848,7 +1058,7 @@ acl_local_auth(struct iscsi_acl *client)
 			client->local_state = AUTH_LOCAL_STATE_ERROR;
 			client->dbg_status = AUTH_DBG_STATUS_CHAP_ALG_REJECT;
 			break;
-		} else if (client->negotiated_chap_alg != AUTH_CHAP_ALG_MD5) {
+		} else if (!acl_get_hash(client->negotiated_chap_alg)) {
 			client->local_state = AUTH_LOCAL_STATE_ERROR;
 			client->dbg_status = AUTH_DBG_STATUS_CHAP_ALG_BAD;
 			break;
@@ -924,7 +1134,8 @@ acl_local_auth(struct iscsi_acl *client)
 		}
 
 		acl_data_to_text(response_data,
-				 AUTH_CHAP_RSP_LEN, client->scratch_key_value,
+				 acl_chap_rsp_len(client),
+				 client->scratch_key_value,
 				 AUTH_STR_MAX_LEN);
 		acl_set_key_value(&client->send_key_block,
 				  AUTH_KEY_TYPE_CHAP_RSP,
@@ -949,7 +1160,7 @@ acl_rmt_auth(struct iscsi_acl *client)
 	unsigned char id_data[1];
 	unsigned char response_data[AUTH_STR_MAX_LEN];
 	unsigned int rsp_len = AUTH_STR_MAX_LEN;
-	unsigned char my_rsp_data[AUTH_CHAP_RSP_LEN];
+	unsigned char my_rsp_data[AUTH_CHAP_RSP_MAX_LEN];
 	int status;
 	enum auth_dbg_status dbg_status;
 	const char *chap_rsp_key_val;
@@ -977,7 +1188,12 @@ acl_rmt_auth(struct iscsi_acl *client)
 				  AUTH_KEY_TYPE_CHAP_IDENTIFIER,
 				  client->scratch_key_value);
 
+		/* never send a challenge shorter than the digest */
 		client->send_chap_challenge.length = client->chap_challenge_len;
+		if (client->send_chap_challenge.length <
+		    acl_chap_rsp_len(client))
+			client->send_chap_challenge.length =
+						acl_chap_rsp_len(client);
 		get_random_bytes(client->send_chap_challenge.large_binary,
 				 client->send_chap_challenge.length);
 		acl_set_key_value(&client->send_key_block,
@@ -1012,7 +1228,7 @@ acl_rmt_auth(struct iscsi_acl *client)
 			break;
 		}
 
-		if (rsp_len == AUTH_CHAP_RSP_LEN) {
+		if (rsp_len == acl_chap_rsp_len(client)) {
 			dbg_status = acl_chap_compute_rsp(client, 1,
 							  client->send_chap_identifier,
 							  client->send_chap_challenge.large_binary,
@@ -1020,8 +1236,7 @@ acl_rmt_auth(struct iscsi_acl *client)
 							  my_rsp_data);
 
 			if (dbg_status == AUTH_DBG_STATUS_NOT_SET &&
-			    memcmp(my_rsp_data, response_data,
-				   AUTH_CHAP_RSP_LEN) == 0) {
+			    memcmp(my_rsp_data, response_data, rsp_len) == 0) {
 				client->rmt_state = AUTH_RMT_STATE_ERROR;
 				client->dbg_status = AUTH_DBG_STATUS_PASSWD_IDENTICAL;
 				break;
@@ -1752,7 +1967,7 @@ acl_chk_chap_alg_list(unsigned int option_count, const int *option_list)
 	return 0;
 }
 
-static int
+int
 acl_set_chap_alg_list(struct iscsi_acl *client, unsigned int option_count,
 		      const int *option_list)
 {
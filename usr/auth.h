@@ -30,6 +30,8 @@ enum {
 	AUTH_RECV_END_MAX_COUNT = 10,
 	ACL_SIGNATURE = 0x5984B2E3,
 	AUTH_CHAP_RSP_LEN = 16,
+	AUTH_CHAP_RSP_MAX_LEN = 32,
+	AUTH_CHAP_ALGS_MAXLEN = 32,
 };
 
 /*
@@ -61,7 +63,9 @@ enum {
 	AUTH_METHOD_MAX_COUNT = 2,
 
 	AUTH_CHAP_ALG_MD5 = 5,
-	AUTH_CHAP_ALG_MAX_COUNT = 2
+	AUTH_CHAP_ALG_SHA1 = 6,
+	AUTH_CHAP_ALG_SHA256 = 7,
+	AUTH_CHAP_ALG_MAX_COUNT = 4
 };
 
 enum auth_neg_role {
@@ -266,6 +270,11 @@ extern int acl_set_passwd(struct iscsi_acl *client,
 			  const unsigned char *pw_data, unsigned int pw_len);
 extern int acl_set_auth_rmt(struct iscsi_acl *client, int auth_rmt);
 extern int acl_set_ip_sec(struct iscsi_acl *client, int ip_sec);
+extern int acl_set_chap_alg_list(struct iscsi_acl *client,
+				 unsigned int option_count,
+				 const int *option_list);
+extern int acl_parse_chap_algs(const char *algs, int *chap_alg_list,
+			       unsigned int max_count);
 extern int acl_get_dbg_status(struct iscsi_acl *client, int *value);
 extern const char *acl_dbg_status_to_text(int dbg_status);
 extern enum auth_dbg_status acl_chap_compute_rsp(struct iscsi_acl *client,
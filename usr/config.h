@@ -58,6 +58,7 @@ struct iscsi_auth_config {
 	char username_in[AUTH_STR_MAX_LEN];
 	unsigned char password_in[AUTH_STR_MAX_LEN];
 	unsigned int password_in_length;
+	char chap_algs[AUTH_CHAP_ALGS_MAXLEN];
 };
 
 /* all per-connection timeouts go in this structure.
@@ -544,48 +544,105 @@ iterate_targets(iscsi_session_t *session, uint32_t ttt)
 	return 1;
 }
 
-static int add_portal(struct list_head *rec_list, discovery_rec_t *drec,
-		      char *targetname, char *address, char *port, char *tag)
+/*
+ * SendTargets responses are parsed as each Text PDU arrives. Targets and
+ * portals are kept as small records. They are turned into node_recs only
+ * when the exchange has completed, so arrays that report thousands of
+ * targets do not hold the whole response text or a full node_rec per
+ * portal while the exchange runs. Only a key=value pair that spans a
+ * PDU boundary is copied.
+ */
+struct st_portal {
+	struct list_head list;
+	int port;
+	int tpgt;
+	char address[];
+};
+
+struct st_target {
+	struct list_head list;
+	struct list_head portals;
+	/* sent a TargetAddress, even one that was skipped */
+	int has_address;
+	char name[];
+};
+
+struct st_parser {
+	/* key=value pair split across PDUs */
+	struct str_buffer partial;
+	/* target whose TargetAddress keys are being parsed */
+	struct st_target *target;
+	struct list_head targets;
+	int num_portals;
+};
+
+static void st_parser_reset(struct st_parser *parser)
 {
-	struct sockaddr_storage ss;
-	struct node_rec *rec;
+	struct st_target *target, *tmp_target;
+	struct st_portal *portal, *tmp_portal;
+
+	list_for_each_entry_safe(target, tmp_target, &parser->targets, list) {
+		list_for_each_entry_safe(portal, tmp_portal, &target->portals,
+					 list) {
+			list_del(&portal->list);
+			free(portal);
+		}
+		list_del(&target->list);
+		free(target);
+	}
+	str_truncate_buffer(&parser->partial, 0);
+	parser->target = NULL;
+	parser->num_portals = 0;
+}
 
-	if (resolve_address(address, port, &ss)) {
-		log_error("cannot resolve %s", address);
-		return 0;
+static void st_parser_init(struct st_parser *parser)
+{
+	memset(parser, 0, sizeof(*parser));
+	str_init_buffer(&parser->partial, 0);
+	INIT_LIST_HEAD(&parser->targets);
+}
+
+static void st_parser_free(struct st_parser *parser)
+{
+	st_parser_reset(parser);
+	str_free_buffer(&parser->partial);
+}
+
+static int st_add_portal(struct st_parser *parser, char *address, char *port,
+			 char *tag)
+{
+	struct st_portal *portal;
+	size_t len = strlen(address);
+
+	if (len >= NI_MAXHOST) {
+		log_error("TargetAddress %s too long, ignoring", address);
+		return 1;
 	}
 
-	rec = calloc(1, sizeof(*rec));
-	if (!rec)
+	portal = calloc(1, sizeof(*portal) + len + 1);
+	if (!portal)
 		return 0;
 
-	idbm_node_setup_from_conf(rec);
-	rec->disc_type = drec->type;
-	rec->disc_port = drec->port;
-	strcpy(rec->disc_address, drec->address);
-
-	strlcpy(rec->name, targetname, TARGET_NAME_MAXLEN);
+	memcpy(portal->address, address, len + 1);
 	if (tag && *tag)
-		rec->tpgt = atoi(tag);
+		portal->tpgt = atoi(tag);
 	else
-		rec->tpgt = PORTAL_GROUP_TAG_UNKNOWN;
+		portal->tpgt = PORTAL_GROUP_TAG_UNKNOWN;
 	if (port && *port)
-		rec->conn[0].port = atoi(port);
+		portal->port = atoi(port);
 	else
-		rec->conn[0].port = ISCSI_LISTEN_PORT;
-	strlcpy(rec->conn[0].address, address, NI_MAXHOST);
+		portal->port = ISCSI_LISTEN_PORT;
 
-	list_add_tail(&rec->list, rec_list);
+	list_add_tail(&portal->list, &parser->target->portals);
+	parser->num_portals++;
 	return 1;
 }
 
-static int
-add_target_record(char *name, char *end, discovery_rec_t *drec,
-		  struct list_head *rec_list)
+static int st_parse_address(struct st_parser *parser, char *address)
 {
-	char *text = NULL;
-	char *nul = name;
-	size_t length;
+	char *port = NULL;
+	char *tag = NULL;
+	char *temp;
 
 	/* address = IPv4
 	 * address = [IPv6]
@@ -600,198 +657,212 @@ add_target_record(char *name, char *end, discovery_rec_t *drec,
 	 * address = [IPv6]:port,tag
 	 * address = DNSname:port,tag
 	 */
+	if ((tag = strrchr(address, ','))) {
+		*tag = '\0';
+		tag++;
+	}
 
-	log_debug(7, "adding target record %p, end %p", name, end);
-
-	/* find the end of the name */
-	while ((nul < end) && (*nul != '\0'))
-		nul++;
-
-	length = nul - name;
-	if (length > TARGET_NAME_MAXLEN) {
-		log_error("TargetName %s too long, ignoring", name);
-		return 0;
+	if (*address == '[') {
+		address++;
+		if ((temp = strchr(address, ']'))) {
+			*temp = '\0';
+			if (temp[1] == ':')
+				port = temp + 2;
+		}
+	} else if ((port = strrchr(address, ':'))) {
+		*port = '\0';
+		port++;
 	}
-	text = name + length;
 
-	/* skip NULs after the name */
-	while ((text < end) && (*text == '\0'))
-		text++;
+	return st_add_portal(parser, address, port, tag);
+}
 
-	/* if no address is provided, use the default */
-	if (text >= end) {
-		if (drec->address == NULL) {
-			log_error("no default address known for target %s",
-				  name);
-			return 0;
-		} else {
-			char default_port[NI_MAXSERV];
-
-			sprintf(default_port, "%d", drec->port);
-			if (!add_portal(rec_list, drec, name, drec->address,
-				        default_port, NULL)) {
-				log_error("failed to add default portal, "
-					  "ignoring target %s", name);
-				return 0;
-			}
-		}
-		/* finished adding the default */
+/* a target without a TargetAddress is reached through the discovery portal */
+static int st_end_target(struct st_parser *parser, discovery_rec_t *drec)
+{
+	struct st_target *target = parser->target;
+	char default_port[NI_MAXSERV];
+
+	if (!target || target->has_address)
 		return 1;
+
+	if (!drec->address[0]) {
+		log_error("no default address known for target %s",
+			  target->name);
+		return 0;
 	}
 
-	/* process TargetAddresses */
-	while (text < end) {
-		char *next = text + strlen(text) + 1;
+	sprintf(default_port, "%d", drec->port);
+	if (!st_add_portal(parser, drec->address, default_port, NULL)) {
+		log_error("failed to add default portal, ignoring target %s",
+			  target->name);
+		return 0;
+	}
+	return 1;
+}
 
-		log_debug(7, "text %p, next %p, end %p, %s", text, next, end,
-			 text);
+static int st_parse_pair(struct st_parser *parser, discovery_rec_t *drec,
+			 char *text)
+{
+	struct st_target *target;
+	size_t length;
 
-		if (strncmp(text, "TargetAddress=", 14) == 0) {
-			char *port = NULL;
-			char *tag = NULL;
-			char *address = text + 14;
-			char *temp;
+	log_debug(7, "processing sendtargets line %s", text);
 
-			if ((tag = strrchr(text, ','))) {
-				*tag = '\0';
-				tag++;
-			}
-			if ((port = strrchr(text, ':'))) {
-				*port = '\0';
-				port++;
-			}
+	if (strncmp(text, "TargetName=", 11) == 0) {
+		if (!st_end_target(parser, drec))
+			return 0;
+		parser->target = NULL;
 
-			if (*address == '[') {
-				address++;
-				if ((temp = strrchr(text, ']')))
-					*temp = '\0';
-			}
+		text += 11;
+		length = strlen(text);
+		if (length > TARGET_NAME_MAXLEN) {
+			log_error("TargetName %s too long, ignoring", text);
+			return 1;
+		}
 
-			if (!add_portal(rec_list, drec, name, address, port,
-					tag)) {
-				log_error("failed to add default portal, "
-					 "ignoring target %s", name);
-				return 0;
-			}
-		} else
-			log_error("unexpected SendTargets data: %s",
-			       text);
-		text = next;
-	}
+		target = calloc(1, sizeof(*target) + length + 1);
+		if (!target)
+			return 0;
+		INIT_LIST_HEAD(&target->portals);
+		memcpy(target->name, text, length + 1);
+		list_add_tail(&target->list, &parser->targets);
+		parser->target = target;
+	} else if (strncmp(text, "TargetAddress=", 14) == 0) {
+		/* belongs to a target we skipped or never saw */
+		if (!parser->target)
+			return 1;
+
+		parser->target->has_address = 1;
+		if (!st_parse_address(parser, text + 14)) {
+			log_error("failed to add portal %s for target %s",
+				  text + 14, parser->target->name);
+			return 0;
+		}
+	} else
+		log_error("unexpected SendTargets data: %s", text);
 
 	return 1;
 }
 
-static int
-process_sendtargets_response(struct str_buffer *sendtargets,
-			     int final, discovery_rec_t *drec,
-			     struct list_head *rec_list)
+static int st_append_partial(struct st_parser *parser, char *data, size_t len)
 {
-	char *start = str_buffer_data(sendtargets);
-	char *text = start;
-	char *end = text + str_data_length(sendtargets);
-	char *nul = end - 1;
-	char *record = NULL;
-	int num_targets = 0;
-
-	if (start == end) {
-		/* no SendTargets data */
-		goto done;
+	size_t curr_len = str_data_length(&parser->partial);
+
+	if (str_enlarge_data(&parser->partial, len)) {
+		log_error("Could not allocate memory to process SendTargets "
+			  "response.");
+		return 0;
 	}
+	memcpy(str_buffer_data(&parser->partial) + curr_len, data, len);
+	return 1;
+}
 
-	/* scan backwards to find the last NUL in the data, to ensure we
-	 * don't walk off the end.  Since key=value pairs can span PDU
-	 * boundaries, we're not guaranteed that the end of the data has a
-	 * NUL.
-	 */
-	while ((nul > start) && *nul)
-		nul--;
+/*
+ * Parse the key=value pairs in one Text response PDU. Complete pairs are
+ * parsed in place; only the trailing piece of a pair that continues in
+ * the next PDU is saved.
+ */
+static int st_parser_feed(struct st_parser *parser, discovery_rec_t *drec,
+			  char *data, size_t len, int final)
+{
+	char *text = data;
+	char *end = data + len;
+	char *nul;
 
-	if (nul == start) {
-		/* couldn't find anything we can process now,
-		 * it's one big partial string
-		 */
-		goto done;
+	while (text < end) {
+		nul = memchr(text, '\0', end - text);
+		if (!nul) {
+			if (!st_append_partial(parser, text, end - text))
+				return 0;
+			break;
+		}
+
+		if (str_data_length(&parser->partial)) {
+			if (!st_append_partial(parser, text, nul - text + 1))
+				return 0;
+			if (!st_parse_pair(parser, drec,
+					   str_buffer_data(&parser->partial)))
+				return 0;
+			str_truncate_buffer(&parser->partial, 0);
+		} else if (nul > text) {
+			if (!st_parse_pair(parser, drec, text))
+				return 0;
+		}
+		text = nul + 1;
 	}
 
-	/* find the boundaries between target records (TargetName or final PDU)
+	if (!final)
+		return 1;
+
+	/* if this is the last PDU of the text sequence, it also ends the
+	 * last key=value pair and target record
 	 */
-	for (;;) {
-		/* skip NULs */
-		while ((text < nul) && (*text == '\0'))
-			text++;
+	if (str_data_length(&parser->partial)) {
+		if (!st_append_partial(parser, "", 1))
+			return 0;
+		if (!st_parse_pair(parser, drec,
+				   str_buffer_data(&parser->partial)))
+			return 0;
+		str_truncate_buffer(&parser->partial, 0);
+	}
+	return st_end_target(parser, drec);
+}
 
-		if (text == nul)
-			break;
+/*
+ * Turn the parsed portals into node records one at a time. Each record is
+ * built in the same buffer from a copy of the config defaults, which are
+ * loaded once, and is handed to rec_fn before the next one is built.
+ */
+static int st_parser_to_recs(struct st_parser *parser, discovery_rec_t *drec,
+			     idbm_disc_rec_fn *rec_fn, void *rec_data)
+{
+	struct st_target *target;
+	struct st_portal *portal;
+	struct sockaddr_storage ss;
+	char port[NI_MAXSERV];
+	struct node_rec *tmpl, *rec;
+	int rc = 0;
 
-		log_debug(7,
-			 "processing sendtargets record %p, text %p, line %s",
-			 record, text, text);
+	if (list_empty(&parser->targets))
+		return 0;
 
-		/* look for the start of a new target record */
-		if (strncmp(text, "TargetName=", 11) == 0) {
-			if (record) {
-				/* send the last record, which we just found
-				 * the end of. don't bother passing the
-				 * "TargetName=" prefix.
-				 */
-				if (!add_target_record(record + 11, text,
-							drec, rec_list)) {
-					log_error(
-					       "failed to add target record");
-					str_truncate_buffer(sendtargets, 0);
-					goto done;
-				}
-				num_targets++;
+	tmpl = calloc(2, sizeof(*tmpl));
+	if (!tmpl)
+		return ISCSI_ERR_NOMEM;
+	rec = tmpl + 1;
+
+	idbm_node_setup_from_conf(tmpl);
+	tmpl->disc_type = drec->type;
+	tmpl->disc_port = drec->port;
+	strcpy(tmpl->disc_address, drec->address);
+
+	list_for_each_entry(target, &parser->targets, list) {
+		list_for_each_entry(portal, &target->portals, list) {
+			sprintf(port, "%d", portal->port);
+			if (resolve_address(portal->address, port, &ss)) {
+				log_error("cannot resolve %s", portal->address);
+				continue;
 			}
-			record = text;
-		}
 
-		/* everything up til the next NUL must be part of the
-		 * current target record
-		 */
-		while ((text < nul) && (*text != '\0'))
-			text++;
-	}
+			memcpy(rec, tmpl, sizeof(*rec));
+			INIT_LIST_HEAD(&rec->list);
 
-	if (record) {
-		if (final) {
-			/* if this is the last PDU of the text sequence,
-			 * it also ends a target record
-			 */
-			log_debug(7,
-				 "processing final sendtargets record %p, "
-				 "line %s",
-				 record, record);
-			if (add_target_record (record + 11, text,
-					       drec, rec_list)) {
-				num_targets++;
-				record = NULL;
-				str_truncate_buffer(sendtargets, 0);
-			} else {
-				log_error("failed to add target record");
-				str_truncate_buffer(sendtargets, 0);
+			strlcpy(rec->name, target->name, TARGET_NAME_MAXLEN);
+			rec->tpgt = portal->tpgt;
+			rec->conn[0].port = portal->port;
+			strlcpy(rec->conn[0].address, portal->address,
+				NI_MAXHOST);
+
+			rc = rec_fn(rec_data, rec);
+			if (rc)
 				goto done;
-			}
-		} else {
-			/* remove the parts of the sendtargets buffer we've
-			 * processed, and move the parts we haven't to the
-			 * beginning of the buffer.
-			 */
-			log_debug(7,
-				 "processed %d bytes of sendtargets data, "
-				 "%d remaining",
-				 (int)(record - str_buffer_data(sendtargets)),
-				 (int)(str_buffer_data(sendtargets) +
-				 str_data_length(sendtargets) - record));
-			str_remove_initial(sendtargets,
-					   record - str_buffer_data(sendtargets));
 		}
 	}
 
-      done:
-
-	return 1;
+done:
+	free(tmpl);
+	return rc;
 }
 
 static void iscsi_free_session(struct iscsi_session *session)
@@ -836,13 +907,17 @@ iscsi_alloc_session(struct iscsi_sendtargets_config *config,
 	iscsi_copy_operational_params(&session->conn[0], &config->session_conf,
 				      &config->conn_conf);
 
-	/* OUI and uniqifying number */
+	/*
+	 * OUI and uniqifying number. Discovery through several ifaces runs
+	 * in parallel worker processes, so use the pid to keep their
+	 * sessions to the same portal from reinstating each other.
+	 */
 	session->isid[0] = DRIVER_ISID_0;
 	session->isid[1] = DRIVER_ISID_1;
 	session->isid[2] = DRIVER_ISID_2;
-	session->isid[3] = 0;
-	session->isid[4] = 0;
-	session->isid[5] = 0;
+	session->isid[3] = (getpid() >> 16) & 0xff;
+	session->isid[4] = (getpid() >>  8) & 0xff;
+	session->isid[5] = getpid() & 0xff;
 
 	if (strlen(iface->iname)) {
 		strcpy(initiator_name, iface->iname);
@@ -884,9 +959,8 @@ fail:
 static int
 process_recvd_pdu(struct iscsi_hdr *pdu,
 		  discovery_rec_t *drec,
-		  struct list_head *rec_list,
 		  iscsi_session_t *session,
-		  struct str_buffer *sendtargets,
+		  struct st_parser *parser,
 		  int *active,
 		  int *valid_text,
 		  char *data)
@@ -901,7 +975,6 @@ process_recvd_pdu(struct iscsi_hdr *pdu,
 			int final =
 				(text_response->flags & ISCSI_FLAG_CMD_FINAL) ||
 				(text_response-> ttt == ISCSI_RESERVED_TAG);
-			size_t curr_data_length;
 
 			log_debug(4, "discovery session to %s:%d received text"
 				 " response, %d data bytes, ttt 0x%x, "
@@ -912,26 +985,16 @@ process_recvd_pdu(struct iscsi_hdr *pdu,
 				 ntohl(text_response->ttt),
 				 text_response->flags & ISCSI_FLAG_CMD_FINAL);
 
-			/* mark how much more data in the sendtargets
-			 * buffer is now valid
-			 */
-			curr_data_length = str_data_length(sendtargets);
-			if (str_enlarge_data(sendtargets, dlength)) {
-				log_error("Could not allocate memory to "
-					  "process SendTargets response.");
-				rc = 0;
-				goto done;
-			}
-
-			memcpy(str_buffer_data(sendtargets) + curr_data_length,
-			       data, dlength);
-
 			*valid_text = 1;
 			/* process as much as we can right now */
-			process_sendtargets_response(sendtargets,
-						     final,
-						     drec,
-						     rec_list);
+			if (!st_parser_feed(parser, drec, data, dlength,
+					    final)) {
+				log_error("failed to process SendTargets "
+					  "response from %s:%d", drec->address,
+					  drec->port);
+				rc = ISCSI_ERR;
+				goto done;
+			}
 
 			if (final) {
 				/* SendTargets exchange is now complete
@@ -1549,8 +1612,12 @@ login_failed:
 	return rc;
 }
 
-int discovery_sendtargets(void *fndata, struct iface_rec *iface,
-			  struct list_head *rec_list)
+/*
+ * SendTargets discovery that hands each node record to rec_fn as it is
+ * built, instead of returning the whole list.
+ */
+int discovery_sendtargets_each(void *fndata, struct iface_rec *iface,
+			       idbm_disc_rec_fn *rec_fn, void *rec_data)
 {
 	discovery_rec_t *drec = fndata;
 	iscsi_session_t *session;
@@ -1562,7 +1629,7 @@ int discovery_sendtargets(void *fndata, struct iface_rec *iface,
 	struct timeval connection_timer;
 	int timeout;
 	int rc = 0;
-	struct str_buffer sendtargets;
+	struct st_parser parser;
 	unsigned int data_len;
 	struct iscsi_sendtargets_config *config = &drec->u.sendtargets;
 
@@ -1594,7 +1661,7 @@ int discovery_sendtargets(void *fndata, struct iface_rec *iface,
 	}
 	data_len = session->conn[0].max_recv_dlength;
 
-	str_init_buffer(&sendtargets, 0);
+	st_parser_init(&parser);
 
 	/* resolve the DiscoveryAddress to an IP address */
 	rc = iscsi_setup_portal(&session->conn[0], drec->address,
@@ -1614,8 +1681,8 @@ reconnect:
 	if (rc)
 		goto free_sendtargets;
 
-	/* reinitialize */
-	str_truncate_buffer(&sendtargets, 0);
+	/* reinitialize, the exchange starts over after a reconnect */
+	st_parser_reset(&parser);
 
 	/* ask for targets */
 	if (!request_targets(session)) {
@@ -1679,11 +1746,12 @@ repoll:
 			/*
 			 * process iSCSI PDU received
 			 */
-			rc = process_recvd_pdu(pdu, drec, rec_list,
-					       session, &sendtargets,
+			rc = process_recvd_pdu(pdu, drec, session, &parser,
 					       &active, &valid_text, data);
 			if (rc == DISCOVERY_NEED_RECONNECT)
 				goto reconnect;
+			else if (rc)
+				goto free_sendtargets;
 
 			/* reset timers after receiving a PDU */
 			if (active) {
@@ -1718,12 +1786,12 @@ repoll:
 		goto free_sendtargets;
 	}
 
-	log_debug(1, "discovery process to %s:%d exiting",
-		 drec->address, drec->port);
-	rc = 0;
+	log_debug(1, "discovery process to %s:%d exiting, found %d portals",
+		 drec->address, drec->port, parser.num_portals);
+	rc = st_parser_to_recs(&parser, drec, rec_fn, rec_data);
 
 free_sendtargets:
-	str_free_buffer(&sendtargets);
+	st_parser_free(&parser);
 	free(data);
 	iscsi_destroy_session(session);
 free_session:
@@ -1731,6 +1799,38 @@ free_session:
 	return rc;
 }
 
+static int st_rec_to_list(void *data, struct node_rec *rec)
+{
+	struct list_head *rec_list = data;
+	struct node_rec *copy;
+
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return ISCSI_ERR_NOMEM;
+
+	memcpy(copy, rec, sizeof(*copy));
+	INIT_LIST_HEAD(&copy->list);
+	list_add_tail(&copy->list, rec_list);
+	return 0;
+}
+
+int discovery_sendtargets(void *fndata, struct iface_rec *iface,
+			  struct list_head *rec_list)
+{
+	struct node_rec *rec, *tmp;
+	int rc;
+
+	rc = discovery_sendtargets_each(fndata, iface, st_rec_to_list,
+					rec_list);
+	if (rc) {
+		list_for_each_entry_safe(rec, tmp, rec_list, list) {
+			list_del(&rec->list);
+			free(rec);
+		}
+	}
+	return rc;
+}
+
 #ifdef SLP_ENABLE
 int
 slp_discovery(struct iscsi_slp_config *config)
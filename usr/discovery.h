@@ -38,6 +38,10 @@ extern int discovery_fw(void *data, struct iface_rec *iface,
 			struct list_head *rec_list);
 extern int discovery_sendtargets(void *data, struct iface_rec *iface,
 				 struct list_head *rec_list);
+extern int discovery_sendtargets_each(void *data, struct iface_rec *iface,
+				      int (*rec_fn)(void *data,
+						    struct node_rec *rec),
+				      void *rec_data);
 extern int discovery_offload_sendtargets(int host_no, int do_login,
 					 struct discovery_rec *drec);
 #endif /* DISCOVERY_H */
@@ -25,6 +25,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <time.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -36,6 +37,7 @@
 #include "log.h"
 #include "session_mgmt.h"
 #include "iscsi_util.h"
+#include "iscsi_sysfs.h"
 #include "event_poll.h"
 #include "iface.h"
 #include "session_mgmt.h"
@@ -122,32 +124,201 @@ static void setup_signal_handler(void)
 	sigaction(SIGTERM, &sa_new, &sa_old );
 }
 
+/*
+ * Portal index used by update_sessions() so reconciling the current and
+ * newly discovered target lists, and checking them against the running
+ * sessions, does not need a list walk or sysfs scan per portal.
+ *
+ * The hash covers the target name, portal and iface name. Entries in the
+ * same bucket are compared with __iscsi_match_session so matching works
+ * like idbm_find_rec_in_list.
+ */
+struct portal_index_entry {
+	struct portal_index_entry *next;
+	uint32_t hash;
+	void *data;
+};
+
+struct portal_index {
+	uint32_t mask;
+	unsigned int nr_entries, max_entries;
+	struct portal_index_entry **buckets;
+	struct portal_index_entry *entries;
+};
+
+static uint32_t portal_hash(const char *targetname, const char *address,
+			    int port, struct iface_rec *iface)
+{
+	uint32_t hash = 2166136261U;
+	const char *strs[3] = { targetname, address, iface->name };
+	const char *c;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		for (c = strs[i]; *c; c++) {
+			hash ^= (unsigned char)*c;
+			hash *= 16777619U;
+		}
+		/* field separator */
+		hash ^= 0xff;
+		hash *= 16777619U;
+	}
+	hash ^= port;
+	hash *= 16777619U;
+	return hash;
+}
+
+static uint32_t rec_hash(struct node_rec *rec)
+{
+	return portal_hash(rec->name, rec->conn[0].address, rec->conn[0].port,
+			   &rec->iface);
+}
+
+static uint32_t session_hash(struct session_info *info)
+{
+	return portal_hash(info->targetname, info->persistent_address,
+			   info->persistent_port, &info->iface);
+}
+
+static int portal_index_init(struct portal_index *idx,
+			     unsigned int max_entries)
+{
+	unsigned int size = 64;
+
+	while (size < max_entries)
+		size <<= 1;
+
+	memset(idx, 0, sizeof(*idx));
+	idx->buckets = calloc(size, sizeof(*idx->buckets));
+	idx->entries = calloc(max_entries ? max_entries : 1,
+			      sizeof(*idx->entries));
+	if (!idx->buckets || !idx->entries) {
+		free(idx->buckets);
+		free(idx->entries);
+		return ISCSI_ERR_NOMEM;
+	}
+	idx->mask = size - 1;
+	idx->max_entries = max_entries;
+	return 0;
+}
+
+static void portal_index_free(struct portal_index *idx)
+{
+	free(idx->buckets);
+	free(idx->entries);
+}
+
+static void portal_index_add(struct portal_index *idx, uint32_t hash,
+			     void *data)
+{
+	struct portal_index_entry *e;
+
+	if (idx->nr_entries == idx->max_entries)
+		return;
+
+	e = &idx->entries[idx->nr_entries++];
+	e->hash = hash;
+	e->data = data;
+	e->next = idx->buckets[hash & idx->mask];
+	idx->buckets[hash & idx->mask] = e;
+}
+
+/* find a node rec in the index matching the rec/session portal */
+static struct node_rec *portal_index_find_rec(struct portal_index *idx,
+					      uint32_t hash, char *targetname,
+					      char *address, int port,
+					      struct iface_rec *iface)
+{
+	struct portal_index_entry *e;
+
+	for (e = idx->buckets[hash & idx->mask]; e; e = e->next) {
+		if (e->hash == hash &&
+		    __iscsi_match_session(e->data, targetname, address, port,
+					  iface, MATCH_ANY_SID))
+			return e->data;
+	}
+	return NULL;
+}
+
+static int portal_index_has_session(struct portal_index *idx,
+				    struct node_rec *rec)
+{
+	struct portal_index_entry *e;
+	uint32_t hash = rec_hash(rec);
+
+	for (e = idx->buckets[hash & idx->mask]; e; e = e->next) {
+		if (e->hash == hash && iscsi_match_session(rec, e->data))
+			return 1;
+	}
+	return 0;
+}
+
+static int snapshot_session(void *data, struct session_info *info)
+{
+	struct list_head *list = data;
+	struct session_info *new;
+
+	new = malloc(sizeof(*new));
+	if (!new)
+		return ISCSI_ERR_NOMEM;
+	memcpy(new, info, sizeof(*new));
+	INIT_LIST_HEAD(&new->list);
+	list_add_tail(&new->list, list);
+	return 0;
+}
+
+static unsigned int rec_list_count(struct list_head *list)
+{
+	struct list_head *pos;
+	unsigned int count = 0;
+
+	list_for_each(pos, list)
+		count++;
+	return count;
+}
+
 /*
  * update_sessions - login/logout sessions
+ * @curr_rec_list: target portals recs found by the previous poll
  * @new_rec_list: new target portals recs bound to ifaces
  * @targetname: if set we only update sessions for this target
  * @iname: if set we only update session for that initiator
  *
  * This will login/logout of portals. When it returns the recs on
- * new_rec_list will be freed or put on the iscsi_targets list.
+ * new_rec_list will be freed or put on the curr_rec_list.
  *
- * FIXME: if we are hitting a per problem this may be it. With targets
- * that do a target per lun this could get ugly.
+ * The running sessions are read from sysfs once per call, and the
+ * current and new lists are diffed through hashed indexes, so a poll is
+ * linear in the number of portals.
  */
-static void update_sessions(struct list_head *new_rec_list,
+static void update_sessions(struct list_head *curr_rec_list,
+			    struct list_head *new_rec_list,
 			    const char *targetname, const char *iname)
 {
 	struct node_rec *rec, *tmp_rec;
-	struct list_head stale_rec_list;
-	int nr_found;
+	struct session_info *info, *tmp_info;
+	struct list_head stale_rec_list, session_list;
+	struct portal_index new_idx, curr_idx, session_idx;
+	unsigned int nr_new, nr_curr;
+	int nr_sessions = 0, nr_found;
 
 	INIT_LIST_HEAD(&stale_rec_list);
+	INIT_LIST_HEAD(&session_list);
+
+	nr_new = rec_list_count(new_rec_list);
+	nr_curr = rec_list_count(curr_rec_list);
+
+	if (portal_index_init(&new_idx, nr_new))
+		goto free_new;
+	list_for_each_entry(rec, new_rec_list, list)
+		portal_index_add(&new_idx, rec_hash(rec), rec);
+
 	/*
  	 * Check if a target portal is no longer being sent.
  	 * Note: Due to how we reread ifaces this will also detect
  	 * changes in ifaces being access through portals.
  	 */
-	list_for_each_entry_safe(rec, tmp_rec, &iscsi_targets, list) {
+	list_for_each_entry_safe(rec, tmp_rec, curr_rec_list, list) {
 		log_debug(7, "Trying to match %s %s to %s %s %s",
 	 		   targetname, iname, rec->name, rec->conn[0].address,
 			    rec->iface.name);
@@ -164,31 +335,59 @@ static void update_sessions(struct list_head *new_rec_list,
 
 		log_debug(5, "Matched %s %s, checking if in new targets.",
 			  targetname, iname);
-		if (!idbm_find_rec_in_list(new_rec_list, rec->name,
+		if (!portal_index_find_rec(&new_idx, rec_hash(rec), rec->name,
 					   rec->conn[0].address,
 					   rec->conn[0].port, &rec->iface)) {
 			log_debug(5, "Not found. Marking for logout");
 			list_move_tail(&rec->list, &stale_rec_list);
+			nr_curr--;
 		}
 	}
+	portal_index_free(&new_idx);
+
+	/* the recs we keep plus the new ones that get added */
+	if (portal_index_init(&curr_idx, nr_curr + nr_new))
+		goto logout_stale;
+	list_for_each_entry(rec, curr_rec_list, list)
+		portal_index_add(&curr_idx, rec_hash(rec), rec);
+
+	/* one sysfs walk for the whole list */
+	iscsi_sysfs_for_each_session(&session_list, &nr_sessions,
+				     snapshot_session, 0);
+	if (portal_index_init(&session_idx, nr_sessions)) {
+		portal_index_free(&curr_idx);
+		goto logout_stale;
+	}
+	list_for_each_entry(info, &session_list, list)
+		portal_index_add(&session_idx, session_hash(info), info);
 
 	list_for_each_entry_safe(rec, tmp_rec, new_rec_list, list) {
-		if (!iscsi_check_for_running_session(rec))
+		if (!portal_index_has_session(&session_idx, rec))
 			iscsi_login_portal_nowait(rec);
 
-		if (!idbm_find_rec_in_list(&iscsi_targets, rec->name,
+		if (!portal_index_find_rec(&curr_idx, rec_hash(rec), rec->name,
 					   rec->conn[0].address,
 					   rec->conn[0].port, &rec->iface)) {
 			log_debug(5, "%s %s %s %s not on curr target list. "
 				 "Adding.", rec->name, rec->conn[0].address,
 				 rec->iface.name, rec->iface.iname);
-			list_move_tail(&rec->list, &iscsi_targets);
+			list_move_tail(&rec->list, curr_rec_list);
+			portal_index_add(&curr_idx, rec_hash(rec), rec);
 		} else {
 			list_del(&rec->list);
 			free(rec);
 		}
 	}
 
+	portal_index_free(&session_idx);
+	portal_index_free(&curr_idx);
+
+logout_stale:
+	list_for_each_entry_safe(info, tmp_info, &session_list, list) {
+		list_del(&info->list);
+		free(info);
+	}
+
 	if (!list_empty(&stale_rec_list)) {
 		iscsi_logout_portals(&stale_rec_list, &nr_found, 0,
 				     logout_session);
@@ -197,6 +396,12 @@ static void update_sessions(struct list_head *new_rec_list,
 			free(rec);
 		}
 	}
+
+free_new:
+	list_for_each_entry_safe(rec, tmp_rec, new_rec_list, list) {
+		list_del(&rec->list);
+		free(rec);
+	}
 }
 
 static void fork_disc(const char *def_iname, struct discovery_rec *drec,
@@ -212,7 +417,8 @@ static void fork_disc(const char *def_iname, struct discovery_rec *drec,
 	} else if (pid < 0)
 		log_error("Fork failed (err %d - %s). Will not be able "
 			   "to perform discovery to %s.",
-			   errno, strerror(errno), drec->address);
+			   errno, strerror(errno),
+			   drec ? drec->address : "SendTargets portals");
 	else {
 		shutdown_callback(pid);
 		log_debug(1, "iSCSI disc and login helper pid=%d", pid);
@@ -375,7 +581,7 @@ static int isns_disc_new_portals(const char *targetname, const char *iname)
 			  targetname);
 		goto free_ifaces;
 	}
-	update_sessions(&rec_list, targetname, iname);
+	update_sessions(&iscsi_targets, &rec_list, targetname, iname);
 	rc = 0;
 
 free_ifaces:
@@ -1018,8 +1224,109 @@ static void start_isns(const char *def_iname, struct discovery_rec *drec,
 }
 
 /* SendTargets */
-static void __do_st_disc_and_login(struct discovery_rec *drec)
+
+/*
+ * All SendTargets records using the discovery daemon are scheduled from
+ * one helper process. Each record has its own timer, and every poll is
+ * moved by up to DISC_ST_JITTER_PCT percent of its interval. Records do
+ * not stay in lock step, so their polls do not all hit the same portals
+ * and sysfs at the same time.
+ *
+ * Each poll runs in its own child, at most DISC_ST_MAX_POLLS at once, so
+ * a dead or slow portal only holds up its own record. The child sends
+ * the portals it ended up with back over a pipe, and is killed if its
+ * SendTargets exchange runs past the record's login, auth and active
+ * timeouts plus DISC_ST_POLL_SLACK. The child first writes
+ * DISC_ST_POLL_DISCOVERED once the exchange is done, and the deadline is
+ * dropped from then on: the logins and logouts that follow are bounded
+ * by their own timeouts, and killing the child halfway through them would
+ * leave the sessions out of step with the kept portal list. A poll that
+ * fails or is killed leaves the record's portal list as it was.
+ */
+#define DISC_ST_START_SPREAD	10	/* secs */
+#define DISC_ST_JITTER_PCT	10
+#define DISC_ST_MAX_POLLS	4
+#define DISC_ST_POLL_SLACK	30	/* secs */
+#define DISC_ST_POLL_DISCOVERED	'D'
+
+struct st_disc_sched {
+	struct list_head list;
+	struct discovery_rec drec;
+	/* portals found by the last poll of this record */
+	struct list_head targets;
+	int poll_inval;
+	time_t next_run;
+
+	/* running poll */
+	pid_t pid;
+	int fd;
+	/* 0 once the poll's SendTargets exchange is done */
+	time_t deadline;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static LIST_HEAD(st_disc_sched_list);
+
+static time_t st_disc_now(void)
 {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* random offset in [-range, range] */
+static int st_disc_jitter(int range)
+{
+	if (range <= 0)
+		return 0;
+	return (rand() % (2 * range + 1)) - range;
+}
+
+static void st_disc_free_targets(struct list_head *targets)
+{
+	struct node_rec *rec, *tmp_rec;
+
+	list_for_each_entry_safe(rec, tmp_rec, targets, list) {
+		list_del(&rec->list);
+		free(rec);
+	}
+}
+
+static void st_disc_sched_free(void)
+{
+	struct st_disc_sched *sched, *tmp;
+
+	list_for_each_entry_safe(sched, tmp, &st_disc_sched_list, list) {
+		list_del(&sched->list);
+		st_disc_free_targets(&sched->targets);
+		free(sched);
+	}
+}
+
+static int st_disc_write(int fd, void *data, size_t len)
+{
+	char *p = data;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return errno ? errno : EIO;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void __do_st_disc_and_login(struct discovery_rec *drec,
+				   struct list_head *curr_rec_list, int fd)
+{
+	char done = DISC_ST_POLL_DISCOVERED;
 	struct list_head rec_list, setup_ifaces;
 	struct iface_rec *iface, *tmp_iface;
 	int rc;
@@ -1042,13 +1349,20 @@ static void __do_st_disc_and_login(struct discovery_rec *drec)
 
 	rc = idbm_bind_ifaces_to_nodes(discovery_sendtargets, drec,
 					&setup_ifaces, &rec_list);
+	/*
+	 * The SendTargets exchange is over. Tell the scheduler, so the
+	 * login/logout reconciliation below is not cut short by the
+	 * poll's deadline.
+	 */
+	if (st_disc_write(fd, &done, sizeof(done)))
+		exit(ISCSI_ERR);
 	if (rc) {
 		log_error("Could not perform SendTargets to %s:%d.",
 			   drec->address, drec->port);
 		goto free_ifaces;
 	}
 
-	update_sessions(&rec_list, NULL, NULL);
+	update_sessions(curr_rec_list, &rec_list, NULL, NULL);
 
 free_ifaces:
 	list_for_each_entry_safe(iface, tmp_iface, &setup_ifaces, list) {
@@ -1057,36 +1371,320 @@ free_ifaces:
 	}
 }
 
-static void do_st_disc_and_login(const char *def_iname,
-				 struct discovery_rec *drec, int poll_inval)
+/* runs in the poll's child, the parent's pipe is on fd */
+static void st_disc_poll_child(struct st_disc_sched *sched, int fd)
 {
-	if (poll_inval < 0)
-		poll_inval = DISC_DEF_POLL_INVL;
+	struct st_disc_sched *other;
+	struct node_rec *rec;
+	int nr = 0;
 
-	do {
-		__do_st_disc_and_login(drec);
-		if (!poll_inval)
-			break;
-	} while (!stop_discoveryd && !sleep(poll_inval));
+	list_for_each_entry(other, &st_disc_sched_list, list) {
+		if (other->pid)
+			close(other->fd);
+	}
+
+	__do_st_disc_and_login(&sched->drec, &sched->targets, fd);
+
+	list_for_each_entry(rec, &sched->targets, list)
+		nr++;
+	if (st_disc_write(fd, &nr, sizeof(nr)))
+		exit(ISCSI_ERR);
+	list_for_each_entry(rec, &sched->targets, list) {
+		if (st_disc_write(fd, rec, sizeof(*rec)))
+			exit(ISCSI_ERR);
+	}
+	exit(0);
+}
 
+static int st_disc_poll_start(struct st_disc_sched *sched, time_t now)
+{
+	struct iscsi_connection_timeout_config *timeo;
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds)) {
+		log_error("Could not create pipe for SendTargets poll of "
+			  "%s:%d (err %d)", sched->drec.address,
+			  sched->drec.port, errno);
+		return ISCSI_ERR;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		st_disc_poll_child(sched, fds[1]);
+	} else if (pid < 0) {
+		log_error("Fork failed (err %d - %s). Could not poll %s:%d.",
+			  errno, strerror(errno), sched->drec.address,
+			  sched->drec.port);
+		close(fds[0]);
+		close(fds[1]);
+		return ISCSI_ERR;
+	}
+	close(fds[1]);
+	reap_inc();
+
+	timeo = &sched->drec.u.sendtargets.conn_timeo;
+	sched->pid = pid;
+	sched->fd = fds[0];
+	sched->deadline = now + timeo->login_timeout + timeo->auth_timeout +
+			  timeo->active_timeout + DISC_ST_POLL_SLACK;
+	sched->len = 0;
+	log_debug(4, "SendTargets poll of %s:%d pid %d", sched->drec.address,
+		  sched->drec.port, pid);
+	return 0;
+}
+
+/* replace the record's portals with the list its poll sent back */
+static void st_disc_poll_parse(struct st_disc_sched *sched)
+{
+	struct list_head targets;
+	struct node_rec *rec, *tmp_rec;
+	char *p = sched->buf;
+	int i, nr;
+
+	if (sched->len < sizeof(nr))
+		goto bad;
+	memcpy(&nr, p, sizeof(nr));
+	p += sizeof(nr);
+	if (nr < 0 || sched->len != sizeof(nr) + (size_t)nr * sizeof(*rec))
+		goto bad;
+
+	INIT_LIST_HEAD(&targets);
+	for (i = 0; i < nr; i++, p += sizeof(*rec)) {
+		rec = malloc(sizeof(*rec));
+		if (!rec) {
+			st_disc_free_targets(&targets);
+			goto bad;
+		}
+		memcpy(rec, p, sizeof(*rec));
+		INIT_LIST_HEAD(&rec->list);
+		list_add_tail(&rec->list, &targets);
+	}
+
+	st_disc_free_targets(&sched->targets);
+	list_for_each_entry_safe(rec, tmp_rec, &targets, list)
+		list_move_tail(&rec->list, &sched->targets);
+	return;
+bad:
+	log_error("SendTargets poll of %s:%d did not complete. Keeping the "
+		  "previous portal list.", sched->drec.address,
+		  sched->drec.port);
+}
+
+static void st_disc_poll_end(struct st_disc_sched *sched, int killed)
+{
+	if (killed)
+		kill(sched->pid, SIGKILL);
+	else
+		st_disc_poll_parse(sched);
+
+	close(sched->fd);
+	free(sched->buf);
+	sched->buf = NULL;
+	sched->size = 0;
+	sched->len = 0;
+	sched->pid = 0;
+
+	if (!sched->poll_inval) {
+		/* one shot, leave its sessions running */
+		list_del(&sched->list);
+		st_disc_free_targets(&sched->targets);
+		free(sched);
+		return;
+	}
+
+	sched->next_run = st_disc_now() + sched->poll_inval +
+			  st_disc_jitter(sched->poll_inval *
+					 DISC_ST_JITTER_PCT / 100);
+}
+
+/* returns 1 once the poll's child closed its end */
+static int st_disc_poll_read(struct st_disc_sched *sched)
+{
+	char *buf;
+	size_t size;
+	ssize_t n;
+
+	if (sched->len == sched->size) {
+		size = sched->size ? sched->size * 2 : 4096;
+		buf = realloc(sched->buf, size);
+		if (!buf) {
+			log_error("Could not allocate memory for SendTargets "
+				  "poll of %s:%d.", sched->drec.address,
+				  sched->drec.port);
+			/* drop the result, it can not be stored */
+			sched->len = 0;
+			return 0;
+		}
+		sched->buf = buf;
+		sched->size = size;
+	}
+
+	n = read(sched->fd, sched->buf + sched->len, sched->size - sched->len);
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : 1;
+	if (n == 0)
+		return 1;
+	sched->len += n;
+
+	/* the exchange's end is always the first byte */
+	if (sched->deadline && sched->buf[0] == DISC_ST_POLL_DISCOVERED) {
+		log_debug(4, "SendTargets poll of %s:%d discovered, "
+			  "reconciling sessions", sched->drec.address,
+			  sched->drec.port);
+		sched->deadline = 0;
+		sched->len--;
+		memmove(sched->buf, sched->buf + 1, sched->len);
+	}
+	return 0;
+}
+
+static void st_disc_scheduler(const char *def_iname,
+			      struct discovery_rec *unused, int poll_inval)
+{
+	struct pollfd pfds[DISC_ST_MAX_POLLS];
+	struct st_disc_sched *polls[DISC_ST_MAX_POLLS];
+	struct st_disc_sched *sched, *tmp, *next;
+	struct node_rec *rec, *tmp_rec;
+	time_t now, wake;
+	int i, nr_polls, spread, timeout;
+
+	srand(getpid() ^ time(NULL));
+
+	now = st_disc_now();
+	list_for_each_entry(sched, &st_disc_sched_list, list) {
+		spread = sched->poll_inval < DISC_ST_START_SPREAD ?
+			 sched->poll_inval : DISC_ST_START_SPREAD;
+		sched->next_run = now + (spread ? rand() % spread : 0);
+	}
+
+	while (!stop_discoveryd && !list_empty(&st_disc_sched_list)) {
+		/* reap the disc/login procs */
+		reap_proc();
+
+		now = st_disc_now();
+		nr_polls = 0;
+		list_for_each_entry(sched, &st_disc_sched_list, list) {
+			if (sched->pid)
+				nr_polls++;
+		}
+
+		/* start the due records, earliest first */
+		while (nr_polls < DISC_ST_MAX_POLLS) {
+			next = NULL;
+			list_for_each_entry(sched, &st_disc_sched_list, list) {
+				if (sched->pid || sched->next_run > now)
+					continue;
+				if (!next || sched->next_run < next->next_run)
+					next = sched;
+			}
+			if (!next)
+				break;
+
+			if (st_disc_poll_start(next, now)) {
+				next->next_run = now + DISC_ST_START_SPREAD;
+				continue;
+			}
+			nr_polls++;
+		}
+
+		/* sleep until a poll sends data, times out or is due */
+		wake = 0;
+		nr_polls = 0;
+		list_for_each_entry(sched, &st_disc_sched_list, list) {
+			if (sched->pid) {
+				pfds[nr_polls].fd = sched->fd;
+				pfds[nr_polls].events = POLLIN;
+				pfds[nr_polls].revents = 0;
+				polls[nr_polls++] = sched;
+				if (sched->deadline &&
+				    (!wake || sched->deadline < wake))
+					wake = sched->deadline;
+			}
+		}
+		if (nr_polls < DISC_ST_MAX_POLLS) {
+			list_for_each_entry(sched, &st_disc_sched_list, list) {
+				if (!sched->pid &&
+				    (!wake || sched->next_run < wake))
+					wake = sched->next_run;
+			}
+		}
+		if (!wake)
+			/* only reconciling polls, wait for their results */
+			timeout = -1;
+		else
+			timeout = wake > now ? (wake - now) * 1000 : 0;
+
+		/* SIGTERM cuts this short */
+		if (poll(pfds, nr_polls, timeout) < 0 && errno != EINTR)
+			log_error("SendTargets scheduler poll failed (err %d)",
+				  errno);
+
+		now = st_disc_now();
+		for (i = 0; i < nr_polls; i++) {
+			sched = polls[i];
+			if (pfds[i].revents && st_disc_poll_read(sched))
+				st_disc_poll_end(sched, 0);
+			else if (sched->deadline && sched->deadline <= now) {
+				log_error("SendTargets poll of %s:%d timed "
+					  "out. Keeping the previous portal "
+					  "list.", sched->drec.address,
+					  sched->drec.port);
+				st_disc_poll_end(sched, 1);
+			}
+		}
+	}
+
+	/* let discoveryd_stop logout everything still being polled */
+	list_for_each_entry_safe(sched, tmp, &st_disc_sched_list, list) {
+		if (sched->pid) {
+			kill(sched->pid, SIGKILL);
+			close(sched->fd);
+			free(sched->buf);
+		}
+		list_for_each_entry_safe(rec, tmp_rec, &sched->targets, list)
+			list_move_tail(&rec->list, &iscsi_targets);
+	}
+	st_disc_sched_free();
 	discoveryd_stop();
 }
 
 static int st_start(void *data, struct discovery_rec *drec)
 {
+	struct st_disc_sched *sched;
+
 	log_debug(1, "st_start %s:%d %d", drec->address, drec->port,
 		  drec->u.sendtargets.use_discoveryd);
 	if (!drec->u.sendtargets.use_discoveryd)
 		return ISCSI_ERR_INVAL;
 
-	fork_disc(NULL, drec, drec->u.sendtargets.discoveryd_poll_inval,
-		  do_st_disc_and_login);
+	sched = calloc(1, sizeof(*sched));
+	if (!sched) {
+		log_error("Could not allocate memory to schedule "
+			  "discovery to %s.", drec->address);
+		return ISCSI_ERR_NOMEM;
+	}
+	INIT_LIST_HEAD(&sched->list);
+	INIT_LIST_HEAD(&sched->targets);
+	memcpy(&sched->drec, drec, sizeof(*drec));
+	sched->poll_inval = drec->u.sendtargets.discoveryd_poll_inval;
+	if (sched->poll_inval < 0)
+		sched->poll_inval = DISC_DEF_POLL_INVL;
+
+	list_add_tail(&sched->list, &st_disc_sched_list);
 	return 0;
 }
 
 static void discoveryd_st_start(void)
 {
 	idbm_for_each_st_drec(NULL, st_start);
+	if (list_empty(&st_disc_sched_list))
+		return;
+
+	fork_disc(NULL, NULL, 0, st_disc_scheduler);
+	/* the helper has its own copy */
+	st_disc_sched_free();
 }
 
 static int isns_start(void *data, struct discovery_rec *drec)
@@ -25,10 +25,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <limits.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/wait.h>
 
 #include "idbm.h"
 #include "idbm_fields.h"
@@ -41,6 +44,7 @@
 #include "sysdeps.h"
 #include "fw_context.h"
 #include "iscsi_err.h"
+#include "auth.h"
 
 #define IDBM_HIDE	0    /* Hide parameter when print. */
 #define IDBM_SHOW	1    /* Show parameter when print. */
@@ -194,6 +198,8 @@ idbm_recinfo_discovery(discovery_rec_t *r, recinfo_t *ri)
 		__recinfo_int(DISC_ST_PASSWORD_IN_LEN, ri, r,
 			u.sendtargets.auth.password_in_length, IDBM_HIDE,
 			num, 1);
+		__recinfo_str(DISC_ST_CHAP_ALGS, ri, r,
+			u.sendtargets.auth.chap_algs, IDBM_SHOW, num, 1);
 		__recinfo_int(DISC_ST_LOGIN_TMO, ri, r,
 			u.sendtargets.conn_timeo.login_timeout,
 			IDBM_SHOW, num, 1);
@@ -424,6 +430,8 @@ idbm_recinfo_node(node_rec_t *r, recinfo_t *ri)
 		      session.auth.password_in, IDBM_MASKED, num, 1);
 	__recinfo_int(SESSION_PASSWORD_IN_LEN, ri, r,
 		      session.auth.password_in_length, IDBM_HIDE, num, 1);
+	__recinfo_str(SESSION_CHAP_ALGS, ri, r,
+		      session.auth.chap_algs, IDBM_SHOW, num, 1);
 	__recinfo_int(SESSION_REPLACEMENT_TMO, ri, r,
 		      session.timeo.replacement_timeout,
 		      IDBM_SHOW, num, 1);
@@ -926,6 +934,7 @@ idbm_discovery_setup_defaults(discovery_rec_t *rec, discovery_type_e type)
 		rec->u.sendtargets.auth.authmethod = 0;
 		rec->u.sendtargets.auth.password_length = 0;
 		rec->u.sendtargets.auth.password_in_length = 0;
+		strcpy(rec->u.sendtargets.auth.chap_algs, "MD5");
 		rec->u.sendtargets.conn_timeo.login_timeout=15;
 		rec->u.sendtargets.conn_timeo.auth_timeout = 45;
 		rec->u.sendtargets.conn_timeo.active_timeout=30;
@@ -953,6 +962,25 @@ idbm_discovery_setup_defaults(discovery_rec_t *rec, discovery_type_e type)
 	}
 }
 
+/* string params with a fixed syntax, rejected before they reach a rec */
+static int idbm_str_param_valid(char *name, char *value)
+{
+	int chap_algs[AUTH_CHAP_ALG_MAX_COUNT];
+
+	if (!strcmp(name, SESSION_CHAP_ALGS) ||
+	    !strcmp(name, DISC_ST_CHAP_ALGS)) {
+		if (strlen(value) >= AUTH_CHAP_ALGS_MAXLEN ||
+		    acl_parse_chap_algs(value, chap_algs,
+					AUTH_CHAP_ALG_MAX_COUNT) < 0) {
+			log_error("Invalid CHAP algorithm list '%s' for %s. "
+				  "Supported algorithms are SHA256, SHA1 "
+				  "and MD5.", value, name);
+			return 0;
+		}
+	}
+	return 1;
+}
+
 int idbm_rec_update_param(recinfo_t *info, char *name, char *value,
 			  int line_number)
 {
@@ -1000,6 +1028,9 @@ setup_passwd_len:
 				if (!info[i].data)
 					continue;
 
+				if (!idbm_str_param_valid(name, value))
+					break;
+
 				strlcpy((char*)info[i].data,
 					value, info[i].data_len);
 				goto updated;
@@ -1758,8 +1789,8 @@ read_iface:
 	while ((iface_dent = readdir(iface_dirfd))) {
 		int curr_rc;
 
-		if (!strcmp(iface_dent->d_name, ".") ||
-		    !strcmp(iface_dent->d_name, ".."))
+		/* also skips the temp files of a running or failed batch */
+		if (iface_dent->d_name[0] == '.')
 			continue;
 
 		log_debug(5, "iface iter found %s.", iface_dent->d_name);
@@ -1810,8 +1841,8 @@ int idbm_for_each_portal(int *found, void *data, idbm_portal_op_fn *fn,
 		char *tmp_port, *tmp_tpgt;
 		int curr_rc;
 
-		if (!strcmp(portal_dent->d_name, ".") ||
-		    !strcmp(portal_dent->d_name, ".."))
+		/* also skips the temp files of a running or failed batch */
+		if (portal_dent->d_name[0] == '.')
 			continue;
 
 		log_debug(5, "found %s", portal_dent->d_name);
@@ -2005,11 +2036,191 @@ mkdir_portal:
 	return f;
 }
 
-static int idbm_rec_write(node_rec_t *rec)
+/*
+ * idbm_add_nodes writes node records as a batch. The DB lock is taken
+ * once, directories already made are not checked again, and each record
+ * is written through one large stdio buffer to a temp file next to it.
+ * When the whole batch is written the filesystem is synced once and the
+ * files are renamed into place, so no record file is ever left half
+ * written. Temp files start with a '.', which the node readdirs skip.
+ */
+#define IDBM_BATCH_BUF_SIZE	65536
+
+struct idbm_batch_file {
+	struct list_head list;
+	/* old style portal file replaced by this batch, unlink on commit */
+	int remove;
+	char path[];
+};
+
+struct idbm_batch {
+	/* NODE_CONFIG_DIR and this target's dir are known to exist */
+	int have_node_dir;
+	char target[TARGET_NAME_MAXLEN + 1];
+	struct list_head files;
+	char *iobuf;
+	/* record text to write instead of printing the rec, if set */
+	char *rec_data;
+	size_t rec_len;
+};
+
+static int idbm_batch_init(struct idbm_batch *batch)
+{
+	memset(batch, 0, sizeof(*batch));
+	INIT_LIST_HEAD(&batch->files);
+	batch->iobuf = malloc(IDBM_BATCH_BUF_SIZE);
+	if (!batch->iobuf) {
+		log_error("Could not alloc node record buffer");
+		return ISCSI_ERR_NOMEM;
+	}
+	return 0;
+}
+
+/* dir/name -> dir/.name.new */
+static int idbm_batch_tmp_path(char *tmp, const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	name = name ? name + 1 : path;
+	return snprintf(tmp, PATH_MAX, "%.*s.%s.new", (int)(name - path),
+			path, name) >= PATH_MAX;
+}
+
+static struct idbm_batch_file *idbm_batch_add(struct idbm_batch *batch,
+					      char *path, int remove)
+{
+	struct idbm_batch_file *file;
+
+	file = malloc(sizeof(*file) + strlen(path) + 1);
+	if (!file)
+		return NULL;
+	strcpy(file->path, path);
+	file->remove = remove;
+	list_add_tail(&file->list, &batch->files);
+	return file;
+}
+
+static FILE *idbm_batch_open(struct idbm_batch *batch, char *path)
+{
+	struct idbm_batch_file *file;
+	char *tmp;
+	FILE *f;
+
+	tmp = malloc(PATH_MAX);
+	if (!tmp)
+		return NULL;
+	if (idbm_batch_tmp_path(tmp, path))
+		f = NULL;
+	else
+		f = fopen(tmp, "w");
+	if (!f) {
+		free(tmp);
+		return NULL;
+	}
+
+	file = idbm_batch_add(batch, path, 0);
+	if (!file) {
+		fclose(f);
+		unlink(tmp);
+		free(tmp);
+		return NULL;
+	}
+	free(tmp);
+
+	setvbuf(f, batch->iobuf, _IOFBF, IDBM_BATCH_BUF_SIZE);
+	return f;
+}
+
+/* forget the file just opened by idbm_batch_open, its write failed */
+static void idbm_batch_drop_last(struct idbm_batch *batch)
+{
+	struct idbm_batch_file *file;
+	char *tmp;
+
+	file = list_entry(batch->files.prev, struct idbm_batch_file, list);
+	tmp = malloc(PATH_MAX);
+	if (tmp) {
+		idbm_batch_tmp_path(tmp, file->path);
+		unlink(tmp);
+		free(tmp);
+	}
+	list_del(&file->list);
+	free(file);
+}
+
+/*
+ * Sync the batch and move its records into place. Old style portal
+ * files that were converted are removed only after that. If the sync
+ * fails, or commit is not set, the new files are removed and the old
+ * records are left alone.
+ */
+static int idbm_batch_end(struct idbm_batch *batch, int commit)
+{
+	struct idbm_batch_file *file, *tmp_file;
+	char *tmp;
+	int fd, rc = 0;
+
+	tmp = malloc(PATH_MAX);
+	if (!tmp) {
+		log_error("Could not alloc portal");
+		rc = ISCSI_ERR_NOMEM;
+	}
+
+	if (!commit)
+		rc = ISCSI_ERR;
+	else if (!rc && !list_empty(&batch->files)) {
+		fd = open(NODE_CONFIG_DIR, O_RDONLY | O_DIRECTORY);
+		if (fd < 0 || syncfs(fd)) {
+			log_error("Could not sync %s: %s", NODE_CONFIG_DIR,
+				  strerror(errno));
+			rc = ISCSI_ERR_IDBM;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+
+	list_for_each_entry_safe(file, tmp_file, &batch->files, list) {
+		if (tmp && !file->remove) {
+			idbm_batch_tmp_path(tmp, file->path);
+			if (rc)
+				unlink(tmp);
+			/*
+			 * ENOENT means the same record was listed twice and
+			 * its first rename already moved it.
+			 */
+			else if (rename(tmp, file->path) && errno != ENOENT) {
+				log_error("Could not rename %s: %s", tmp,
+					  strerror(errno));
+				unlink(tmp);
+				rc = ISCSI_ERR_IDBM;
+			}
+		}
+		if (file->remove)
+			continue;
+		list_del(&file->list);
+		free(file);
+	}
+
+	/* only the conversions are left */
+	list_for_each_entry_safe(file, tmp_file, &batch->files, list) {
+		if (!rc && unlink(file->path) && errno != ENOENT)
+			log_error("Could not convert %s: %s", file->path,
+				  strerror(errno));
+		list_del(&file->list);
+		free(file);
+	}
+
+	free(tmp);
+	free(batch->iobuf);
+	batch->iobuf = NULL;
+	return commit ? rc : 0;
+}
+
+static int idbm_rec_write(node_rec_t *rec, struct idbm_batch *batch)
 {
 	struct stat statb;
 	FILE *f;
-	char *portal;
+	char *portal, *old_portal = NULL;
 	int rc = 0;
 
 	portal = malloc(PATH_MAX);
@@ -2019,7 +2230,7 @@ static int idbm_rec_write(node_rec_t *rec)
 	}
 
 	snprintf(portal, PATH_MAX, "%s", NODE_CONFIG_DIR);
-	if (access(portal, F_OK) != 0) {
+	if ((!batch || !batch->have_node_dir) && access(portal, F_OK) != 0) {
 		if (mkdir(portal, 0660) != 0) {
 			log_error("Could not make %s: %s", portal,
 				  strerror(errno));
@@ -2027,9 +2238,12 @@ static int idbm_rec_write(node_rec_t *rec)
 			goto free_portal;
 		}
 	}
+	if (batch)
+		batch->have_node_dir = 1;
 
 	snprintf(portal, PATH_MAX, "%s/%s", NODE_CONFIG_DIR, rec->name);
-	if (access(portal, F_OK) != 0) {
+	if ((!batch || strcmp(batch->target, rec->name)) &&
+	    access(portal, F_OK) != 0) {
 		if (mkdir(portal, 0660) != 0) {
 			log_error("Could not make %s: %s", portal,
 				  strerror(errno));
@@ -2037,6 +2251,8 @@ static int idbm_rec_write(node_rec_t *rec)
 			goto free_portal;
 		}
 	}
+	if (batch)
+		strlcpy(batch->target, rec->name, sizeof(batch->target));
 
 	snprintf(portal, PATH_MAX, "%s/%s/%s,%d", NODE_CONFIG_DIR,
 		 rec->name, rec->conn[0].address, rec->conn[0].port);
@@ -2071,12 +2287,12 @@ static int idbm_rec_write(node_rec_t *rec)
 			/* drop down to old style portal as config */
 			goto open_conf;
 		/*
-		 * Old style portal as a file, but with tpgt. Let's update it.
+		 * Old style portal as a file, but with tpgt. Let's update it
+		 * once the new record is written.
 		 */
-		if (unlink(portal)) {
-			log_error("Could not convert %s: %s", portal,
-				  strerror(errno));
-			rc = ISCSI_ERR_IDBM;
+		old_portal = strdup(portal);
+		if (!old_portal) {
+			rc = ISCSI_ERR_NOMEM;
 			goto unlock;
 		}
 	} else {
@@ -2100,18 +2316,42 @@ mkdir_portal:
 		 rec->name, rec->conn[0].address, rec->conn[0].port, rec->tpgt,
 		 rec->iface.name);
 open_conf:
-	f = fopen(portal, "w");
+	if (batch)
+		f = idbm_batch_open(batch, portal);
+	else
+		f = fopen(portal, "w");
 	if (!f) {
 		log_error("Could not open %s: %s", portal, strerror(errno));
 		rc = ISCSI_ERR_IDBM;
 		goto unlock;
 	}
 
-	idbm_print(IDBM_PRINT_TYPE_NODE, rec, 1, f);
-	fclose(f);
+	if (batch && batch->rec_data)
+		fwrite(batch->rec_data, 1, batch->rec_len, f);
+	else
+		idbm_print(IDBM_PRINT_TYPE_NODE, rec, 1, f);
+	if (fclose(f)) {
+		log_error("Could not write %s: %s", portal, strerror(errno));
+		if (batch)
+			idbm_batch_drop_last(batch);
+		rc = ISCSI_ERR_IDBM;
+		goto unlock;
+	}
+
+	if (!old_portal)
+		goto unlock;
+	if (batch) {
+		if (!idbm_batch_add(batch, old_portal, 1))
+			rc = ISCSI_ERR_NOMEM;
+	} else if (unlink(old_portal)) {
+		log_error("Could not convert %s: %s", old_portal,
+			  strerror(errno));
+		rc = ISCSI_ERR_IDBM;
+	}
 unlock:
 	idbm_unlock();
 free_portal:
+	free(old_portal);
 	free(portal);
 	return rc;
 }
@@ -2282,7 +2522,8 @@ static int setup_disc_to_node_link(char *disc_portal, node_rec_t *rec)
 	return rc;
 }
 
-int idbm_add_node(node_rec_t *newrec, discovery_rec_t *drec, int overwrite)
+static int __idbm_add_node(node_rec_t *newrec, discovery_rec_t *drec,
+			   int overwrite, struct idbm_batch *batch)
 {
 	node_rec_t rec;
 	char *node_portal, *disc_portal;
@@ -2307,7 +2548,7 @@ int idbm_add_node(node_rec_t *newrec, discovery_rec_t *drec, int overwrite)
 		strcpy(newrec->disc_address, drec->address);
 	}
 
-	rc = idbm_rec_write(newrec);
+	rc = idbm_rec_write(newrec, batch);
 	/*
 	 * if a old app passed in a bogus tpgt then we do not create links
 	 * since it will set a different tpgt in another iscsiadm call
@@ -2351,27 +2592,383 @@ free_portal:
 	return rc;
 }
 
-static int idbm_bind_iface_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
-				    void *data, struct iface_rec *iface,
-				    struct list_head *bound_recs)
+int idbm_add_node(node_rec_t *newrec, discovery_rec_t *drec, int overwrite)
+{
+	return __idbm_add_node(newrec, drec, overwrite, NULL);
+}
+
+/*
+ * A node batch adds or updates records one at a time, as discovery finds
+ * them, and makes them visible together on commit. Discovery can take a
+ * while, so the DB is not locked until then: each record's text is
+ * appended to a private, already unlinked, staging file and only the keys
+ * needed to place it are kept in memory. Commit takes the lock once and
+ * writes the staged records like idbm_add_node would.
+ */
+struct idbm_node_batch_rec {
+	struct list_head list;
+	long offset;
+	size_t len;
+	int tpgt;
+	int port;
+	char iface[ISCSI_MAX_IFACE_LEN];
+	char *address;
+	char name[];
+};
+
+struct idbm_node_batch {
+	struct idbm_batch batch;
+	discovery_rec_t *drec;
+	int overwrite;
+	FILE *stage;
+	struct list_head recs;
+	size_t max_len;
+	int err;
+};
+
+static FILE *idbm_node_batch_stage_open(void)
+{
+	char path[] = ISCSI_CONFIG_ROOT".batch.XXXXXX";
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		log_error("Could not create %s: %s", path, strerror(errno));
+		return NULL;
+	}
+	unlink(path);
+
+	f = fdopen(fd, "w+");
+	if (!f) {
+		log_error("Could not open %s: %s", path, strerror(errno));
+		close(fd);
+	}
+	return f;
+}
+
+static void idbm_node_batch_free(struct idbm_node_batch *nb)
+{
+	struct idbm_node_batch_rec *brec, *tmp;
+
+	list_for_each_entry_safe(brec, tmp, &nb->recs, list) {
+		list_del(&brec->list);
+		free(brec);
+	}
+	if (nb->stage)
+		fclose(nb->stage);
+	free(nb->batch.iobuf);
+	free(nb);
+}
+
+/**
+ * idbm_node_batch_alloc - start a batch of node record writes
+ * @drec: discovery record the nodes were found through or NULL
+ * @overwrite: replace records that already exist
+ */
+struct idbm_node_batch *idbm_node_batch_alloc(discovery_rec_t *drec,
+					      int overwrite)
+{
+	struct idbm_node_batch *nb;
+
+	nb = calloc(1, sizeof(*nb));
+	if (!nb) {
+		log_error("Could not alloc node record batch");
+		return NULL;
+	}
+	INIT_LIST_HEAD(&nb->recs);
+
+	if (idbm_batch_init(&nb->batch)) {
+		free(nb);
+		return NULL;
+	}
+
+	nb->stage = idbm_node_batch_stage_open();
+	if (!nb->stage) {
+		idbm_node_batch_free(nb);
+		return NULL;
+	}
+	nb->drec = drec;
+	nb->overwrite = overwrite;
+	return nb;
+}
+
+/**
+ * idbm_node_batch_add - add or update a record in the batch
+ * @nb: batch from idbm_node_batch_alloc
+ * @rec: record to write, not kept after the call
+ *
+ * The record is only staged here, without the DB lock. A record that
+ * cannot be written on commit is logged and skipped, and its error is
+ * returned by idbm_node_batch_commit.
+ */
+int idbm_node_batch_add(struct idbm_node_batch *nb, node_rec_t *rec)
+{
+	struct idbm_node_batch_rec *brec;
+	size_t name_len;
+	long end;
+
+	name_len = strlen(rec->name) + 1;
+	brec = calloc(1, sizeof(*brec) + name_len +
+		      strlen(rec->conn[0].address) + 1);
+	if (!brec)
+		return ISCSI_ERR_NOMEM;
+	strcpy(brec->name, rec->name);
+	brec->address = brec->name + name_len;
+	strcpy(brec->address, rec->conn[0].address);
+	brec->port = rec->conn[0].port;
+	brec->tpgt = rec->tpgt;
+	strlcpy(brec->iface, rec->iface.name, sizeof(brec->iface));
+
+	if (nb->drec) {
+		rec->disc_type = nb->drec->type;
+		rec->disc_port = nb->drec->port;
+		strcpy(rec->disc_address, nb->drec->address);
+	}
+
+	brec->offset = ftell(nb->stage);
+	idbm_print(IDBM_PRINT_TYPE_NODE, rec, 1, nb->stage);
+	end = ftell(nb->stage);
+	if (brec->offset < 0 || end < 0 || ferror(nb->stage)) {
+		log_error("Could not stage record for %s: %s", rec->name,
+			  strerror(errno));
+		free(brec);
+		return ISCSI_ERR_IDBM;
+	}
+	brec->len = end - brec->offset;
+	if (brec->len > nb->max_len)
+		nb->max_len = brec->len;
+	list_add_tail(&brec->list, &nb->recs);
+	return 0;
+}
+
+/* write the staged records to the DB, with the lock held */
+static void idbm_node_batch_write(struct idbm_node_batch *nb)
+{
+	struct idbm_node_batch_rec *brec;
+	node_rec_t *rec;
+	char *data;
+	int rc;
+
+	if (fflush(nb->stage)) {
+		log_error("Could not stage records: %s", strerror(errno));
+		nb->err = ISCSI_ERR_IDBM;
+		return;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	data = malloc(nb->max_len);
+	if (!rec || !data) {
+		log_error("Could not alloc node record");
+		nb->err = ISCSI_ERR_NOMEM;
+		goto free_rec;
+	}
+
+	list_for_each_entry(brec, &nb->recs, list) {
+		/* only the keys are used to place the staged text */
+		strlcpy(rec->name, brec->name, sizeof(rec->name));
+		strlcpy(rec->conn[0].address, brec->address,
+			sizeof(rec->conn[0].address));
+		rec->conn[0].port = brec->port;
+		rec->tpgt = brec->tpgt;
+		strlcpy(rec->iface.name, brec->iface, sizeof(rec->iface.name));
+
+		if (pread(fileno(nb->stage), data, brec->len, brec->offset) !=
+		    (ssize_t)brec->len) {
+			log_error("Could not read staged record for %s",
+				  brec->name);
+			nb->err = ISCSI_ERR_IDBM;
+			continue;
+		}
+		nb->batch.rec_data = data;
+		nb->batch.rec_len = brec->len;
+
+		rc = __idbm_add_node(rec, nb->drec, nb->overwrite, &nb->batch);
+		if (rc) {
+			log_error("Could not add/update [%s,%d %s]",
+				  brec->address, brec->port, brec->name);
+			nb->err = rc;
+		}
+	}
+	nb->batch.rec_data = NULL;
+
+free_rec:
+	free(data);
+	free(rec);
+}
+
+static int idbm_node_batch_end(struct idbm_node_batch *nb, int commit)
+{
+	int rc;
+
+	if (commit && !list_empty(&nb->recs)) {
+		rc = idbm_lock();
+		if (rc) {
+			idbm_node_batch_free(nb);
+			return rc;
+		}
+		idbm_node_batch_write(nb);
+		rc = idbm_batch_end(&nb->batch, 1);
+		idbm_unlock();
+	} else
+		rc = idbm_batch_end(&nb->batch, commit);
+
+	if (!rc)
+		rc = nb->err;
+	idbm_node_batch_free(nb);
+	return rc;
+}
+
+/**
+ * idbm_node_batch_commit - write the batch's records and free it
+ * @nb: batch from idbm_node_batch_alloc
+ */
+int idbm_node_batch_commit(struct idbm_node_batch *nb)
+{
+	return idbm_node_batch_end(nb, 1);
+}
+
+/**
+ * idbm_node_batch_abort - drop the batch's records and free it
+ * @nb: batch from idbm_node_batch_alloc
+ *
+ * Nothing has been written to the DB yet, so it is left as it was.
+ */
+void idbm_node_batch_abort(struct idbm_node_batch *nb)
+{
+	idbm_node_batch_end(nb, 0);
+}
+
+/**
+ * idbm_add_nodes - add or update a list of node records
+ * @rec_list: list of node_recs, like discovery returns
+ * @drec: discovery record the nodes were found through or NULL
+ * @overwrite: replace records that already exist
+ *
+ * Like calling idbm_add_node for each record, but the DB is locked once
+ * and the records are synced to disk once. A record that cannot be added
+ * is logged and skipped, and the last error is returned.
+ */
+int idbm_add_nodes(struct list_head *rec_list, discovery_rec_t *drec,
+		   int overwrite)
 {
+	struct idbm_node_batch *nb;
+	struct node_rec *rec;
+	int rc;
+
+	if (list_empty(rec_list))
+		return 0;
+
+	nb = idbm_node_batch_alloc(drec, overwrite);
+	if (!nb)
+		return ISCSI_ERR_NOMEM;
+
+	list_for_each_entry(rec, rec_list, list) {
+		rc = idbm_node_batch_add(nb, rec);
+		if (rc) {
+			idbm_node_batch_abort(nb);
+			return rc;
+		}
+	}
+
+	return idbm_node_batch_commit(nb);
+}
+
+/*
+ * Discovery hands its records to the bind code one at a time, and the
+ * bind code passes them on with the iface filled in. With a rec_fn the
+ * caller can write each record as it arrives. Without one they are
+ * collected in a list, in iface order. List based discovery functions
+ * are wrapped by disc_list_each.
+ */
+struct disc_list_fn {
+	idbm_disc_nodes_fn *fn;
+	void *data;
+};
+
+static int disc_list_each(void *data, struct iface_rec *iface,
+			  idbm_disc_rec_fn *rec_fn, void *rec_data)
+{
+	struct disc_list_fn *list_fn = data;
 	struct node_rec *rec, *tmp;
 	struct list_head new_recs;
 	int rc;
 
 	INIT_LIST_HEAD(&new_recs);
-	rc = disc_node_fn(data, iface, &new_recs);
-	if (rc)
-		return rc;
+	rc = list_fn->fn(list_fn->data, iface, &new_recs);
 
 	list_for_each_entry_safe(rec, tmp, &new_recs, list) {
-		list_del_init(&rec->list);
-		list_add_tail(&rec->list, bound_recs);
-		iface_copy(&rec->iface, iface);
+		list_del(&rec->list);
+		if (!rc)
+			rc = rec_fn(rec_data, rec);
+		free(rec);
 	}
+	return rc;
+}
+
+static int disc_rec_to_list(void *data, struct node_rec *rec)
+{
+	struct list_head *recs = data;
+	struct node_rec *copy;
+
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return ISCSI_ERR_NOMEM;
+
+	memcpy(copy, rec, sizeof(*copy));
+	INIT_LIST_HEAD(&copy->list);
+	INIT_LIST_HEAD(&copy->iface.list);
+	copy->session.info = NULL;
+	list_add_tail(&copy->list, recs);
 	return 0;
 }
 
+struct disc_bind {
+	struct iface_rec *iface;
+	idbm_disc_rec_fn *rec_fn;
+	void *rec_data;
+};
+
+static int disc_rec_bind(void *data, struct node_rec *rec)
+{
+	struct disc_bind *bind = data;
+
+	iface_copy(&rec->iface, bind->iface);
+	return bind->rec_fn(bind->rec_data, rec);
+}
+
+static int idbm_bind_iface_to_nodes(idbm_disc_each_fn *disc_fn, void *data,
+				    struct iface_rec *iface,
+				    idbm_disc_rec_fn *rec_fn, void *rec_data)
+{
+	struct list_head new_recs;
+	struct disc_bind bind;
+	struct node_rec *rec, *tmp;
+	int rc;
+
+	bind.iface = iface;
+	if (rec_fn) {
+		bind.rec_fn = rec_fn;
+		bind.rec_data = rec_data;
+		return disc_fn(data, iface, disc_rec_bind, &bind);
+	}
+
+	/* only hand over the list if the whole discovery worked */
+	INIT_LIST_HEAD(&new_recs);
+	bind.rec_fn = disc_rec_to_list;
+	bind.rec_data = &new_recs;
+	rc = disc_fn(data, iface, disc_rec_bind, &bind);
+
+	list_for_each_entry_safe(rec, tmp, &new_recs, list) {
+		if (rc) {
+			list_del(&rec->list);
+			free(rec);
+		} else
+			list_move_tail(&rec->list, rec_data);
+	}
+	return rc;
+}
+
 static int
 discovery_error_fatal(int err)
 {
@@ -2386,17 +2983,273 @@ discovery_error_fatal(int err)
 	return 1;
 }
 
-int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
-			      void *data, struct list_head *ifaces,
-			      struct list_head *bound_recs)
+/*
+ * Discovery through several ifaces is run in forked workers, at most
+ * IDBM_DISC_MAX_WORKERS at a time, so one slow or dead path does not
+ * serialize the others. Workers are processes and not threads because the
+ * discovery code keeps its session and ipc state in globals. Each worker
+ * sends its records back over a pipe as discovery finds them.
+ */
+#define IDBM_DISC_MAX_WORKERS	8
+
+struct disc_worker {
+	struct list_head list;
+	struct iface_rec iface;
+	pid_t pid;
+	int fd;
+	int rc;
+	/* partially received record */
+	struct node_rec rec;
+	size_t off;
+	/* received records when there is no rec_fn */
+	struct list_head recs;
+};
+
+struct disc_send {
+	struct disc_worker *w;
+	int fd;
+};
+
+/* child: send one record to the parent */
+static int disc_rec_send(void *data, struct node_rec *rec)
+{
+	struct disc_send *send = data;
+	char *buf = (char *)rec;
+	size_t len = sizeof(*rec);
+	ssize_t n;
+
+	while (len) {
+		n = write(send->fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			log_error("Could not send discovery results "
+				  "for iface %s: %s", send->w->iface.name,
+				  strerror(errno));
+			return ISCSI_ERR;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* child: run the discovery and stream the found recs back to the parent */
+static void disc_worker_run(idbm_disc_each_fn *disc_fn, void *data,
+			    struct disc_worker *w, int fd)
+{
+	struct disc_send send;
+	int rc;
+
+	send.w = w;
+	send.fd = fd;
+	rc = disc_fn(data, &w->iface, disc_rec_send, &send);
+	close(fd);
+	exit(rc);
+}
+
+static int disc_worker_start(idbm_disc_each_fn *disc_fn, void *data,
+			     struct disc_worker *w)
+{
+	int fds[2];
+
+	if (pipe(fds)) {
+		log_error("Could not create discovery pipe: %s",
+			  strerror(errno));
+		return ISCSI_ERR;
+	}
+
+	/* do not let the child flush our pending output a second time */
+	fflush(NULL);
+
+	w->pid = fork();
+	if (w->pid < 0) {
+		log_error("Could not fork discovery for iface %s: %s",
+			  w->iface.name, strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return ISCSI_ERR;
+	}
+
+	if (w->pid == 0) {
+		close(fds[0]);
+		disc_worker_run(disc_fn, data, w, fds[1]);
+	}
+
+	close(fds[1]);
+	w->fd = fds[0];
+	log_debug(4, "discovery through iface %s started in pid %d",
+		  w->iface.name, w->pid);
+	return 0;
+}
+
+/* parent: pull whatever the worker sent. Returns 0 once it is done */
+static int disc_worker_read(struct disc_worker *w, idbm_disc_rec_fn *rec_fn,
+			    void *rec_data)
 {
-	struct list_head def_ifaces;
+	ssize_t n;
+	int status, rc;
+
+	n = read(w->fd, (char *)&w->rec + w->off, sizeof(w->rec) - w->off);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 1;
+
+	if (n > 0) {
+		w->off += n;
+		if (w->off < sizeof(w->rec))
+			return 1;
+
+		w->off = 0;
+		INIT_LIST_HEAD(&w->rec.list);
+		INIT_LIST_HEAD(&w->rec.iface.list);
+		w->rec.session.info = NULL;
+		iface_copy(&w->rec.iface, &w->iface);
+		if (rec_fn)
+			rc = rec_fn(rec_data, &w->rec);
+		else
+			rc = disc_rec_to_list(&w->recs, &w->rec);
+		if (rc && !w->rc)
+			w->rc = rc;
+		return 1;
+	}
+
+	/* EOF or error, reap the worker */
+	close(w->fd);
+	w->fd = -1;
+
+	if (waitpid(w->pid, &status, 0) < 0 || !WIFEXITED(status))
+		rc = ISCSI_ERR_CHILD_TERMINATED;
+	else
+		rc = WEXITSTATUS(status);
+	/* short read or truncated record */
+	if (!rc && (n < 0 || w->off))
+		rc = ISCSI_ERR;
+	if (!w->rc)
+		w->rc = rc;
+
+	log_debug(4, "discovery through iface %s in pid %d done, rc %d",
+		  w->iface.name, w->pid, w->rc);
+	return 0;
+}
+
+static int idbm_bind_ifaces_to_nodes_parallel(idbm_disc_each_fn *disc_fn,
+					      void *data,
+					      struct list_head *workers,
+					      idbm_disc_rec_fn *rec_fn,
+					      void *rec_data)
+{
+	struct pollfd pfds[IDBM_DISC_MAX_WORKERS];
+	struct disc_worker *running[IDBM_DISC_MAX_WORKERS];
+	struct disc_worker *w, *next, *tmp;
+	struct node_rec *rec, *tmp_rec;
+	unsigned int nr_running = 0;
+	int stop = 0, rc = 0, i;
+
+	next = list_entry(workers->next, struct disc_worker, list);
+
+	while (1) {
+		/* keep the pipeline full unless a fatal error was seen */
+		while (!stop && nr_running < IDBM_DISC_MAX_WORKERS &&
+		       &next->list != workers) {
+			if (disc_worker_start(disc_fn, data, next)) {
+				next->rc = ISCSI_ERR;
+				stop = 1;
+				break;
+			}
+			running[nr_running++] = next;
+			next = list_entry(next->list.next, struct disc_worker,
+					  list);
+		}
+
+		if (!nr_running)
+			break;
+
+		for (i = 0; i < (int)nr_running; i++) {
+			pfds[i].fd = running[i]->fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+
+		if (poll(pfds, nr_running, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error("Discovery poll failed: %s",
+				  strerror(errno));
+			stop = 1;
+			/* fall through and drain with blocking reads */
+			for (i = 0; i < (int)nr_running; i++)
+				pfds[i].revents = POLLIN;
+		}
+
+		for (i = (int)nr_running - 1; i >= 0; i--) {
+			if (!pfds[i].revents)
+				continue;
+
+			w = running[i];
+			if (disc_worker_read(w, rec_fn, rec_data))
+				continue;
+
+			if (discovery_error_fatal(w->rc))
+				stop = 1;
+			running[i] = running[--nr_running];
+		}
+	}
+
+	/* merge in iface order, the first fatal error wins like before */
+	list_for_each_entry(w, workers, list) {
+		if (discovery_error_fatal(w->rc)) {
+			rc = w->rc;
+			break;
+		}
+	}
+
+	list_for_each_entry_safe(w, tmp, workers, list) {
+		list_for_each_entry_safe(rec, tmp_rec, &w->recs, list) {
+			list_del_init(&rec->list);
+			if (rc) {
+				free(rec);
+				continue;
+			}
+			list_add_tail(&rec->list, rec_data);
+		}
+		list_del(&w->list);
+		free(w);
+	}
+
+	return rc;
+}
+
+static int idbm_add_disc_worker(struct list_head *workers,
+				struct iface_rec *iface)
+{
+	struct disc_worker *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return ISCSI_ERR_NOMEM;
+
+	INIT_LIST_HEAD(&w->list);
+	INIT_LIST_HEAD(&w->recs);
+	iface_copy(&w->iface, iface);
+	INIT_LIST_HEAD(&w->iface.list);
+	w->fd = -1;
+	list_add_tail(&w->list, workers);
+	return 0;
+}
+
+static int __idbm_bind_ifaces(idbm_disc_each_fn *disc_fn, void *data,
+			      struct list_head *ifaces,
+			      idbm_disc_rec_fn *rec_fn, void *rec_data)
+{
+	struct list_head def_ifaces, workers;
 	struct node_rec *rec, *tmp_rec;
 	struct iface_rec *iface, *tmp_iface;
+	struct disc_worker *w, *tmp_w;
 	struct iscsi_transport *t;
 	int rc = 0, found = 0;
 
 	INIT_LIST_HEAD(&def_ifaces);
+	INIT_LIST_HEAD(&workers);
 
 	if (!ifaces || list_empty(ifaces)) {
 		iface_link_ifaces(&def_ifaces);
@@ -2414,10 +3267,9 @@ int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
 				continue;
 			}
 
-			rc = idbm_bind_iface_to_nodes(disc_node_fn, data, iface,
-						      bound_recs);
+			rc = idbm_add_disc_worker(&workers, iface);
 			free(iface);
-			if (discovery_error_fatal(rc))
+			if (rc)
 				goto fail;
 			found = 1;
 		}
@@ -2428,8 +3280,9 @@ int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
 
 			memset(&def_iface, 0, sizeof(struct iface_rec));
 			iface_setup_defaults(&def_iface);
-			return idbm_bind_iface_to_nodes(disc_node_fn, data,
-							&def_iface, bound_recs);
+			return idbm_bind_iface_to_nodes(disc_fn, data,
+							&def_iface, rec_fn,
+							rec_data);
 		}
 	} else {
 		list_for_each_entry(iface, ifaces, list) {
@@ -2442,27 +3295,86 @@ int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
 				continue;
 			}
 
-			rc = idbm_bind_iface_to_nodes(disc_node_fn, data, iface,
-						      bound_recs);
-			if (discovery_error_fatal(rc))
+			rc = idbm_add_disc_worker(&workers, iface);
+			if (rc)
 				goto fail;
 		}
 	}
+
+	if (list_empty(&workers))
+		return 0;
+
+	/* no need to fork for a single path */
+	if (workers.next == workers.prev) {
+		w = list_entry(workers.next, struct disc_worker, list);
+		rc = idbm_bind_iface_to_nodes(disc_fn, data, &w->iface,
+					      rec_fn, rec_data);
+		list_del(&w->list);
+		free(w);
+		if (discovery_error_fatal(rc))
+			goto fail;
+		return 0;
+	}
+
+	rc = idbm_bind_ifaces_to_nodes_parallel(disc_fn, data, &workers,
+						rec_fn, rec_data);
+	if (rc)
+		goto fail;
 	return 0;
 
-fail:	
+fail:
+	list_for_each_entry_safe(w, tmp_w, &workers, list) {
+		list_del(&w->list);
+		free(w);
+	}
+
 	list_for_each_entry_safe(iface, tmp_iface, &def_ifaces, list) {
 		list_del(&iface->list);
 		free(iface);
 	}
 
-	list_for_each_entry_safe(rec, tmp_rec, bound_recs, list) {
-		list_del(&rec->list);
-		free(rec);
+	if (!rec_fn) {
+		list_for_each_entry_safe(rec, tmp_rec,
+					 (struct list_head *)rec_data, list) {
+			list_del(&rec->list);
+			free(rec);
+		}
 	}
 	return rc;
 }
 
+int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
+			      void *data, struct list_head *ifaces,
+			      struct list_head *bound_recs)
+{
+	struct disc_list_fn list_fn;
+
+	list_fn.fn = disc_node_fn;
+	list_fn.data = data;
+	return __idbm_bind_ifaces(disc_list_each, &list_fn, ifaces, NULL,
+				  bound_recs);
+}
+
+/**
+ * idbm_bind_ifaces_each - run discovery through ifaces, one rec at a time
+ * @disc_fn: discovery function, calls its rec_fn for each record found
+ * @data: passed to disc_fn
+ * @ifaces: ifaces to bind to, or NULL to pick them like
+ *	    idbm_bind_ifaces_to_nodes
+ * @rec_fn: called with each record as it is found, iface filled in
+ * @rec_data: passed to rec_fn
+ *
+ * Nothing but the record in flight is kept, so the caller can write or
+ * print each record without holding the whole result. Records already
+ * passed to rec_fn are not taken back if a later path fails.
+ */
+int idbm_bind_ifaces_each(idbm_disc_each_fn *disc_fn, void *data,
+			  struct list_head *ifaces,
+			  idbm_disc_rec_fn *rec_fn, void *rec_data)
+{
+	return __idbm_bind_ifaces(disc_fn, data, ifaces, rec_fn, rec_data);
+}
+
 static void idbm_rm_disc_node_links(char *disc_dir)
 {
 	char *target = NULL, *tpgt = NULL, *port = NULL;
@@ -2812,7 +3724,7 @@ int idbm_node_set_param(void *data, node_rec_t *rec)
 	if (rc)
 		return rc;
 
-	return idbm_rec_write(rec);
+	return idbm_rec_write(rec, NULL);
 }
 
 int idbm_discovery_set_param(void *data, discovery_rec_t *rec)
@@ -2986,6 +3898,7 @@ void idbm_node_setup_defaults(node_rec_t *rec)
 	rec->session.auth.authmethod = 0;
 	rec->session.auth.password_length = 0;
 	rec->session.auth.password_in_length = 0;
+	strcpy(rec->session.auth.chap_algs, "MD5");
 	rec->session.err_timeo.abort_timeout = DEF_ABORT_TIMEO;
 	rec->session.err_timeo.lu_reset_timeout = DEF_LU_RESET_TIMEO;
 	rec->session.err_timeo.tgt_reset_timeout = DEF_TGT_RESET_TIMEO;
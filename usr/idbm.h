@@ -131,11 +131,26 @@ extern int idbm_delete_node(node_rec_t *rec);
 extern int idbm_add_node(node_rec_t *newrec, discovery_rec_t *drec,
 			 int overwrite);
 struct list_head;
+extern int idbm_add_nodes(struct list_head *rec_list, discovery_rec_t *drec,
+			  int overwrite);
+struct idbm_node_batch;
+extern struct idbm_node_batch *idbm_node_batch_alloc(discovery_rec_t *drec,
+						     int overwrite);
+extern int idbm_node_batch_add(struct idbm_node_batch *nb, node_rec_t *rec);
+extern int idbm_node_batch_commit(struct idbm_node_batch *nb);
+extern void idbm_node_batch_abort(struct idbm_node_batch *nb);
 typedef int (idbm_disc_nodes_fn)(void *data, struct iface_rec *iface,
 				 struct list_head *recs);
 extern int idbm_bind_ifaces_to_nodes(idbm_disc_nodes_fn *disc_node_fn,
 				     void *data, struct list_head *ifaces,
 				     struct list_head *bound_recs);
+/* rec is only valid for the call, copy it to keep it */
+typedef int (idbm_disc_rec_fn)(void *data, struct node_rec *rec);
+typedef int (idbm_disc_each_fn)(void *data, struct iface_rec *iface,
+				idbm_disc_rec_fn *rec_fn, void *rec_data);
+extern int idbm_bind_ifaces_each(idbm_disc_each_fn *disc_fn, void *data,
+				 struct list_head *ifaces,
+				 idbm_disc_rec_fn *rec_fn, void *rec_data);
 extern int idbm_add_discovery(discovery_rec_t *newrec);
 extern void idbm_sendtargets_defaults(struct iscsi_sendtargets_config *cfg);
 extern void idbm_isns_defaults(struct iscsi_isns_config *cfg);
@@ -30,6 +30,7 @@
 #define SESSION_USERNAME_IN	"node.session.auth.username_in"
 #define SESSION_PASSWORD_IN	"node.session.auth.password_in"
 #define SESSION_PASSWORD_IN_LEN	"node.session.auth.password_in_length"
+#define SESSION_CHAP_ALGS	"node.session.auth.chap_algs"
 #define SESSION_REPLACEMENT_TMO	"node.session.timeo.replacement_timeout"
 #define SESSION_ABORT_TMO	"node.session.err_timeo.abort_timeout"
 #define SESSION_LU_RESET_TMO	"node.session.err_timeo.lu_reset_timeout"
@@ -153,6 +154,7 @@
 #define DISC_ST_USERNAME_IN	"discovery.sendtargets.auth.username_in"
 #define DISC_ST_PASSWORD_IN	"discovery.sendtargets.auth.password_in"
 #define DISC_ST_PASSWORD_IN_LEN	"discovery.sendtargets.auth.password_in_length"
+#define DISC_ST_CHAP_ALGS	"discovery.sendtargets.auth.chap_algs"
 #define DISC_ST_LOGIN_TMO	"discovery.sendtargets.timeo.login_timeout"
 #define DISC_ST_REOPEN_MAX	"discovery.sendtargets.reopen_max"
 #define DISC_ST_DISC_DAEMON_POLL_INVAL	"discovery.sendtargets.discoveryd_poll_inval"
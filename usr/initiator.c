@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "initiator.h"
 #include "transport.h"
@@ -55,6 +56,43 @@
 
 #define PROC_DIR "/proc"
 
+/*
+ * Login retry policy.
+ *
+ * A retry after a failed login waits a random time between
+ * ISCSI_LOGIN_BACKOFF_MIN and three times the previous wait, capped at
+ * ISCSI_LOGIN_BACKOFF_MAX (decorrelated jitter), so sessions that lost
+ * their target at the same moment do not come back in lockstep.
+ *
+ * Every connect is then admitted through a token bucket per target
+ * portal, which lets ISCSI_LOGIN_BUCKET_BURST logins through at once
+ * and ISCSI_LOGIN_BUCKET_RATE per second after that. A login that finds
+ * the bucket empty reserves the next free slot and waits for it.
+ *
+ * Sessions recovering to the same portal are recovered as a group. The
+ * first one probes the portal with its own backoff while the others
+ * wait on the bucket, for at most ISCSI_LOGIN_PARK_MAX at a time. When
+ * the probe gets a TCP connection the others are let through the
+ * bucket right away, without their backoff.
+ */
+#define ISCSI_LOGIN_BACKOFF_MIN		1000	/* msecs */
+#define ISCSI_LOGIN_BACKOFF_MAX		30000	/* msecs */
+#define ISCSI_LOGIN_BUCKET_RATE		32	/* logins per sec */
+#define ISCSI_LOGIN_BUCKET_BURST	64
+#define ISCSI_LOGIN_PARK_MAX		120000	/* msecs */
+
+struct login_bucket {
+	struct list_head list;
+	struct sockaddr_storage addr;
+	/* when the bucket will be full again, msecs */
+	uint64_t tat;
+	/* session whose reconnects probe the portal during recovery */
+	struct iscsi_session *prober;
+	struct list_head waiters;
+};
+
+static LIST_HEAD(login_buckets);
+
 struct login_task_retry_info {
 	actor_t retry_actor;
 	queue_task_t *qtask;
@@ -63,11 +101,13 @@ struct login_task_retry_info {
 };
 
 static void iscsi_login_timedout(void *data);
+static void iscsi_login_delay_done(void *data);
 static int iscsi_sched_ev_context(struct iscsi_ev_context *ev_context,
 				  struct iscsi_conn *conn, unsigned long tmo,
 				  int event);
 static int queue_session_login_task_retry(struct login_task_retry_info *info,
 					  node_rec_t *rec, queue_task_t *qtask);
+static void login_portal_release(struct iscsi_session *session, int up);
 
 static int iscsi_ev_context_alloc(iscsi_conn_t *conn)
 {
@@ -252,17 +292,20 @@ static int
 __session_conn_create(iscsi_session_t *session, int cid)
 {
 	iscsi_conn_t *conn = &session->conn[cid];
-	conn_rec_t *conn_rec = &session->nrec.conn[cid];
+	conn_rec_t *conn_rec = &session->nrec.conn[0];
 	int err;
 
-	if (iscsi_ev_context_alloc(conn)) {
+	/* a non-leading conn keeps its pool when it is dropped */
+	if (!conn->context_pool[0] && iscsi_ev_context_alloc(conn)) {
 		log_error("cannot allocate context_pool for conn cid %d", cid);
 		return ISCSI_ERR_NOMEM;
 	}
 
 	conn->state = ISCSI_CONN_STATE_FREE;
 	conn->session = session;
+	conn->bind_ep = session->conn[0].bind_ep;
 	actor_init(&conn->login_timer, iscsi_login_timedout, NULL);
+	actor_init(&conn->delay_timer, iscsi_login_delay_done, NULL);
 	/*
 	 * TODO: we must export the socket_fd/transport_eph from sysfs
 	 * so if iscsid is resyncing up we can pick that up and cleanup up
@@ -325,11 +368,16 @@ __session_conn_create(iscsi_session_t *session, int cid)
 static void
 session_release(iscsi_session_t *session)
 {
+	int cid;
+
 	log_debug(2, "Releasing session %p", session);
 
+	login_portal_release(session, 0);
+
 	if (session->target_alias)
 		free(session->target_alias);
-	iscsi_ev_context_free(&session->conn[0]);
+	for (cid = 0; cid < ISCSI_MAX_CONNS; cid++)
+		iscsi_ev_context_free(&session->conn[cid]);
 	free(session);
 }
 
@@ -350,6 +398,7 @@ __session_create(node_rec_t *rec, struct iscsi_transport *t, int *rc)
 	log_debug(2, "Allocted session %p", session);
 
 	INIT_LIST_HEAD(&session->list);
+	INIT_LIST_HEAD(&session->portal_wait);
 	session->t = t;
 	session->reopen_qtask.mgmt_ipc_fd = -1;
 	session->id = -1;
@@ -395,7 +444,10 @@ __session_create(node_rec_t *rec, struct iscsi_transport *t, int *rc)
 	session->isid[5] = 0;
 
 	/* setup authentication variables for the session*/
-	iscsi_setup_authentication(session, &rec->session.auth);
+	if (iscsi_setup_authentication(session, &rec->session.auth)) {
+		*rc = ISCSI_ERR_INVAL;
+		goto free_session;
+	}
 
 	iscsi_session_init_params(session);
 
@@ -424,10 +476,9 @@ free_session:
 	return NULL;
 }
 
-static void iscsi_flush_context_pool(struct iscsi_session *session)
+static void iscsi_flush_conn_context_pool(struct iscsi_conn *conn)
 {
 	struct iscsi_ev_context *ev_context;
-	struct iscsi_conn *conn = &session->conn[0];
 	int i;
 
 	for (i = 0; i < CONTEXT_POOL_MAX; i++) {
@@ -442,6 +493,14 @@ static void iscsi_flush_context_pool(struct iscsi_session *session)
 	}
 }
 
+static void iscsi_flush_context_pool(struct iscsi_session *session)
+{
+	int cid;
+
+	for (cid = 0; cid < ISCSI_MAX_CONNS; cid++)
+		iscsi_flush_conn_context_pool(&session->conn[cid]);
+}
+
 static void
 __session_destroy(iscsi_session_t *session)
 {
@@ -455,15 +514,62 @@ static void
 conn_delete_timers(iscsi_conn_t *conn)
 {
 	actor_delete(&conn->login_timer);
+	actor_delete(&conn->delay_timer);
 	actor_delete(&conn->nop_out_timer);
 }
 
+/*
+ * Take a non-leading connection out of the session. The kernel fails
+ * the commands that were sent on it, and scsi-ml retries them on the
+ * connections that are left.
+ */
+static void session_conn_drop(iscsi_conn_t *conn)
+{
+	iscsi_session_t *session = conn->session;
+
+	log_debug(2, "drop conn %d:%d (conn state %d)", session->id,
+		  conn->id, conn->state);
+
+	iscsi_flush_conn_context_pool(conn);
+	conn_delete_timers(conn);
+	session->t->template->ep_disconnect(conn);
+
+	if (conn->state == ISCSI_CONN_STATE_IN_LOGIN ||
+	    conn->state == ISCSI_CONN_STATE_IN_LOGOUT ||
+	    conn->state == ISCSI_CONN_STATE_LOGGED_IN ||
+	    conn->state == ISCSI_CONN_STATE_CLEANUP_WAIT) {
+		if (ipc->stop_conn(session->t->handle, session->id,
+				   conn->id, STOP_CONN_TERM))
+			log_error("can't stop connection %d:%d (%d)",
+				  session->id, conn->id, errno);
+	}
+
+	/* this just fails if we never got as far as creating it */
+	if (ipc->destroy_conn(session->t->handle, session->id, conn->id))
+		log_debug(2, "could not destroy connection %d:%d",
+			  session->id, conn->id);
+
+	conn->state = ISCSI_CONN_STATE_FREE;
+}
+
+static void session_drop_conns(iscsi_session_t *session)
+{
+	int cid;
+
+	for (cid = 1; cid < ISCSI_MAX_CONNS; cid++)
+		if (session->conn[cid].state != ISCSI_CONN_STATE_FREE)
+			session_conn_drop(&session->conn[cid]);
+}
+
 static int 
 session_conn_shutdown(iscsi_conn_t *conn, queue_task_t *qtask,
 		      int err)
 {
 	iscsi_session_t *session = conn->session;
 
+	/* the session goes with its leading connection */
+	session_drop_conns(session);
+
 	log_debug(2, "disconnect conn");
 	/* this will check for a valid interconnect connection */
 	if (session->t->template->ep_disconnect)
@@ -508,8 +614,8 @@ cleanup:
 	log_warning("Connection%d:%d to [target: %s, portal: %s,%d] "
 		    "through [iface: %s] is shutdown.",
 		    session->id, conn->id, session->nrec.name,
-		    session->nrec.conn[conn->id].address,
-		    session->nrec.conn[conn->id].port,
+		    iscsi_conn_rec(conn)->address,
+		    iscsi_conn_rec(conn)->port,
 		    session->nrec.iface.name);
 
 	mgmt_ipc_write_rsp(qtask, err);
@@ -532,11 +638,249 @@ queue_delayed_reopen(queue_task_t *qtask, int delay)
 	actor_timer_mod(&conn->login_timer, delay, qtask);
 }
 
-static int iscsi_conn_connect(struct iscsi_conn *conn, queue_task_t *qtask)
+static uint64_t login_time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int login_bucket_match(struct sockaddr_storage *a,
+			      struct sockaddr_storage *b)
+{
+	struct sockaddr_in *a4 = (struct sockaddr_in *)a;
+	struct sockaddr_in *b4 = (struct sockaddr_in *)b;
+	struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)a;
+	struct sockaddr_in6 *b6 = (struct sockaddr_in6 *)b;
+
+	if (a->ss_family != b->ss_family)
+		return 0;
+
+	if (a->ss_family == AF_INET)
+		return a4->sin_port == b4->sin_port &&
+		       a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+
+	return a6->sin6_port == b6->sin6_port &&
+	       !memcmp(&a6->sin6_addr, &b6->sin6_addr,
+		       sizeof(a6->sin6_addr));
+}
+
+static struct login_bucket *
+login_bucket_get(struct sockaddr_storage *addr, uint64_t now)
+{
+	struct login_bucket *bucket, *tmp, *found = NULL;
+
+	if (addr->ss_family != AF_INET && addr->ss_family != AF_INET6)
+		return NULL;
+
+	list_for_each_entry_safe(bucket, tmp, &login_buckets, list) {
+		if (login_bucket_match(&bucket->addr, addr))
+			found = bucket;
+		else if (bucket->tat <= now && !bucket->prober &&
+			 list_empty(&bucket->waiters)) {
+			/* full again, same as a new one */
+			list_del(&bucket->list);
+			free(bucket);
+		}
+	}
+	if (found)
+		return found;
+
+	bucket = calloc(1, sizeof(*bucket));
+	if (!bucket)
+		return NULL;
+	memcpy(&bucket->addr, addr, sizeof(*addr));
+	INIT_LIST_HEAD(&bucket->waiters);
+	list_add_tail(&bucket->list, &login_buckets);
+	return bucket;
+}
+
+/*
+ * Reserve the first login slot at or after @when and return its time.
+ */
+static uint64_t login_bucket_reserve(struct login_bucket *bucket,
+				     uint64_t when)
+{
+	uint64_t interval = 1000 / ISCSI_LOGIN_BUCKET_RATE;
+	uint64_t burst = interval * ISCSI_LOGIN_BUCKET_BURST;
+
+	if (bucket->tat > when + burst)
+		when = bucket->tat - burst;
+	if (bucket->tat < when)
+		bucket->tat = when;
+	bucket->tat += interval;
+	return when;
+}
+
+/*
+ * Return how many seconds conn has to wait before it may connect, or 0
+ * to connect now. The wait runs on the conn's delay timer, and the slot
+ * reserved for it is used when the timer fires.
+ */
+static uint32_t iscsi_login_delay(struct iscsi_conn *conn, int redirected)
+{
+	struct iscsi_session *session = conn->session;
+	struct login_bucket *bucket;
+	uint64_t now, when, slot, backoff = 0;
+
+	/*
+	 * non-leading conns follow a successful login of the leading one
+	 * and are never retried. A redirect continues a login the target
+	 * already answered.
+	 */
+	if (conn->id || redirected)
+		return 0;
+
+	if (session->login_delayed) {
+		session->login_delayed = 0;
+		return 0;
+	}
+
+	now = login_time_now();
+	bucket = login_bucket_get(&conn->saddr, now);
+	/* the portal we fail back to changed since the last attempt */
+	if (session->login_bucket && session->login_bucket != bucket)
+		login_portal_release(session, 0);
+
+	/*
+	 * Another session is already finding out if the portal is back.
+	 * Wait for it to connect rather than adding our own connects. The
+	 * wait is rechecked every ISCSI_LOGIN_BACKOFF_MAX in case it is
+	 * missed, and given up after ISCSI_LOGIN_PARK_MAX in case the
+	 * probe keeps failing for a reason of its own.
+	 */
+	if (bucket && session->r_stage == R_STAGE_SESSION_REOPEN) {
+		if (!bucket->prober) {
+			if (!list_empty(&session->portal_wait))
+				list_del_init(&session->portal_wait);
+			bucket->prober = session;
+			session->login_bucket = bucket;
+		} else if (bucket->prober != session) {
+			uint64_t parked;
+
+			if (list_empty(&session->portal_wait)) {
+				list_add_tail(&session->portal_wait,
+					      &bucket->waiters);
+				session->login_bucket = bucket;
+				session->portal_wait_start = now;
+			}
+
+			parked = now - session->portal_wait_start;
+			if (parked < ISCSI_LOGIN_PARK_MAX) {
+				log_debug(3, "session %d waiting for session "
+					  "%d to probe the portal",
+					  session->id, bucket->prober->id);
+				parked = ISCSI_LOGIN_PARK_MAX - parked;
+				if (parked > ISCSI_LOGIN_BACKOFF_MAX)
+					parked = ISCSI_LOGIN_BACKOFF_MAX;
+				return (parked + 999) / 1000;
+			}
+
+			log_debug(3, "session %d gave up waiting for session "
+				  "%d to probe the portal", session->id,
+				  bucket->prober->id);
+			list_del_init(&session->portal_wait);
+			session->login_bucket = NULL;
+		}
+	}
+
+	if (session->login_backoff) {
+		backoff = ISCSI_LOGIN_BACKOFF_MIN +
+			  rand() % (session->login_backoff * 3 -
+				    ISCSI_LOGIN_BACKOFF_MIN + 1);
+		if (backoff > ISCSI_LOGIN_BACKOFF_MAX)
+			backoff = ISCSI_LOGIN_BACKOFF_MAX;
+		session->login_backoff = backoff;
+	} else
+		session->login_backoff = ISCSI_LOGIN_BACKOFF_MIN;
+
+	when = now + backoff;
+	if (bucket) {
+		slot = login_bucket_reserve(bucket, when);
+		/*
+		 * waiting for our turn at the portal does not count
+		 * against initial_login_retry_max
+		 */
+		if (session->r_stage == R_STAGE_NO_CHANGE)
+			conn->initial_connect_time.tv_sec +=
+						(slot - when + 999) / 1000;
+		when = slot;
+	}
+
+	if (when == now)
+		return 0;
+
+	session->login_delayed = 1;
+	log_debug(3, "session %d login delayed %llu msecs (backoff %llu)",
+		  session->id, (unsigned long long)(when - now),
+		  (unsigned long long)backoff);
+	return (when - now + 999) / 1000;
+}
+
+/*
+ * Take session off its login_bucket. If it was probing the portal the
+ * sessions waiting on it connect now, at the rate the bucket allows.
+ * With @up the portal is back, else the probe went away and the first
+ * waiter takes over probing.
+ */
+static void login_portal_release(struct iscsi_session *session, int up)
+{
+	struct login_bucket *bucket = session->login_bucket;
+	struct iscsi_session *waiter, *tmp;
+	uint64_t now, slot;
+
+	if (!bucket)
+		return;
+	session->login_bucket = NULL;
+
+	if (!list_empty(&session->portal_wait)) {
+		list_del_init(&session->portal_wait);
+		return;
+	}
+	if (bucket->prober != session)
+		return;
+	bucket->prober = NULL;
+
+	now = login_time_now();
+	list_for_each_entry_safe(waiter, tmp, &bucket->waiters, portal_wait) {
+		struct iscsi_conn *wconn = &waiter->conn[0];
+
+		list_del_init(&waiter->portal_wait);
+		if (up)
+			waiter->login_bucket = NULL;
+		else
+			bucket->prober = waiter;
+		waiter->login_backoff = 0;
+		slot = login_bucket_reserve(bucket, now);
+		waiter->login_delayed = 1;
+		log_debug(3, "session %d released by session %d probe (%s), "
+			  "connecting in %llu msecs", waiter->id, session->id,
+			  up ? "up" : "gone", (unsigned long long)(slot - now));
+		actor_timer_mod(&wconn->delay_timer, (slot - now + 999) / 1000,
+				wconn->delay_timer.data);
+		if (!up)
+			break;
+	}
+}
+
+static int iscsi_conn_connect(struct iscsi_conn *conn, queue_task_t *qtask,
+			      int redirected)
 {
 	struct iscsi_ev_context *ev_context;
+	uint32_t delay;
 	int rc;
 
+	/*
+	 * Not a login failure, so wait on the delay timer rather than
+	 * the login timer and iscsi_login_eh.
+	 */
+	delay = iscsi_login_delay(conn, redirected);
+	if (delay) {
+		actor_timer_mod(&conn->delay_timer, delay, qtask);
+		return 0;
+	}
+
 	ev_context = iscsi_ev_context_get(conn, 0);
 	if (!ev_context) {
 		/* while reopening the recv pool should be full */
@@ -568,6 +912,53 @@ static int iscsi_conn_connect(struct iscsi_conn *conn, queue_task_t *qtask)
 	return 0;
 }
 
+static void iscsi_login_delay_done(void *data)
+{
+	struct queue_task *qtask = data;
+	struct iscsi_conn *conn = qtask->conn;
+
+	if (iscsi_conn_connect(conn, qtask, 0))
+		queue_delayed_reopen(qtask, ISCSI_CONN_ERR_REOPEN_DELAY);
+}
+
+/*
+ * MC/S: once the leading connection is logged in, bring up the other
+ * MaxConnections - 1 to the same portal. They share the session's auth
+ * state, so the next one is started when the one before it is in full
+ * feature phase. One that fails is dropped and the session carries on
+ * with what it has until it is reinstated.
+ */
+static void session_conn_add(iscsi_session_t *session)
+{
+	iscsi_conn_t *conn;
+	queue_task_t *qtask;
+	int cid;
+
+	if (session->type != ISCSI_SESSION_TYPE_NORMAL ||
+	    session->t->caps & CAP_LOGIN_OFFLOAD)
+		return;
+
+	for (cid = 1; cid < session->max_conns; cid++)
+		if (session->conn[cid].state == ISCSI_CONN_STATE_FREE)
+			break;
+	if (cid >= session->max_conns)
+		return;
+
+	conn = &session->conn[cid];
+	if (__session_conn_create(session, cid)) {
+		log_error("Could not set up connection %d:%d",
+			  session->id, cid);
+		return;
+	}
+
+	qtask = &session->conn_qtask[cid];
+	qtask->conn = conn;
+	qtask->mgmt_ipc_fd = -1;
+	conn->state = ISCSI_CONN_STATE_XPT_WAIT;
+	if (iscsi_conn_connect(conn, qtask, 0))
+		session_conn_drop(conn);
+}
+
 static void
 __session_conn_reopen(iscsi_conn_t *conn, queue_task_t *qtask, int do_stop,
 		      int redirected)
@@ -614,7 +1005,7 @@ __session_conn_reopen(iscsi_conn_t *conn, queue_task_t *qtask, int do_stop,
 				 &conn->session->nrec.iface) != 0)
 		goto queue_reopen;
 
-	if (iscsi_conn_connect(conn, qtask)) {
+	if (iscsi_conn_connect(conn, qtask, redirected)) {
 		delay = ISCSI_CONN_ERR_REOPEN_DELAY;
 		goto queue_reopen;
 	}
@@ -687,6 +1078,14 @@ static void iscsi_login_eh(struct iscsi_conn *conn, struct queue_task *qtask,
 	struct iscsi_session *session = conn->session;
 
 	log_debug(3, "iscsi_login_eh");
+	if (conn->id) {
+		log_warning("Could not add connection %d:%d to [target: %s, "
+			    "portal: %s,%d] (err %d).", session->id, conn->id,
+			    session->nrec.name, iscsi_conn_rec(conn)->address,
+			    iscsi_conn_rec(conn)->port, err);
+		session_conn_drop(conn);
+		return;
+	}
 	/*
 	 * Flush polls and other events
 	 */
@@ -706,7 +1105,7 @@ static void iscsi_login_eh(struct iscsi_conn *conn, struct queue_task *qtask,
 			else {
 				session->reopen_cnt++;
 				session->t->template->ep_disconnect(conn);
-				if (iscsi_conn_connect(conn, qtask))
+				if (iscsi_conn_connect(conn, qtask, 0))
 					queue_delayed_reopen(qtask,
 						ISCSI_CONN_ERR_REOPEN_DELAY);
 			}
@@ -801,12 +1200,12 @@ __conn_error_handle(iscsi_session_t *session, iscsi_conn_t *conn)
 
 		if (session->erl > 0) {
 			/* check if we still have some logged in connections */
-			for (i=0; i<ISCSI_CONN_MAX; i++) {
+			for (i=0; i<ISCSI_MAX_CONNS; i++) {
 				if (session->conn[i].state ==
 				    ISCSI_CONN_STATE_LOGGED_IN)
 					break;
 			}
-			if (i != ISCSI_CONN_MAX) {
+			if (i != ISCSI_MAX_CONNS) {
 				/* FIXME: re-assign leading connection
 				 *        for ERL>0 */
 			}
@@ -815,7 +1214,7 @@ __conn_error_handle(iscsi_session_t *session, iscsi_conn_t *conn)
 		}
 
 		/* mark all connections as failed */
-		for (i=0; i<ISCSI_CONN_MAX; i++) {
+		for (i=0; i<ISCSI_MAX_CONNS; i++) {
 			if (session->conn[i].state ==
 			    ISCSI_CONN_STATE_LOGGED_IN)
 				session->conn[i].state =
@@ -824,6 +1223,12 @@ __conn_error_handle(iscsi_session_t *session, iscsi_conn_t *conn)
 		session->r_stage = R_STAGE_SESSION_REOPEN;
 		break;
 	case ISCSI_CONN_STATE_IN_LOGIN:
+		if (conn->id) {
+			iscsi_login_eh(conn, &session->conn_qtask[conn->id],
+				       ISCSI_ERR_TRANS);
+			return;
+		}
+
 		if (session->r_stage == R_STAGE_SESSION_REOPEN) {
 			queue_task_t *qtask;
 
@@ -851,7 +1256,12 @@ __conn_error_handle(iscsi_session_t *session, iscsi_conn_t *conn)
 	}
 
 	if (session->r_stage == R_STAGE_SESSION_REOPEN) {
-		session_conn_reopen(conn, &session->reopen_qtask,
+		/*
+		 * ERL=0 recovers the session through the leading conn,
+		 * the others are brought back once it is logged in.
+		 */
+		session_drop_conns(session);
+		session_conn_reopen(&session->conn[0], &session->reopen_qtask,
 				    STOP_CONN_RECOVER);
 		return;
 	}
@@ -872,7 +1282,8 @@ static void session_conn_error(void *data)
 
 	switch (error) {
 	case ISCSI_ERR_INVALID_HOST:
-		if (session_conn_shutdown(conn, NULL, ISCSI_SUCCESS))
+		if (session_conn_shutdown(&session->conn[0], NULL,
+					  ISCSI_SUCCESS))
 			log_error("BUG: Could not shutdown session.");
 		break;
 	default:
@@ -980,6 +1391,7 @@ void free_initiator(void)
 {
 	struct iscsi_transport *t;
 	iscsi_session_t *session, *tmp;
+	struct login_bucket *bucket, *tmp_bucket;
 
 	list_for_each_entry(t, &transports, list) {
 		list_for_each_entry_safe(session, tmp, &t->sessions, list) {
@@ -989,6 +1401,11 @@ void free_initiator(void)
 		}
 	}
 
+	list_for_each_entry_safe(bucket, tmp_bucket, &login_buckets, list) {
+		list_del(&bucket->list);
+		free(bucket);
+	}
+
 	free_transports();
 }
 
@@ -1052,8 +1469,8 @@ setup_full_feature_phase(iscsi_conn_t *conn)
 		log_warning("Connection%d:%d to [target: %s, portal: %s,%d] "
 			    "through [iface: %s] is operational now",
 			    session->id, conn->id, session->nrec.name,
-			    session->nrec.conn[conn->id].address,
-			    session->nrec.conn[conn->id].port,
+			    iscsi_conn_rec(conn)->address,
+			    iscsi_conn_rec(conn)->port,
 			    session->nrec.iface.name);
 	} else {
 		session->notify_qtask = NULL;
@@ -1069,7 +1486,9 @@ setup_full_feature_phase(iscsi_conn_t *conn)
 	 * reset ERL=0 reopen counter
 	 */
 	session->reopen_cnt = 0;
+	session->login_backoff = 0;
 	session->r_stage = R_STAGE_NO_CHANGE;
+	login_portal_release(session, 1);
 
 	/* noop_out */
 	if (conn->userspace_nop && conn->noop_out_interval) {
@@ -1078,6 +1497,8 @@ setup_full_feature_phase(iscsi_conn_t *conn)
 		log_debug(3, "noop out timer %p start",
 			  &conn->nop_out_timer);
 	}
+
+	session_conn_add(session);
 }
 
 static void iscsi_logout_timedout(void *data)
@@ -1543,15 +1964,24 @@ static void session_conn_poll(void *data)
 		/* connected! */
 		memset(c, 0, sizeof(iscsi_login_context_t));
 
-		/* do not allocate new connection in case of reopen */
-		if (session->id == -1) {
-			if (conn->id == 0 && session_ipc_create(session)) {
-				log_error("Can't create session.");
-				err = ISCSI_ERR_INTERNAL;
-				goto cleanup;
+		/* the portal is back, let the sessions waiting on it in */
+		login_portal_release(session, 1);
+
+		/*
+		 * do not allocate new connection in case of reopen. The
+		 * non-leading ones are destroyed when dropped.
+		 */
+		if (session->id == -1 || conn->id) {
+			if (conn->id == 0) {
+				if (session_ipc_create(session)) {
+					log_error("Can't create session.");
+					err = ISCSI_ERR_INTERNAL;
+					goto cleanup;
+				}
+				log_debug(3, "created new iSCSI session sid %d "
+					  "host no %u", session->id,
+					  session->hostno);
 			}
-			log_debug(3, "created new iSCSI session sid %d host "
-				  "no %u", session->id, session->hostno);
 
 			err = ipc->create_conn(session->t->handle,
 					session->id, conn->id, &conn->id);
@@ -1566,7 +1996,7 @@ static void session_conn_poll(void *data)
 
 		iscsi_copy_operational_params(conn,
 					&session->nrec.session.iscsi,
-					&session->nrec.conn[conn->id].iscsi);
+					&iscsi_conn_rec(conn)->iscsi);
 		/*
 		 * TODO: use the iface number or some other value
 		 * so this will be persistent
@@ -1592,7 +2022,16 @@ static void session_conn_poll(void *data)
 		c->buffer = conn->data;
 		c->bufsize = sizeof(conn->data);
 
-		conn->exp_statsn = iscsi_sysfs_get_exp_statsn(session->id);
+		/*
+		 * sysfs has the leading conn's, a new conn starts at 0. It
+		 * continues the session's CmdSN from where the kernel is.
+		 */
+		if (conn->id) {
+			conn->exp_statsn = 0;
+			iscsi_sysfs_get_cmdsn(session->id, &session->cmdsn);
+		} else
+			conn->exp_statsn =
+				iscsi_sysfs_get_exp_statsn(session->id);
 
 		if (session->t->caps & CAP_LOGIN_OFFLOAD) {
 			setup_offload_login_phase(conn);
@@ -1627,6 +2066,10 @@ static void session_conn_poll(void *data)
 	return;
 
 cleanup:
+	if (conn->id) {
+		iscsi_login_eh(conn, qtask, err);
+		return;
+	}
 	session_conn_shutdown(conn, qtask, err);
 }
 
@@ -1671,8 +2114,8 @@ static void session_conn_process_login(void *data)
 		log_warning("Connection%d:%d to [target: %s, portal: %s,%d] "
 			    "through [iface: %s] is operational now",
 			    session->id, conn->id, session->nrec.name,
-			    session->nrec.conn[conn->id].address,
-			    session->nrec.conn[conn->id].port,
+			    iscsi_conn_rec(conn)->address,
+			    iscsi_conn_rec(conn)->port,
 			    session->nrec.iface.name);
 	} else {
 		session->notify_qtask = NULL;
@@ -1683,7 +2126,9 @@ static void session_conn_process_login(void *data)
 	 * reset ERL=0 reopen counter
 	 */
 	session->reopen_cnt = 0;
+	session->login_backoff = 0;
 	session->r_stage = R_STAGE_NO_CHANGE;
+	login_portal_release(session, 1);
 
 	return;
 
@@ -1896,7 +2341,7 @@ static int __session_login_task(node_rec_t *rec, queue_task_t *qtask)
 	qtask->rsp.command = MGMT_IPC_SESSION_LOGIN;
 	qtask->rsp.err = ISCSI_SUCCESS;
 
-	if (iscsi_conn_connect(conn, qtask)) {
+	if (iscsi_conn_connect(conn, qtask, 0)) {
 		log_debug(4, "Initial connect failed. Waiting %u seconds "
 			  "before trying to reconnect.",
 			  ISCSI_CONN_ERR_REOPEN_DELAY);
@@ -2166,5 +2611,6 @@ static struct iscsi_ipc_ev_clbk ipc_clbk = {
 
 void iscsi_initiator_init(void)
 {
+	srand(getpid() ^ time(NULL));
 	ipc_register_ev_callback(&ipc_clbk);
 }
@@ -123,6 +123,8 @@ typedef struct iscsi_conn {
 
 	struct timeval initial_connect_time;
 	actor_t login_timer;
+	/* waits out iscsi_login_delay before the connect */
+	actor_t delay_timer;
 	actor_t nop_out_timer;
 
 #define CONTEXT_POOL_MAX 32
@@ -193,6 +195,32 @@ typedef struct queue_task {
 
 struct iscsi_transport_template;
 struct iscsi_transport;
+struct login_bucket;
+
+#define ISCSI_LOGIN_CACHE_TEXT_LEN	256
+
+/*
+ * Operational parameters agreed on by the last successful login of a
+ * normal session. They are offered as is when the session is reinstated,
+ * leaving out keys that have the iSCSI default value. text is that
+ * login text, built once when the parameters are saved.
+ */
+struct iscsi_login_cache {
+	int valid;
+	int in_use;
+	uint32_t hdrdgst_en;
+	uint32_t datadgst_en;
+	uint32_t max_recv_dlength;
+	uint32_t imm_data_en;
+	uint32_t initial_r2t_en;
+	uint32_t first_burst;
+	uint32_t max_burst;
+	uint32_t pdu_inorder_en;
+	uint32_t dataseq_inorder_en;
+	uint32_t max_conns;
+	int text_len;
+	char text[ISCSI_LOGIN_CACHE_TEXT_LEN];
+};
 
 /* daemon's session structure */
 typedef struct iscsi_session {
@@ -210,6 +238,7 @@ typedef struct iscsi_session {
 	uint32_t exp_cmdsn;
 	uint32_t max_cmdsn;
 	int erl;
+	uint32_t max_conns;
 	uint32_t imm_data_en;
 	uint32_t initial_r2t_en;
 	uint32_t fast_abort;
@@ -242,11 +271,29 @@ typedef struct iscsi_session {
 	char username_in[AUTH_STR_MAX_LEN];
 	uint8_t password_in[AUTH_STR_MAX_LEN];
 	int password_in_length;
-	iscsi_conn_t conn[ISCSI_CONN_MAX];
+	int chap_algs[AUTH_CHAP_ALG_MAX_COUNT];
+	int num_chap_algs;
+	/*
+	 * conn[0] is the leading connection. The others are brought up
+	 * one at a time once it is logged in, see session_conn_add().
+	 */
+	iscsi_conn_t conn[ISCSI_MAX_CONNS];
+	queue_task_t conn_qtask[ISCSI_MAX_CONNS];
 	uint64_t param_mask;
+	struct iscsi_login_cache login_cache;
 
 	/* connection reopens during recovery */
 	int reopen_cnt;
+	/* last login retry backoff in msecs, see iscsi_login_delay() */
+	uint32_t login_backoff;
+	int login_delayed;
+	/*
+	 * login_bucket this session probes, or is on the waiters of
+	 * (portal_wait) since portal_wait_start msecs
+	 */
+	struct login_bucket *login_bucket;
+	struct list_head portal_wait;
+	uint64_t portal_wait_start;
 	queue_task_t reopen_qtask;
 	iscsi_session_r_stage_e r_stage;
 	uint32_t replacement_timeout;
@@ -263,6 +310,12 @@ typedef struct iscsi_session {
 	queue_task_t *notify_qtask;
 } iscsi_session_t;
 
+/* all the connections of a session go to the portal of its node record */
+static inline conn_rec_t *iscsi_conn_rec(iscsi_conn_t *conn)
+{
+	return &conn->session->nrec.conn[0];
+}
+
 /* login.c */
 
 #define ISCSI_SESSION_TYPE_NORMAL 0
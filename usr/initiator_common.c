@@ -61,6 +61,19 @@ const static unsigned int align_32_down(unsigned int param)
 int iscsi_setup_authentication(struct iscsi_session *session,
 			       struct iscsi_auth_config *auth_cfg)
 {
+	int chap_algs[AUTH_CHAP_ALG_MAX_COUNT];
+	int num_chap_algs;
+
+	/* check the whole config before the session is touched */
+	num_chap_algs = acl_parse_chap_algs(auth_cfg->chap_algs, chap_algs,
+					    AUTH_CHAP_ALG_MAX_COUNT);
+	if (num_chap_algs < 0) {
+		log_error("Invalid CHAP algorithm list '%s'. Supported "
+			  "algorithms are SHA256, SHA1 and MD5.",
+			  auth_cfg->chap_algs);
+		return EINVAL;
+	}
+
 	/* if we have any incoming credentials, we insist on authenticating
 	 * the target or not logging in at all
 	 */
@@ -94,6 +107,9 @@ int iscsi_setup_authentication(struct iscsi_session *session,
 		memcpy(session->password_in, auth_cfg->password_in,
 		       session->password_in_length);
 
+	memcpy(session->chap_algs, chap_algs, sizeof(chap_algs));
+	session->num_chap_algs = num_chap_algs;
+
 	if (session->password_length || session->password_in_length) {
 		/* setup the auth buffers */
 		session->auth_buffers[0].address = &session->auth_client_block;
@@ -129,49 +145,10 @@ int iscsi_setup_authentication(struct iscsi_session *session,
 	return 0;
 }
 
-void
-iscsi_copy_operational_params(struct iscsi_conn *conn,
-			struct iscsi_session_operational_config *session_conf,
-			struct iscsi_conn_operational_config *conn_conf)
+static void
+iscsi_copy_session_params(struct iscsi_session *session,
+			struct iscsi_session_operational_config *session_conf)
 {
-	struct iscsi_session *session = conn->session;
-	struct iscsi_transport *t = session->t;
-
-	conn->hdrdgst_en = conn_conf->HeaderDigest;
-	conn->datadgst_en = conn_conf->DataDigest;
-
-	conn->max_recv_dlength =
-			align_32_down(conn_conf->MaxRecvDataSegmentLength);
-	if (conn->max_recv_dlength < ISCSI_MIN_MAX_RECV_SEG_LEN ||
-	    conn->max_recv_dlength > ISCSI_MAX_MAX_RECV_SEG_LEN) {
-		log_error("Invalid iscsi.MaxRecvDataSegmentLength. Must be "
-			 "within %u and %u. Setting to %u",
-			  ISCSI_MIN_MAX_RECV_SEG_LEN,
-			  ISCSI_MAX_MAX_RECV_SEG_LEN,
-			  DEF_INI_MAX_RECV_SEG_LEN);
-		conn_conf->MaxRecvDataSegmentLength =
-						DEF_INI_MAX_RECV_SEG_LEN;
-		conn->max_recv_dlength = DEF_INI_MAX_RECV_SEG_LEN;
-	}
-
-	/* zero indicates to use the target's value */
-	conn->max_xmit_dlength =
-			align_32_down(conn_conf->MaxXmitDataSegmentLength);
-	if (conn->max_xmit_dlength == 0)
-		conn->max_xmit_dlength = ISCSI_DEF_MAX_RECV_SEG_LEN;
-	if (conn->max_xmit_dlength < ISCSI_MIN_MAX_RECV_SEG_LEN ||
-	    conn->max_xmit_dlength > ISCSI_MAX_MAX_RECV_SEG_LEN) {
-		log_error("Invalid iscsi.MaxXmitDataSegmentLength. Must be "
-			 "within %u and %u. Setting to %u",
-			  ISCSI_MIN_MAX_RECV_SEG_LEN,
-			  ISCSI_MAX_MAX_RECV_SEG_LEN,
-			  DEF_INI_MAX_RECV_SEG_LEN);
-		conn_conf->MaxXmitDataSegmentLength =
-						DEF_INI_MAX_RECV_SEG_LEN;
-		conn->max_xmit_dlength = DEF_INI_MAX_RECV_SEG_LEN;
-	}
-
-	/* session's operational parameters */
 	session->initial_r2t_en = session_conf->InitialR2T;
 	session->imm_data_en = session_conf->ImmediateData;
 	session->first_burst = align_32_down(session_conf->FirstBurstLength);
@@ -215,6 +192,62 @@ iscsi_copy_operational_params(struct iscsi_conn *conn,
 	session->def_time2retain = session_conf->DefaultTime2Retain;
 	session->erl = session_conf->ERL;
 
+	session->max_conns = session_conf->MaxConnections;
+	if (session->max_conns < 1 || session->max_conns > ISCSI_MAX_CONNS) {
+		log_error("Invalid iscsi.MaxConnections of %d. Must be "
+			  "within 1 and %d. Setting to 1",
+			  session_conf->MaxConnections, ISCSI_MAX_CONNS);
+		session_conf->MaxConnections = 1;
+		session->max_conns = 1;
+	}
+}
+
+void
+iscsi_copy_operational_params(struct iscsi_conn *conn,
+			struct iscsi_session_operational_config *session_conf,
+			struct iscsi_conn_operational_config *conn_conf)
+{
+	struct iscsi_session *session = conn->session;
+	struct iscsi_transport *t = session->t;
+
+	conn->hdrdgst_en = conn_conf->HeaderDigest;
+	conn->datadgst_en = conn_conf->DataDigest;
+
+	conn->max_recv_dlength =
+			align_32_down(conn_conf->MaxRecvDataSegmentLength);
+	if (conn->max_recv_dlength < ISCSI_MIN_MAX_RECV_SEG_LEN ||
+	    conn->max_recv_dlength > ISCSI_MAX_MAX_RECV_SEG_LEN) {
+		log_error("Invalid iscsi.MaxRecvDataSegmentLength. Must be "
+			 "within %u and %u. Setting to %u",
+			  ISCSI_MIN_MAX_RECV_SEG_LEN,
+			  ISCSI_MAX_MAX_RECV_SEG_LEN,
+			  DEF_INI_MAX_RECV_SEG_LEN);
+		conn_conf->MaxRecvDataSegmentLength =
+						DEF_INI_MAX_RECV_SEG_LEN;
+		conn->max_recv_dlength = DEF_INI_MAX_RECV_SEG_LEN;
+	}
+
+	/* zero indicates to use the target's value */
+	conn->max_xmit_dlength =
+			align_32_down(conn_conf->MaxXmitDataSegmentLength);
+	if (conn->max_xmit_dlength == 0)
+		conn->max_xmit_dlength = ISCSI_DEF_MAX_RECV_SEG_LEN;
+	if (conn->max_xmit_dlength < ISCSI_MIN_MAX_RECV_SEG_LEN ||
+	    conn->max_xmit_dlength > ISCSI_MAX_MAX_RECV_SEG_LEN) {
+		log_error("Invalid iscsi.MaxXmitDataSegmentLength. Must be "
+			 "within %u and %u. Setting to %u",
+			  ISCSI_MIN_MAX_RECV_SEG_LEN,
+			  ISCSI_MAX_MAX_RECV_SEG_LEN,
+			  DEF_INI_MAX_RECV_SEG_LEN);
+		conn_conf->MaxXmitDataSegmentLength =
+						DEF_INI_MAX_RECV_SEG_LEN;
+		conn->max_xmit_dlength = DEF_INI_MAX_RECV_SEG_LEN;
+	}
+
+	/* the leading connection's login settles the session's values */
+	if (!conn->id)
+		iscsi_copy_session_params(session, session_conf);
+
 	if (session->type == ISCSI_SESSION_TYPE_DISCOVERY) {
 		/*
 		 * Right now, we only support 8K max for kernel based
@@ -352,17 +385,17 @@ int iscsi_session_set_neg_params(struct iscsi_conn *conn)
 			.param = ISCSI_PARAM_MAX_RECV_DLENGTH,
 			.value = &conn->max_recv_dlength,
 			.type = ISCSI_INT,
-			.conn_only = 0,
+			.conn_only = 1,
 		}, {
 			.param = ISCSI_PARAM_MAX_XMIT_DLENGTH,
 			.value = &conn->max_xmit_dlength,
 			.type = ISCSI_INT,
-			.conn_only = 0,
+			.conn_only = 1,
 		}, {
 			.param = ISCSI_PARAM_HDRDGST_EN,
 			.value = &conn->hdrdgst_en,
 			.type = ISCSI_INT,
-			.conn_only = 0,
+			.conn_only = 1,
 		}, {
 			.param = ISCSI_PARAM_DATADGST_EN,
 			.value = &conn->datadgst_en,
@@ -478,12 +511,12 @@ int iscsi_session_set_params(struct iscsi_conn *conn)
 			.value = session->target_name,
 		}, {
 			.param = ISCSI_PARAM_PERSISTENT_ADDRESS,
-			.value = session->nrec.conn[conn->id].address,
+			.value = iscsi_conn_rec(conn)->address,
 			.type = ISCSI_STRING,
 			.conn_only = 1,
 		}, {
 			.param = ISCSI_PARAM_PERSISTENT_PORT,
-			.value = &session->nrec.conn[conn->id].port,
+			.value = &iscsi_conn_rec(conn)->port,
 			.type = ISCSI_INT,
 			.conn_only = 1,
 		}, {
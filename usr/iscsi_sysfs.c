@@ -1785,6 +1785,25 @@ int iscsi_sysfs_get_exp_statsn(int sid)
 	return exp_statsn;
 }
 
+/*
+ * A connection added to a running session logs in with the CmdSN the
+ * kernel will use next, which it has moved on since the leading login.
+ * cmdsn is left as it is if the kernel does not export it.
+ */
+int iscsi_sysfs_get_cmdsn(int sid, uint32_t *cmdsn)
+{
+	char id[NAME_SIZE];
+	uint32_t value;
+
+	snprintf(id, sizeof(id), ISCSI_SESSION_ID, sid);
+	if (sysfs_get_uint(id, ISCSI_SESSION_SUBSYS, "cmdsn", &value)) {
+		log_debug(3, "Could not read cmdsn for sid %d.", sid);
+		return ISCSI_ERR_SYSFS_LOOKUP;
+	}
+	*cmdsn = value;
+	return 0;
+}
+
 int iscsi_sysfs_session_supports_nop(int sid)
 {
 	char id[NAME_SIZE];
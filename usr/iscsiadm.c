@@ -54,6 +54,7 @@
 #include "iscsi_ipc.h"
 #include "iscsi_timer.h"
 #include "flashnode.h"
+#include "uip_mgmt_ipc.h"
 
 static char program_name[] = "iscsiadm";
 static char config_file[TARGET_NAME_MAXLEN];
@@ -135,7 +136,7 @@ iscsiadm -m discovery [ -hV ] [ -d debug_level ] [-P printlevel] [ -t type -p ip
 iscsiadm -m node [ -hV ] [ -d debug_level ] [ -P printlevel ] [ -L all,manual,automatic ] [ -U all,manual,automatic ] [ -S ] [ [ -T targetname -p ip:port -I ifaceN ] [ -l | -u | -R | -s] ] \
 [ [ -o  operation  ] [ -n name ] [ -v value ] ]\n\
 iscsiadm -m session [ -hV ] [ -d debug_level ] [ -P  printlevel] [ -r sessionid | sysfsdir [ -R | -u | -s ] [ -o operation ] [ -n name ] [ -v value ] ]\n\
-iscsiadm -m iface [ -hV ] [ -d debug_level ] [ -P printlevel ] [ -I ifacename | -H hostno|MAC ] [ [ -o  operation  ] [ -n name ] [ -v value ] ] [ -C ping [ -a ip ] [ -b packetsize ] [ -c count ] [ -i interval ] ]\n\
+iscsiadm -m iface [ -hV ] [ -d debug_level ] [ -P printlevel ] [ -I ifacename | -H hostno|MAC ] [ [ -o  operation  ] [ -n name ] [ -v value ] ] [ [ -C ping [ -a ip ] [ -b packetsize ] [ -c count ] [ -i interval ] ] | [ -C stats ] ]\n\
 iscsiadm -m fw [ -d debug_level ] [ -l ]\n\
 iscsiadm -m host [ -P printlevel ] [ -H hostno|MAC ] [ [ -C chap [ -x chap_tbl_idx ] ] | [ -C flashnode [ -A portal_type ] [ -x flashnode_idx ] ] | [ -C stats ] ] [ [ -o operation ] [ -n name ] [ -v value ] ] \n\
 iscsiadm -k priority\n");
@@ -1050,20 +1051,9 @@ exec_disc_op_on_recs(discovery_rec_t *drec, struct list_head *rec_list,
 	if (op & OP_DELETE)
 		idbm_for_each_rec(&found, rec_list, delete_stale_rec);
 
-	if (op & OP_NEW || op & OP_UPDATE) {
+	if (op & OP_NEW || op & OP_UPDATE)
 		/* now add/update records */
-		list_for_each_entry(new_rec, rec_list, list) {
-			rc = idbm_add_node(new_rec, drec, op & OP_UPDATE);
-			if (rc)
-				log_error("Could not add/update "
-					  "[%s:" iface_fmt " %s,%d,%d %s]",
-					   new_rec->iface.transport_name,
-					   iface_str(&new_rec->iface),
-					   new_rec->conn[0].address,
-					   new_rec->conn[0].port,
-					   new_rec->tpgt, new_rec->name);
-		}
-	}
+		rc = idbm_add_nodes(rec_list, drec, op & OP_UPDATE);
 
 	memset(&tmp_rec, 0, sizeof(node_rec_t));
 	list_for_each_entry(new_rec, rec_list, list) {
@@ -1088,6 +1078,150 @@ exec_disc_op_on_recs(discovery_rec_t *drec, struct list_head *rec_list,
 	return rc;
 }
 
+/*
+ * Without a login the SendTargets results are written and printed as
+ * each record is built, so only the record in flight is held in full.
+ * What is kept of each portal is just enough to find the stale records.
+ */
+struct st_disc_key {
+	struct list_head list;
+	int port;
+	char *address;
+	char iface[ISCSI_MAX_IFACE_LEN];
+	char transport[ISCSI_TRANSPORT_NAME_MAXLEN];
+	char name[];
+};
+
+struct st_disc_stream {
+	discovery_rec_t *drec;
+	struct idbm_node_batch *nb;
+	int info_level;
+	int op;
+	int count;
+	struct list_head keys;
+	struct node_rec last_rec;
+};
+
+static int st_disc_stream_rec(void *data, struct node_rec *rec)
+{
+	struct st_disc_stream *stream = data;
+	struct st_disc_key *key;
+	size_t name_len;
+	int rc;
+
+	stream->count++;
+
+	if (stream->op & OP_DELETE) {
+		name_len = strlen(rec->name) + 1;
+		key = calloc(1, sizeof(*key) + name_len +
+			     strlen(rec->conn[0].address) + 1);
+		if (!key)
+			return ISCSI_ERR_NOMEM;
+		strcpy(key->name, rec->name);
+		key->address = key->name + name_len;
+		strcpy(key->address, rec->conn[0].address);
+		key->port = rec->conn[0].port;
+		strlcpy(key->iface, rec->iface.name, sizeof(key->iface));
+		strlcpy(key->transport, rec->iface.transport_name,
+			sizeof(key->transport));
+		list_add_tail(&key->list, &stream->keys);
+	}
+
+	if (stream->op & OP_NEW || stream->op & OP_UPDATE) {
+		rc = idbm_node_batch_add(stream->nb, rec);
+		if (rc)
+			return rc;
+	}
+
+	switch (stream->info_level) {
+	case 0:
+	case -1:
+		idbm_print_node_flat(NULL, rec);
+		break;
+	case 1:
+		idbm_print_node_and_iface_tree(&stream->last_rec, rec);
+	}
+	return 0;
+}
+
+/* like delete_stale_rec, but against the keys of a streamed discovery */
+static int delete_stale_key(void *data, struct node_rec *rec)
+{
+	struct st_disc_stream *stream = data;
+	struct st_disc_key *key;
+	struct iface_rec iface;
+
+	/* if we are not from the same discovery source ignore it */
+	if (rec->disc_type != stream->drec->type ||
+	    rec->disc_port != stream->drec->port ||
+	    strcmp(rec->disc_address, stream->drec->address))
+		return -1;
+
+	memset(&iface, 0, sizeof(iface));
+	list_for_each_entry(key, &stream->keys, list) {
+		strcpy(iface.name, key->iface);
+		strcpy(iface.transport_name, key->transport);
+		if (__iscsi_match_session(rec, key->name, key->address,
+					  key->port, &iface, 0))
+			return -1;
+	}
+	/* if there is a error we can continue on */
+	return delete_node(NULL, rec);
+}
+
+static int
+stream_software_sendtargets(discovery_rec_t *drec, struct list_head *ifaces,
+			    int info_level, int op)
+{
+	struct st_disc_stream *stream;
+	struct st_disc_key *key, *tmp;
+	int rc, found = 0;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return ISCSI_ERR_NOMEM;
+	stream->drec = drec;
+	stream->info_level = info_level;
+	stream->op = op;
+	INIT_LIST_HEAD(&stream->keys);
+
+	if (op & OP_NEW || op & OP_UPDATE) {
+		stream->nb = idbm_node_batch_alloc(drec, op & OP_UPDATE);
+		if (!stream->nb) {
+			free(stream);
+			return ISCSI_ERR_NOMEM;
+		}
+	}
+
+	rc = idbm_bind_ifaces_each(discovery_sendtargets_each, drec, ifaces,
+				   st_disc_stream_rec, stream);
+	if (!rc && !stream->count)
+		rc = ISCSI_ERR_NO_OBJS_FOUND;
+
+	if (stream->nb) {
+		if (rc)
+			idbm_node_batch_abort(stream->nb);
+		else
+			rc = idbm_node_batch_commit(stream->nb);
+	}
+
+	if (rc == ISCSI_ERR_NO_OBJS_FOUND)
+		log_error("No portals found");
+	else if (rc)
+		log_error("Could not perform SendTargets discovery: %s",
+			  iscsi_err_to_str(rc));
+	else if (op & OP_DELETE)
+		/* the new records are in place, drop the ones not found */
+		idbm_for_each_rec(&found, stream, delete_stale_key);
+
+	list_for_each_entry_safe(key, tmp, &stream->keys, list) {
+		list_del(&key->list);
+		free(key);
+	}
+	free(stream);
+	return rc;
+}
+
 static int
 do_software_sendtargets(discovery_rec_t *drec, struct list_head *ifaces,
 		        int info_level, int do_login, int op, int sync_drec)
@@ -1118,6 +1252,11 @@ do_software_sendtargets(discovery_rec_t *drec, struct list_head *ifaces,
 		}
 	}
 
+	/* logging in needs the records, otherwise do not keep them */
+	if (!do_login)
+		return stream_software_sendtargets(drec, ifaces, info_level,
+						   op);
+
 	rc = idbm_bind_ifaces_to_nodes(discovery_sendtargets, drec, ifaces,
 				       &rec_list);
 	if (rc) {
@@ -3254,6 +3393,164 @@ ping_exit:
 	return rc;
 }
 
+#define ISCSIUIO_MAX_STATS_IFACES	64
+
+static void print_iface_stats(struct iscsid_uip_nic_stats *stats,
+			      struct iscsid_uip_iface_stats *iface_stats)
+{
+	struct iscsid_uip_iface_stats *ifs;
+	uint32_t i;
+
+	printf("iscsiuio NIC Statistics:\n"
+	       "\tinterrupts: %llu\n"
+	       "\tmissed_interrupts: %llu\n"
+	       "\ttx_packets: %llu\n"
+	       "\ttx_bytes: %llu\n"
+	       "\trx_packets: %llu\n"
+	       "\trx_bytes: %llu\n"
+	       "\trx_no_iface: %llu\n"
+	       "\trx_ignored: %llu\n"
+	       "\tpkt_alloc_failures: %llu\n"
+	       "\ttx_queue_failures: %llu\n"
+	       "\tnl_enqueued: %llu\n"
+	       "\tnl_processed: %llu\n"
+	       "\tnl_dropped: %llu\n"
+	       "\tnl_flushed: %llu\n"
+	       "\tnl_depth_max: %u\n",
+	       (unsigned long long)stats->interrupts,
+	       (unsigned long long)stats->missed_interrupts,
+	       (unsigned long long)stats->tx_packets,
+	       (unsigned long long)stats->tx_bytes,
+	       (unsigned long long)stats->rx_packets,
+	       (unsigned long long)stats->rx_bytes,
+	       (unsigned long long)stats->rx_no_iface,
+	       (unsigned long long)stats->rx_ignored,
+	       (unsigned long long)stats->pkt_alloc_failures,
+	       (unsigned long long)stats->tx_queue_failures,
+	       (unsigned long long)stats->nl_enqueued,
+	       (unsigned long long)stats->nl_processed,
+	       (unsigned long long)stats->nl_dropped,
+	       (unsigned long long)stats->nl_flushed,
+	       stats->nl_depth_max);
+
+	for (i = 0; i < stats->num_ifaces; i++) {
+		ifs = &iface_stats[i];
+
+		printf("iscsiuio Iface Statistics: iface_num %d vlan %u %s\n"
+		       "\ttx_packets: %llu\n"
+		       "\ttx_bytes: %llu\n"
+		       "\trx_packets: %llu\n"
+		       "\trx_bytes: %llu\n"
+		       "\tarp_hits: %llu\n"
+		       "\tarp_misses: %llu\n"
+		       "\tip_recv: %llu\n"
+		       "\tip_sent: %llu\n"
+		       "\tip_drop: %llu\n"
+		       "\tip_chkerr: %llu\n"
+		       "\ticmp_recv: %llu\n"
+		       "\ticmp_sent: %llu\n"
+		       "\ticmp_drop: %llu\n"
+		       "\ttcp_recv: %llu\n"
+		       "\ttcp_sent: %llu\n"
+		       "\ttcp_drop: %llu\n"
+		       "\ttcp_chkerr: %llu\n"
+		       "\ttcp_rexmit: %llu\n"
+		       "\ttcp_rst: %llu\n"
+		       "\tudp_recv: %llu\n"
+		       "\tudp_sent: %llu\n"
+		       "\tudp_drop: %llu\n"
+		       "\tudp_chkerr: %llu\n",
+		       ifs->iface_num, ifs->vlan_id,
+		       ifs->protocol == AF_INET6 ? "ipv6" : "ipv4",
+		       (unsigned long long)ifs->tx_packets,
+		       (unsigned long long)ifs->tx_bytes,
+		       (unsigned long long)ifs->rx_packets,
+		       (unsigned long long)ifs->rx_bytes,
+		       (unsigned long long)ifs->arp_hits,
+		       (unsigned long long)ifs->arp_misses,
+		       (unsigned long long)ifs->ip_recv,
+		       (unsigned long long)ifs->ip_sent,
+		       (unsigned long long)ifs->ip_drop,
+		       (unsigned long long)ifs->ip_chkerr,
+		       (unsigned long long)ifs->icmp_recv,
+		       (unsigned long long)ifs->icmp_sent,
+		       (unsigned long long)ifs->icmp_drop,
+		       (unsigned long long)ifs->tcp_recv,
+		       (unsigned long long)ifs->tcp_sent,
+		       (unsigned long long)ifs->tcp_drop,
+		       (unsigned long long)ifs->tcp_chkerr,
+		       (unsigned long long)ifs->tcp_rexmit,
+		       (unsigned long long)ifs->tcp_rst,
+		       (unsigned long long)ifs->udp_recv,
+		       (unsigned long long)ifs->udp_sent,
+		       (unsigned long long)ifs->udp_drop,
+		       (unsigned long long)ifs->udp_chkerr);
+	}
+}
+
+static int exec_iface_stats_op(struct iface_rec *iface)
+{
+	struct iscsid_uip_nic_stats stats;
+	struct iscsid_uip_iface_stats *iface_stats = NULL;
+	struct iscsi_transport *t;
+	struct host_info hinfo;
+	uint32_t host_no;
+	int rc;
+
+	if (!iface) {
+		log_error("Stats requires iface.");
+		return ISCSI_ERR_INVAL;
+	}
+
+	rc = iface_conf_read(iface);
+	if (rc) {
+		log_error("Could not read iface %s (%d).", iface->name, rc);
+		return rc;
+	}
+
+	t = iscsi_sysfs_get_transport_by_name(iface->transport_name);
+	if (!t) {
+		log_error("Can't find transport.");
+		return ISCSI_ERR_INVAL;
+	}
+
+	if (!t->template->set_net_config) {
+		log_error("Iface stats are only available for transports "
+			  "using iscsiuio.");
+		return ISCSI_ERR_OP_NOT_SUPP;
+	}
+
+	if (!strlen(iface->netdev)) {
+		host_no = iscsi_sysfs_get_host_no_from_hwinfo(iface, &rc);
+		if (host_no == -1) {
+			log_error("Can't find host_no.");
+			return ISCSI_ERR_INVAL;
+		}
+
+		memset(&hinfo, 0, sizeof(hinfo));
+		hinfo.host_no = host_no;
+		iscsi_sysfs_get_hostinfo_by_host_no(&hinfo);
+		strcpy(iface->netdev, hinfo.iface.netdev);
+	}
+
+	iface_stats = calloc(ISCSIUIO_MAX_STATS_IFACES, sizeof(*iface_stats));
+	if (!iface_stats) {
+		log_error("Could not allocate memory for iface stats.");
+		return ISCSI_ERR_NOMEM;
+	}
+
+	rc = uip_broadcast_stats_req(iface, &stats, iface_stats,
+				     ISCSIUIO_MAX_STATS_IFACES);
+	if (rc)
+		log_error("Could not get stats for iface %s: %s",
+			  iface->name, iscsi_err_to_str(rc));
+	else
+		print_iface_stats(&stats, iface_stats);
+
+	free(iface_stats);
+	return rc;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -3557,6 +3854,8 @@ main(int argc, char **argv)
 		if (sub_mode == MODE_PING)
 			rc = exec_ping_op(iface, ip, packet_size, ping_count,
 					  ping_interval);
+		else if (sub_mode == MODE_HOST_STATS)
+			rc = exec_iface_stats_op(iface);
 		else
 			rc = exec_iface_op(op, do_show, info_level, iface,
 					   host_no, &params);
@@ -234,15 +234,18 @@ static int uip_connect(int *fd)
 	return ipc_connect(fd, ISCSID_UIP_NAMESPACE, 0);
 }
 
-int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
+/*
+ * Send a request to uIP and wait for its response header.  On success the
+ * connection is left open in *fd so a response payload can be read.
+ */
+static int uip_request(void *buf, size_t buf_len, int fd_flags, int *fd,
+		       iscsid_uip_rsp_t *rsp)
 {
 	int err;
-	int fd;
-	iscsid_uip_rsp_t rsp;
 	int flags;
 	int count;
 
-	err = uip_connect(&fd);
+	err = uip_connect(fd);
 	if (err) {
 		log_warning("uIP daemon is not up");
 		return err;
@@ -251,11 +254,11 @@ int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
 	log_debug(3, "connected to uIP daemon");
 
 	/*  Send the data to uIP */
-	err = write(fd, buf, buf_len);
+	err = write(*fd, buf, buf_len);
 	if (err != buf_len) {
 		log_error("got write error (%d/%d), daemon died?",
 			  err, errno);
-		close(fd);
+		close(*fd);
 		return ISCSI_ERR_ISCSID_COMM_ERR;
 	}
 
@@ -263,29 +266,29 @@ int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
 
 	/*  Set the socket to a non-blocking read, this way if there are
 	 *  problems waiting for uIP, iscsid can bailout early */
-	flags = fcntl(fd, F_GETFL, 0);
+	flags = fcntl(*fd, F_GETFL, 0);
 	if (flags == -1)
 		flags = 0;
 
 	if (fd_flags)
 		flags |= fd_flags;
 
-	err = fcntl(fd, F_SETFL, flags);
+	err = fcntl(*fd, F_SETFL, flags);
 	if (err) {
 		log_error("could not set uip broadcast to non-blocking: %d",
 			  errno);
-		close(fd);
+		close(*fd);
 		return ISCSI_ERR;
 	}
 
 #define MAX_UIP_BROADCAST_READ_TRIES 5
 	for (count = 0; count < MAX_UIP_BROADCAST_READ_TRIES; count++) {
 		/*  Wait for the response */
-		err = read(fd, &rsp, sizeof(rsp));
-		if (err == sizeof(rsp)) {
+		err = read(*fd, rsp, sizeof(*rsp));
+		if (err == sizeof(*rsp)) {
 			log_debug(3, "Broadcasted to uIP with length: %ld "
 				     "cmd: 0x%x rsp: 0x%x", buf_len,
-				     rsp.command, rsp.err);
+				     rsp->command, rsp->err);
 			err = 0;
 			break;
 		} else if ((err == -1) && (errno == EAGAIN)) {
@@ -306,7 +309,19 @@ int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
 	}
 
 	if (err)
-		goto done;
+		close(*fd);
+	return err;
+}
+
+int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
+{
+	int err;
+	int fd;
+	iscsid_uip_rsp_t rsp;
+
+	err = uip_request(buf, buf_len, fd_flags, &fd, &rsp);
+	if (err)
+		return err;
 
 	switch (rsp.command) {
 	case ISCSID_UIP_IPC_GET_IFACE:
@@ -330,6 +345,73 @@ int uip_broadcast(void *buf, size_t buf_len, int fd_flags, uint32_t *status)
 		err = ISCSI_ERR;
 	}
 
+	close(fd);
+	return err;
+}
+
+static int uip_read_payload(int fd, void *data, size_t len)
+{
+	char *p = data;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			log_error("Could not read uIP response payload "
+				  "(%zd/%d)", n, errno);
+			return ISCSI_ERR_ISCSID_COMM_ERR;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int uip_broadcast_stats(void *buf, size_t buf_len,
+			struct iscsid_uip_nic_stats *stats,
+			struct iscsid_uip_iface_stats *iface_stats,
+			int max_ifaces)
+{
+	int err;
+	int fd;
+	iscsid_uip_rsp_t rsp;
+	uint32_t i;
+
+	err = uip_request(buf, buf_len, 0, &fd, &rsp);
+	if (err)
+		return err;
+
+	if (rsp.command != ISCSID_UIP_IPC_GET_STATS) {
+		err = ISCSI_ERR;
+		goto done;
+	}
+
+	switch (rsp.err) {
+	case ISCSID_UIP_MGMT_IPC_OK:
+		break;
+	case ISCSID_UIP_MGMT_IPC_ERR_NOT_FOUND:
+		err = ISCSI_ERR_NO_OBJS_FOUND;
+		goto done;
+	default:
+		err = ISCSI_ERR;
+		goto done;
+	}
+
+	err = uip_read_payload(fd, stats, sizeof(*stats));
+	if (err)
+		goto done;
+
+	/* Anything past max_ifaces is dropped with the connection */
+	for (i = 0; i < stats->num_ifaces && i < max_ifaces; i++) {
+		err = uip_read_payload(fd, &iface_stats[i],
+				       sizeof(*iface_stats));
+		if (err)
+			goto done;
+	}
+	stats->num_ifaces = i;
+
 done:
 	close(fd);
 	return err;
@@ -26,6 +26,8 @@
 struct iscsiadm_req;
 struct iscsiadm_rsp;
 struct node_rec;
+struct iscsid_uip_nic_stats;
+struct iscsid_uip_iface_stats;
 
 extern int iscsid_exec_req(struct iscsiadm_req *req, struct iscsiadm_rsp *rsp,
 			   int iscsid_start, int tmo);
@@ -38,5 +40,9 @@ extern int iscsid_req_by_sid(iscsiadm_cmd_e cmd, int sid);
 
 extern int uip_broadcast(void *buf, size_t buf_len, int fd_flags,
 			 uint32_t *status);
+extern int uip_broadcast_stats(void *buf, size_t buf_len,
+			       struct iscsid_uip_nic_stats *stats,
+			       struct iscsid_uip_iface_stats *iface_stats,
+			       int max_ifaces);
 
 #endif
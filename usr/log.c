@@ -9,20 +9,22 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
-#include <sys/shm.h>
-#include <sys/ipc.h>
-#include <sys/types.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "iscsi_util.h"
 #include "log.h"
 
-#define SEMKEY	0xA7L
 #define LOGDBG 0
 
 #if LOGDBG
@@ -38,245 +40,537 @@ static int log_stop_daemon = 0;
 static void (*log_func)(int prio, void *priv, const char *fmt, va_list ap);
 static void *log_func_priv;
 
-static void free_logarea (void)
+/*
+ * Messages from iscsid and its children are handed to the logger process
+ * through a ring in a memfd mapping that all of them share.
+ *
+ * Producers claim a slot with a compare and swap on head and publish it
+ * by setting the slot's seq, so no lock is taken and a full ring drops
+ * the message and counts it. The logger only sleeps on the eventfd after
+ * setting waiting, and only a producer that sees waiting set writes to
+ * the eventfd.
+ *
+ * When the format can be encoded, the producer only copies the format
+ * and its arguments into the slot. The logger does the printf work.
+ */
+#define LOG_REC_SIZE		512
+#define LOG_MIN_RECS		64
+#define LOG_SPEC_MAX		32
+
+enum {
+	LOG_REC_TEXT,
+	LOG_REC_BINARY,
+};
+
+struct log_rec {
+	uint64_t seq;
+	struct timespec ts;
+	short prio;
+	unsigned short len;
+	unsigned char type;
+	char data[];
+};
+
+#define LOG_REC_DATA_SIZE	(LOG_REC_SIZE - offsetof(struct log_rec, data))
+
+struct log_ring {
+	/* next slot claimed by a producer */
+	uint64_t head __attribute__((aligned(64)));
+	/* next slot read by the logger, only it writes this */
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t dropped;
+	uint32_t waiting;
+	uint32_t nr_recs;
+	char recs[] __attribute__((aligned(64)));
+};
+
+static struct log_ring *log_ring;
+static size_t log_ring_size;
+static int log_efd = -1;
+static uint64_t log_dropped_reported;
+
+static struct log_rec *log_ring_rec(uint64_t pos)
 {
-	int shmid;
-
-	if (!la)
-		return;
+	return (struct log_rec *)(log_ring->recs +
+			(pos & (log_ring->nr_recs - 1)) * LOG_REC_SIZE);
+}
 
-	if (la->semid != -1)
-		semctl(la->semid, 0, IPC_RMID, la->semarg);
-	if (la->buff) {
-		shmdt(la->buff);
-		shmctl(la->shmid_buff, IPC_RMID, NULL);
-		la->buff = NULL;
-		la->shmid_buff = -1;
+static void free_logarea (void)
+{
+	if (log_ring) {
+		munmap(log_ring, log_ring_size);
+		log_ring = NULL;
 	}
-	if (la->start) {
-		shmdt(la->start);
-		shmctl(la->shmid_msg, IPC_RMID, NULL);
-		la->start = NULL;
-		la->shmid_msg = -1;
+	if (log_efd >= 0) {
+		close(log_efd);
+		log_efd = -1;
 	}
-	shmid = la->shmid;
-	shmdt(la);
-	shmctl(shmid, IPC_RMID, NULL);
-	la = NULL;
 }
 
 static int logarea_init (int size)
 {
-	int shmid;
+	uint32_t nr_recs = LOG_MIN_RECS;
+	uint64_t i;
+	int fd;
 
 	logdbg(stderr,"enter logarea_init\n");
 
-	if ((shmid = shmget(IPC_PRIVATE, sizeof(struct logarea),
-			    0644 | IPC_CREAT | IPC_EXCL)) == -1) {
-		syslog(LOG_ERR, "shmget logarea failed %d", errno);
+	while (nr_recs * 2 * LOG_REC_SIZE <= size)
+		nr_recs *= 2;
+	log_ring_size = sizeof(struct log_ring) + nr_recs * LOG_REC_SIZE;
+
+	fd = memfd_create("iscsid-log", MFD_CLOEXEC);
+	if (fd < 0) {
+		syslog(LOG_ERR, "memfd_create failed %d", errno);
 		return 1;
 	}
 
-	la = shmat(shmid, NULL, 0);
-	if (!la) {
-		syslog(LOG_ERR, "shmat logarea failed %d", errno);
-		shmctl(shmid, IPC_RMID, NULL);
+	if (ftruncate(fd, log_ring_size)) {
+		syslog(LOG_ERR, "ftruncate log ring failed %d", errno);
+		close(fd);
 		return 1;
 	}
-	la->shmid = shmid;
-	la->start = NULL;
-	la->buff = NULL;
-	la->semid = -1;
-
-	if (size < MAX_MSG_SIZE)
-		size = DEFAULT_AREA_SIZE;
 
-	if ((shmid = shmget(IPC_PRIVATE, size,
-			    0644 | IPC_CREAT | IPC_EXCL)) == -1) {
-		syslog(LOG_ERR, "shmget msg failed %d", errno);
-		free_logarea();
+	log_ring = mmap(NULL, log_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (log_ring == MAP_FAILED) {
+		syslog(LOG_ERR, "mmap log ring failed %d", errno);
+		log_ring = NULL;
 		return 1;
 	}
-	la->shmid_msg = shmid;
 
-	la->start = shmat(la->shmid_msg, NULL, 0);
-	if (!la->start) {
-		syslog(LOG_ERR, "shmat msg failed %d", errno);
+	log_ring->nr_recs = nr_recs;
+	for (i = 0; i < nr_recs; i++)
+		log_ring_rec(i)->seq = i;
+
+	log_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (log_efd < 0) {
+		syslog(LOG_ERR, "eventfd failed %d", errno);
 		free_logarea();
 		return 1;
 	}
-	memset(la->start, 0, size);
 
-	la->empty = 1;
-	la->end = la->start + size;
-	la->head = la->start;
-	la->tail = la->start;
+	return 0;
+}
 
-	if ((shmid = shmget(IPC_PRIVATE, MAX_MSG_SIZE + sizeof(struct logmsg),
-			    0644 | IPC_CREAT | IPC_EXCL)) == -1) {
-		syslog(LOG_ERR, "shmget logmsg failed %d", errno);
-		free_logarea();
-		return 1;
+enum {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_INTMAX,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_LDOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+	LOG_ARG_BAD,
+};
+
+/*
+ * Parse the conversion spec at fmt, which points at a '%'. Returns its
+ * length and sets the argument type and the precision (-1 if none).
+ * Conversions that cannot be encoded, such as '*', %n and %m, are
+ * LOG_ARG_BAD.
+ */
+static int log_parse_spec(const char *fmt, int *arg, int *prec)
+{
+	const char *p = fmt + 1;
+	int lmod = 0;
+
+	*prec = -1;
+	if (*p == '%') {
+		*arg = LOG_ARG_NONE;
+		return 2;
 	}
-	la->buff = shmat(shmid, NULL, 0);
-	if (!la->buff) {
-		syslog(LOG_ERR, "shmat logmsgfailed %d", errno);
-		free_logarea();
-		return 1;
+
+	*arg = LOG_ARG_BAD;
+	while (*p && strchr("#0- +'", *p))
+		p++;
+	while (isdigit(*p))
+		p++;
+	if (*p == '.') {
+		p++;
+		*prec = atoi(p);
+		while (isdigit(*p))
+			p++;
 	}
 
-	if ((la->semid = semget(SEMKEY, 1, 0600 | IPC_CREAT)) < 0) {
-		syslog(LOG_ERR, "semget failed %d", errno);
-		free_logarea();
-		return 1;
+	switch (*p) {
+	case 'h':
+		p++;
+		if (*p == 'h')
+			p++;
+		break;
+	case 'l':
+		p++;
+		lmod = LOG_ARG_LONG;
+		if (*p == 'l') {
+			p++;
+			lmod = LOG_ARG_LLONG;
+		}
+		break;
+	case 'z':
+		p++;
+		lmod = LOG_ARG_SIZE;
+		break;
+	case 't':
+		p++;
+		lmod = LOG_ARG_PTRDIFF;
+		break;
+	case 'j':
+		p++;
+		lmod = LOG_ARG_INTMAX;
+		break;
+	case 'L':
+		p++;
+		lmod = LOG_ARG_LDOUBLE;
+		break;
 	}
 
-	la->semarg.val=1;
-	if (semctl(la->semid, 0, SETVAL, la->semarg) < 0) {
-		syslog(LOG_ERR, "semctl failed %d", errno);
-		free_logarea();
-		return 1;
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		if (lmod == LOG_ARG_LDOUBLE)
+			break;
+		*arg = lmod ? lmod : LOG_ARG_INT;
+		break;
+	case 'c':
+		if (!lmod)
+			*arg = LOG_ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E':
+	case 'g': case 'G': case 'a': case 'A':
+		*arg = lmod == LOG_ARG_LDOUBLE ? LOG_ARG_LDOUBLE :
+						 LOG_ARG_DOUBLE;
+		break;
+	case 'p':
+		*arg = LOG_ARG_PTR;
+		break;
+	case 's':
+		if (!lmod)
+			*arg = LOG_ARG_STR;
+		break;
 	}
 
-	la->shmid_buff = shmid;
-	la->ops[0].sem_num = 0;
-	la->ops[0].sem_flg = 0;
+	if (!*p || p - fmt + 1 >= LOG_SPEC_MAX)
+		*arg = LOG_ARG_BAD;
+	return p - fmt + 1;
+}
 
+static int log_arg_size(int arg)
+{
+	switch (arg) {
+	case LOG_ARG_INT:
+		return sizeof(int);
+	case LOG_ARG_LONG:
+		return sizeof(long);
+	case LOG_ARG_LLONG:
+		return sizeof(long long);
+	case LOG_ARG_SIZE:
+		return sizeof(size_t);
+	case LOG_ARG_PTRDIFF:
+		return sizeof(ptrdiff_t);
+	case LOG_ARG_INTMAX:
+		return sizeof(intmax_t);
+	case LOG_ARG_DOUBLE:
+		return sizeof(double);
+	case LOG_ARG_LDOUBLE:
+		return sizeof(long double);
+	case LOG_ARG_PTR:
+		return sizeof(void *);
+	}
 	return 0;
-
 }
 
-#if LOGDBG
-static void dump_logarea (void)
+/*
+ * Copy the format and its arguments into the record: the format string,
+ * then each argument in order. Strings are copied with their NUL.
+ * Returns the bytes used, or 0 if the message has to be formatted here.
+ */
+static int log_encode(char *data, const char *fmt, va_list ap)
 {
-	struct logmsg * msg;
+	char *p = data, *end = data + LOG_REC_DATA_SIZE;
+	size_t len = strlen(fmt) + 1;
+	const char *f, *str;
+	union {
+		int i;
+		long l;
+		long long ll;
+		size_t z;
+		ptrdiff_t t;
+		intmax_t j;
+		double d;
+		long double ld;
+		void *ptr;
+	} v;
+	int arg, prec, size;
+
+	if (len > end - p)
+		return 0;
+	memcpy(p, fmt, len);
+	p += len;
+
+	for (f = fmt; *f; f++) {
+		if (*f != '%')
+			continue;
+
+		f += log_parse_spec(f, &arg, &prec) - 1;
+		switch (arg) {
+		case LOG_ARG_NONE:
+			continue;
+		case LOG_ARG_BAD:
+			return 0;
+		case LOG_ARG_STR:
+			str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+			len = prec < 0 ? strlen(str) : strnlen(str, prec);
+			if (len + 1 > end - p)
+				return 0;
+			memcpy(p, str, len);
+			p[len] = '\0';
+			p += len + 1;
+			continue;
+		case LOG_ARG_INT:
+			v.i = va_arg(ap, int);
+			break;
+		case LOG_ARG_LONG:
+			v.l = va_arg(ap, long);
+			break;
+		case LOG_ARG_LLONG:
+			v.ll = va_arg(ap, long long);
+			break;
+		case LOG_ARG_SIZE:
+			v.z = va_arg(ap, size_t);
+			break;
+		case LOG_ARG_PTRDIFF:
+			v.t = va_arg(ap, ptrdiff_t);
+			break;
+		case LOG_ARG_INTMAX:
+			v.j = va_arg(ap, intmax_t);
+			break;
+		case LOG_ARG_DOUBLE:
+			v.d = va_arg(ap, double);
+			break;
+		case LOG_ARG_LDOUBLE:
+			v.ld = va_arg(ap, long double);
+			break;
+		case LOG_ARG_PTR:
+			v.ptr = va_arg(ap, void *);
+			break;
+		}
 
-	logdbg(stderr, "\n==== area: start addr = %p, end addr = %p ====\n",
-		la->start, la->end);
-	logdbg(stderr, "|addr     |next     |prio|msg\n");
+		size = log_arg_size(arg);
+		if (size > end - p)
+			return 0;
+		memcpy(p, &v, size);
+		p += size;
+	}
 
-	for (msg = (struct logmsg *)la->head; (void *)msg != la->tail;
-	     msg = msg->next)
-		logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-				msg->prio, (char *)&msg->str);
+	return p - data;
+}
 
-	logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-			msg->prio, (char *)&msg->str);
+/* logger side of log_encode */
+static void log_decode(struct log_rec *rec, char *buf, size_t buf_len)
+{
+	char *data = rec->data, *end = rec->data + rec->len;
+	char spec[LOG_SPEC_MAX];
+	const char *f = data;
+	size_t pos = 0;
+	int arg, prec, len, n;
+	union {
+		int i;
+		long l;
+		long long ll;
+		size_t z;
+		ptrdiff_t t;
+		intmax_t j;
+		double d;
+		long double ld;
+		void *ptr;
+	} v;
+
+	data += strlen(data) + 1;
+	buf[0] = '\0';
+
+	while (*f && pos < buf_len - 1) {
+		if (*f != '%') {
+			buf[pos++] = *f++;
+			continue;
+		}
 
-	logdbg(stderr, "\n\n");
+		len = log_parse_spec(f, &arg, &prec);
+		memcpy(spec, f, len);
+		spec[len] = '\0';
+		f += len;
+
+		switch (arg) {
+		case LOG_ARG_NONE:
+			buf[pos++] = '%';
+			continue;
+		case LOG_ARG_STR:
+			n = snprintf(buf + pos, buf_len - pos, spec, data);
+			data += strlen(data) + 1;
+			goto next;
+		}
+
+		len = log_arg_size(arg);
+		if (len > end - data)
+			break;
+		memcpy(&v, data, len);
+		data += len;
+
+		switch (arg) {
+		case LOG_ARG_INT:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.i);
+			break;
+		case LOG_ARG_LONG:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.l);
+			break;
+		case LOG_ARG_LLONG:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.ll);
+			break;
+		case LOG_ARG_SIZE:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.z);
+			break;
+		case LOG_ARG_PTRDIFF:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.t);
+			break;
+		case LOG_ARG_INTMAX:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.j);
+			break;
+		case LOG_ARG_DOUBLE:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.d);
+			break;
+		case LOG_ARG_LDOUBLE:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.ld);
+			break;
+		case LOG_ARG_PTR:
+			n = snprintf(buf + pos, buf_len - pos, spec, v.ptr);
+			break;
+		default:
+			n = 0;
+		}
+next:
+		if (n < 0)
+			break;
+		pos += n;
+		if (pos >= buf_len)
+			pos = buf_len - 1;
+	}
+	buf[pos] = '\0';
 }
-#endif
 
 int log_enqueue (int prio, const char * fmt, va_list ap)
 {
-	int len, fwd;
-	char buff[MAX_MSG_SIZE];
-	struct logmsg * msg;
-	struct logmsg * lastmsg;
-
-	lastmsg = (struct logmsg *)la->tail;
+	struct log_rec *rec;
+	uint64_t pos, seq;
+	va_list aq;
+	int len;
 
-	if (!la->empty) {
-		fwd = sizeof(struct logmsg) +
-		      strlen((char *)&lastmsg->str) * sizeof(char) + 1;
-		la->tail += fwd;
-	}
-	vsnprintf(buff, MAX_MSG_SIZE, fmt, ap);
-	len = strlen(buff) * sizeof(char) + 1;
-
-	/* not enough space on tail : rewind */
-	if (la->head <= la->tail &&
-	    (len + sizeof(struct logmsg)) > (la->end - la->tail)) {
-		logdbg(stderr, "enqueue: rewind tail to %p\n", la->tail);
-			la->tail = la->start;
+	pos = __atomic_load_n(&log_ring->head, __ATOMIC_RELAXED);
+	for (;;) {
+		rec = log_ring_rec(pos);
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&log_ring->head, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t)(seq - pos) < 0) {
+			/* the logger has not caught up: drop msg */
+			logdbg(stderr, "enqueue: log ring overrun, drop msg\n");
+			__atomic_add_fetch(&log_ring->dropped, 1,
+					   __ATOMIC_RELAXED);
+			return 1;
+		} else
+			pos = __atomic_load_n(&log_ring->head,
+					      __ATOMIC_RELAXED);
 	}
 
-	/* not enough space on head : drop msg */
-	if (la->head > la->tail &&
-	    (len + sizeof(struct logmsg)) > (la->head - la->tail)) {
-		logdbg(stderr, "enqueue: log area overrun, drop msg\n");
+	clock_gettime(CLOCK_REALTIME, &rec->ts);
+	rec->prio = prio;
 
-		if (!la->empty)
-			la->tail = lastmsg;
-
-		return 1;
+	va_copy(aq, ap);
+	len = log_encode(rec->data, fmt, aq);
+	va_end(aq);
+	if (len) {
+		rec->type = LOG_REC_BINARY;
+	} else {
+		rec->type = LOG_REC_TEXT;
+		vsnprintf(rec->data, LOG_REC_DATA_SIZE, fmt, ap);
+		len = strlen(rec->data) + 1;
 	}
+	rec->len = len;
 
-	/* ok, we can stage the msg in the area */
-	la->empty = 0;
-	msg = (struct logmsg *)la->tail;
-	msg->prio = prio;
-	memcpy((void *)&msg->str, buff, len);
-	lastmsg->next = la->tail;
-	msg->next = la->head;
+	/* publish, then wake the logger if it is going to sleep */
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&log_ring->waiting, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&log_ring->waiting, 0, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
 
-	logdbg(stderr, "enqueue: %p, %p, %i, %s\n", (void *)msg, msg->next,
-		msg->prio, (char *)&msg->str);
+		if (write(log_efd, &one, sizeof(one)) < 0)
+			logdbg(stderr, "enqueue: eventfd write failed\n");
+	}
 
-#if LOGDBG
-	dump_logarea();
-#endif
+	logdbg(stderr, "enqueue: %llu, %i, %d\n", (unsigned long long)pos,
+		prio, rec->type);
 	return 0;
 }
 
-int log_dequeue (void * buff)
+/* logger: returns the next published record or NULL */
+static struct log_rec *log_dequeue (void)
 {
-	struct logmsg * src = (struct logmsg *)la->head;
-	struct logmsg * dst = (struct logmsg *)buff;
-	struct logmsg * lst = (struct logmsg *)la->tail;
-	int len;
+	uint64_t pos = log_ring->tail;
+	struct log_rec *rec = log_ring_rec(pos);
 
-	if (la->empty)
-		return 0;
-
-	len = strlen((char *)&src->str) * sizeof(char) +
-	      sizeof(struct logmsg) + 1;
-
-	dst->prio = src->prio;
-	memcpy(dst, src,  len);
-
-	if (la->tail == la->head)
-		la->empty = 1; /* purge the last log msg */
-	else {
-		la->head = src->next;
-		lst->next = la->head;
-	}
-	logdbg(stderr, "dequeue: %p, %p, %i, %s\n",
-	       (void *)src, src->next, src->prio, (char *)&src->str);
+	if (__atomic_load_n(&rec->seq, __ATOMIC_SEQ_CST) != pos + 1)
+		return NULL;
+	return rec;
+}
 
-	memset((void *)src, 0, len);
+/* logger: give the slot back to the producers */
+static void log_release (struct log_rec *rec)
+{
+	uint64_t pos = log_ring->tail;
 
-	return len;
+	__atomic_store_n(&rec->seq, pos + log_ring->nr_recs,
+			 __ATOMIC_RELEASE);
+	log_ring->tail = pos + 1;
 }
 
 /*
  * this one can block under memory pressure
  */
-static void log_syslog (void * buff)
+static void log_syslog (struct log_rec *rec)
 {
-	struct logmsg * msg = (struct logmsg *)buff;
+	char buf[LOG_REC_DATA_SIZE];
+	const char *msg = rec->data;
+	struct tm tm;
+
+	if (rec->type == LOG_REC_BINARY) {
+		log_decode(rec, buf, sizeof(buf));
+		msg = buf;
+	}
 
-	syslog(msg->prio, "%s", (char *)&msg->str);
+	/*
+	 * debug output can lag behind iscsid, so tag it with the time it
+	 * was logged at
+	 */
+	if (rec->prio == LOG_DEBUG) {
+		localtime_r(&rec->ts.tv_sec, &tm);
+		syslog(rec->prio, "%02d:%02d:%02d.%06ld %s", tm.tm_hour,
+		       tm.tm_min, tm.tm_sec, rec->ts.tv_nsec / 1000, msg);
+	} else
+		syslog(rec->prio, "%s", msg);
 }
 
 void log_do_log_daemon(int prio, void *priv, const char *fmt, va_list ap)
 {
-	struct sembuf ops[1];
-
-	ops[0].sem_num = la->ops[0].sem_num;
-	ops[0].sem_flg = la->ops[0].sem_flg;
-
-	ops[0].sem_op = -1;
-	if (semop(la->semid, ops, 1) < 0) {
-		syslog(LOG_ERR, "semop down failed %d", errno);
-		return;
-	}
-
 	log_enqueue(prio, fmt, ap);
-
-	ops[0].sem_op = 1;
-	if (semop(la->semid, ops, 1) < 0)
-		syslog(LOG_ERR, "semop up failed");
 }
 
 void log_do_log_std(int prio, void *priv, const char *fmt, va_list ap)
@@ -308,14 +602,13 @@ void log_error(const char *fmt, ...)
 	va_end(ap);
 }
 
-void log_debug(int level, const char *fmt, ...)
+/* only called through log_debug(), which has checked the level */
+void __log_debug(int level, const char *fmt, ...)
 {
-	if (log_level > level) {
-		va_list ap;
-		va_start(ap, fmt);
-		log_func(LOG_DEBUG, log_func_priv, fmt, ap);
-		va_end(ap);
-	}
+	va_list ap;
+	va_start(ap, fmt);
+	log_func(LOG_DEBUG, log_func_priv, fmt, ap);
+	va_end(ap);
 }
 
 void log_info(const char *fmt, ...)
@@ -364,28 +657,42 @@ static void __dump_char(int level, unsigned char *buf, int *cp, int ch)
 
 static void log_flush(void)
 {
-	int msglen;
-	struct sembuf ops[1];
+	struct log_rec *rec;
+	uint64_t dropped;
 
-	ops[0].sem_num = la->ops[0].sem_num;
-	ops[0].sem_flg = la->ops[0].sem_flg;
+	while ((rec = log_dequeue())) {
+		log_syslog(rec);
+		log_release(rec);
+	}
 
+	dropped = __atomic_load_n(&log_ring->dropped, __ATOMIC_RELAXED);
+	if (dropped != log_dropped_reported) {
+		syslog(LOG_WARNING, "log ring overrun, %llu messages dropped",
+		       (unsigned long long)(dropped - log_dropped_reported));
+		log_dropped_reported = dropped;
+	}
+}
 
-	while (!la->empty) {
-		ops[0].sem_op = -1;
-		if (semop(la->semid, ops, 1) < 0) {
-			syslog(LOG_ERR, "semop down failed %d", errno);
-			exit(1);
-		}
-		msglen = log_dequeue(la->buff);
-		ops[0].sem_op = 1;
-		if (semop(la->semid, ops, 1) < 0) {
-			syslog(LOG_ERR, "semop up failed");
-			exit(1);
-		}
-		if (msglen)
-			log_syslog(la->buff);
+/*
+ * Sleep until a producer kicks the eventfd. waiting is set before the
+ * ring is checked again, so a message published in between is not
+ * missed. The timeout only bounds how long SIGTERM can go unnoticed.
+ */
+static void log_wait(void)
+{
+	struct pollfd pfd;
+	uint64_t cnt;
+
+	__atomic_store_n(&log_ring->waiting, 1, __ATOMIC_SEQ_CST);
+	if (!log_dequeue()) {
+		pfd.fd = log_efd;
+		pfd.events = POLLIN;
+		poll(&pfd, 1, 1000);
 	}
+	__atomic_store_n(&log_ring->waiting, 0, __ATOMIC_SEQ_CST);
+
+	if (read(log_efd, &cnt, sizeof(cnt)) < 0)
+		logdbg(stderr, "eventfd read failed %d\n", errno);
 }
 
 static void catch_signal(int signo)
@@ -454,10 +761,9 @@ int log_init(char *program_name, int size,
 
 		while(1) {
 			log_flush();
-			sleep(1);
-
 			if (log_stop_daemon)
 				break;
+			log_wait();
 		}
 
 		__log_close();
@@ -30,56 +30,44 @@
 #include <sys/types.h>
 #include "iscsid.h"
 
-union semun {
-	int val;
-	struct semid_ds *buf;
-	unsigned short int *array;
-	struct seminfo *__buf;
-};
-#include <sys/sem.h>
-
-#define DEFAULT_AREA_SIZE 16384
-#define MAX_MSG_SIZE 256
+#define DEFAULT_AREA_SIZE 262144
 
 extern int log_level;
 
-struct logmsg {
-	short int prio;
-	void *next;
-	char *str;
-};
-
-struct logarea {
-	int shmid;
-	int shmid_msg;
-	int shmid_buff;
-	int empty;
-	void *head;
-	void *tail;
-	void *start;
-	void *end;
-	char *buff;
-	struct sembuf ops[1];
-	int semid;
-	union semun semarg;
-};
-
-struct logarea *la;
-
 extern int log_init(char *program_name, int size,
 	void (*func)(int prio, void *priv, const char *fmt, va_list ap),
 	void *priv);
 extern void log_close (pid_t pid);
-extern void dump_logmsg (void *);
 extern void log_info(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
 extern void log_warning(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
 extern void log_error(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
-extern void log_debug(int level, const char *fmt, ...)
+extern void __log_debug(int level, const char *fmt, ...)
 	__attribute__ ((format (printf, 2, 3)));
 
+/*
+ * log_debug(level, ...) calls with a level at or above LOG_DEBUG_LEVEL_MAX
+ * are compiled out. The others cost one branch on log_level, and their
+ * arguments are only evaluated when the message will be logged.
+ * debug_level 8 is the highest iscsid accepts, so by default nothing
+ * that could be printed is dropped.
+ */
+#ifndef LOG_DEBUG_LEVEL_MAX
+#define LOG_DEBUG_LEVEL_MAX 8
+#endif
+
+#define log_debug_enabled(level)					\
+	((level) < LOG_DEBUG_LEVEL_MAX &&				\
+	 __builtin_expect(log_level > (level), 0))
+
+#define log_debug(level, fmt, args...)					\
+do {									\
+	if (log_debug_enabled(level))					\
+		__log_debug(level, fmt, ##args);			\
+} while (0)
+
 extern void log_do_log_daemon(int prio, void *priv, const char *fmt, va_list ap);
 extern void log_do_log_std(int prio, void *priv, const char *fmt, va_list ap);
 
@@ -228,69 +228,438 @@ iscsi_update_address(iscsi_conn_t *conn, char *address)
 	return 1;
 }
 
+/*
+ * Login text key handlers. Each one is passed the whole "key=value" text,
+ * for error messages, and the value.
+ */
 static enum iscsi_login_status
-get_security_text_keys(iscsi_session_t *session, int cid, char **data,
-		       struct iscsi_acl *auth_client, char *end)
+login_key_target_alias(iscsi_session_t *session, int cid, char *text,
+		       char *value)
 {
-	char *text = *data;
-	char *value = NULL;
-	char *value_end = NULL;
-	size_t size;
-	int tag;
-	enum iscsi_login_status ret;
+	size_t size = strlen(value);
+
+	if (session->target_alias &&
+	    strlen(session->target_alias) == size &&
+	    memcmp(session->target_alias, value, size) == 0)
+		return LOGIN_OK;
+
+	free(session->target_alias);
+	session->target_alias = malloc(size + 1);
+	if (!session->target_alias) {
+		/* Alias not critical. So just print an error */
+		log_error("Login failed to allocate alias");
+		return LOGIN_OK;
+	}
+	memcpy(session->target_alias, value, size);
+	session->target_alias[size] = '\0';
+	return LOGIN_OK;
+}
 
+static enum iscsi_login_status
+login_key_target_address(iscsi_session_t *session, int cid, char *text,
+			 char *value)
+{
 	/*
-	 * a few keys are possible in Security stage
-	 * which the auth code doesn't care about, but
-	 * which we might want to see, or at least not
-	 * choke on.
+	 * if possible, change the session's
+	 * ip_address and port to the new TargetAddress for
+	 * leading connection
 	 */
-	if (iscsi_find_key_value("TargetAlias", text, end, &value,
-		&value_end)) {
-		size = value_end - value;
-		session->target_alias = malloc(size + 1);
-		if (!session->target_alias) {
-			/* Alias not critical. So just print an error */
-			log_error("Login failed to allocate alias");
-			*data = value_end;
-			return LOGIN_OK;
-		}
-		memcpy(session->target_alias, value, size);
-		session->target_alias[size] = '\0';
-		text = value_end;
-	} else if (iscsi_find_key_value("TargetAddress", text, end, &value,
-					 &value_end)) {
+	if (!iscsi_update_address(&session->conn[cid], value)) {
+		log_error("Login redirection failed, "
+			  "can't handle redirection to %s", value);
+		return LOGIN_REDIRECTION_FAILED;
+	}
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_target_portal_group_tag(iscsi_session_t *session, int cid,
+				  char *text, char *value)
+{
+	int tag = strtoul(value, NULL, 0);
+
+	/*
+	 * We should have already obtained this
+	 * via discovery, but the value could be stale.
+	 * If the target was reconfigured it will send us
+	 * the updated tpgt.
+	 */
+	if (session->portal_group_tag >= 0) {
+		if (tag != session->portal_group_tag)
+			log_debug(2, "Portal group tag "
+				  "mismatch, expected %u, "
+				  "received %u. Updating",
+				  session->portal_group_tag, tag);
+	}
+	/* we now know the tag */
+	session->portal_group_tag = tag;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_initial_r2t(iscsi_session_t *session, int cid, char *text,
+		      char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->initial_r2t_en = strcmp(value, "Yes") == 0;
+	else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_INITIALR2T;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_immediate_data(iscsi_session_t *session, int cid, char *text,
+			 char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->imm_data_en = strcmp(value, "Yes") == 0;
+	else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_IMMEDIATEDATA;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_max_recv_dlength(iscsi_session_t *session, int cid, char *text,
+			   char *value)
+{
+	iscsi_conn_t *conn = &session->conn[cid];
+
+	if (session->type == ISCSI_SESSION_TYPE_DISCOVERY ||
+	    !session->t->template->rdma) {
+		int tgt_max_xmit;
+		conn_rec_t *conn_rec = iscsi_conn_rec(conn);
+
+		tgt_max_xmit = strtoul(value, NULL, 0);
 		/*
-		 * if possible, change the session's
-		 * ip_address and port to the new TargetAddress for
-		 * leading connection
+		 * if the rec value is zero it means to use
+		 * what the target gave us.
 		 */
-		if (iscsi_update_address(&session->conn[cid], value)) {
-			text = value_end;
-		} else {
-			log_error("Login redirection failed, "
-				  "can't handle redirection to %s", value);
-			return LOGIN_REDIRECTION_FAILED;
+		if (!conn_rec->iscsi.MaxXmitDataSegmentLength ||
+		    tgt_max_xmit < conn->max_xmit_dlength)
+			conn->max_xmit_dlength = tgt_max_xmit;
+	}
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_first_burst(iscsi_session_t *session, int cid, char *text,
+		      char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->first_burst = strtoul(value, NULL, 0);
+	else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_FIRSTBURSTLENGTH;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_max_burst(iscsi_session_t *session, int cid, char *text,
+		    char *value)
+{
+	/*
+	 * we don't really care, since it's a  limit on the target's
+	 * R2Ts, but record it anwyay
+	 */
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->max_burst = strtoul(value, NULL, 0);
+	else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_MAXBURSTLENGTH;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_digest(uint32_t *digest_en, const char *name, char *text,
+		 char *value)
+{
+	if (strcmp(value, "None") == 0) {
+		if (*digest_en != ISCSI_DIGEST_CRC32C)
+			*digest_en = ISCSI_DIGEST_NONE;
+		else {
+			log_error("Login negotiation failed, %s=CRC32C "
+				  "is required, can't accept %s", name, text);
+			return LOGIN_NEGOTIATION_FAILED;
 		}
-	} else if (iscsi_find_key_value("TargetPortalGroupTag", text, end,
-					 &value, &value_end)) {
-		/*
-		 * We should have already obtained this
-		 * via discovery, but the value could be stale.
-		 * If the target was reconfigured it will send us
-		 * the updated tpgt.
-		 */
-		tag = strtoul(value, NULL, 0);
-		if (session->portal_group_tag >= 0) {
-			if (tag != session->portal_group_tag)
-				log_debug(2, "Portal group tag "
-					  "mismatch, expected %u, "
-					  "received %u. Updating",
-					  session->portal_group_tag, tag);
+	} else if (strcmp(value, "CRC32C") == 0) {
+		if (*digest_en != ISCSI_DIGEST_NONE)
+			*digest_en = ISCSI_DIGEST_CRC32C;
+		else {
+			log_error("Login negotiation failed, %s=None is "
+				  "required, can't accept %s", name, text);
+			return LOGIN_NEGOTIATION_FAILED;
 		}
-		/* we now know the tag */
-		session->portal_group_tag = tag;
-		text = value_end;
+	} else {
+		log_error("Login negotiation failed, "
+			       "can't accept %s", text);
+		return LOGIN_NEGOTIATION_FAILED;
+	}
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_header_digest(iscsi_session_t *session, int cid, char *text,
+			char *value)
+{
+	return login_key_digest(&session->conn[cid].hdrdgst_en,
+				"HeaderDigest", text, value);
+}
+
+static enum iscsi_login_status
+login_key_data_digest(iscsi_session_t *session, int cid, char *text,
+		      char *value)
+{
+	return login_key_digest(&session->conn[cid].datadgst_en,
+				"DataDigest", text, value);
+}
+
+static enum iscsi_login_status
+login_key_time2wait(iscsi_session_t *session, int cid, char *text,
+		    char *value)
+{
+	session->def_time2wait = strtoul(value, NULL, 0);
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_time2retain(iscsi_session_t *session, int cid, char *text,
+		      char *value)
+{
+	session->def_time2retain = strtoul(value, NULL, 0);
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_ignore(iscsi_session_t *session, int cid, char *text, char *value)
+{
+	/*
+	 * markers: result function is AND, target must honor our No,
+	 * and we don't do markers, so we don't care about the intervals.
+	 * cisco keys: we don't really care what the target ends up using.
+	 */
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_pdu_inorder(iscsi_session_t *session, int cid, char *text,
+		      char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->pdu_inorder_en = strcmp(value, "Yes") == 0;
+	else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_DATAPDUINORDER;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_dataseq_inorder(iscsi_session_t *session, int cid, char *text,
+			  char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL)
+		session->dataseq_inorder_en = strcmp(value, "Yes") == 0;
+	else
+		session->irrelevant_keys_bitmap |=
+					IRRELEVANT_DATASEQUENCEINORDER;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_max_r2t(iscsi_session_t *session, int cid, char *text,
+		  char *value)
+{
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
+		if (strcmp(value, "1")) {
+			log_error("Login negotiation "
+				       "failed, can't accept Max"
+				       "OutstandingR2T %s", value);
+			return LOGIN_NEGOTIATION_FAILED;
+		}
+	} else
+		session->irrelevant_keys_bitmap |=
+					IRRELEVANT_MAXOUTSTANDINGR2T;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_max_conns(iscsi_session_t *session, int cid, char *text,
+		    char *value)
+{
+	uint32_t max_conns;
+
+	if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
+		/* the result function is minimum */
+		max_conns = strtoul(value, NULL, 0);
+		if (!max_conns || max_conns > session->max_conns) {
+			log_error("Login negotiation "
+				       "failed, can't accept Max"
+				       "Connections %s", value);
+			return LOGIN_NEGOTIATION_FAILED;
+		}
+		session->max_conns = max_conns;
+	} else
+		session->irrelevant_keys_bitmap |= IRRELEVANT_MAXCONNECTIONS;
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_erl(iscsi_session_t *session, int cid, char *text, char *value)
+{
+	if (strcmp(value, "0")) {
+		log_error("Login negotiation failed, "
+		       "can't accept ErrorRecovery %s", value);
+		return LOGIN_NEGOTIATION_FAILED;
+	}
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_rdma_ext(iscsi_session_t *session, int cid, char *text,
+		   char *value)
+{
+	if (session->t->template->rdma &&
+	    strcmp(value, "Yes") != 0) {
+		log_error("Login negotiation failed, "
+			  "Target must support RDMAExtensions");
+		return LOGIN_NEGOTIATION_FAILED;
+	}
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_ini_recv_dlength(iscsi_session_t *session, int cid, char *text,
+			   char *value)
+{
+	iscsi_conn_t *conn = &session->conn[cid];
+
+	if (session->t->template->rdma)
+		conn->max_recv_dlength = MIN(conn->max_recv_dlength,
+					     strtoul(value, NULL, 0));
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_tgt_recv_dlength(iscsi_session_t *session, int cid, char *text,
+			   char *value)
+{
+	iscsi_conn_t *conn = &session->conn[cid];
+
+	if (session->t->template->rdma)
+		conn->max_xmit_dlength = MIN(conn->max_xmit_dlength,
+					     strtoul(value, NULL, 0));
+	return LOGIN_OK;
+}
+
+static enum iscsi_login_status
+login_key_cisco_protocol(iscsi_session_t *session, int cid, char *text,
+			 char *value)
+{
+	if (strcmp(value, "NotUnderstood") &&
+	    strcmp(value, "Reject") &&
+	    strcmp(value, "Irrelevant") &&
+	    strcmp(value, "draft20")) {
+		/* if we didn't get a compatible protocol, fail */
+		log_error("Login version mismatch, "
+			       "can't accept protocol %s", value);
+		return LOGIN_VERSION_MISMATCH;
+	}
+	return LOGIN_OK;
+}
+
+struct login_key {
+	const char *name;
+	enum iscsi_login_status (*handle)(iscsi_session_t *session, int cid,
+					  char *text, char *value);
+};
+
+/*
+ * Keys we accept in the security stage which the auth code doesn't care
+ * about, but which we might want to see, or at least not choke on.
+ * Both tables must stay sorted by strcmp() order.
+ */
+static const struct login_key security_keys[] = {
+	{ "TargetAddress", login_key_target_address },
+	{ "TargetAlias", login_key_target_alias },
+	{ "TargetPortalGroupTag", login_key_target_portal_group_tag },
+};
+
+static const struct login_key op_params_keys[] = {
+	{ "DataDigest", login_key_data_digest },
+	{ "DataPDUInOrder", login_key_pdu_inorder },
+	{ "DataSequenceInOrder", login_key_dataseq_inorder },
+	{ "DefaultTime2Retain", login_key_time2retain },
+	{ "DefaultTime2Wait", login_key_time2wait },
+	{ "ErrorRecoveryLevel", login_key_erl },
+	{ "FirstBurstLength", login_key_first_burst },
+	{ "HeaderDigest", login_key_header_digest },
+	{ "IFMarkInt", login_key_ignore },
+	{ "IFMarker", login_key_ignore },
+	{ "ImmediateData", login_key_immediate_data },
+	{ "InitialR2T", login_key_initial_r2t },
+	{ "InitiatorRecvDataSegmentLength", login_key_ini_recv_dlength },
+	{ "MaxBurstLength", login_key_max_burst },
+	{ "MaxConnections", login_key_max_conns },
+	{ "MaxOutstandingR2T", login_key_max_r2t },
+	{ "MaxRecvDataSegmentLength", login_key_max_recv_dlength },
+	{ "OFMarkInt", login_key_ignore },
+	{ "OFMarker", login_key_ignore },
+	{ "RDMAExtensions", login_key_rdma_ext },
+	{ "TargetAddress", login_key_target_address },
+	{ "TargetAlias", login_key_target_alias },
+	{ "TargetPortalGroupTag", login_key_target_portal_group_tag },
+	{ "TargetRecvDataSegmentLength", login_key_tgt_recv_dlength },
+	{ "X-com.cisco.PingTimeout", login_key_ignore },
+	{ "X-com.cisco.protocol", login_key_cisco_protocol },
+	{ "X-com.cisco.sendAsyncText", login_key_ignore },
+};
+
+/*
+ * Binary search a key table for the key of the "key=value" pair at text.
+ * On a match *value is set to the start of the value.
+ */
+static const struct login_key *
+login_key_lookup(const struct login_key *keys, int nr_keys, char *text,
+		 char **value)
+{
+	char *sep = strchr(text, ISCSI_TEXT_SEPARATOR);
+	int low = 0, high = nr_keys - 1, mid, cmp;
+	size_t len;
+
+	if (!sep)
+		return NULL;
+	len = sep - text;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		cmp = strncmp(text, keys[mid].name, len);
+		if (!cmp && keys[mid].name[len])
+			cmp = -1;
+		if (!cmp) {
+			*value = sep + 1;
+			return &keys[mid];
+		}
+		if (cmp < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+	return NULL;
+}
+
+static enum iscsi_login_status
+get_security_text_keys(iscsi_session_t *session, int cid, char **data,
+		       struct iscsi_acl *auth_client, char *end)
+{
+	const struct login_key *key;
+	char *text = *data;
+	char *value;
+	enum iscsi_login_status ret;
+
+	key = login_key_lookup(security_keys,
+			       sizeof(security_keys) / sizeof(security_keys[0]),
+			       text, &value);
+	if (key) {
+		ret = key->handle(session, cid, text, value);
+		if (ret != LOGIN_OK)
+			return ret;
+		text = value + strlen(value);
 	} else {
 		/*
 		 * any key we don't recognize either
@@ -309,305 +678,115 @@ static enum iscsi_login_status
 get_op_params_text_keys(iscsi_session_t *session, int cid,
 			char **data, char *end)
 {
+	const struct login_key *key;
 	char *text = *data;
-	char *value = NULL;
-	char *value_end = NULL;
-	size_t size;
-	iscsi_conn_t *conn = &session->conn[cid];
+	char *value;
+	enum iscsi_login_status ret;
 
-	if (iscsi_find_key_value("TargetAlias", text, end, &value,
-				 &value_end)) {
-		size = value_end - value;
-		if (session->target_alias &&
-		    strlen(session->target_alias) == size &&
-		    memcmp(session->target_alias, value, size) == 0) {
-			*data = value_end;
-			return LOGIN_OK;
-		}
-		free(session->target_alias);
-		session->target_alias = malloc(size + 1);
-		if (!session->target_alias) {
-			/* Alias not critical. So just print an error */
-			log_error("Login failed to allocate alias");
-			*data = value_end;
-			return LOGIN_OK;
-		}
-		memcpy(session->target_alias, value, size);
-		session->target_alias[size] = '\0';
-		text = value_end;
-	} else if (iscsi_find_key_value("TargetAddress", text, end, &value,
-					 &value_end)) {
-		if (iscsi_update_address(conn, value))
-			text = value_end;
-		else {
-			log_error("Login redirection failed, "
-				  "can't handle redirection to %s",
-				  value);
-			return LOGIN_REDIRECTION_FAILED;
-		}
-	} else if (iscsi_find_key_value("TargetPortalGroupTag", text, end,
-					 &value, &value_end)) {
-		int tag = strtoul(value, NULL, 0);
-		/*
-		 * We should have already obtained this
-		 * via discovery, but the value could be stale.
-		 * If the target was reconfigured it will send us
-		 * the updated tpgt.
-		 */
-		if (session->portal_group_tag >= 0) {
-			if (tag != session->portal_group_tag)
-				log_debug(2, "Portal group tag "
-					  "mismatch, expected %u, "
-					  "received %u. Updating",
-					  session->portal_group_tag, tag);
-		}
-		/* we now know the tag */
-		session->portal_group_tag = tag;
-		text = value_end;
-	} else if (iscsi_find_key_value("InitialR2T", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
-			if (value && (strcmp(value, "Yes") == 0))
-				session->initial_r2t_en = 1;
-			else
-				session->initial_r2t_en = 0;
-		} else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_INITIALR2T;
-		text = value_end;
-	} else if (iscsi_find_key_value("ImmediateData", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
-			if (value && (strcmp(value, "Yes") == 0))
-				session->imm_data_en = 1;
-			else
-				session->imm_data_en = 0;
-		} else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_IMMEDIATEDATA;
-		text = value_end;
-	} else if (iscsi_find_key_value("MaxRecvDataSegmentLength", text, end,
-				     &value, &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_DISCOVERY ||
-		    !session->t->template->rdma) {
-			int tgt_max_xmit;
-			conn_rec_t *conn_rec = &session->nrec.conn[cid];
-
-			tgt_max_xmit = strtoul(value, NULL, 0);
-			/*
-			 * if the rec value is zero it means to use
-			 * what the target gave us.
-			 */
-			if (!conn_rec->iscsi.MaxXmitDataSegmentLength ||
-			    tgt_max_xmit < conn->max_xmit_dlength)
-				conn->max_xmit_dlength = tgt_max_xmit;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("FirstBurstLength", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL)
-			session->first_burst = strtoul(value, NULL, 0);
-		else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_FIRSTBURSTLENGTH;
-		text = value_end;
-	} else if (iscsi_find_key_value("MaxBurstLength", text, end, &value,
-					 &value_end)) {
-		/*
-		 * we don't really care, since it's a  limit on the target's
-		 * R2Ts, but record it anwyay
-		 */
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL)
-			session->max_burst = strtoul(value, NULL, 0);
-		else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_MAXBURSTLENGTH;
-		text = value_end;
-	} else if (iscsi_find_key_value("HeaderDigest", text, end, &value,
-					 &value_end)) {
-		if (strcmp(value, "None") == 0) {
-			if (conn->hdrdgst_en != ISCSI_DIGEST_CRC32C)
-				conn->hdrdgst_en = ISCSI_DIGEST_NONE;
-			else {
-				log_error("Login negotiation "
-					       "failed, HeaderDigest=CRC32C "
-					       "is required, can't accept "
-					       "%s", text);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else if (strcmp(value, "CRC32C") == 0) {
-			if (conn->hdrdgst_en != ISCSI_DIGEST_NONE)
-				conn->hdrdgst_en = ISCSI_DIGEST_CRC32C;
-			else {
-				log_error("Login negotiation "
-				       "failed, HeaderDigest=None is "
-				       "required, can't accept %s", text);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else {
-			log_error("Login negotiation failed, "
-				       "can't accept %s", text);
-			return LOGIN_NEGOTIATION_FAILED;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("DataDigest", text, end, &value,
-					 &value_end)) {
-		if (strcmp(value, "None") == 0) {
-			if (conn->datadgst_en != ISCSI_DIGEST_CRC32C)
-				conn->datadgst_en = ISCSI_DIGEST_NONE;
-			else {
-				log_error("Login negotiation "
-				       "failed, DataDigest=CRC32C "
-				       "is required, can't accept %s", text);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else if (strcmp(value, "CRC32C") == 0) {
-			if (conn->datadgst_en != ISCSI_DIGEST_NONE)
-				conn->datadgst_en = ISCSI_DIGEST_CRC32C;
-			else {
-				log_error("Login negotiation "
-				       "failed, DataDigest=None is "
-				       "required, can't accept %s", text);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else {
-			log_error("Login negotiation failed, "
-				       "can't accept %s", text);
-			return LOGIN_NEGOTIATION_FAILED;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("DefaultTime2Wait", text, end, &value,
-					 &value_end)) {
-		session->def_time2wait = strtoul(value, NULL, 0);
-		text = value_end;
-	} else if (iscsi_find_key_value("DefaultTime2Retain", text, end,
-					 &value, &value_end)) {
-		session->def_time2retain = strtoul(value, NULL, 0);
-		text = value_end;
-	} else if (iscsi_find_key_value("OFMarker", text, end, &value,
-					 &value_end))
-		/* result function is AND, target must honor our No */
-		text = value_end;
-	else if (iscsi_find_key_value("OFMarkInt", text, end, &value,
-					 &value_end))
-		/* we don't do markers, so we don't care */
-		text = value_end;
-	else if (iscsi_find_key_value("IFMarker", text, end, &value,
-					 &value_end))
-		/* result function is AND, target must honor our No */
-		text = value_end;
-	else if (iscsi_find_key_value("IFMarkInt", text, end, &value,
-					 &value_end))
-		/* we don't do markers, so we don't care */
-		text = value_end;
-	else if (iscsi_find_key_value("DataPDUInOrder", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
-			if (value && strcmp(value, "Yes") == 0)
-				session->pdu_inorder_en = 1;
-			else
-				session->pdu_inorder_en = 0;
-		} else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_DATAPDUINORDER;
-		text = value_end;
-	} else if (iscsi_find_key_value ("DataSequenceInOrder", text, end,
-					 &value, &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL)
-			if (value && strcmp(value, "Yes") == 0)
-				session->dataseq_inorder_en = 1;
-			else
-				session->dataseq_inorder_en = 0;
-		else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_DATASEQUENCEINORDER;
-		text = value_end;
-	} else if (iscsi_find_key_value("MaxOutstandingR2T", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
-			if (strcmp(value, "1")) {
-				log_error("Login negotiation "
-					       "failed, can't accept Max"
-					       "OutstandingR2T %s", value);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_MAXOUTSTANDINGR2T;
-		text = value_end;
-	} else if (iscsi_find_key_value("MaxConnections", text, end, &value,
-					 &value_end)) {
-		if (session->type == ISCSI_SESSION_TYPE_NORMAL) {
-			if (strcmp(value, "1")) {
-				log_error("Login negotiation "
-					       "failed, can't accept Max"
-					       "Connections %s", value);
-				return LOGIN_NEGOTIATION_FAILED;
-			}
-		} else
-			session->irrelevant_keys_bitmap |=
-						IRRELEVANT_MAXCONNECTIONS;
-		text = value_end;
-	} else if (iscsi_find_key_value("ErrorRecoveryLevel", text, end,
-					 &value, &value_end)) {
-		if (strcmp(value, "0")) {
-			log_error("Login negotiation failed, "
-			       "can't accept ErrorRecovery %s", value);
-			return LOGIN_NEGOTIATION_FAILED;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("RDMAExtensions", text, end,
-					&value, &value_end)) {
-		if (session->t->template->rdma &&
-		    strcmp(value, "Yes") != 0) {
-			log_error("Login negotiation failed, "
-				  "Target must support RDMAExtensions");
-			return LOGIN_NEGOTIATION_FAILED;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("InitiatorRecvDataSegmentLength", text,
-					end, &value, &value_end)) {
-		if (session->t->template->rdma) {
-			conn->max_recv_dlength = MIN(conn->max_recv_dlength,
-						     strtoul(value, NULL, 0));
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("TargetRecvDataSegmentLength", text,
-					end, &value, &value_end)) {
-		if (session->t->template->rdma) {
-			conn->max_xmit_dlength = MIN(conn->max_xmit_dlength,
-						     strtoul(value, NULL, 0));
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value ("X-com.cisco.protocol", text, end,
-					 &value, &value_end)) {
-		if (strcmp(value, "NotUnderstood") &&
-		    strcmp(value, "Reject") &&
-		    strcmp(value, "Irrelevant") &&
-		    strcmp(value, "draft20")) {
-			/* if we didn't get a compatible protocol, fail */
-			log_error("Login version mismatch, "
-				       "can't accept protocol %s", value);
-			return LOGIN_VERSION_MISMATCH;
-		}
-		text = value_end;
-	} else if (iscsi_find_key_value("X-com.cisco.PingTimeout", text, end,
-					 &value, &value_end))
-		/* we don't really care what the target ends up using */
-		text = value_end;
-	else if (iscsi_find_key_value("X-com.cisco.sendAsyncText", text, end,
-					 &value, &value_end))
-		/* we don't bother for the target response */
-		text = value_end;
-	else {
+	key = login_key_lookup(op_params_keys,
+			       sizeof(op_params_keys) /
+			       sizeof(op_params_keys[0]), text, &value);
+	if (!key) {
 		log_error("Login negotiation failed, couldn't "
 			       "recognize text %s", text);
 		return LOGIN_NEGOTIATION_FAILED;
 	}
-	*data = text;
+
+	ret = key->handle(session, cid, text, value);
+	if (ret != LOGIN_OK)
+		return ret;
+
+	*data = value + strlen(value);
 	return LOGIN_OK;
 }
 
+static int
+login_cache_add(struct iscsi_login_cache *cache, char *param, char *value)
+{
+	int length = strlen(param) + 1 + strlen(value) + 1;
+
+	if (cache->text_len + length > sizeof(cache->text))
+		return 0;
+
+	sprintf(cache->text + cache->text_len, "%s%c%s", param,
+		ISCSI_TEXT_SEPARATOR, value);
+	cache->text_len += length;
+	return 1;
+}
+
+/*
+ * Remember what the leading connection's login agreed on, so reinstating
+ * the session can offer just that.
+ */
+static void
+login_cache_save(iscsi_session_t *session, int cid)
+{
+	struct iscsi_login_cache *cache = &session->login_cache;
+	iscsi_conn_t *conn = &session->conn[cid];
+	char value[AUTH_STR_MAX_LEN];
+	int ok = 1;
+
+	if (cid)
+		return;
+
+	cache->valid = 0;
+	if (session->type != ISCSI_SESSION_TYPE_NORMAL ||
+	    session->t->template->rdma)
+		return;
+
+	/* both digests have to be settled for the cache to be usable */
+	if ((conn->hdrdgst_en != ISCSI_DIGEST_NONE &&
+	     conn->hdrdgst_en != ISCSI_DIGEST_CRC32C) ||
+	    (conn->datadgst_en != ISCSI_DIGEST_NONE &&
+	     conn->datadgst_en != ISCSI_DIGEST_CRC32C))
+		return;
+
+	cache->hdrdgst_en = conn->hdrdgst_en;
+	cache->datadgst_en = conn->datadgst_en;
+	cache->max_recv_dlength = conn->max_recv_dlength;
+	cache->imm_data_en = session->imm_data_en;
+	cache->initial_r2t_en = session->initial_r2t_en;
+	cache->first_burst = session->first_burst;
+	cache->max_burst = session->max_burst;
+	cache->pdu_inorder_en = session->pdu_inorder_en;
+	cache->dataseq_inorder_en = session->dataseq_inorder_en;
+	cache->max_conns = session->max_conns;
+	cache->text_len = 0;
+
+	/* keys left out take their default value on both sides */
+	if (cache->hdrdgst_en == ISCSI_DIGEST_CRC32C)
+		ok &= login_cache_add(cache, "HeaderDigest", "CRC32C");
+	if (cache->datadgst_en == ISCSI_DIGEST_CRC32C)
+		ok &= login_cache_add(cache, "DataDigest", "CRC32C");
+	if (!cache->initial_r2t_en)
+		ok &= login_cache_add(cache, "InitialR2T", "No");
+	if (!cache->imm_data_en)
+		ok &= login_cache_add(cache, "ImmediateData", "No");
+	if (cache->max_burst != ISCSI_DEF_MAX_BURST_LEN) {
+		sprintf(value, "%d", cache->max_burst);
+		ok &= login_cache_add(cache, "MaxBurstLength", value);
+	}
+	if (cache->first_burst != ISCSI_DEF_FIRST_BURST_LEN) {
+		sprintf(value, "%d", cache->first_burst);
+		ok &= login_cache_add(cache, "FirstBurstLength", value);
+	}
+	if (!cache->pdu_inorder_en)
+		ok &= login_cache_add(cache, "DataPDUInOrder", "No");
+	if (!cache->dataseq_inorder_en)
+		ok &= login_cache_add(cache, "DataSequenceInOrder", "No");
+	if (cache->max_conns != 1) {
+		sprintf(value, "%u", cache->max_conns);
+		ok &= login_cache_add(cache, "MaxConnections", value);
+	}
+	if (cache->max_recv_dlength != ISCSI_DEF_MAX_RECV_SEG_LEN) {
+		sprintf(value, "%d", cache->max_recv_dlength);
+		ok &= login_cache_add(cache, "MaxRecvDataSegmentLength",
+				      value);
+	}
+
+	cache->valid = ok;
+}
+
 static enum iscsi_login_status
 check_security_stage_status(iscsi_session_t *session,
 			    struct iscsi_acl *auth_client)
@@ -771,6 +950,10 @@ iscsi_process_login_response(iscsi_session_t *session, int cid,
 		conn->current_stage = login_rsp->flags &
 					 ISCSI_FLAG_LOGIN_NEXT_STAGE_MASK;
 		session->irrelevant_keys_bitmap = 0;
+
+		if (conn->current_stage == ISCSI_FULL_FEATURE_PHASE &&
+		    login_rsp->status_class == ISCSI_STATUS_CLS_SUCCESS)
+			login_cache_save(session, cid);
 	} else
 		/*
 		 * we got a partial response, don't advance,
@@ -813,8 +996,9 @@ add_params_normal_session(iscsi_session_t *session, struct iscsi_hdr *pdu,
 	if (!iscsi_add_text(pdu, data, max_data_length,
 			    "MaxOutstandingR2T", "1"))
 		return 0;
+	sprintf(value, "%u", session->max_conns);
 	if (!iscsi_add_text(pdu, data, max_data_length,
-			    "MaxConnections", "1"))
+			    "MaxConnections", value))
 		return 0;
 	if (!iscsi_add_text(pdu, data, max_data_length,
 			    "DataPDUInOrder", "Yes"))
@@ -964,6 +1148,58 @@ fill_crc_digest_text(iscsi_conn_t *conn, struct iscsi_hdr *pdu,
 	return 1;
 }
 
+/*
+ * Reinstating a session: offer what the last login agreed on, from the
+ * text built when it was saved.
+ */
+static int
+fill_cached_op_params_text(iscsi_session_t *session, int cid,
+			   struct iscsi_hdr *pdu, char *data,
+			   int max_data_length)
+{
+	struct iscsi_login_cache *cache = &session->login_cache;
+	iscsi_conn_t *conn = &session->conn[cid];
+	int pdu_length = ntoh24(pdu->dlength);
+	char value[AUTH_STR_MAX_LEN];
+
+	if (pdu_length + cache->text_len >= max_data_length) {
+		log_warning("Failed to add cached login text");
+		return 0;
+	}
+
+	/* the response checks and the kernel go by these */
+	conn->hdrdgst_en = cache->hdrdgst_en;
+	conn->datadgst_en = cache->datadgst_en;
+	conn->max_recv_dlength = cache->max_recv_dlength;
+	session->imm_data_en = cache->imm_data_en;
+	session->initial_r2t_en = cache->initial_r2t_en;
+	session->first_burst = cache->first_burst;
+	session->max_burst = cache->max_burst;
+	session->pdu_inorder_en = cache->pdu_inorder_en;
+	session->dataseq_inorder_en = cache->dataseq_inorder_en;
+	session->max_conns = cache->max_conns;
+
+	memcpy(data + pdu_length, cache->text, cache->text_len);
+	hton24(pdu->dlength, pdu_length + cache->text_len);
+	cache->in_use = 1;
+
+	/* these follow the session, see __session_conn_reopen() */
+	if (session->def_time2wait != ISCSI_DEF_TIME2WAIT) {
+		sprintf(value, "%d", session->def_time2wait);
+		if (!iscsi_add_text(pdu, data, max_data_length,
+				    "DefaultTime2Wait", value))
+			return 0;
+	}
+
+	if (session->def_time2retain != ISCSI_DEF_TIME2RETAIN) {
+		sprintf(value, "%d", session->def_time2retain);
+		if (!iscsi_add_text(pdu, data, max_data_length,
+				    "DefaultTime2Retain", value))
+			return 0;
+	}
+	return 1;
+}
+
 static int
 fill_op_params_text(iscsi_session_t *session, int cid, struct iscsi_hdr *pdu,
 		    char *data, int max_data_length, int *transit)
@@ -986,6 +1222,11 @@ fill_op_params_text(iscsi_session_t *session, int cid, struct iscsi_hdr *pdu,
 	 * keys.
 	 */
 	if (!conn->partial_response) {
+		if (session->login_cache.valid && !cid)
+			return fill_cached_op_params_text(session, cid, pdu,
+							  data,
+							  max_data_length);
+
 		/*
 		 * request the desired settings the first time
 		 * we are in this stage
@@ -994,22 +1235,31 @@ fill_op_params_text(iscsi_session_t *session, int cid, struct iscsi_hdr *pdu,
 		    !fill_crc_digest_text(conn, pdu, data, max_data_length))
 			return 0;
 
-		sprintf(value, "%d", session->def_time2wait);
 		if (!iscsi_add_text(pdu, data, max_data_length,
-				    "DefaultTime2Wait", value))
+				    "IFMarker", "No"))
 			return 0;
 
-		sprintf(value, "%d", session->def_time2retain);
 		if (!iscsi_add_text(pdu, data, max_data_length,
-				    "DefaultTime2Retain", value))
+				    "OFMarker", "No"))
 			return 0;
 
+		/*
+		 * a non-leading connection only negotiates the connection
+		 * keys, the leading only ones were settled by the session
+		 */
+		if (cid)
+			return add_params_transport_specific(session, cid,
+							     pdu, data,
+							     max_data_length);
+
+		sprintf(value, "%d", session->def_time2wait);
 		if (!iscsi_add_text(pdu, data, max_data_length,
-				    "IFMarker", "No"))
+				    "DefaultTime2Wait", value))
 			return 0;
 
+		sprintf(value, "%d", session->def_time2retain);
 		if (!iscsi_add_text(pdu, data, max_data_length,
-				    "OFMarker", "No"))
+				    "DefaultTime2Retain", value))
 			return 0;
 
 		if (!iscsi_add_text(pdu, data, max_data_length,
@@ -1145,9 +1395,10 @@ iscsi_make_login_pdu(iscsi_session_t *session, int cid, struct iscsi_hdr *hdr,
 	/* initialize the PDU header */
 	memset(login_hdr, 0, sizeof(*login_hdr));
 	login_hdr->opcode = ISCSI_OP_LOGIN | ISCSI_OP_IMMEDIATE;
-	login_hdr->cid = 0;
+	login_hdr->cid = htons(cid);
 	memcpy(login_hdr->isid, session->isid, sizeof(session->isid));
-	login_hdr->tsih = 0;
+	/* a non-leading connection logs into the existing session */
+	login_hdr->tsih = cid ? htons(session->tsih) : 0;
 	login_hdr->cmdsn = htonl(session->cmdsn);
 	/* don't increment on immediate */
 	login_hdr->min_version = ISCSI_DRAFT20_VERSION;
@@ -1181,7 +1432,7 @@ iscsi_make_login_pdu(iscsi_session_t *session, int cid, struct iscsi_hdr *hdr,
 				return 0;
 		}
 
-		if (!iscsi_add_text(hdr, data, max_data_length,
+		if (!cid && !iscsi_add_text(hdr, data, max_data_length,
 		    "SessionType", (session->type ==
 		      ISCSI_SESSION_TYPE_DISCOVERY) ? "Discovery" : "Normal"))
 			return 0;
@@ -1276,6 +1527,13 @@ check_for_authentication(iscsi_session_t *session,
 		log_error("Couldn't set remote authentication");
 		goto end;
 	}
+
+	if (session->num_chap_algs &&
+	    acl_set_chap_alg_list(auth_client, session->num_chap_algs,
+				  session->chap_algs) != AUTH_STATUS_NO_ERROR) {
+		log_error("Couldn't set CHAP algorithm list");
+		goto end;
+	}
 	return LOGIN_OK;
 
  end:
@@ -1334,6 +1592,18 @@ check_status_login_response(iscsi_session_t *session, int cid,
 		ret = LOGIN_OK;
 		*final = 1;
 	}
+
+	/*
+	 * if the target turned down what it agreed to last time,
+	 * negotiate everything again on the next attempt
+	 */
+	if (!cid && session->login_cache.in_use && *final &&
+	    ((ret != LOGIN_OK && ret != LOGIN_REDIRECT) ||
+	     login_rsp->status_class == ISCSI_STATUS_CLS_INITIATOR_ERR)) {
+		log_debug(1, "dropping cached login parameters of session %d",
+			  session->id);
+		session->login_cache.valid = 0;
+	}
 	return ret;
 }
 
@@ -1354,6 +1624,7 @@ iscsi_login_begin(iscsi_session_t *session, iscsi_login_context_t *c)
 		session->cmdsn = 1;
 		session->exp_cmdsn = 1;
 		session->max_cmdsn = 1;
+		session->login_cache.in_use = 0;
 	}
 
 	conn->current_stage = ISCSI_INITIAL_LOGIN_STAGE;
@@ -1615,7 +1615,16 @@ static int ctldev_handle(void)
 		drop_data(nlh);
 		return -ENXIO;
 	}
-	conn = &session->conn[0];
+
+	/* a non-leading conn may have been dropped since this was sent */
+	if (cid >= ISCSI_MAX_CONNS ||
+	    (cid && session->conn[cid].state == ISCSI_CONN_STATE_FREE)) {
+		log_debug(1, "Connection %d:%d is gone. Dropping event.",
+			  sid, cid);
+		drop_data(nlh);
+		return 0;
+	}
+	conn = &session->conn[cid];
 
 	ev_size = nlh->nlmsg_len - NLMSG_ALIGN(sizeof(struct nlmsghdr));
 
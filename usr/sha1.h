@@ -14,6 +14,8 @@
 #include <string.h>
 #include "types.h"
 
+#define SHA1_DIGEST_SIZE	20
+
 struct sha1_ctx {
         uint64_t count;
         uint32_t state[5];
@@ -0,0 +1,159 @@
+/*
+ * SHA-256 Secure Hash Algorithm, FIPS 180-4.
+ *
+ * Laid out like sha1.c so the CHAP code can use either one the same way.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+#include <arpa/inet.h>
+#include "sha256.h"
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror(uint32_t value, uint32_t bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+#define Ch(x,y,z)	(z ^ (x & (y ^ z)))
+#define Maj(x,y,z)	((x & y) | (z & (x | y)))
+#define S0(x)		(ror(x, 2) ^ ror(x, 13) ^ ror(x, 22))
+#define S1(x)		(ror(x, 6) ^ ror(x, 11) ^ ror(x, 25))
+#define s0(x)		(ror(x, 7) ^ ror(x, 18) ^ (x >> 3))
+#define s1(x)		(ror(x, 17) ^ ror(x, 19) ^ (x >> 10))
+
+/* Hash a single 512-bit block. This is the core of the algorithm. */
+static void sha256_transform(uint32_t *state, const uint8_t *in)
+{
+	uint32_t a, b, c, d, e, f, g, h, t1, t2;
+	uint32_t w[64];
+	int i;
+
+	/* convert/copy data to workspace */
+	for (i = 0; i < 16; i++) {
+		memcpy(&w[i], in + i * 4, 4);
+		w[i] = ntohl(w[i]);
+	}
+	for (i = 16; i < 64; i++)
+		w[i] = s1(w[i - 2]) + w[i - 7] + s0(w[i - 15]) + w[i - 16];
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + S1(e) + Ch(e, f, g) + sha256_k[i] + w[i];
+		t2 = S0(a) + Maj(a, b, c);
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+
+	/* Wipe variables */
+	memset(w, 0x00, sizeof w);
+}
+
+void sha256_init(void *ctx)
+{
+	struct sha256_ctx *sctx = ctx;
+	static const struct sha256_ctx initstate = {
+	  0,
+	  { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+	  { 0, }
+	};
+
+	*sctx = initstate;
+}
+
+void sha256_update(void *ctx, const uint8_t *data, unsigned int len)
+{
+	struct sha256_ctx *sctx = ctx;
+	unsigned int i, j;
+
+	j = (sctx->count >> 3) & 0x3f;
+	sctx->count += (uint64_t)len << 3;
+
+	if ((j + len) > 63) {
+		memcpy(&sctx->buffer[j], data, (i = 64 - j));
+		sha256_transform(sctx->state, sctx->buffer);
+		for ( ; i + 63 < len; i += 64)
+			sha256_transform(sctx->state, &data[i]);
+		j = 0;
+	} else
+		i = 0;
+	memcpy(&sctx->buffer[j], &data[i], len - i);
+}
+
+/* Add padding and return the message digest. */
+void sha256_final(void *ctx, uint8_t *out)
+{
+	struct sha256_ctx *sctx = ctx;
+	uint32_t i, index, padlen, t2;
+	uint64_t t;
+	uint8_t bits[8];
+	static const uint8_t padding[64] = { 0x80, };
+
+	t = sctx->count;
+	for (i = 0; i < 8; i++) {
+		bits[7 - i] = t & 0xff;
+		t >>= 8;
+	}
+
+	/* Pad out to 56 mod 64 */
+	index = (sctx->count >> 3) & 0x3f;
+	padlen = (index < 56) ? (56 - index) : ((64 + 56) - index);
+	sha256_update(sctx, padding, padlen);
+
+	/* Append length */
+	sha256_update(sctx, bits, sizeof bits);
+
+	/* Store state in digest */
+	for (i = 0; i < 8; i++) {
+		t2 = htonl(sctx->state[i]);
+		memcpy(out + i * 4, &t2, 4);
+	}
+
+	/* Wipe context */
+	memset(sctx, 0, sizeof *sctx);
+}
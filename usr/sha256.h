@@ -0,0 +1,29 @@
+/*
+ * sha256.h - SHA-256 Secure Hash Algorithm used for CHAP authentication.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <sys/types.h>
+#include <string.h>
+#include "types.h"
+
+#define SHA256_DIGEST_SIZE	32
+
+struct sha256_ctx {
+	uint64_t count;
+	uint32_t state[8];
+	uint8_t buffer[64];
+};
+
+void sha256_init(void *ctx);
+void sha256_update(void *ctx, const uint8_t *data, unsigned int len);
+void sha256_final(void *ctx, uint8_t *out);
+
+#endif
@@ -76,3 +76,25 @@ int uip_broadcast_ping_req(struct iscsi_transport *t,
 			     sizeof(iscsid_uip_broadcast_header_t) +
 			     broadcast.header.payload_len, 0, status);
 }
+
+int uip_broadcast_stats_req(struct iface_rec *iface,
+			    struct iscsid_uip_nic_stats *stats,
+			    struct iscsid_uip_iface_stats *iface_stats,
+			    int max_ifaces)
+{
+	struct iscsid_uip_broadcast broadcast;
+
+	log_debug(3, "requesting stats from uip");
+
+	memset(&broadcast, 0, sizeof(broadcast));
+
+	broadcast.header.command = ISCSID_UIP_IPC_GET_STATS;
+	broadcast.header.payload_len = sizeof(*iface);
+
+	memcpy(&broadcast.u.stats_rec.rec, iface, sizeof(*iface));
+
+	return uip_broadcast_stats(&broadcast,
+				   sizeof(iscsid_uip_broadcast_header_t) +
+				   sizeof(*iface), stats, iface_stats,
+				   max_ifaces);
+}
@@ -30,6 +30,7 @@ typedef enum iscsid_uip_cmd {
 	ISCSID_UIP_IPC_UNKNOWN			= 0,
 	ISCSID_UIP_IPC_GET_IFACE		= 1,
 	ISCSID_UIP_IPC_PING			= 2,
+	ISCSID_UIP_IPC_GET_STATS		= 3,
 
 	__ISCSID_UIP_IPC_MAX_COMMAND
 } iscsid_uip_cmd_e;
@@ -55,6 +56,10 @@ typedef struct iscsid_uip_broadcast {
 			int datalen;
 			int *status;
 		} ping_rec;
+
+		struct ipc_broadcast_stats_rec {
+			struct iface_rec rec;
+		} stats_rec;
 	} u;
 } iscsid_uip_broadcast_t;
 
@@ -74,6 +79,59 @@ typedef struct iscsid_uip_mgmt_rsp {
 	enum iscsi_ping_status_code ping_sc;
 } iscsid_uip_rsp_t;
 
+/*
+ * ISCSID_UIP_IPC_GET_STATS response payload.  The iscsid_uip_rsp_t is
+ * followed by one iscsid_uip_nic_stats and then num_ifaces
+ * iscsid_uip_iface_stats, one per nic_iface (including VLANs) of the NIC.
+ */
+struct iscsid_uip_nic_stats {
+	uint64_t interrupts;
+	uint64_t missed_interrupts;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t rx_no_iface;		/* no nic_iface for the VLAN/protocol */
+	uint64_t rx_ignored;		/* unhandled ethertype */
+	uint64_t pkt_alloc_failures;	/* packet pool exhausted */
+	uint64_t tx_queue_failures;	/* couldn't queue a TX awaiting ARP */
+	uint64_t nl_enqueued;
+	uint64_t nl_processed;
+	uint64_t nl_dropped;
+	uint64_t nl_flushed;
+	uint32_t nl_depth_max;
+	uint32_t num_ifaces;
+};
+
+struct iscsid_uip_iface_stats {
+	int32_t iface_num;
+	uint16_t vlan_id;
+	uint16_t protocol;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t arp_hits;
+	uint64_t arp_misses;
+	uint64_t ip_recv;
+	uint64_t ip_sent;
+	uint64_t ip_drop;
+	uint64_t ip_chkerr;
+	uint64_t icmp_recv;
+	uint64_t icmp_sent;
+	uint64_t icmp_drop;
+	uint64_t tcp_recv;
+	uint64_t tcp_sent;
+	uint64_t tcp_drop;
+	uint64_t tcp_chkerr;
+	uint64_t tcp_rexmit;
+	uint64_t tcp_rst;
+	uint64_t udp_recv;
+	uint64_t udp_sent;
+	uint64_t udp_drop;
+	uint64_t udp_chkerr;
+};
+
 extern int uip_broadcast_params(struct iscsi_transport *t,
 				struct iface_rec *iface,
 				struct iscsi_session *session);
@@ -83,4 +141,9 @@ extern int uip_broadcast_ping_req(struct iscsi_transport *t,
 				  struct sockaddr_storage *dst_addr,
 				  uint32_t *status);
 
+extern int uip_broadcast_stats_req(struct iface_rec *iface,
+				   struct iscsid_uip_nic_stats *stats,
+				   struct iscsid_uip_iface_stats *iface_stats,
+				   int max_ifaces);
+
 #endif /* UIP_MGMT_IPC_H */